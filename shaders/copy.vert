@@ -0,0 +1,7 @@
+#version 450
+
+//one triangle over the whole target, made from the vertex index
+void main() {
+    vec2 uv = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);
+    gl_Position = vec4(uv * 2 - 1, 0, 1);
+}
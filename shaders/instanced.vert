@@ -0,0 +1,21 @@
+#version 450
+
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+layout(location = 0) out vec3 v2f_color;
+
+struct Instance {
+    vec2 position;
+    float scale;
+    uint batch;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout(std430, binding = 1) readonly buffer Visible { uint visible[]; };
+
+void main() {
+    Instance inst = instances[visible[gl_InstanceIndex]];
+    gl_Position = vec4(inPosition * inst.scale + inst.position, 0, 1);
+    v2f_color = inColor;
+}
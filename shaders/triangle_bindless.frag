@@ -0,0 +1,29 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+layout(location = 0) in vec3 v2f_color;
+
+layout(location = 0) out vec4 outColor;
+
+//the bindless table and DrawConstants, see bindless.hpp
+layout(set = 0, binding = 2) readonly buffer Materials {
+    vec4 tint[];
+} buffers[];
+
+//see MeshFeature in vulkanapi.hpp
+layout(constant_id = 0) const bool TINT = true;
+
+layout(push_constant) uniform DrawConstants {
+    uint textureIndex;
+    uint samplerIndex;
+    uint bufferIndex;
+    uint element;
+} draw;
+
+void main() {
+    outColor = vec4(v2f_color, 1.0);
+    if (TINT) {
+        outColor *= buffers[draw.bufferIndex].tint[draw.element];
+    }
+}
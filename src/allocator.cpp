@@ -0,0 +1,334 @@
+#include "allocator.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <unordered_map>
+#include <vector>
+
+static const VkDeviceSize DEFAULT_BLOCK_SIZE = 64ull << 20;
+static const VkDeviceSize MIN_BLOCK_SIZE = 1ull << 20;
+static const VkDeviceSize MIN_NODE_SIZE = 256;
+
+struct MemoryBlock : BuddyNodes {
+    uint32_t pool;
+    VkDeviceMemory memory;
+    char* mapped;
+    std::unordered_map<VkDeviceSize, Allocation*> allocs;
+};
+
+struct MemoryPool {
+    uint32_t memType;
+    bool linear;
+    VkDeviceSize blockSize;
+    std::vector<MemoryBlock*> blocks;
+};
+
+static VkDevice allocDevice;
+static VkPhysicalDeviceMemoryProperties memProps;
+static uint32_t maxAllocationCount;
+static uint32_t deviceAllocationCount;
+static std::vector<MemoryPool> pools;
+static AllocatorStats stats;
+
+static uint32_t Log2(VkDeviceSize v) {
+    uint32_t r = 0;
+    while (v >>= 1) r++;
+    return r;
+}
+
+static VkDeviceSize NextPow2(VkDeviceSize v) {
+    VkDeviceSize r = 1;
+    while (r < v) r <<= 1;
+    return r;
+}
+
+void BuddyNodes::Init(VkDeviceSize blockSize, VkDeviceSize minNodeSize) {
+    size = blockSize;
+    reserved = 0;
+    freeLists.clear();
+    freeLists.resize(Log2(size / minNodeSize) + 1);
+    freeLists[0].insert(0);
+}
+
+bool BuddyNodes::AllocNode(uint32_t level, VkDeviceSize* offset) {
+    int l = (int)level;
+    while (l >= 0 && freeLists[l].empty()) l--;
+    if (l < 0) return false;
+
+    auto& list = freeLists[l];
+    VkDeviceSize off = *list.begin();
+    list.erase(list.begin());
+    while ((uint32_t)l < level) {
+        l++;
+        freeLists[l].insert(off + (size >> l));
+    }
+    reserved += size >> level;
+    *offset = off;
+    return true;
+}
+
+void BuddyNodes::FreeNode(VkDeviceSize offset, uint32_t level) {
+    reserved -= size >> level;
+    while (level > 0) {
+        const VkDeviceSize buddy = offset ^ (size >> level);
+        auto& list = freeLists[level];
+        auto it = list.find(buddy);
+        if (it == list.end()) break;
+        list.erase(it);
+        offset = std::min(offset, buddy);
+        level--;
+    }
+    freeLists[level].insert(offset);
+}
+
+VkDeviceSize BuddyNodes::LargestFree() const {
+    for (size_t l = 0; l < freeLists.size(); l++) {
+        if (!freeLists[l].empty()) return size >> l;
+    }
+    return 0;
+}
+
+static VkDeviceMemory AllocDeviceMemory(VkDeviceSize size, uint32_t memType, char** mapped) {
+    if (deviceAllocationCount + 1 >= maxAllocationCount) {
+        std::cerr << "allocator: at maxMemoryAllocationCount (" << maxAllocationCount << ")!" << std::endl;
+    }
+    VkMemoryAllocateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    info.allocationSize = size;
+    info.memoryTypeIndex = memType;
+    VkDeviceMemory mem;
+    VKDO(vkAllocateMemory(allocDevice, &info, nullptr, &mem));
+    deviceAllocationCount++;
+
+    *mapped = nullptr;
+    if (memProps.memoryTypes[memType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        void* ptr;
+        VKDO(vkMapMemory(allocDevice, mem, 0, VK_WHOLE_SIZE, 0, &ptr));
+        *mapped = (char*)ptr;
+    }
+    return mem;
+}
+
+static void FreeDeviceMemory(VkDeviceMemory mem, bool mapped) {
+    if (mapped) vkUnmapMemory(allocDevice, mem);
+    vkFreeMemory(allocDevice, mem, nullptr);
+    deviceAllocationCount--;
+}
+
+static MemoryBlock* CreateBlock(MemoryPool& pool) {
+    auto block = new MemoryBlock();
+    block->pool = pool.memType * 2 + (pool.linear ? 0 : 1);
+    block->Init(pool.blockSize, MIN_NODE_SIZE);
+    block->memory = AllocDeviceMemory(block->size, pool.memType, &block->mapped);
+    pool.blocks.push_back(block);
+    stats.blockCount++;
+    stats.blockBytes += block->size;
+    return block;
+}
+
+static void DestroyBlock(MemoryPool& pool, MemoryBlock* block) {
+    FreeDeviceMemory(block->memory, block->mapped != nullptr);
+    stats.blockCount--;
+    stats.blockBytes -= block->size;
+    pool.blocks.erase(std::find(pool.blocks.begin(), pool.blocks.end(), block));
+    delete block;
+}
+
+static MemoryPool& GetPool(uint32_t memType, bool linear) {
+    return pools[memType * 2 + (linear ? 0 : 1)];
+}
+
+/* empty blocks are returned to the driver, except for one per pool to avoid churn */
+static void ReleaseEmptyBlocks(MemoryPool& pool) {
+    bool kept = false;
+    for (size_t a = pool.blocks.size(); a-- > 0;) {
+        if (pool.blocks[a]->reserved) continue;
+        if (!kept) {
+            kept = true;
+            continue;
+        }
+        DestroyBlock(pool, pool.blocks[a]);
+    }
+}
+
+void Allocator::Init(VkPhysicalDevice physDevice, VkDevice device) {
+    allocDevice = device;
+    vkGetPhysicalDeviceMemoryProperties(physDevice, &memProps);
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physDevice, &props);
+    maxAllocationCount = props.limits.maxMemoryAllocationCount;
+
+    pools.resize(memProps.memoryTypeCount * 2);
+    for (uint32_t a = 0; a < memProps.memoryTypeCount; a++) {
+        //small heaps (eg. the 256MB host visible device local heap) get smaller blocks
+        const auto heapSize = memProps.memoryHeaps[memProps.memoryTypes[a].heapIndex].size;
+        auto blockSize = DEFAULT_BLOCK_SIZE;
+        while (blockSize > MIN_BLOCK_SIZE && blockSize > heapSize / 8) blockSize >>= 1;
+
+        for (int b = 0; b < 2; b++) {
+            auto& pool = pools[a * 2 + b];
+            pool.memType = a;
+            pool.linear = (b == 0);
+            pool.blockSize = blockSize;
+        }
+    }
+    stats = AllocatorStats();
+}
+
+void Allocator::Exit() {
+    if (stats.allocationCount) {
+        std::cerr << "allocator: " << stats.allocationCount << " allocations leaked!" << std::endl;
+    }
+    for (auto& p : pools) {
+        while (!p.blocks.empty()) DestroyBlock(p, p.blocks.back());
+    }
+    pools.clear();
+}
+
+uint32_t Allocator::FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+    const VkMemoryPropertyFlags tries[] = { required | preferred, required };
+    for (auto flags : tries) {
+        for (uint32_t a = 0; a < memProps.memoryTypeCount; a++) {
+            if ((typeBits & (1u << a)) && (memProps.memoryTypes[a].propertyFlags & flags) == flags)
+                return a;
+        }
+    }
+    return UINT32_MAX;
+}
+
+Allocation* Allocator::Alloc(const VkMemoryRequirements& req, MemoryUsage usage, bool linear) {
+    uint32_t memType = UINT32_MAX;
+    switch (usage) {
+    case MEMORY_USAGE_GPU_ONLY:
+        memType = FindMemoryType(req.memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        if (memType == UINT32_MAX) memType = FindMemoryType(req.memoryTypeBits, 0);
+        break;
+    case MEMORY_USAGE_UPLOAD:
+        memType = FindMemoryType(req.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+        break;
+    case MEMORY_USAGE_READBACK:
+        memType = FindMemoryType(req.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+        break;
+    }
+    if (memType == UINT32_MAX) {
+        std::cerr << "allocator: no suitable memory type!" << std::endl;
+        abort();
+    }
+
+    auto alloc = new Allocation();
+    alloc->size = req.size;
+    auto& pool = GetPool(memType, linear);
+
+    //buddy nodes are aligned to their own size, so rounding up to the alignment is enough
+    const auto nodeSize = std::max(NextPow2(std::max(req.size, req.alignment)), MIN_NODE_SIZE);
+    if (nodeSize > pool.blockSize / 2) {
+        alloc->memory = AllocDeviceMemory(req.size, memType, &alloc->mapped);
+        alloc->offset = 0;
+        stats.dedicatedCount++;
+        stats.dedicatedBytes += req.size;
+        stats.reservedBytes += req.size;
+    }
+    else {
+        const uint32_t level = Log2(pool.blockSize / nodeSize);
+        VkDeviceSize offset = 0;
+        MemoryBlock* block = nullptr;
+        for (auto b : pool.blocks) {
+            if (b->AllocNode(level, &offset)) {
+                block = b;
+                break;
+            }
+        }
+        if (!block) {
+            block = CreateBlock(pool);
+            block->AllocNode(level, &offset);
+        }
+        alloc->memory = block->memory;
+        alloc->offset = offset;
+        alloc->mapped = block->mapped ? block->mapped + offset : nullptr;
+        alloc->block = block;
+        alloc->level = level;
+        block->allocs[offset] = alloc;
+        stats.reservedBytes += nodeSize;
+    }
+    stats.allocationCount++;
+    stats.usedBytes += req.size;
+    return alloc;
+}
+
+void Allocator::Free(Allocation* alloc) {
+    if (!alloc) return;
+    stats.allocationCount--;
+    stats.usedBytes -= alloc->size;
+    if (!alloc->block) {
+        FreeDeviceMemory(alloc->memory, alloc->mapped != nullptr);
+        stats.dedicatedCount--;
+        stats.dedicatedBytes -= alloc->size;
+        stats.reservedBytes -= alloc->size;
+    }
+    else {
+        auto block = alloc->block;
+        block->allocs.erase(alloc->offset);
+        stats.reservedBytes -= block->size >> alloc->level;
+        block->FreeNode(alloc->offset, alloc->level);
+        if (!block->reserved) {
+            ReleaseEmptyBlocks(pools[block->pool]);
+        }
+    }
+    delete alloc;
+}
+
+Allocation* Allocator::CreateBuffer(const VkBufferCreateInfo& info, MemoryUsage usage, VkBuffer* buffer) {
+    VKDO(vkCreateBuffer(allocDevice, &info, nullptr, buffer));
+
+    VkMemoryRequirements req;
+    vkGetBufferMemoryRequirements(allocDevice, *buffer, &req);
+    auto alloc = Alloc(req, usage, true);
+    VKDO(vkBindBufferMemory(allocDevice, *buffer, alloc->memory, alloc->offset));
+    return alloc;
+}
+
+Allocation* Allocator::CreateImage(const VkImageCreateInfo& info, MemoryUsage usage, VkImage* image) {
+    VKDO(vkCreateImage(allocDevice, &info, nullptr, image));
+
+    VkMemoryRequirements req;
+    vkGetImageMemoryRequirements(allocDevice, *image, &req);
+    auto alloc = Alloc(req, usage, info.tiling == VK_IMAGE_TILING_LINEAR);
+    VKDO(vkBindImageMemory(allocDevice, *image, alloc->memory, alloc->offset));
+    return alloc;
+}
+
+void Allocator::DestroyBuffer(VkBuffer buffer, Allocation* alloc) {
+    vkDestroyBuffer(allocDevice, buffer, nullptr);
+    Free(alloc);
+}
+
+void Allocator::DestroyImage(VkImage image, Allocation* alloc) {
+    vkDestroyImage(allocDevice, image, nullptr);
+    Free(alloc);
+}
+
+AllocatorStats Allocator::GetStats() {
+    VkDeviceSize totalFree = 0, largestFree = 0;
+    for (auto& p : pools) {
+        for (auto b : p.blocks) {
+            totalFree += b->size - b->reserved;
+            largestFree += b->LargestFree();
+        }
+    }
+    auto res = stats;
+    res.fragmentation = totalFree ? 1.0f - (float)largestFree / totalFree : 0.0f;
+    return res;
+}
+
+void Allocator::PrintStats() {
+    const auto s = GetStats();
+    const double mb = 1.0 / (1 << 20);
+    std::cout << "gpu memory: " << s.allocationCount << " allocations, "
+        << s.usedBytes * mb << "MB used, " << s.reservedBytes * mb << "MB reserved, "
+        << s.blockCount << " blocks (" << s.blockBytes * mb << "MB), "
+        << s.dedicatedCount << " dedicated (" << s.dedicatedBytes * mb << "MB), "
+        << "fragmentation " << s.fragmentation << std::endl;
+}
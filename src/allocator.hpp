@@ -0,0 +1,83 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+enum MemoryUsage {
+    MEMORY_USAGE_GPU_ONLY,
+    /* host visible and coherent, for staging and per-frame data */
+    MEMORY_USAGE_UPLOAD,
+    /* host visible, cached if possible, for reading results back */
+    MEMORY_USAGE_READBACK
+};
+
+/* The buddy bookkeeping of one memory block. A node of level l is size >> l bytes and aligned to
+ * that, level 0 is the whole block. Apart from the device memory, so it can be checked without one.
+ */
+struct BuddyNodes {
+    VkDeviceSize size;
+    /* bytes in allocated nodes */
+    VkDeviceSize reserved;
+    /* free node offsets per level */
+    std::vector<std::set<VkDeviceSize>> freeLists;
+
+    /* one free node of blockSize, with levels down to nodes of minNodeSize */
+    void Init(VkDeviceSize blockSize, VkDeviceSize minNodeSize);
+    /* takes the lowest free node of the level, splitting larger nodes as needed */
+    bool AllocNode(uint32_t level, VkDeviceSize* offset);
+    /* returns the node and merges it with its buddy for as long as the buddy is free too */
+    void FreeNode(VkDeviceSize offset, uint32_t level);
+    VkDeviceSize LargestFree() const;
+};
+
+struct MemoryBlock;
+
+struct Allocation {
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size;
+    /* persistently mapped pointer to offset, null if the memory is not host visible */
+    char* mapped;
+
+    MemoryBlock* block; //null for dedicated allocations
+    uint32_t level;
+};
+
+struct AllocatorStats {
+    uint32_t blockCount;
+    uint32_t dedicatedCount;
+    uint32_t allocationCount;
+    /* device memory held, in blocks and in dedicated allocations */
+    VkDeviceSize blockBytes;
+    VkDeviceSize dedicatedBytes;
+    /* bytes requested by live allocations, and bytes reserved for them after rounding */
+    VkDeviceSize usedBytes;
+    VkDeviceSize reservedBytes;
+    /* 0 when the free space of every block is one contiguous range */
+    float fragmentation;
+};
+
+/* Sub-allocates device memory from large blocks with a buddy allocator.
+ * Each memory type has a pool for linear resources (buffers, linear images) and one for
+ * optimal-tiling images, so neighbours never violate bufferImageGranularity.
+ */
+class Allocator {
+public:
+    static void Init(VkPhysicalDevice physDevice, VkDevice device);
+    static void Exit();
+
+    /* returns UINT32_MAX if no type has the required flags */
+    static uint32_t FindMemoryType(uint32_t typeBits, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred = 0);
+
+    static Allocation* Alloc(const VkMemoryRequirements& req, MemoryUsage usage, bool linear);
+    static void Free(Allocation* alloc);
+
+    static Allocation* CreateBuffer(const VkBufferCreateInfo& info, MemoryUsage usage, VkBuffer* buffer);
+    static Allocation* CreateImage(const VkImageCreateInfo& info, MemoryUsage usage, VkImage* image);
+    static void DestroyBuffer(VkBuffer buffer, Allocation* alloc);
+    static void DestroyImage(VkImage image, Allocation* alloc);
+
+    static AllocatorStats GetStats();
+    static void PrintStats();
+};
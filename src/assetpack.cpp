@@ -0,0 +1,451 @@
+#include "assetpack.hpp"
+#include "jobsystem.hpp"
+#include "lz4.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <set>
+
+static const uint32_t PACK_MAGIC = 0x4b505648; //"HVPK"
+static const uint32_t PACK_VERSION = 1;
+//entries start on page boundaries, so a stored entry can be handed out straight from the mapping
+static const uint64_t PACK_ALIGNMENT = 4096;
+//compressed entries are cut into blocks of this size, which decode independently
+static const uint32_t BLOCK_SIZE = 256 << 10;
+//set in a block's size when the block did not compress and is stored as is
+static const uint32_t STORED_BLOCK = 0x80000000;
+
+struct PackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    /* power of two, larger than entryCount so probing always reaches an empty slot */
+    uint32_t slotCount;
+    uint64_t entriesOffset;
+    uint64_t slotsOffset;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+struct PackEntry {
+    uint64_t hash;
+    uint64_t offset;
+    uint64_t packedSize;
+    uint64_t size;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    /* 0 for stored entries. Otherwise the data starts with a uint32_t size per block */
+    uint32_t blockCount;
+    uint32_t reserved;
+};
+
+static const uint32_t EMPTY_SLOT = UINT32_MAX;
+
+static uint64_t HashName(const char* name, size_t length) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t a = 0; a < length; a++) {
+        h ^= (uint8_t)name[a];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+static uint64_t AlignUp(uint64_t v, uint64_t alignment) {
+    return (v + alignment - 1) / alignment * alignment;
+}
+
+struct PackInput {
+    MappedFile* file;
+    /* block sizes followed by the blocks, empty if the entry is stored */
+    std::vector<char> packed;
+    uint32_t blockCount;
+};
+
+static void CompressEntry(PackInput& in) {
+    const auto src = in.file->Span();
+    const auto blocks = (uint32_t)((src.size + BLOCK_SIZE - 1) / BLOCK_SIZE);
+    std::vector<std::vector<char>> out(blocks);
+    JobSystem::ParallelFor(blocks, [&](uint32_t b, uint32_t) {
+        const auto raw = src.Sub((size_t)b * BLOCK_SIZE, BLOCK_SIZE);
+        out[b].resize(Lz4::CompressBound(raw.size));
+        const auto size = Lz4::Compress(raw.data, raw.size, out[b].data(), out[b].size());
+        if (size && size < raw.size) {
+            out[b].resize(size);
+        }
+        else {
+            out[b].assign(raw.data, raw.data + raw.size);
+        }
+    });
+
+    size_t total = blocks * sizeof(uint32_t);
+    for (auto& o : out) total += o.size();
+    //not worth a decode for less than an eighth saved
+    if (total > src.size - src.size / 8) return;
+
+    in.packed.resize(blocks * sizeof(uint32_t));
+    for (uint32_t b = 0; b < blocks; b++) {
+        const auto raw = src.Sub((size_t)b * BLOCK_SIZE, BLOCK_SIZE);
+        uint32_t size = (uint32_t)out[b].size();
+        if (size == raw.size) size |= STORED_BLOCK;
+        memcpy(&in.packed[b * sizeof(uint32_t)], &size, sizeof(size));
+        in.packed.insert(in.packed.end(), out[b].begin(), out[b].end());
+    }
+    in.blockCount = blocks;
+}
+
+static bool WriteAt(FILE* f, uint64_t& pos, uint64_t offset, const void* data, size_t size) {
+    static const char zeros[PACK_ALIGNMENT] = {};
+    while (pos < offset) {
+        const auto n = (size_t)std::min<uint64_t>(offset - pos, sizeof(zeros));
+        if (fwrite(zeros, 1, n, f) != n) return false;
+        pos += n;
+    }
+    if (size && fwrite(data, 1, size, f) != size) return false;
+    pos += size;
+    return true;
+}
+
+bool AssetPack::Write(const std::string& path, const std::vector<std::string>& files, bool compress) {
+    std::vector<PackInput> inputs(files.size());
+    std::set<std::string> unique;
+    bool ok = true;
+    for (size_t a = 0; a < files.size(); a++) {
+        inputs[a].file = MappedFile::Open(files[a]);
+        inputs[a].blockCount = 0;
+        if (!inputs[a].file) ok = false;
+        if (!unique.insert(files[a]).second) {
+            std::cout << "pack: " << files[a] << " is listed twice!" << std::endl;
+            ok = false;
+        }
+    }
+
+    std::vector<PackEntry> entries(files.size());
+    std::string names;
+    PackHeader hd = {};
+    uint64_t offset = sizeof(PackHeader);
+    for (size_t a = 0; ok && a < files.size(); a++) {
+        auto& in = inputs[a];
+        if (compress && in.file->Size()) CompressEntry(in);
+        auto& e = entries[a];
+        e.hash = HashName(files[a].data(), files[a].size());
+        e.offset = AlignUp(offset, PACK_ALIGNMENT);
+        e.size = in.file->Size();
+        e.packedSize = in.blockCount ? in.packed.size() : e.size;
+        e.nameOffset = (uint32_t)names.size();
+        e.nameLength = (uint32_t)files[a].size();
+        e.blockCount = in.blockCount;
+        names += files[a];
+        offset = e.offset + e.packedSize;
+    }
+
+    hd.magic = PACK_MAGIC;
+    hd.version = PACK_VERSION;
+    hd.entryCount = (uint32_t)entries.size();
+    hd.slotCount = 2;
+    while (hd.slotCount < hd.entryCount * 2) hd.slotCount *= 2;
+    hd.entriesOffset = AlignUp(offset, 8);
+    hd.slotsOffset = hd.entriesOffset + entries.size() * sizeof(PackEntry);
+    hd.namesOffset = hd.slotsOffset + hd.slotCount * sizeof(uint32_t);
+    hd.namesSize = names.size();
+
+    //open addressing with linear probing, Find walks the same way
+    std::vector<uint32_t> slots(hd.slotCount, EMPTY_SLOT);
+    for (uint32_t a = 0; a < hd.entryCount; a++) {
+        uint32_t s = (uint32_t)entries[a].hash & (hd.slotCount - 1);
+        while (slots[s] != EMPTY_SLOT) s = (s + 1) & (hd.slotCount - 1);
+        slots[s] = a;
+    }
+
+    FILE* f = ok ? fopen(path.c_str(), "wb") : nullptr;
+    if (ok && !f) {
+        std::cout << "pack: cannot open " << path << "!" << std::endl;
+        ok = false;
+    }
+    if (ok) {
+        uint64_t pos = 0;
+        ok = WriteAt(f, pos, 0, &hd, sizeof(hd));
+        for (size_t a = 0; ok && a < entries.size(); a++) {
+            const auto& in = inputs[a];
+            ok = in.blockCount ? WriteAt(f, pos, entries[a].offset, in.packed.data(), in.packed.size())
+                : WriteAt(f, pos, entries[a].offset, in.file->Span().data, in.file->Size());
+        }
+        ok = ok && WriteAt(f, pos, hd.entriesOffset, entries.data(), entries.size() * sizeof(PackEntry))
+            && WriteAt(f, pos, hd.slotsOffset, slots.data(), slots.size() * sizeof(uint32_t))
+            && WriteAt(f, pos, hd.namesOffset, names.data(), names.size());
+        ok = (fclose(f) == 0) && ok;
+        if (!ok) {
+            std::cout << "pack: failed to write " << path << std::endl;
+            remove(path.c_str());
+        }
+    }
+
+    uint64_t raw = 0, packed = 0;
+    for (size_t a = 0; a < inputs.size(); a++) {
+        if (ok) {
+            raw += entries[a].size;
+            packed += entries[a].packedSize;
+            std::cout << "  " << files[a] << ": " << entries[a].size << " -> " << entries[a].packedSize
+                << (entries[a].blockCount ? " (lz4)" : " (stored)") << std::endl;
+        }
+        MappedFile::Close(inputs[a].file);
+    }
+    if (ok) {
+        std::cout << "pack: wrote " << files.size() << " entries to " << path << ", "
+            << (raw >> 10) << "KB -> " << (packed >> 10) << "KB" << std::endl;
+    }
+    return ok;
+}
+
+static const char* ValidatePack(ByteSpan data) {
+    if (data.size < sizeof(PackHeader)) return "file too small";
+    const auto& hd = *(const PackHeader*)data.data;
+    if (hd.magic != PACK_MAGIC || hd.version != PACK_VERSION) return "bad magic or version";
+    if (!hd.slotCount || (hd.slotCount & (hd.slotCount - 1)) || hd.slotCount <= hd.entryCount) return "bad slot count";
+    if (hd.entriesOffset % 8 || hd.slotsOffset % 4) return "misaligned table";
+    if (hd.entriesOffset + (uint64_t)hd.entryCount * sizeof(PackEntry) > hd.slotsOffset
+            || hd.slotsOffset + (uint64_t)hd.slotCount * sizeof(uint32_t) > hd.namesOffset
+            || hd.namesOffset + hd.namesSize > data.size) {
+        return "table out of range";
+    }
+    auto entries = (const PackEntry*)(data.data + hd.entriesOffset);
+    for (uint32_t a = 0; a < hd.entryCount; a++) {
+        const auto& e = entries[a];
+        if (e.offset > data.size || e.packedSize > data.size - e.offset) return "entry out of range";
+        if ((uint64_t)e.nameOffset + e.nameLength > hd.namesSize) return "name out of range";
+        if (!e.blockCount && e.packedSize != e.size) return "bad stored size";
+        if (e.blockCount && (e.blockCount != (e.size + BLOCK_SIZE - 1) / BLOCK_SIZE
+                || (uint64_t)e.blockCount * sizeof(uint32_t) > e.packedSize)) {
+            return "bad block count";
+        }
+    }
+    auto slots = (const uint32_t*)(data.data + hd.slotsOffset);
+    for (uint32_t a = 0; a < hd.slotCount; a++) {
+        if (slots[a] != EMPTY_SLOT && slots[a] >= hd.entryCount) return "bad slot";
+    }
+    return nullptr;
+}
+
+AssetPack* AssetPack::Open(const std::string& path) {
+    auto file = MappedFile::Open(path);
+    if (!file) return nullptr;
+    const char* err = ValidatePack(file->Span());
+    if (err) {
+        std::cout << "pack: " << path << " is not usable (" << err << ")" << std::endl;
+        MappedFile::Close(file);
+        return nullptr;
+    }
+
+    const char* base = file->Span().data;
+    const auto& hd = *(const PackHeader*)base;
+    auto pack = new AssetPack();
+    pack->file = file;
+    pack->entries = (const PackEntry*)(base + hd.entriesOffset);
+    pack->slots = (const uint32_t*)(base + hd.slotsOffset);
+    pack->names = base + hd.namesOffset;
+    pack->entryCount = hd.entryCount;
+    pack->slotMask = hd.slotCount - 1;
+    return pack;
+}
+
+void AssetPack::Close(AssetPack* pack) {
+    if (!pack) return;
+    MappedFile::Close(pack->file);
+    delete pack;
+}
+
+uint32_t AssetPack::Find(const std::string& name) const {
+    const auto h = HashName(name.data(), name.size());
+    for (uint32_t s = (uint32_t)h & slotMask; ; s = (s + 1) & slotMask) {
+        const auto a = slots[s];
+        if (a == EMPTY_SLOT) return UINT32_MAX;
+        const auto& e = entries[a];
+        if (e.hash == h && e.nameLength == name.size() && !memcmp(names + e.nameOffset, name.data(), name.size())) {
+            return a;
+        }
+    }
+}
+
+uint32_t AssetPack::EntryCount() const {
+    return entryCount;
+}
+
+std::string AssetPack::Name(uint32_t entry) const {
+    return std::string(names + entries[entry].nameOffset, entries[entry].nameLength);
+}
+
+size_t AssetPack::Size(uint32_t entry) const {
+    return (size_t)entries[entry].size;
+}
+
+bool AssetPack::IsCompressed(uint32_t entry) const {
+    return entries[entry].blockCount > 0;
+}
+
+ByteSpan AssetPack::Span(uint32_t entry) const {
+    const auto& e = entries[entry];
+    if (e.blockCount) return ByteSpan{ nullptr, 0 };
+    return file->Span(e.offset, e.size);
+}
+
+struct PackBlock {
+    ByteSpan src;
+    bool stored;
+};
+
+//splits a compressed entry into its blocks, false if the sizes do not add up
+static bool GetBlocks(const PackEntry& e, ByteSpan data, std::vector<PackBlock>& blocks) {
+    const auto table = data.Sub(0, e.blockCount * sizeof(uint32_t));
+    uint64_t offset = table.size;
+    blocks.resize(e.blockCount);
+    for (uint32_t b = 0; b < e.blockCount; b++) {
+        uint32_t size;
+        memcpy(&size, table.data + b * sizeof(uint32_t), sizeof(size));
+        blocks[b].stored = (size & STORED_BLOCK) != 0;
+        size &= ~STORED_BLOCK;
+        if (offset + size > data.size) return false;
+        blocks[b].src = data.Sub(offset, size);
+        offset += size;
+    }
+    return true;
+}
+
+static bool DecodeBlock(const PackBlock& block, char* dst, size_t dstSize) {
+    if (!block.stored) return Lz4::Decompress(block.src.data, block.src.size, dst, dstSize);
+    if (block.src.size != dstSize) return false;
+    memcpy(dst, block.src.data, dstSize);
+    return true;
+}
+
+bool AssetPack::Read(uint32_t entry, char* out) const {
+    const auto& e = entries[entry];
+    const auto data = file->Span(e.offset, e.packedSize);
+    if (!e.blockCount) {
+        if (e.size) memcpy(out, data.data, e.size);
+        return true;
+    }
+    std::vector<PackBlock> blocks;
+    if (!GetBlocks(e, data, blocks)) return false;
+    std::atomic<bool> ok(true);
+    JobSystem::ParallelFor(e.blockCount, [&](uint32_t b, uint32_t) {
+        const size_t offset = (size_t)b * BLOCK_SIZE;
+        if (!DecodeBlock(blocks[b], out + offset, std::min<size_t>(BLOCK_SIZE, e.size - offset))) ok = false;
+    });
+    return ok;
+}
+
+ByteSpan AssetPack::Load(uint32_t entry, std::vector<char>& storage) const {
+    if (!IsCompressed(entry)) return Span(entry);
+    storage.resize(Size(entry));
+    if (!Read(entry, storage.data())) return ByteSpan{ nullptr, 0 };
+    return ByteSpan{ storage.data(), storage.size() };
+}
+
+bool AssetPack::LoadAll(std::vector<char>& storage, std::vector<ByteSpan>& spans) const {
+    struct Job {
+        PackBlock block;
+        size_t dst;
+        size_t size;
+    };
+    std::vector<Job> jobs;
+    std::vector<size_t> offsets(entryCount);
+    size_t total = 0;
+    std::vector<PackBlock> blocks;
+    for (uint32_t a = 0; a < entryCount; a++) {
+        const auto& e = entries[a];
+        if (!e.blockCount) continue;
+        if (!GetBlocks(e, file->Span(e.offset, e.packedSize), blocks)) return false;
+        offsets[a] = total;
+        for (uint32_t b = 0; b < e.blockCount; b++) {
+            const size_t offset = (size_t)b * BLOCK_SIZE;
+            jobs.push_back(Job{ blocks[b], total + offset, std::min<size_t>(BLOCK_SIZE, e.size - offset) });
+        }
+        total += e.size;
+    }
+
+    //one flat list of blocks keeps every thread busy, however the sizes are spread over entries
+    storage.resize(total);
+    std::atomic<bool> ok(true);
+    JobSystem::ParallelFor((uint32_t)jobs.size(), [&](uint32_t j, uint32_t) {
+        if (!DecodeBlock(jobs[j].block, storage.data() + jobs[j].dst, jobs[j].size)) ok = false;
+    });
+
+    spans.resize(entryCount);
+    for (uint32_t a = 0; a < entryCount; a++) {
+        spans[a] = IsCompressed(a) ? ByteSpan{ storage.data() + offsets[a], Size(a) } : Span(a);
+    }
+    return ok;
+}
+
+typedef std::chrono::steady_clock PackClock;
+
+static double PackMsSince(PackClock::time_point t) {
+    return std::chrono::duration<double, std::milli>(PackClock::now() - t).count();
+}
+
+static uint64_t SpanHash(ByteSpan span) {
+    return HashName(span.data, span.size);
+}
+
+void AssetPack::Benchmark(const std::string& path) {
+    auto t = PackClock::now();
+    auto pack = Open(path);
+    const double openMs = PackMsSince(t);
+    if (!pack) return;
+
+    const auto count = pack->EntryCount();
+    std::vector<std::string> names(count);
+    size_t raw = 0, compressed = 0;
+    for (uint32_t a = 0; a < count; a++) {
+        names[a] = pack->Name(a);
+        raw += pack->Size(a);
+        if (pack->IsCompressed(a)) compressed++;
+    }
+    std::cout << "pack benchmark: " << path << ", " << count << " entries (" << compressed << " compressed), "
+        << (raw >> 10) << "KB, " << JobSystem::ThreadCount() << " threads" << std::endl;
+    std::cout << "  open: " << openMs * 1000 << "us" << std::endl;
+
+    const uint32_t LOOKUPS = 1000000;
+    uint64_t found = 0;
+    t = PackClock::now();
+    for (uint32_t a = 0; a < LOOKUPS; a++) {
+        found += pack->Find(names[a % count]) != UINT32_MAX;
+    }
+    std::cout << "  lookup: " << PackMsSince(t) * 1e6 / LOOKUPS << "ns (" << found << " found)" << std::endl;
+
+    //loose files are what the pack replaces, they are expected under the same names
+    std::vector<uint64_t> hashes(count);
+    t = PackClock::now();
+    bool loose = true;
+    for (uint32_t a = 0; a < count && loose; a++) {
+        const auto bytes = FileReader::ReadBytes(names[a]);
+        loose = bytes.size() == pack->Size(a);
+        hashes[a] = SpanHash(ByteSpan{ bytes.data(), bytes.size() });
+    }
+    if (loose) {
+        std::cout << "  loose files: " << PackMsSince(t) << "ms" << std::endl;
+    }
+    else {
+        std::cout << "  loose files: not found next to the pack, skipped" << std::endl;
+    }
+
+    t = PackClock::now();
+    bool ok = true;
+    std::vector<char> storage;
+    for (uint32_t a = 0; a < count; a++) {
+        const auto span = pack->Load(a, storage);
+        ok = ok && (span.data || !pack->Size(a)) && (!loose || SpanHash(span) == hashes[a]);
+    }
+    std::cout << "  pack, one by one: " << PackMsSince(t) << "ms" << (ok ? "" : " (mismatch!)") << std::endl;
+
+    t = PackClock::now();
+    std::vector<ByteSpan> spans;
+    ok = pack->LoadAll(storage, spans);
+    for (uint32_t a = 0; a < count; a++) {
+        ok = ok && (!loose || SpanHash(spans[a]) == hashes[a]);
+    }
+    std::cout << "  pack, LoadAll: " << PackMsSince(t) << "ms" << (ok ? "" : " (mismatch!)") << std::endl;
+
+    Close(pack);
+}
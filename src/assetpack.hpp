@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "filereader.hpp"
+
+struct PackEntry;
+
+/* A single-file archive of named assets, read through one memory mapping.
+ * Entries start on 4096 byte boundaries, so stored entries can be used in place. Compressed
+ * entries are split into independent LZ4 blocks that are decoded in parallel.
+ */
+class AssetPack {
+public:
+    /* Writes files to path under the names they were given. With compress, entries that
+     * shrink by at least an eighth are stored as LZ4 blocks. Returns false on any I/O error.
+     */
+    static bool Write(const std::string& path, const std::vector<std::string>& files, bool compress);
+
+    /* returns null if the file is missing or not a valid pack */
+    static AssetPack* Open(const std::string& path);
+    static void Close(AssetPack* pack);
+
+    /* returns UINT32_MAX if there is no entry called name */
+    uint32_t Find(const std::string& name) const;
+    uint32_t EntryCount() const;
+    std::string Name(uint32_t entry) const;
+    /* the uncompressed size */
+    size_t Size(uint32_t entry) const;
+    bool IsCompressed(uint32_t entry) const;
+
+    /* the entry inside the mapping, without a copy. Empty for compressed entries */
+    ByteSpan Span(uint32_t entry) const;
+    /* Decodes into out, which must hold Size(entry) bytes. Returns false if the data is corrupt.
+     * Large entries are decoded with ParallelFor, so this must not be called from a job.
+     */
+    bool Read(uint32_t entry, char* out) const;
+    /* Span for stored entries, otherwise decodes into storage and returns that.
+     * Returns an empty span if the data is corrupt.
+     */
+    ByteSpan Load(uint32_t entry, std::vector<char>& storage) const;
+    /* Makes every entry available at once: stored ones point into the mapping, compressed ones
+     * are decoded into storage with all job threads. Returns false if any entry is corrupt.
+     */
+    bool LoadAll(std::vector<char>& storage, std::vector<ByteSpan>& spans) const;
+
+    /* compares loading the pack's entries with loading them as loose files from the working directory */
+    static void Benchmark(const std::string& path);
+
+private:
+    MappedFile* file;
+    const PackEntry* entries;
+    const uint32_t* slots;
+    const char* names;
+    uint32_t entryCount;
+    uint32_t slotMask;
+};
@@ -0,0 +1,78 @@
+#include "asynccompute.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <vector>
+
+struct ComputeFrame {
+    VkCommandPool pool;
+    VkCommandBuffer cmd;
+    VkSemaphore done;
+};
+
+static VkDevice computeDevice;
+static VkQueue computeQueue;
+static std::vector<ComputeFrame> frames;
+
+void AsyncCompute::Init(VkDevice device, uint32_t family, VkQueue queue, uint32_t count) {
+    computeDevice = device;
+    computeQueue = queue;
+    frames.resize(count);
+    for (auto& f : frames) {
+        VkCommandPoolCreateInfo pinfo = {};
+        pinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        pinfo.queueFamilyIndex = family;
+        pinfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        VKDO(vkCreateCommandPool(device, &pinfo, nullptr, &f.pool));
+
+        VkCommandBufferAllocateInfo ainfo = {};
+        ainfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        ainfo.commandPool = f.pool;
+        ainfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        ainfo.commandBufferCount = 1;
+        VKDO(vkAllocateCommandBuffers(device, &ainfo, &f.cmd));
+
+        VkSemaphoreCreateInfo sinfo = {};
+        sinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VKDO(vkCreateSemaphore(device, &sinfo, nullptr, &f.done));
+    }
+    std::cout << "async compute on queue family " << family << std::endl;
+}
+
+void AsyncCompute::Exit() {
+    for (auto& f : frames) {
+        vkDestroySemaphore(computeDevice, f.done, nullptr);
+        vkDestroyCommandPool(computeDevice, f.pool, nullptr);
+    }
+    frames.clear();
+}
+
+VkCommandBuffer AsyncCompute::Begin(uint32_t frame) {
+    auto& f = frames[frame];
+    VKDO(vkResetCommandPool(computeDevice, f.pool, 0));
+    VkCommandBufferBeginInfo binfo = {};
+    binfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    binfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VKDO(vkBeginCommandBuffer(f.cmd, &binfo));
+    return f.cmd;
+}
+
+VkSemaphore AsyncCompute::Submit(uint32_t frame, VkSemaphore wait) {
+    auto& f = frames[frame];
+    VKDO(vkEndCommandBuffer(f.cmd));
+
+    //the waits of this queue can only name stages it has, all of them are blocked
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    if (wait != VK_NULL_HANDLE) {
+        info.waitSemaphoreCount = 1;
+        info.pWaitSemaphores = &wait;
+        info.pWaitDstStageMask = &waitStage;
+    }
+    info.commandBufferCount = 1;
+    info.pCommandBuffers = &f.cmd;
+    info.signalSemaphoreCount = 1;
+    info.pSignalSemaphores = &f.done;
+    VKDO(vkQueueSubmit(computeQueue, 1, &info, VK_NULL_HANDLE));
+    return f.done;
+}
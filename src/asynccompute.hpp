@@ -0,0 +1,22 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+/* Submits compute work to a queue family without graphics, so it runs alongside the graphics
+ * queue (mostly next to the frame before it). Each frame's compute submit signals a semaphore
+ * that the frame's graphics submit waits on, which also orders everything the compute work
+ * waited for before the graphics work. The graphics frame is what FrameSync counts, so a frame
+ * slot's compute work is known to be done once its graphics work is.
+ */
+class AsyncCompute {
+public:
+    static void Init(VkDevice device, uint32_t family, VkQueue queue, uint32_t frames);
+    static void Exit();
+
+    /* resets the frame's pool and begins its command buffer */
+    static VkCommandBuffer Begin(uint32_t frame);
+    /* Ends and submits the frame's command buffer. wait, if not null, is waited on before any of
+     * it runs. Returns the semaphore for the graphics submit of the frame.
+     */
+    static VkSemaphore Submit(uint32_t frame, VkSemaphore wait);
+};
@@ -0,0 +1,37 @@
+#include <iostream>
+#include <string>
+
+#include "assetpack.hpp"
+#include "filereader.hpp"
+#include "jobsystem.hpp"
+#include "transforms.hpp"
+
+//cpu benchmarks of the renderer library, none needs a device: hvbench [--transforms] [--io file] [--pack file] [--threads n]
+int main(int argc, char** argv) {
+    bool transforms = false;
+    std::string ioPath;
+    std::string packPath;
+    uint32_t threads = 0;
+    for (int a = 1; a < argc; a++) {
+        const std::string arg = argv[a];
+        if (arg == "--transforms") transforms = true;
+        else if (arg == "--io" && a + 1 < argc) ioPath = argv[++a];
+        else if (arg == "--pack" && a + 1 < argc) packPath = argv[++a];
+        else if (arg == "--threads" && a + 1 < argc) threads = std::stoul(argv[++a]);
+        else {
+            std::cerr << "usage: hvbench [--transforms] [--io file] [--pack file] [--threads n]" << std::endl;
+            return 1;
+        }
+    }
+    //the transforms need no files, so they are what runs by default
+    if (ioPath.empty() && packPath.empty()) {
+        transforms = true;
+    }
+
+    if (transforms) Transforms::Benchmark();
+    JobSystem::Init(threads);
+    if (!ioPath.empty()) FileReader::Benchmark(ioPath);
+    if (!packPath.empty()) AssetPack::Benchmark(packPath);
+    JobSystem::Exit();
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include "bindless.hpp"
+#include "handles.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+//upper bounds, most devices allow far more
+static const uint32_t MAX_TEXTURES = 16384;
+static const uint32_t MAX_SAMPLERS = 64;
+static const uint32_t MAX_BUFFERS = 16384;
+
+enum Binding {
+    BINDING_TEXTURES,
+    BINDING_SAMPLERS,
+    BINDING_BUFFERS,
+    BINDING_COUNT
+};
+
+//indices below next that are not in use, reused before growing
+struct IndexAllocator {
+    uint32_t capacity;
+    uint32_t next;
+    std::vector<uint32_t> freeList;
+
+    uint32_t Alloc(const char* kind) {
+        if (!freeList.empty()) {
+            const auto index = freeList.back();
+            freeList.pop_back();
+            return index;
+        }
+        if (next == capacity) {
+            std::cerr << "bindless table is out of " << kind << " (" << capacity << ")!" << std::endl;
+            abort();
+        }
+        return next++;
+    }
+};
+
+static VkDevice tableDevice;
+static VkDescriptorSetLayout setLayout;
+static VkPipelineLayout pipelineLayout;
+static VkDescriptorPool pool;
+static VkDescriptorSet set;
+static IndexAllocator indices[BINDING_COUNT];
+
+void Bindless::Init(VkDevice device, const VkPhysicalDeviceDescriptorIndexingProperties& limits) {
+    tableDevice = device;
+    indices[BINDING_TEXTURES].capacity = std::min(MAX_TEXTURES, std::min(limits.maxDescriptorSetUpdateAfterBindSampledImages,
+        limits.maxPerStageDescriptorUpdateAfterBindSampledImages));
+    indices[BINDING_SAMPLERS].capacity = std::min(MAX_SAMPLERS, std::min(limits.maxDescriptorSetUpdateAfterBindSamplers,
+        limits.maxPerStageDescriptorUpdateAfterBindSamplers));
+    indices[BINDING_BUFFERS].capacity = std::min(MAX_BUFFERS, std::min(limits.maxDescriptorSetUpdateAfterBindStorageBuffers,
+        limits.maxPerStageDescriptorUpdateAfterBindStorageBuffers));
+    //every stage sees all three arrays, textures and buffers share what the samplers leave
+    const uint32_t shared = (limits.maxPerStageUpdateAfterBindResources - indices[BINDING_SAMPLERS].capacity) / 2;
+    indices[BINDING_TEXTURES].capacity = std::min(indices[BINDING_TEXTURES].capacity, shared);
+    indices[BINDING_BUFFERS].capacity = std::min(indices[BINDING_BUFFERS].capacity, shared);
+
+    const VkDescriptorType types[BINDING_COUNT] = {
+        VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, VK_DESCRIPTOR_TYPE_SAMPLER, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+    };
+    VkDescriptorSetLayoutBinding bindings[BINDING_COUNT] = {};
+    VkDescriptorBindingFlags flags[BINDING_COUNT];
+    VkDescriptorPoolSize sizes[BINDING_COUNT];
+    for (uint32_t a = 0; a < BINDING_COUNT; a++) {
+        bindings[a].binding = a;
+        bindings[a].descriptorType = types[a];
+        bindings[a].descriptorCount = indices[a].capacity;
+        bindings[a].stageFlags = VK_SHADER_STAGE_ALL;
+        //slots nobody uses may be empty or stale, and are written while earlier frames still run
+        flags[a] = VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT
+            | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
+        sizes[a].type = types[a];
+        sizes[a].descriptorCount = indices[a].capacity;
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {};
+    flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    flagsInfo.bindingCount = BINDING_COUNT;
+    flagsInfo.pBindingFlags = flags;
+    VkDescriptorSetLayoutCreateInfo linfo = {};
+    linfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    linfo.pNext = &flagsInfo;
+    linfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    linfo.bindingCount = BINDING_COUNT;
+    linfo.pBindings = bindings;
+    VKDO(vkCreateDescriptorSetLayout(device, &linfo, nullptr, &setLayout));
+
+    VkPushConstantRange range = {};
+    range.stageFlags = VK_SHADER_STAGE_ALL;
+    range.size = sizeof(DrawConstants);
+    VkPipelineLayoutCreateInfo pinfo = {};
+    pinfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pinfo.setLayoutCount = 1;
+    pinfo.pSetLayouts = &setLayout;
+    pinfo.pushConstantRangeCount = 1;
+    pinfo.pPushConstantRanges = &range;
+    VKDO(vkCreatePipelineLayout(device, &pinfo, nullptr, &pipelineLayout));
+
+    VkDescriptorPoolCreateInfo dinfo = {};
+    dinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    dinfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    dinfo.maxSets = 1;
+    dinfo.poolSizeCount = BINDING_COUNT;
+    dinfo.pPoolSizes = sizes;
+    VKDO(vkCreateDescriptorPool(device, &dinfo, nullptr, &pool));
+
+    VkDescriptorSetAllocateInfo ainfo = {};
+    ainfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ainfo.descriptorPool = pool;
+    ainfo.descriptorSetCount = 1;
+    ainfo.pSetLayouts = &setLayout;
+    VKDO(vkAllocateDescriptorSets(device, &ainfo, &set));
+
+    std::cout << "bindless table: " << indices[BINDING_TEXTURES].capacity << " textures, "
+        << indices[BINDING_SAMPLERS].capacity << " samplers, " << indices[BINDING_BUFFERS].capacity
+        << " buffers" << std::endl;
+}
+
+void Bindless::Exit() {
+    vkDestroyDescriptorPool(tableDevice, pool, nullptr);
+    vkDestroyPipelineLayout(tableDevice, pipelineLayout, nullptr);
+    vkDestroyDescriptorSetLayout(tableDevice, setLayout, nullptr);
+    for (auto& i : indices) {
+        i.next = 0;
+        i.freeList.clear();
+    }
+}
+
+VkDescriptorSetLayout Bindless::SetLayout() {
+    return setLayout;
+}
+
+VkPipelineLayout Bindless::PipelineLayout() {
+    return pipelineLayout;
+}
+
+void Bindless::Bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint) {
+    vkCmdBindDescriptorSets(cmd, bindPoint, pipelineLayout, 0, 1, &set, 0, nullptr);
+}
+
+static void Write(Binding binding, uint32_t index, const VkDescriptorImageInfo* image, const VkDescriptorBufferInfo* buffer) {
+    VkWriteDescriptorSet write = {};
+    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write.dstSet = set;
+    write.dstBinding = binding;
+    write.dstArrayElement = index;
+    write.descriptorCount = 1;
+    write.descriptorType = (binding == BINDING_TEXTURES) ? VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+        : (binding == BINDING_SAMPLERS) ? VK_DESCRIPTOR_TYPE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write.pImageInfo = image;
+    write.pBufferInfo = buffer;
+    vkUpdateDescriptorSets(tableDevice, 1, &write, 0, nullptr);
+}
+
+uint32_t Bindless::AddTexture(VkImageView view, VkImageLayout layout) {
+    const auto index = indices[BINDING_TEXTURES].Alloc("textures");
+    VkDescriptorImageInfo info = {};
+    info.imageView = view;
+    info.imageLayout = layout;
+    Write(BINDING_TEXTURES, index, &info, nullptr);
+    return index;
+}
+
+uint32_t Bindless::AddSampler(VkSampler sampler) {
+    const auto index = indices[BINDING_SAMPLERS].Alloc("samplers");
+    VkDescriptorImageInfo info = {};
+    info.sampler = sampler;
+    Write(BINDING_SAMPLERS, index, &info, nullptr);
+    return index;
+}
+
+uint32_t Bindless::AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range) {
+    const auto index = indices[BINDING_BUFFERS].Alloc("buffers");
+    VkDescriptorBufferInfo info = {};
+    info.buffer = buffer;
+    info.offset = offset;
+    info.range = range;
+    Write(BINDING_BUFFERS, index, nullptr, &info);
+    return index;
+}
+
+//frames already submitted may still read the slot
+static void Remove(Binding binding, uint32_t index) {
+    DeletionQueue::Defer([binding, index]() {
+        indices[binding].freeList.push_back(index);
+    });
+}
+
+void Bindless::RemoveTexture(uint32_t index) {
+    Remove(BINDING_TEXTURES, index);
+}
+
+void Bindless::RemoveSampler(uint32_t index) {
+    Remove(BINDING_SAMPLERS, index);
+}
+
+void Bindless::RemoveBuffer(uint32_t index) {
+    Remove(BINDING_BUFFERS, index);
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+/* push constants of every pipeline made with Bindless::PipelineLayout(), indices into the table */
+struct DrawConstants {
+    uint32_t texture;
+    uint32_t sampler;
+    uint32_t buffer;
+    /* for the shader to pick an element of the buffer */
+    uint32_t element;
+};
+
+/* One descriptor set holding large arrays of textures, samplers and storage buffers, bound once per
+ * command buffer. Shaders pick their resources with the indices in DrawConstants, so materials need
+ * no sets or pools of their own. The arrays are update-after-bind, so resources can be added while
+ * frames are in flight. Needs VK_EXT_descriptor_indexing (core in 1.2).
+ */
+class Bindless {
+public:
+    /* the array sizes are clamped to the device's update-after-bind limits */
+    static void Init(VkDevice device, const VkPhysicalDeviceDescriptorIndexingProperties& limits);
+    static void Exit();
+
+    static VkDescriptorSetLayout SetLayout();
+    /* set 0 is the table, plus DrawConstants for all stages */
+    static VkPipelineLayout PipelineLayout();
+    static void Bind(VkCommandBuffer cmd, VkPipelineBindPoint bindPoint);
+
+    /* Each returns an index that stays the same until it is removed. A removed index is handed out
+     * again only once the frames submitted before the removal have finished.
+     */
+    static uint32_t AddTexture(VkImageView view, VkImageLayout layout);
+    static uint32_t AddSampler(VkSampler sampler);
+    static uint32_t AddBuffer(VkBuffer buffer, VkDeviceSize offset, VkDeviceSize range);
+    static void RemoveTexture(uint32_t index);
+    static void RemoveSampler(uint32_t index);
+    static void RemoveBuffer(uint32_t index);
+};
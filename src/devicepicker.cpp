@@ -0,0 +1,152 @@
+#include "devicepicker.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+//a step in type outweighs everything else, so an integrated gpu never wins over a discrete one
+static int64_t TypeScore(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return 4000;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return 2000;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return 1000;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return 0;
+    default: return 500;
+    }
+}
+
+static const char* TypeName(VkPhysicalDeviceType type) {
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+    default: return "other";
+    }
+}
+
+static std::string Lower(std::string s) {
+    for (auto& c : s) c = (char)std::tolower((unsigned char)c);
+    return s;
+}
+
+bool DeviceInfo::HasExtension(const char* ext) const {
+    for (auto& e : extensions) {
+        if (e == ext) return true;
+    }
+    return false;
+}
+
+DeviceInfo DevicePicker::Query(VkPhysicalDevice device, VkSurfaceKHR surface) {
+    DeviceInfo info = {};
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(device, &props);
+    info.name = props.deviceName;
+    info.type = props.deviceType;
+    info.vendorID = props.vendorID;
+    info.apiVersion = props.apiVersion;
+
+    VkPhysicalDeviceMemoryProperties memProps;
+    vkGetPhysicalDeviceMemoryProperties(device, &memProps);
+    for (uint32_t a = 0; a < memProps.memoryHeapCount; a++) {
+        if (memProps.memoryHeaps[a].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+            info.localMemory = std::max(info.localMemory, memProps.memoryHeaps[a].size);
+        }
+    }
+
+    uint32_t count = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, nullptr);
+    info.queueFamilies.resize(count);
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &count, info.queueFamilies.data());
+    info.present.resize(count, true);
+    if (surface != VK_NULL_HANDLE) {
+        for (uint32_t a = 0; a < count; a++) {
+            VkBool32 pres = VK_FALSE;
+            VKDO(vkGetPhysicalDeviceSurfaceSupportKHR(device, a, surface, &pres));
+            info.present[a] = pres == VK_TRUE;
+        }
+    }
+
+    vkGetPhysicalDeviceFeatures(device, &info.features);
+
+    VKDO(vkEnumerateDeviceExtensionProperties(device, nullptr, &count, nullptr));
+    std::vector<VkExtensionProperties> extensions(count);
+    VKDO(vkEnumerateDeviceExtensionProperties(device, nullptr, &count, extensions.data()));
+    for (auto& e : extensions) {
+        info.extensions.push_back(e.extensionName);
+    }
+    info.groupSize = 1;
+    return info;
+}
+
+int64_t DevicePicker::Score(const DeviceInfo& info, bool headless, std::string& reason) {
+    bool graphics = false, transfer = false, compute = false;
+    for (size_t a = 0; a < info.queueFamilies.size(); a++) {
+        const auto flags = info.queueFamilies[a].queueFlags;
+        //the graphics queue also presents, see Vulkan::InitDevice
+        if ((flags & VK_QUEUE_GRAPHICS_BIT) && (headless || info.present[a])) graphics = true;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) transfer = true;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) compute = true;
+    }
+    if (!graphics) {
+        reason = headless ? "no graphics queue" : "no graphics queue that can present";
+        return -1;
+    }
+    if (!headless && !info.HasExtension(VK_KHR_SWAPCHAIN_EXTENSION_NAME)) {
+        reason = "no swapchain";
+        return -1;
+    }
+
+    int64_t score = TypeScore(info.type);
+    //64MB a point, up to 64GB, which breaks ties within a type
+    score += (int64_t)std::min<VkDeviceSize>(info.localMemory >> 26, 1000);
+    //uploads alongside rendering, and culling alongside the previous frame
+    if (transfer) score += 100;
+    if (compute) score += 100;
+    //timeline semaphores and descriptor indexing in core
+    if (info.apiVersion >= VK_API_VERSION_1_2) score += 50;
+    const auto& f = info.features;
+    if (f.drawIndirectFirstInstance) score += 50;
+    if (f.shaderSampledImageArrayDynamicIndexing && f.shaderStorageBufferArrayDynamicIndexing) score += 50;
+    if (f.textureCompressionBC || f.textureCompressionASTC_LDR) score += 25;
+    if (f.pipelineStatisticsQuery && f.inheritedQueries) score += 10;
+    if (info.HasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME)) score += 25;
+    return score;
+}
+
+int DevicePicker::Pick(const std::vector<DeviceInfo>& devices, bool headless, const std::string& choice) {
+    const bool byIndex = !choice.empty() && std::all_of(choice.begin(), choice.end(), [](char c) {
+        return std::isdigit((unsigned char)c) != 0;
+    });
+    const auto index = byIndex ? std::strtoul(choice.c_str(), nullptr, 10) : 0;
+    const auto name = Lower(choice);
+    int best = -1;
+    int64_t bestScore = -1;
+    for (size_t a = 0; a < devices.size(); a++) {
+        if (byIndex && index != a) continue;
+        if (!byIndex && !choice.empty() && Lower(devices[a].name).find(name) == std::string::npos) continue;
+        std::string reason;
+        const auto score = Score(devices[a], headless, reason);
+        //the first of equal devices, as they were enumerated
+        if (score > bestScore) {
+            best = (int)a;
+            bestScore = score;
+        }
+    }
+    return best;
+}
+
+void DevicePicker::Print(const std::vector<DeviceInfo>& devices, bool headless, int picked) {
+    for (size_t a = 0; a < devices.size(); a++) {
+        const auto& d = devices[a];
+        std::string reason;
+        const auto score = Score(d, headless, reason);
+        std::cout << ((int)a == picked ? " * " : "   ") << a << ": " << d.name << " (" << TypeName(d.type) << ", "
+            << (d.localMemory >> 20) << "MB";
+        if (d.groupSize > 1) std::cout << ", group of " << d.groupSize;
+        std::cout << ") ";
+        if (score < 0) std::cout << "unusable: " << reason << std::endl;
+        else std::cout << "score " << score << std::endl;
+    }
+}
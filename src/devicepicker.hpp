@@ -0,0 +1,45 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* what picking a physical device looks at, read from the device by Query or filled in by hand */
+struct DeviceInfo {
+    std::string name;
+    VkPhysicalDeviceType type;
+    uint32_t vendorID;
+    uint32_t apiVersion;
+    /* the largest DEVICE_LOCAL heap */
+    VkDeviceSize localMemory;
+    std::vector<VkQueueFamilyProperties> queueFamilies;
+    /* per queue family, whether it can present to the surface */
+    std::vector<bool> present;
+    VkPhysicalDeviceFeatures features;
+    std::vector<std::string> extensions;
+    /* devices in its device group, 1 when it is not linked to any other */
+    uint32_t groupSize;
+
+    bool HasExtension(const char* name) const;
+};
+
+/* Chooses the physical device to render with. Every device gets a score from its type, the size
+ * of its local memory, its queue families and the optional features the renderer uses; devices
+ * that cannot draw (or present, with a window) are left out. Scoring only reads DeviceInfo, so
+ * it works the same on a list made up without any gpu.
+ */
+class DevicePicker {
+public:
+    /* surface is VK_NULL_HANDLE when headless */
+    static DeviceInfo Query(VkPhysicalDevice device, VkSurfaceKHR surface);
+
+    /* higher is better, -1 if the device cannot be used, and then why in reason */
+    static int64_t Score(const DeviceInfo& info, bool headless, std::string& reason);
+    /* The index of the device to use, or -1 if there is none. A non empty choice is either an
+     * index into devices or part of a device name (any case), and wins over the scores as long
+     * as that device is usable.
+     */
+    static int Pick(const std::vector<DeviceInfo>& devices, bool headless, const std::string& choice);
+    /* one line per device with its score, picked is marked */
+    static void Print(const std::vector<DeviceInfo>& devices, bool headless, int picked);
+};
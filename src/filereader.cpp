@@ -1,5 +1,96 @@
-#pragma once
 #include "filereader.hpp"
+#include "jobsystem.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#ifdef PLATFORM_WIN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+ByteSpan ByteSpan::Sub(size_t offset, size_t count) const {
+    offset = std::min(offset, size);
+    return ByteSpan{ data + offset, std::min(count, size - offset) };
+}
+
+MappedFile* MappedFile::Open(const std::string& path) {
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef PLATFORM_WIN
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER sz;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &sz)) {
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        std::cout << "cannot open " << path << "!" << std::endl;
+        return nullptr;
+    }
+    size = (size_t)sz.QuadPart;
+    if (size) {
+        //the view keeps the mapping and the file alive, so both handles can go right away
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        std::cout << "cannot open " << path << "!" << std::endl;
+        return nullptr;
+    }
+    size = (size_t)st.st_size;
+    if (size) {
+        void* ptr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        data = (ptr != MAP_FAILED) ? (const char*)ptr : nullptr;
+    }
+    close(fd);
+#endif
+    if (size && !data) {
+        std::cout << "cannot map " << path << "!" << std::endl;
+        return nullptr;
+    }
+
+    auto file = new MappedFile();
+    file->data = data;
+    file->size = size;
+    return file;
+}
+
+void MappedFile::Close(MappedFile* file) {
+    if (!file) return;
+    if (file->data) {
+#ifdef PLATFORM_WIN
+        UnmapViewOfFile(file->data);
+#else
+        munmap((void*)file->data, file->size);
+#endif
+    }
+    delete file;
+}
+
+ByteSpan MappedFile::Span() const {
+    return ByteSpan{ data, size };
+}
+
+ByteSpan MappedFile::Span(size_t offset, size_t count) const {
+    return Span().Sub(offset, count);
+}
+
+size_t MappedFile::Size() const {
+    return size;
+}
 
 std::vector<char> FileReader::ReadBytes(const std::string& path) {
     std::ifstream strm(path, std::ios::ate | std::ios::binary);
@@ -11,6 +102,138 @@ std::vector<char> FileReader::ReadBytes(const std::string& path) {
     strm.seekg(0);
     std::vector<char> res(sz);
     strm.read(res.data(), sz);
-    std::cout << "read " << sz << " bytes from " << path << std::endl;
     return res;
+}
+
+struct AsyncRead {
+    std::mutex mutex;
+    std::condition_variable cv;
+    uint32_t remaining;
 };
+
+static const size_t PAGE_STRIDE = 4096;
+//keeps the page reads from being optimized out
+static std::atomic<char> touchSink;
+
+//reads one byte per page, so the page faults happen on this thread instead of the consumer's
+static void TouchPages(ByteSpan span) {
+#ifndef PLATFORM_WIN
+    static const uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+    const auto begin = (uintptr_t)span.data & ~(pageSize - 1);
+    madvise((void*)begin, (uintptr_t)span.data + span.size - begin, MADV_WILLNEED);
+#endif
+    char c = 0;
+    for (size_t a = 0; a < span.size; a += PAGE_STRIDE) {
+        c ^= span.data[a];
+    }
+    if (span.size) c ^= span.data[span.size - 1];
+    touchSink.store(c, std::memory_order_relaxed);
+}
+
+AsyncRead* FileReader::ReadAsync(ByteSpan span, size_t chunkSize, const std::function<void(ByteSpan, size_t)>& fn) {
+    chunkSize = std::max(chunkSize, PAGE_STRIDE);
+    const auto chunks = (uint32_t)((span.size + chunkSize - 1) / chunkSize);
+    auto read = new AsyncRead();
+    read->remaining = chunks;
+    for (uint32_t a = 0; a < chunks; a++) {
+        const size_t offset = a * chunkSize;
+        JobSystem::SubmitIo([read, span, offset, chunkSize, fn]() {
+            const auto chunk = span.Sub(offset, chunkSize);
+            TouchPages(chunk);
+            if (fn) fn(chunk, offset);
+            std::lock_guard<std::mutex> lock(read->mutex);
+            if (--read->remaining == 0) read->cv.notify_all();
+        });
+    }
+    return read;
+}
+
+bool FileReader::IsDone(AsyncRead* read) {
+    std::lock_guard<std::mutex> lock(read->mutex);
+    return read->remaining == 0;
+}
+
+void FileReader::Finish(AsyncRead* read) {
+    {
+        std::unique_lock<std::mutex> lock(read->mutex);
+        read->cv.wait(lock, [read] { return read->remaining == 0; });
+    }
+    delete read;
+}
+
+typedef std::chrono::steady_clock IoClock;
+
+static double IoMsSince(IoClock::time_point t) {
+    return std::chrono::duration<double, std::milli>(IoClock::now() - t).count();
+}
+
+//stands in for a consumer that looks at every byte
+static uint64_t Checksum(ByteSpan span) {
+    uint64_t sum = 0;
+    size_t a = 0;
+    for (; a + 8 <= span.size; a += 8) {
+        uint64_t v;
+        memcpy(&v, span.data + a, 8);
+        sum += v;
+    }
+    for (; a < span.size; a++) sum += (uint8_t)span.data[a];
+    return sum;
+}
+
+static void PrintThroughput(const std::string& name, double ms, size_t bytes) {
+    std::cout << "  " << name << ": " << ms << "ms, " << (bytes / 1048576.0) / (ms / 1000) << "MB/s" << std::endl;
+}
+
+void FileReader::Benchmark(const std::string& path) {
+    const int REPEATS = 3;
+    const size_t CHUNK_SIZE = 4 << 20;
+
+    //the first read pulls the file into the page cache, the numbers below are all warm
+    const auto warm = ReadBytes(path);
+    if (warm.empty()) return;
+    const auto size = warm.size();
+    const auto expected = Checksum(ByteSpan{ warm.data(), warm.size() });
+    std::cout << "io benchmark: " << path << ", " << (size >> 10) << "KB, best of " << REPEATS << std::endl;
+
+    double best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        const auto t = IoClock::now();
+        const auto bytes = ReadBytes(path);
+        if (Checksum(ByteSpan{ bytes.data(), bytes.size() }) != expected) std::cout << "  checksum mismatch!" << std::endl;
+        best = std::min(best, IoMsSince(t));
+    }
+    PrintThroughput("ReadBytes", best, size);
+
+    const int OPENS = 100;
+    const auto openStart = IoClock::now();
+    for (int r = 0; r < OPENS; r++) {
+        MappedFile::Close(MappedFile::Open(path));
+    }
+    std::cout << "  map+unmap: " << IoMsSince(openStart) * 1000 / OPENS << "us" << std::endl;
+
+    //a fresh mapping every time, so the page faults are part of the measurement
+    best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        const auto t = IoClock::now();
+        auto file = MappedFile::Open(path);
+        if (Checksum(file->Span()) != expected) std::cout << "  checksum mismatch!" << std::endl;
+        MappedFile::Close(file);
+        best = std::min(best, IoMsSince(t));
+    }
+    PrintThroughput("mapped, 1 thread", best, size);
+
+    best = 1e30;
+    for (int r = 0; r < REPEATS; r++) {
+        const auto t = IoClock::now();
+        auto file = MappedFile::Open(path);
+        std::atomic<uint64_t> sum(0);
+        FileReader::Finish(ReadAsync(file->Span(), CHUNK_SIZE, [&sum](ByteSpan chunk, size_t) {
+            sum += Checksum(chunk);
+        }));
+        if (sum != expected) std::cout << "  checksum mismatch!" << std::endl;
+        MappedFile::Close(file);
+        best = std::min(best, IoMsSince(t));
+    }
+    PrintThroughput("mapped, async on " + std::to_string(JobSystem::IoThreadCount())
+        + " threads, " + std::to_string(CHUNK_SIZE >> 20) + "MB chunks", best, size);
+}
@@ -1,10 +1,54 @@
 #pragma once
 #include <iostream>
 #include <fstream>
+#include <functional>
 #include <vector>
 #include <string>
 
+/* a view into memory owned by someone else, usually a MappedFile */
+struct ByteSpan {
+    const char* data;
+    size_t size;
+
+    /* clamped to this span */
+    ByteSpan Sub(size_t offset, size_t count) const;
+};
+
+/* A read-only memory mapping of a whole file. Spans into it stay valid until Close,
+ * and pages are only read from disk when first touched.
+ */
+class MappedFile {
+public:
+    /* returns null if the file cannot be opened */
+    static MappedFile* Open(const std::string& path);
+    static void Close(MappedFile* file);
+
+    ByteSpan Span() const;
+    ByteSpan Span(size_t offset, size_t count) const;
+    size_t Size() const;
+
+private:
+    const char* data;
+    size_t size;
+};
+
+struct AsyncRead;
+
 class FileReader {
 public:
+    /* copies the whole file, prefer MappedFile for anything large */
     static std::vector<char> ReadBytes(const std::string& path);
+
+    /* Faults span in on the job system's io threads, chunkSize bytes per task, and calls
+     * fn(chunk, offset) for each chunk once its pages are resident. fn may be empty and runs on
+     * a background thread. Afterwards the span can be copied from without blocking on the disk,
+     * e.g. straight into the staging ring by the Uploader, as Texture does.
+     */
+    static AsyncRead* ReadAsync(ByteSpan span, size_t chunkSize, const std::function<void(ByteSpan, size_t)>& fn);
+    static bool IsDone(AsyncRead* read);
+    /* blocks until every chunk has been read, then frees read */
+    static void Finish(AsyncRead* read);
+
+    /* prints open and read throughput of ReadBytes, a mapping and ReadAsync on path */
+    static void Benchmark(const std::string& path);
 };
@@ -0,0 +1,121 @@
+#include "framestats.hpp"
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+typedef std::chrono::steady_clock Clock;
+
+static Clock::time_point startTime = Clock::now();
+static std::vector<double> cpuTimes;
+static std::vector<double> gpuTimes;
+static std::vector<double> recordTimes;
+static std::vector<double> latencies;
+
+void FrameStats::Reset() {
+    cpuTimes.clear();
+    gpuTimes.clear();
+    recordTimes.clear();
+    latencies.clear();
+    startTime = Clock::now();
+}
+
+void FrameStats::AddCpuTime(double ms) {
+    cpuTimes.push_back(ms);
+}
+
+void FrameStats::AddGpuTime(double ms) {
+    gpuTimes.push_back(ms);
+}
+
+void FrameStats::AddRecordTime(double ms) {
+    recordTimes.push_back(ms);
+}
+
+void FrameStats::AddLatency(double ms) {
+    latencies.push_back(ms);
+}
+
+static void PrintTimes(const char* name, std::vector<double> times) {
+    if (times.empty()) {
+        std::cout << "  " << name << ": n/a" << std::endl;
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (auto t : times) sum += t;
+    auto pct = [&](double p) {
+        return times[std::min((size_t)(p * times.size()), times.size() - 1)];
+    };
+    std::cout << "  " << name << " ms: mean " << sum / times.size()
+        << ", p50 " << pct(0.5) << ", p99 " << pct(0.99)
+        << ", max " << times.back() << std::endl;
+}
+
+//percentiles, then the share of frames in doubling buckets
+static void PrintHistogram(const char* name, std::vector<double> times) {
+    if (times.empty()) {
+        std::cout << "  " << name << ": n/a" << std::endl;
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    auto pct = [&](double p) {
+        return times[std::min((size_t)(p * times.size()), times.size() - 1)];
+    };
+    std::cout << "  " << name << " ms: p50 " << pct(0.5) << ", p90 " << pct(0.9) << ", p99 " << pct(0.99)
+        << ", p99.9 " << pct(0.999) << ", max " << times.back() << std::endl;
+
+    const uint32_t BUCKETS = 8;
+    size_t counts[BUCKETS] = {};
+    for (auto t : times) {
+        uint32_t b = 0;
+        for (double limit = 1; b < BUCKETS - 1 && t >= limit; limit *= 2) b++;
+        counts[b]++;
+    }
+    for (uint32_t b = 0; b < BUCKETS; b++) {
+        const double share = (double)counts[b] / times.size();
+        std::cout << "    " << ((b == BUCKETS - 1) ? ">=" : "< ") << (1 << std::min(b, BUCKETS - 2))
+            << "\t" << std::string((size_t)(share * 50 + 0.5), '#') << " " << share * 100 << "%" << std::endl;
+    }
+}
+
+void FrameStats::Report() {
+    const double secs = std::chrono::duration<double>(Clock::now() - startTime).count();
+    const auto frames = cpuTimes.size();
+    std::cout << "frames: " << frames << " in " << secs << "s ("
+        << (secs > 0 ? frames / secs : 0) << " fps)" << std::endl;
+    PrintTimes("cpu", cpuTimes);
+    PrintTimes("gpu", gpuTimes);
+    PrintTimes("record", recordTimes);
+    PrintHistogram("latency", latencies);
+}
+
+//mean, p50 and p99 as csv fields
+static void WriteTimes(std::ostream& out, std::vector<double> times) {
+    if (times.empty()) {
+        out << ",,,";
+        return;
+    }
+    std::sort(times.begin(), times.end());
+    double sum = 0;
+    for (auto t : times) sum += t;
+    auto pct = [&](double p) {
+        return times[std::min((size_t)(p * times.size()), times.size() - 1)];
+    };
+    out << "," << sum / times.size() << "," << pct(0.5) << "," << pct(0.99);
+}
+
+bool FrameStats::WriteCsv(const std::string& path, const std::string& test) {
+    const bool exists = std::ifstream(path).good();
+    std::ofstream out(path, std::ios::app);
+    if (!out) return false;
+    if (!exists) {
+        out << "test,frames,cpu mean,cpu p50,cpu p99,gpu mean,gpu p50,gpu p99,record mean,record p50,record p99" << std::endl;
+    }
+    out << test << "," << cpuTimes.size();
+    WriteTimes(out, cpuTimes);
+    WriteTimes(out, gpuTimes);
+    WriteTimes(out, recordTimes);
+    out << std::endl;
+    return out.good();
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <string>
+
+class FrameStats {
+public:
+    static void Reset();
+    static void AddCpuTime(double ms);
+    static void AddGpuTime(double ms);
+    static void AddRecordTime(double ms);
+    /* from sampling a frame's input until it is presented, or its gpu work ends without present wait */
+    static void AddLatency(double ms);
+    static void Report();
+    /* appends a row for test to a csv file, which gets a header when it is new */
+    static bool WriteCsv(const std::string& path, const std::string& test);
+};
@@ -0,0 +1,161 @@
+#include "framesync.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+static VkDevice syncDevice;
+static bool timeline;
+static VkSemaphore timelineSemaphore;
+//core in 1.2, the KHR entry points before that
+static PFN_vkWaitSemaphores waitSemaphores;
+static PFN_vkGetSemaphoreCounterValue getCounterValue;
+//without timelines, the fence of each frame in flight and the value it signals
+static std::vector<VkFence> fences;
+static std::vector<uint64_t> fenceValues;
+static uint64_t submitted;
+static uint64_t completed;
+
+void FrameSync::Init(VkDevice device, uint32_t framesInFlight, bool useTimeline) {
+    syncDevice = device;
+    timeline = useTimeline;
+    submitted = completed = 0;
+
+    if (timeline) {
+        waitSemaphores = (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(device, "vkWaitSemaphores");
+        getCounterValue = (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValue");
+        if (!waitSemaphores || !getCounterValue) {
+            waitSemaphores = (PFN_vkWaitSemaphores)vkGetDeviceProcAddr(device, "vkWaitSemaphoresKHR");
+            getCounterValue = (PFN_vkGetSemaphoreCounterValue)vkGetDeviceProcAddr(device, "vkGetSemaphoreCounterValueKHR");
+        }
+        VkSemaphoreTypeCreateInfo tinfo = {};
+        tinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        tinfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        tinfo.initialValue = 0;
+        VkSemaphoreCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        info.pNext = &tinfo;
+        VKDO(vkCreateSemaphore(device, &info, nullptr, &timelineSemaphore));
+    }
+    else {
+        fences.resize(framesInFlight);
+        fenceValues.assign(framesInFlight, 0);
+        VkFenceCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        for (auto& f : fences) {
+            VKDO(vkCreateFence(device, &info, nullptr, &f));
+        }
+    }
+    std::cout << "frame sync: " << (timeline ? "timeline semaphore" : "fences") << std::endl;
+}
+
+void FrameSync::Exit() {
+    Wait(submitted);
+    if (timeline) {
+        vkDestroySemaphore(syncDevice, timelineSemaphore, nullptr);
+    }
+    for (auto f : fences) {
+        vkDestroyFence(syncDevice, f, nullptr);
+    }
+    fences.clear();
+}
+
+bool FrameSync::IsTimeline() {
+    return timeline;
+}
+
+uint64_t FrameSync::NextValue() {
+    return submitted + 1;
+}
+
+uint64_t FrameSync::CompletedValue() {
+    if (timeline) {
+        uint64_t value;
+        VKDO(getCounterValue(syncDevice, timelineSemaphore, &value));
+        completed = std::max(completed, value);
+    }
+    else {
+        //one queue finishes in order, so any signaled fence covers everything before it
+        for (size_t a = 0; a < fences.size(); a++) {
+            if (fenceValues[a] > completed && vkGetFenceStatus(syncDevice, fences[a]) == VK_SUCCESS) {
+                completed = fenceValues[a];
+            }
+        }
+    }
+    return completed;
+}
+
+void FrameSync::Wait(uint64_t value) {
+    if (value <= completed) return;
+    if (value > submitted) {
+        std::cerr << "waiting for frame " << value << " which was never submitted!" << std::endl;
+        abort();
+    }
+    if (timeline) {
+        VkSemaphoreWaitInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        info.semaphoreCount = 1;
+        info.pSemaphores = &timelineSemaphore;
+        info.pValues = &value;
+        VKDO(waitSemaphores(syncDevice, &info, UINT64_MAX));
+    }
+    else {
+        //a fence is only reused after its value was waited for, so an unfinished value still has its fence
+        const auto slot = value % fences.size();
+        VKDO(vkWaitForFences(syncDevice, 1, &fences[slot], VK_TRUE, UINT64_MAX));
+    }
+    completed = value;
+}
+
+uint64_t FrameSync::Submit(VkQueue queue, const VkSubmitInfo& submitInfo, int32_t deviceIndex, const uint32_t* waitDevices) {
+    const uint64_t value = submitted + 1;
+    VkSubmitInfo info = submitInfo;
+    //device group indices for every semaphore and command buffer, one more signal for the timeline
+    std::vector<uint32_t> waitIndices, masks, signalIndices;
+    VkDeviceGroupSubmitInfo groupInfo = {};
+    if (deviceIndex >= 0) {
+        if (waitDevices) waitIndices.assign(waitDevices, waitDevices + info.waitSemaphoreCount);
+        else waitIndices.assign(info.waitSemaphoreCount, (uint32_t)deviceIndex);
+        masks.assign(info.commandBufferCount, 1u << deviceIndex);
+        signalIndices.assign(info.signalSemaphoreCount + (timeline ? 1 : 0), (uint32_t)deviceIndex);
+        groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+        groupInfo.pNext = info.pNext;
+        groupInfo.waitSemaphoreCount = (uint32_t)waitIndices.size();
+        groupInfo.pWaitSemaphoreDeviceIndices = waitIndices.data();
+        groupInfo.commandBufferCount = (uint32_t)masks.size();
+        groupInfo.pCommandBufferDeviceMasks = masks.data();
+        groupInfo.signalSemaphoreCount = (uint32_t)signalIndices.size();
+        groupInfo.pSignalSemaphoreDeviceIndices = signalIndices.data();
+        info.pNext = &groupInfo;
+    }
+
+    if (timeline) {
+        //the binary semaphores in the submit ignore their values
+        std::vector<VkSemaphore> signals(info.pSignalSemaphores, info.pSignalSemaphores + info.signalSemaphoreCount);
+        signals.push_back(timelineSemaphore);
+        std::vector<uint64_t> values(signals.size(), 0);
+        values.back() = value;
+
+        VkTimelineSemaphoreSubmitInfo tinfo = {};
+        tinfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        tinfo.pNext = info.pNext;
+        tinfo.signalSemaphoreValueCount = (uint32_t)values.size();
+        tinfo.pSignalSemaphoreValues = values.data();
+        VkSubmitInfo sinfo = info;
+        sinfo.pNext = &tinfo;
+        sinfo.signalSemaphoreCount = (uint32_t)signals.size();
+        sinfo.pSignalSemaphores = signals.data();
+        VKDO(vkQueueSubmit(queue, 1, &sinfo, VK_NULL_HANDLE));
+    }
+    else {
+        const auto slot = value % fences.size();
+        if (fenceValues[slot]) {
+            Wait(fenceValues[slot]);
+            VKDO(vkResetFences(syncDevice, 1, &fences[slot]));
+        }
+        VKDO(vkQueueSubmit(queue, 1, &info, fences[slot]));
+        fenceValues[slot] = value;
+    }
+    submitted = value;
+    return value;
+}
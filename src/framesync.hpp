@@ -0,0 +1,31 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+/* One counter for the frames submitted to the graphics queue, which the cpu can wait on and
+ * resources can be retired against. With timeline semaphores the gpu signals each frame's value
+ * itself. Without them every frame in flight keeps a fence and the value is read back from those.
+ * Only used from the thread that submits frames.
+ */
+class FrameSync {
+public:
+    /* timeline needs the timelineSemaphore feature enabled on the device */
+    static void Init(VkDevice device, uint32_t framesInFlight, bool timeline);
+    /* waits for every submitted frame */
+    static void Exit();
+    static bool IsTimeline();
+
+    /* the value the next Submit signals, values start at 1 */
+    static uint64_t NextValue();
+    /* the highest value the gpu has finished, without blocking */
+    static uint64_t CompletedValue();
+    /* blocks until the gpu has finished value, returns at once for values already seen */
+    static void Wait(uint64_t value);
+
+    /* Submits info and signals NextValue() once it has executed. Without timelines at most
+     * framesInFlight submits may be unfinished, the oldest is waited for otherwise.
+     * On a device made of a device group, deviceIndex is the physical device that runs the
+     * command buffers, waits and signals; -1 leaves the submit to the defaults. waitDevices, when
+     * given, has the device that runs each wait instead.
+     */
+    static uint64_t Submit(VkQueue queue, const VkSubmitInfo& info, int32_t deviceIndex = -1, const uint32_t* waitDevices = nullptr);
+};
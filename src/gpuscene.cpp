@@ -0,0 +1,270 @@
+#include "gpuscene.hpp"
+#include "allocator.hpp"
+#include "handles.hpp"
+#include "layouts.hpp"
+#include "mesh.hpp"
+#include "uploader.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <cstring>
+
+static const uint32_t CULL_GROUP_SIZE = 64;
+
+/* matches Command in cull.comp, the stride of the indirect draws */
+struct GpuCommand {
+    VkDrawIndexedIndirectCommand draw;
+    /* bounding radius of the mesh, scaled per instance */
+    float radius;
+    uint32_t pad[2];
+};
+
+struct CullConstants {
+    /* view planes in clip space, a point is inside when dot(xy, plane.xy) + plane.w >= 0 */
+    float planes[4][4];
+    uint32_t instanceCount;
+};
+
+struct GpuBatch {
+    SlotId mesh;
+    uint32_t first;
+    uint32_t count;
+};
+
+struct FrameBuffers {
+    VkBuffer commands;
+    Allocation* commandsAlloc;
+    VkBuffer counts;
+    Allocation* countsAlloc;
+    VkBuffer visible;
+    Allocation* visibleAlloc;
+    VkDescriptorSet set;
+};
+
+static VkDevice sceneDevice;
+static PFN_vkCmdDrawIndexedIndirectCountKHR drawIndexedIndirectCount;
+static VkDescriptorSetLayout setLayout;
+static VkPipelineLayout pipelineLayout;
+static VkDescriptorPool descriptorPool;
+static std::vector<FrameBuffers> frameBuffers;
+static VkBuffer instanceBuffer;
+static Allocation* instanceAlloc;
+static VkBuffer templateBuffer;
+static Allocation* templateAlloc;
+static const SlotPool<Mesh*>* meshPool;
+static std::vector<GpuBatch> batches;
+static std::vector<uint32_t> sharingFamilies;
+/* kept until the Uploader has read them */
+static std::vector<GpuInstance> instanceData;
+static std::vector<GpuCommand> templateData;
+static uint64_t uploadTicket;
+
+static Allocation* CreateSceneBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer* buffer) {
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage;
+    info.sharingMode = (sharingFamilies.size() > 1) ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    if (sharingFamilies.size() > 1) {
+        info.queueFamilyIndexCount = (uint32_t)sharingFamilies.size();
+        info.pQueueFamilyIndices = sharingFamilies.data();
+    }
+    return Allocator::CreateBuffer(info, MEMORY_USAGE_GPU_ONLY, buffer);
+}
+
+//frames in flight may still read them
+static void DestroySceneBuffers() {
+    if (batches.empty()) return;
+    for (auto& f : frameBuffers) {
+        DeletionQueue::RetireBuffer(f.commands, f.commandsAlloc);
+        DeletionQueue::RetireBuffer(f.counts, f.countsAlloc);
+        DeletionQueue::RetireBuffer(f.visible, f.visibleAlloc);
+    }
+    DeletionQueue::RetireBuffer(instanceBuffer, instanceAlloc);
+    DeletionQueue::RetireBuffer(templateBuffer, templateAlloc);
+    batches.clear();
+}
+
+void GpuScene::Init(VkDevice device, uint32_t frames, PFN_vkCmdDrawIndexedIndirectCountKHR drawCount,
+        const ShaderInfo& cull, const ShaderInfo& instanced, const std::vector<uint32_t>& families) {
+    sceneDevice = device;
+    sharingFamilies = families;
+    drawIndexedIndirectCount = drawCount;
+    frameBuffers.resize(frames);
+
+    //instances, visible list, commands, counts, as both shaders declare them
+    if (cull.pushConstantSize != sizeof(CullConstants)) {
+        std::cerr << "cull shader expects " << cull.pushConstantSize << " bytes of push constants, not "
+            << sizeof(CullConstants) << "!" << std::endl;
+        abort();
+    }
+    const ShaderInfo* stages[] = { &cull, &instanced };
+    pipelineLayout = Layouts::PipelineLayout(stages, 2);
+    setLayout = Layouts::SetLayoutOf(pipelineLayout, 0);
+
+    VkDescriptorPoolSize size = {};
+    size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    size.descriptorCount = 4 * frames;
+    VkDescriptorPoolCreateInfo dinfo = {};
+    dinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    dinfo.maxSets = frames;
+    dinfo.poolSizeCount = 1;
+    dinfo.pPoolSizes = &size;
+    VKDO(vkCreateDescriptorPool(device, &dinfo, nullptr, &descriptorPool));
+
+    std::vector<VkDescriptorSetLayout> layouts(frames, setLayout);
+    std::vector<VkDescriptorSet> sets(frames);
+    VkDescriptorSetAllocateInfo ainfo = {};
+    ainfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    ainfo.descriptorPool = descriptorPool;
+    ainfo.descriptorSetCount = frames;
+    ainfo.pSetLayouts = layouts.data();
+    VKDO(vkAllocateDescriptorSets(device, &ainfo, sets.data()));
+    for (uint32_t a = 0; a < frames; a++) {
+        frameBuffers[a].set = sets[a];
+    }
+}
+
+void GpuScene::Exit() {
+    DestroySceneBuffers();
+    vkDestroyDescriptorPool(sceneDevice, descriptorPool, nullptr);
+    frameBuffers.clear();
+}
+
+VkPipelineLayout GpuScene::PipelineLayout() {
+    return pipelineLayout;
+}
+
+void GpuScene::SetInstances(const SlotPool<Mesh*>& pool, const std::vector<SlotId>& meshes, const std::vector<GpuInstance>& instances) {
+    DestroySceneBuffers();
+    meshPool = &pool;
+    if (instances.empty()) return;
+
+    //sorted by mesh, so each mesh's visible instances get a contiguous range of the visible list
+    std::vector<uint32_t> batchOf(meshes.size(), UINT32_MAX);
+    for (auto& i : instances) {
+        if (batchOf[i.mesh] == UINT32_MAX) {
+            batchOf[i.mesh] = (uint32_t)batches.size();
+            batches.push_back(GpuBatch{ meshes[i.mesh], 0, 0 });
+        }
+        batches[batchOf[i.mesh]].count++;
+    }
+    uint32_t first = 0;
+    templateData.assign(batches.size(), GpuCommand());
+    for (size_t b = 0; b < batches.size(); b++) {
+        batches[b].first = first;
+        auto& c = templateData[b];
+        //a mesh that is gone already gets an empty command
+        const auto mesh = pool.Get(batches[b].mesh);
+        c.draw.indexCount = mesh ? (*mesh)->indexCount : 0;
+        c.draw.firstInstance = first;
+        c.radius = mesh ? (*mesh)->radius : 0;
+        first += batches[b].count;
+    }
+    //the uploaded copy holds the batch in place of the mesh index
+    instanceData.resize(instances.size());
+    std::vector<uint32_t> next(batches.size());
+    for (size_t b = 0; b < batches.size(); b++) next[b] = batches[b].first;
+    for (auto& i : instances) {
+        const auto b = batchOf[i.mesh];
+        auto& dst = instanceData[next[b]++];
+        dst = i;
+        dst.mesh = b;
+    }
+
+    const VkDeviceSize instanceSize = instanceData.size() * sizeof(GpuInstance);
+    const VkDeviceSize commandSize = templateData.size() * sizeof(GpuCommand);
+    instanceAlloc = CreateSceneBuffer(instanceSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+        | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &instanceBuffer);
+    templateAlloc = CreateSceneBuffer(commandSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+        | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &templateBuffer);
+    for (auto& f : frameBuffers) {
+        f.commandsAlloc = CreateSceneBuffer(commandSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &f.commands);
+        f.countsAlloc = CreateSceneBuffer(batches.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+            | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, &f.counts);
+        f.visibleAlloc = CreateSceneBuffer(instanceData.size() * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, &f.visible);
+
+        VkDescriptorBufferInfo infos[4] = {
+            { instanceBuffer, 0, VK_WHOLE_SIZE },
+            { f.visible, 0, VK_WHOLE_SIZE },
+            { f.commands, 0, VK_WHOLE_SIZE },
+            { f.counts, 0, VK_WHOLE_SIZE }
+        };
+        VkWriteDescriptorSet writes[4] = {};
+        for (uint32_t a = 0; a < 4; a++) {
+            writes[a].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[a].dstSet = f.set;
+            writes[a].dstBinding = a;
+            writes[a].descriptorCount = 1;
+            writes[a].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[a].pBufferInfo = &infos[a];
+        }
+        vkUpdateDescriptorSets(sceneDevice, 4, writes, 0, nullptr);
+    }
+
+    const bool concurrent = sharingFamilies.size() > 1;
+    Uploader::Upload(templateBuffer, 0, templateData.data(), commandSize,
+        VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT, concurrent);
+    uploadTicket = Uploader::Upload(instanceBuffer, 0, instanceData.data(), instanceSize,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT, concurrent);
+}
+
+uint32_t GpuScene::InstanceCount() {
+    return (uint32_t)instanceData.size();
+}
+
+static bool SceneReady() {
+    return !batches.empty() && Uploader::IsDone(uploadTicket);
+}
+
+void GpuScene::RecordCull(VkCommandBuffer cmd, uint32_t frame, VkPipeline cull) {
+    if (!SceneReady()) return;
+    auto& f = frameBuffers[frame];
+
+    //start from zero instances per command and no draws
+    VkBufferCopy region = {};
+    region.size = batches.size() * sizeof(GpuCommand);
+    vkCmdCopyBuffer(cmd, templateBuffer, f.commands, 1, &region);
+    vkCmdFillBuffer(cmd, f.counts, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+    CullConstants pc = {};
+    const float planes[4][4] = {
+        { 1, 0, 0, 1 }, { -1, 0, 0, 1 }, { 0, 1, 0, 1 }, { 0, -1, 0, 1 }
+    };
+    memcpy(pc.planes, planes, sizeof(planes));
+    pc.instanceCount = InstanceCount();
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, cull);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &f.set, 0, nullptr);
+    vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(pc), &pc);
+    vkCmdDispatch(cmd, (pc.instanceCount + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+}
+
+void GpuScene::RecordDraws(VkCommandBuffer cmd, uint32_t frame, VkPipeline pipeline) {
+    if (!SceneReady()) return;
+    auto& f = frameBuffers[frame];
+
+    vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+    vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &f.set, 0, nullptr);
+    for (uint32_t b = 0; b < batches.size(); b++) {
+        //removed meshes are skipped, the cull pass still counts their instances
+        const auto mesh = meshPool->Get(batches[b].mesh);
+        if (!mesh || !(*mesh)->ready) continue;
+        (*mesh)->Bind(cmd);
+        const VkDeviceSize offset = b * sizeof(GpuCommand);
+        if (drawIndexedIndirectCount) {
+            //the count is 0 when culling removed every instance, so not even an empty draw reaches the gpu
+            drawIndexedIndirectCount(cmd, f.commands, offset, f.counts, b * sizeof(uint32_t), 1, sizeof(GpuCommand));
+        }
+        else {
+            vkCmdDrawIndexedIndirect(cmd, f.commands, offset, 1, sizeof(GpuCommand));
+        }
+    }
+}
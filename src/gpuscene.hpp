@@ -0,0 +1,47 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "slotpool.hpp"
+#include "spirv.hpp"
+
+class Mesh;
+
+/* matches Instance in cull.comp and instanced.vert */
+struct GpuInstance {
+    float position[2];
+    float scale;
+    /* index into the mesh ids given to SetInstances */
+    uint32_t mesh;
+};
+
+/* Instances that are culled and drawn entirely on the gpu. Every frame a compute pass tests
+ * each instance against the view, appends the visible ones to a list and counts them into one
+ * VkDrawIndexedIndirectCommand per mesh, so the cpu records one dispatch and one indirect draw
+ * per mesh however many instances there are.
+ */
+class GpuScene {
+public:
+    /* drawCount is vkCmdDrawIndexedIndirectCount(KHR), or null to draw every mesh's command.
+     * cull and instanced are the reflected shaders, the pipeline layout is made from them.
+     * families are the queue families that use the buffers, including the Uploader's; with more
+     * than one the buffers are shared concurrently, so culling can run on an async compute queue.
+     */
+    static void Init(VkDevice device, uint32_t frames, PFN_vkCmdDrawIndexedIndirectCountKHR drawCount,
+        const ShaderInfo& cull, const ShaderInfo& instanced, const std::vector<uint32_t>& families);
+    static void Exit();
+
+    /* shared by the cull pipeline and the instanced graphics pipeline, owned by Layouts */
+    static VkPipelineLayout PipelineLayout();
+
+    /* Replaces the scene while the device is idle, the data arrives through the Uploader. The meshes
+     * are looked up in pool by id every frame, instances of meshes removed from it are not drawn.
+     */
+    static void SetInstances(const SlotPool<Mesh*>& pool, const std::vector<SlotId>& meshes, const std::vector<GpuInstance>& instances);
+    static uint32_t InstanceCount();
+
+    /* Call outside a render pass, before RecordDraws for the same frame. The buffers are written by
+     * a compute shader; the caller puts the barrier before the draws that read them.
+     */
+    static void RecordCull(VkCommandBuffer cmd, uint32_t frame, VkPipeline cull);
+    static void RecordDraws(VkCommandBuffer cmd, uint32_t frame, VkPipeline pipeline);
+};
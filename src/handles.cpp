@@ -0,0 +1,117 @@
+#include "handles.hpp"
+#include <iostream>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "allocator.hpp"
+#include "framesync.hpp"
+
+struct RetiredBatch {
+    /* the FrameSync value that has to finish first */
+    uint64_t value;
+    std::vector<std::function<void()>> functions;
+    std::vector<uint64_t> objects[HANDLE_KIND_COUNT];
+    std::vector<std::pair<VkBuffer, Allocation*>> buffers;
+    std::vector<std::pair<VkImage, Allocation*>> images;
+};
+
+static VkDevice delDevice;
+//oldest first, the back one collects what is retired until the next submit
+static std::deque<RetiredBatch> batches;
+//emptied batches, kept so their vectors do not allocate again
+static std::vector<RetiredBatch> spareBatches;
+static uint64_t retiredCount;
+static uint64_t batchCount;
+static uint32_t maxPending;
+
+template<class T>
+static T FromBits(uint64_t bits) {
+    T handle;
+    memcpy(&handle, &bits, sizeof(T));
+    return handle;
+}
+
+static RetiredBatch& CurrentBatch() {
+    const uint64_t value = DeletionQueue::RetireValue();
+    if (batches.empty() || batches.back().value != value) {
+        if (spareBatches.empty()) {
+            batches.emplace_back();
+        }
+        else {
+            batches.push_back(std::move(spareBatches.back()));
+            spareBatches.pop_back();
+        }
+        batches.back().value = value;
+        maxPending = std::max(maxPending, (uint32_t)batches.size());
+    }
+    retiredCount++;
+    return batches.back();
+}
+
+static void DestroyBatch(RetiredBatch& b) {
+    for (auto& f : b.functions) f();
+    for (auto h : b.objects[HANDLE_PIPELINE]) vkDestroyPipeline(delDevice, FromBits<VkPipeline>(h), nullptr);
+    for (auto h : b.objects[HANDLE_PIPELINE_CACHE]) vkDestroyPipelineCache(delDevice, FromBits<VkPipelineCache>(h), nullptr);
+    for (auto h : b.objects[HANDLE_IMAGE_VIEW]) vkDestroyImageView(delDevice, FromBits<VkImageView>(h), nullptr);
+    for (auto h : b.objects[HANDLE_SAMPLER]) vkDestroySampler(delDevice, FromBits<VkSampler>(h), nullptr);
+    for (auto h : b.objects[HANDLE_SWAPCHAIN]) vkDestroySwapchainKHR(delDevice, FromBits<VkSwapchainKHR>(h), nullptr);
+    for (auto h : b.objects[HANDLE_SEMAPHORE]) vkDestroySemaphore(delDevice, FromBits<VkSemaphore>(h), nullptr);
+    for (auto h : b.objects[HANDLE_FENCE]) vkDestroyFence(delDevice, FromBits<VkFence>(h), nullptr);
+    for (auto h : b.objects[HANDLE_QUERY_POOL]) vkDestroyQueryPool(delDevice, FromBits<VkQueryPool>(h), nullptr);
+    for (auto h : b.objects[HANDLE_DESCRIPTOR_POOL]) vkDestroyDescriptorPool(delDevice, FromBits<VkDescriptorPool>(h), nullptr);
+    for (auto h : b.objects[HANDLE_COMMAND_POOL]) vkDestroyCommandPool(delDevice, FromBits<VkCommandPool>(h), nullptr);
+    //views of these images went above
+    for (auto& p : b.buffers) Allocator::DestroyBuffer(p.first, p.second);
+    for (auto& p : b.images) Allocator::DestroyImage(p.first, p.second);
+
+    b.functions.clear();
+    for (auto& o : b.objects) o.clear();
+    b.buffers.clear();
+    b.images.clear();
+    batchCount++;
+}
+
+void DeletionQueue::Init(VkDevice device) {
+    delDevice = device;
+}
+
+void DeletionQueue::Exit() {
+    Collect(UINT64_MAX);
+    spareBatches.clear();
+}
+
+void DeletionQueue::RetireBits(HandleKind kind, uint64_t bits) {
+    CurrentBatch().objects[kind].push_back(bits);
+}
+
+void DeletionQueue::RetireBuffer(VkBuffer buffer, Allocation* alloc) {
+    CurrentBatch().buffers.push_back(std::make_pair(buffer, alloc));
+}
+
+void DeletionQueue::RetireImage(VkImage image, Allocation* alloc) {
+    CurrentBatch().images.push_back(std::make_pair(image, alloc));
+}
+
+void DeletionQueue::Defer(std::function<void()> fn) {
+    CurrentBatch().functions.push_back(std::move(fn));
+}
+
+uint64_t DeletionQueue::RetireValue() {
+    //the frame being recorded, whose submit closes the batch
+    return FrameSync::NextValue();
+}
+
+void DeletionQueue::Collect(uint64_t completed) {
+    while (!batches.empty() && batches.front().value <= completed) {
+        //out of the queue first, what its functions retire goes to a batch of its own
+        auto b = std::move(batches.front());
+        batches.pop_front();
+        DestroyBatch(b);
+        spareBatches.push_back(std::move(b));
+    }
+}
+
+void DeletionQueue::Report() {
+    std::cout << "deletion queue: " << retiredCount << " objects in " << batchCount << " batches, at most "
+        << maxPending << " batches waiting" << std::endl;
+}
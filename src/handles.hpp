@@ -0,0 +1,112 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+struct Allocation;
+
+/* the kinds of object DeletionQueue destroys, in the order a batch destroys them */
+enum HandleKind {
+    HANDLE_PIPELINE,
+    HANDLE_PIPELINE_CACHE,
+    HANDLE_IMAGE_VIEW,
+    HANDLE_SAMPLER,
+    HANDLE_SWAPCHAIN,
+    HANDLE_SEMAPHORE,
+    HANDLE_FENCE,
+    HANDLE_QUERY_POOL,
+    HANDLE_DESCRIPTOR_POOL,
+    HANDLE_COMMAND_POOL,
+    HANDLE_KIND_COUNT
+};
+
+/* Destroys objects once the frames that may still use them have finished, so they can be let go
+ * of at any time without waiting for the device. Everything retired between two submits forms
+ * one batch, which waits for the next submit as well: the frame being recorded may use an object
+ * too (an upload it waits for may still be writing it). A batch is destroyed kind by kind when
+ * that frame is done. Only used from the thread that submits frames.
+ */
+class DeletionQueue {
+public:
+    static void Init(VkDevice device);
+    /* destroys everything still queued, the device must be idle */
+    static void Exit();
+
+    /* destroyed once every frame submitted so far, and the next one, have finished */
+    template<class T>
+    static void Retire(HandleKind kind, T handle) {
+        uint64_t bits = 0;
+        memcpy(&bits, &handle, sizeof(T));
+        RetireBits(kind, bits);
+    }
+    /* the same for objects made with Allocator::CreateBuffer and CreateImage */
+    static void RetireBuffer(VkBuffer buffer, Allocation* alloc);
+    static void RetireImage(VkImage image, Allocation* alloc);
+    /* runs fn at the same time, before the objects of its batch are destroyed and in the order
+     * they were deferred */
+    static void Defer(std::function<void()> fn);
+    /* the FrameSync value that has to finish before what is retired now goes */
+    static uint64_t RetireValue();
+
+    /* destroys the batches whose frame is at most completed, call once per frame with
+     * FrameSync::CompletedValue() */
+    static void Collect(uint64_t completed);
+    static void Report();
+
+private:
+    static void RetireBits(HandleKind kind, uint64_t bits);
+};
+
+/* Owns one object, which goes to the DeletionQueue when the owner is reset, assigned another
+ * object or destroyed. Move only. Owners at file scope must be reset before the device goes.
+ */
+template<class T, HandleKind KIND>
+class Unique {
+public:
+    Unique() : handle(VK_NULL_HANDLE) {}
+    explicit Unique(T h) : handle(h) {}
+    Unique(Unique&& other) : handle(other.Release()) {}
+    Unique(const Unique&) = delete;
+    ~Unique() { Reset(); }
+
+    Unique& operator=(Unique&& other) {
+        if (this != &other) Reset(other.Release());
+        return *this;
+    }
+    Unique& operator=(const Unique&) = delete;
+
+    T Get() const { return handle; }
+    operator T() const { return handle; }
+    /* retires what is held and gives the slot to a vkCreate* function */
+    T* Put() {
+        Reset();
+        return &handle;
+    }
+    /* gives up ownership without destroying */
+    T Release() {
+        const T h = handle;
+        handle = VK_NULL_HANDLE;
+        return h;
+    }
+    void Reset(T h = VK_NULL_HANDLE) {
+        if (handle != VK_NULL_HANDLE) {
+            DeletionQueue::Retire(KIND, handle);
+        }
+        handle = h;
+    }
+
+private:
+    T handle;
+};
+
+typedef Unique<VkPipeline, HANDLE_PIPELINE> UniquePipeline;
+typedef Unique<VkPipelineCache, HANDLE_PIPELINE_CACHE> UniquePipelineCache;
+typedef Unique<VkImageView, HANDLE_IMAGE_VIEW> UniqueImageView;
+typedef Unique<VkSampler, HANDLE_SAMPLER> UniqueSampler;
+typedef Unique<VkSwapchainKHR, HANDLE_SWAPCHAIN> UniqueSwapchain;
+typedef Unique<VkSemaphore, HANDLE_SEMAPHORE> UniqueSemaphore;
+typedef Unique<VkFence, HANDLE_FENCE> UniqueFence;
+typedef Unique<VkQueryPool, HANDLE_QUERY_POOL> UniqueQueryPool;
+typedef Unique<VkDescriptorPool, HANDLE_DESCRIPTOR_POOL> UniqueDescriptorPool;
+typedef Unique<VkCommandPool, HANDLE_COMMAND_POOL> UniqueCommandPool;
@@ -0,0 +1,153 @@
+#include "imagediff.hpp"
+#include <algorithm>
+#include <cstdio>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define IMAGEDIFF_SSE2
+#endif
+
+//luma weights out of 256, so the weighted delta of a pixel stays within 0 to 255
+static const uint32_t WEIGHT_R = 77;
+static const uint32_t WEIGHT_G = 150;
+static const uint32_t WEIGHT_B = 29;
+
+struct DiffSums {
+    uint64_t failed;
+    uint64_t sum;
+    uint32_t max;
+};
+
+static inline uint32_t AbsDiff(uint8_t x, uint8_t y) {
+    return (x > y) ? x - y : y - x;
+}
+
+static void AccumulateScalar(const uint8_t* a, const uint8_t* b, size_t pixels, uint32_t tolerance, DiffSums& sums) {
+    for (size_t p = 0; p < pixels * 4; p += 4) {
+        const uint32_t delta = (WEIGHT_R * AbsDiff(a[p], b[p]) + WEIGHT_G * AbsDiff(a[p + 1], b[p + 1])
+            + WEIGHT_B * AbsDiff(a[p + 2], b[p + 2]) + 128) >> 8;
+        sums.failed += delta > tolerance;
+        sums.sum += delta;
+        sums.max = std::max(sums.max, delta);
+    }
+}
+
+static DiffResult Finish(const DiffSums& sums, size_t pixels) {
+    DiffResult res = {};
+    res.pixels = pixels;
+    res.failed = sums.failed;
+    res.maxDelta = sums.max;
+    res.meanDelta = pixels ? (double)sums.sum / pixels : 0;
+    return res;
+}
+
+DiffResult ImageDiff::CompareScalar(const uint8_t* a, const uint8_t* b, size_t pixels, uint32_t tolerance) {
+    DiffSums sums = {};
+    AccumulateScalar(a, b, pixels, tolerance, sums);
+    return Finish(sums, pixels);
+}
+
+DiffResult ImageDiff::Compare(const uint8_t* a, const uint8_t* b, size_t pixels, uint32_t tolerance) {
+#ifdef IMAGEDIFF_SSE2
+    DiffSums sums = {};
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i weights = _mm_setr_epi16(WEIGHT_R, WEIGHT_G, WEIGHT_B, 0, WEIGHT_R, WEIGHT_G, WEIGHT_B, 0);
+    const __m128i round = _mm_set1_epi32(128);
+    const __m128i tol = _mm_set1_epi32((int)std::min(tolerance, 255u));
+    //4 pixels per step, the 32 bit lane sums are moved out before they can wrap
+    const size_t CHUNK = 1 << 22;
+    size_t p = 0;
+    while (pixels - p >= 4) {
+        const size_t end = p + std::min((pixels - p) & ~(size_t)3, CHUNK);
+        __m128i failed = zero;
+        __m128i sum = zero;
+        __m128i max = zero;
+        for (; p < end; p += 4) {
+            const __m128i x = _mm_loadu_si128((const __m128i*)(a + p * 4));
+            const __m128i y = _mm_loadu_si128((const __m128i*)(b + p * 4));
+            const __m128i d = _mm_or_si128(_mm_subs_epu8(x, y), _mm_subs_epu8(y, x));
+            //r * wr + g * wg and b * wb for two pixels per half
+            const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi8(d, zero), weights);
+            const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi8(d, zero), weights);
+            const __m128i rg = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(2, 0, 2, 0)));
+            const __m128i bl = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(lo), _mm_castsi128_ps(hi), _MM_SHUFFLE(3, 1, 3, 1)));
+            const __m128i delta = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(rg, bl), round), 8);
+            //the compare gives -1 for failed pixels
+            failed = _mm_sub_epi32(failed, _mm_cmpgt_epi32(delta, tol));
+            sum = _mm_add_epi32(sum, delta);
+            //deltas fit in 16 bits with the upper half zero, so the 16 bit max works per lane
+            max = _mm_max_epi16(max, delta);
+        }
+        uint32_t lanes[3][4];
+        _mm_storeu_si128((__m128i*)lanes[0], failed);
+        _mm_storeu_si128((__m128i*)lanes[1], sum);
+        _mm_storeu_si128((__m128i*)lanes[2], max);
+        for (uint32_t l = 0; l < 4; l++) {
+            sums.failed += lanes[0][l];
+            sums.sum += lanes[1][l];
+            sums.max = std::max(sums.max, lanes[2][l]);
+        }
+    }
+    AccumulateScalar(a + p * 4, b + p * 4, pixels - p, tolerance, sums);
+    return Finish(sums, pixels);
+#else
+    return CompareScalar(a, b, pixels, tolerance);
+#endif
+}
+
+//skips whitespace and # comments between the header fields
+static bool ReadField(FILE* f, uint32_t& value) {
+    int c = fgetc(f);
+    while (c == '#' || c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) c = fgetc(f);
+        }
+        c = fgetc(f);
+    }
+    if (c < '0' || c > '9') return false;
+    value = 0;
+    while (c >= '0' && c <= '9') {
+        value = value * 10 + (c - '0');
+        c = fgetc(f);
+    }
+    //exactly one whitespace character ends the last field before the pixels
+    return c != EOF;
+}
+
+bool ImageDiff::LoadPpm(const std::string& path, std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    uint32_t maxValue = 0;
+    const bool header = fgetc(f) == 'P' && fgetc(f) == '6'
+        && ReadField(f, width) && ReadField(f, height) && ReadField(f, maxValue) && maxValue == 255;
+    std::vector<uint8_t> rgb;
+    if (header) {
+        rgb.resize((size_t)width * height * 3);
+    }
+    const bool ok = header && fread(rgb.data(), 1, rgb.size(), f) == rgb.size();
+    fclose(f);
+    if (!ok) return false;
+
+    rgba.resize((size_t)width * height * 4);
+    for (size_t a = 0; a < (size_t)width * height; a++) {
+        rgba[a * 4] = rgb[a * 3];
+        rgba[a * 4 + 1] = rgb[a * 3 + 1];
+        rgba[a * 4 + 2] = rgb[a * 3 + 2];
+        rgba[a * 4 + 3] = 255;
+    }
+    return true;
+}
+
+bool ImageDiff::SavePpm(const std::string& path, const uint8_t* rgba, uint32_t width, uint32_t height) {
+    std::vector<uint8_t> rgb((size_t)width * height * 3);
+    for (size_t a = 0; a < (size_t)width * height; a++) {
+        rgb[a * 3] = rgba[a * 4];
+        rgb[a * 3 + 1] = rgba[a * 4 + 1];
+        rgb[a * 3 + 2] = rgba[a * 4 + 2];
+    }
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "P6\n%u %u\n255\n", width, height);
+    const bool ok = fwrite(rgb.data(), 1, rgb.size(), f) == rgb.size();
+    return (fclose(f) == 0) && ok;
+}
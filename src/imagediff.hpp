@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct DiffResult {
+    uint64_t pixels;
+    /* pixels whose delta is above the tolerance */
+    uint64_t failed;
+    /* per pixel delta, 0 to 255 */
+    uint32_t maxDelta;
+    double meanDelta;
+};
+
+/* Compares rendered images against golden ones. The delta of a pixel is the luma weighted sum of
+ * its channel differences, so a change in green counts more than the same change in blue and small
+ * rounding differences between drivers stay below a tolerance of a few steps. Alpha is ignored.
+ */
+class ImageDiff {
+public:
+    /* a and b are RGBA8, pixels long */
+    static DiffResult Compare(const uint8_t* a, const uint8_t* b, size_t pixels, uint32_t tolerance);
+    /* the same without SIMD, which Compare falls back to on other cpus */
+    static DiffResult CompareScalar(const uint8_t* a, const uint8_t* b, size_t pixels, uint32_t tolerance);
+
+    /* binary PPM (P6) with 8 bit channels, loaded as RGBA8 with alpha 255 */
+    static bool LoadPpm(const std::string& path, std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height);
+    static bool SavePpm(const std::string& path, const uint8_t* rgba, uint32_t width, uint32_t height);
+};
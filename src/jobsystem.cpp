@@ -0,0 +1,159 @@
+#include "jobsystem.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+static std::vector<std::thread> workers;
+static std::mutex jobMutex;
+static std::condition_variable startCv;
+static std::condition_variable doneCv;
+static const std::function<void(uint32_t, uint32_t)>* job;
+static uint32_t jobCount;
+static uint32_t jobThreads;
+static std::atomic<uint32_t> nextIndex;
+static uint32_t busyWorkers;
+static uint64_t generation;
+static bool quit;
+
+//threads taking tasks in submission order
+struct TaskQueue {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> tasks;
+    bool quit;
+};
+static TaskQueue background;
+//disk reads, so they never wait behind pipeline compiles
+static TaskQueue io;
+
+static void RunJobs(uint32_t worker) {
+    uint32_t i;
+    while ((i = nextIndex++) < jobCount) {
+        (*job)(i, worker);
+    }
+}
+
+static void WorkerMain(uint32_t worker) {
+    uint64_t seen = 0;
+    std::unique_lock<std::mutex> lock(jobMutex);
+    for (;;) {
+        startCv.wait(lock, [&] { return quit || generation != seen; });
+        if (quit) return;
+        seen = generation;
+        const bool take = worker < jobThreads;
+        lock.unlock();
+        if (take) RunJobs(worker);
+        lock.lock();
+        if (--busyWorkers == 0) doneCv.notify_one();
+    }
+}
+
+static void TaskMain(TaskQueue* q) {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(q->mutex);
+            q->cv.wait(lock, [q] { return q->quit || !q->tasks.empty(); });
+            if (q->tasks.empty()) return;
+            task = std::move(q->tasks.front());
+            q->tasks.pop_front();
+        }
+        task();
+    }
+}
+
+static void StartTasks(TaskQueue& q, uint32_t threads) {
+    q.quit = false;
+    for (uint32_t a = 0; a < std::max(threads, 1u); a++) {
+        q.threads.push_back(std::thread(TaskMain, &q));
+    }
+}
+
+static void StopTasks(TaskQueue& q) {
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.quit = true;
+    }
+    q.cv.notify_all();
+    for (auto& t : q.threads) t.join();
+    q.threads.clear();
+}
+
+static void PushTask(TaskQueue& q, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.tasks.push_back(std::move(task));
+    }
+    q.cv.notify_one();
+}
+
+void JobSystem::Init(uint32_t threads, uint32_t backgroundThreads, uint32_t ioThreads) {
+    if (!threads) threads = std::max(std::thread::hardware_concurrency(), 1u);
+    quit = false;
+    for (uint32_t a = 1; a < threads; a++) {
+        workers.push_back(std::thread(WorkerMain, a));
+    }
+    StartTasks(background, backgroundThreads);
+    StartTasks(io, ioThreads);
+}
+
+void JobSystem::Exit() {
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        quit = true;
+    }
+    startCv.notify_all();
+    for (auto& t : workers) t.join();
+    workers.clear();
+
+    StopTasks(io);
+    StopTasks(background);
+}
+
+uint32_t JobSystem::ThreadCount() {
+    return (uint32_t)workers.size() + 1;
+}
+
+void JobSystem::ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn, uint32_t maxThreads) {
+    const uint32_t threads = maxThreads ? std::min(maxThreads, ThreadCount()) : ThreadCount();
+    if (threads <= 1 || count <= 1) {
+        for (uint32_t a = 0; a < count; a++) fn(a, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(jobMutex);
+        job = &fn;
+        jobCount = count;
+        jobThreads = threads;
+        nextIndex = 0;
+        busyWorkers = (uint32_t)workers.size();
+        generation++;
+    }
+    startCv.notify_all();
+    RunJobs(0);
+
+    std::unique_lock<std::mutex> lock(jobMutex);
+    doneCv.wait(lock, [] { return busyWorkers == 0; });
+}
+
+void JobSystem::Submit(std::function<void()> task) {
+    PushTask(background, std::move(task));
+}
+
+void JobSystem::SubmitIo(std::function<void()> task) {
+    PushTask(io, std::move(task));
+}
+
+uint32_t JobSystem::BackgroundThreadCount() {
+    return (uint32_t)background.threads.size();
+}
+
+uint32_t JobSystem::IoThreadCount() {
+    return (uint32_t)io.threads.size();
+}
@@ -0,0 +1,29 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+/* A fixed pool of worker threads. The calling thread takes part in every ParallelFor as worker 0.
+ * Background tasks run on a few separate threads, so blocking work never delays a ParallelFor. Disk
+ * reads have threads of their own, so they do not queue behind long background tasks such as
+ * pipeline compiles.
+ */
+class JobSystem {
+public:
+    /* threads includes the calling thread, 0 uses every hardware thread */
+    static void Init(uint32_t threads, uint32_t backgroundThreads = 2, uint32_t ioThreads = 2);
+    static void Exit();
+    static uint32_t ThreadCount();
+
+    /* runs fn(index, worker) for every index in [0, count) on at most maxThreads threads and
+     * returns when all of them are done. worker is stable for the duration of each call and
+     * below ThreadCount(), so it can index per-thread resources. Calls must not be nested.
+     */
+    static void ParallelFor(uint32_t count, const std::function<void(uint32_t, uint32_t)>& fn, uint32_t maxThreads = 0);
+
+    /* queues task for a background thread, tasks start in submission order. Exit runs the remaining ones first */
+    static void Submit(std::function<void()> task);
+    static uint32_t BackgroundThreadCount();
+    /* the same for a task that mostly waits for the disk */
+    static void SubmitIo(std::function<void()> task);
+    static uint32_t IoThreadCount();
+};
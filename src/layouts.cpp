@@ -0,0 +1,116 @@
+#include "layouts.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <map>
+
+static VkDevice layoutDevice;
+//keyed by binding, type, count and stages of every binding
+static std::map<std::vector<uint32_t>, VkDescriptorSetLayout> setLayouts;
+//keyed by the set layouts, then the push constant stages and size
+static std::map<std::vector<uint64_t>, VkPipelineLayout> pipelineLayouts;
+static std::map<VkPipelineLayout, std::vector<VkDescriptorSetLayout>> layoutSets;
+static uint32_t requests;
+
+void Layouts::Init(VkDevice device) {
+    layoutDevice = device;
+    requests = 0;
+}
+
+void Layouts::Exit() {
+    for (auto& p : pipelineLayouts) {
+        vkDestroyPipelineLayout(layoutDevice, p.second, nullptr);
+    }
+    for (auto& s : setLayouts) {
+        vkDestroyDescriptorSetLayout(layoutDevice, s.second, nullptr);
+    }
+    pipelineLayouts.clear();
+    setLayouts.clear();
+    layoutSets.clear();
+}
+
+VkDescriptorSetLayout Layouts::SetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings) {
+    std::vector<uint32_t> key;
+    for (auto& b : bindings) {
+        key.insert(key.end(), { b.binding, (uint32_t)b.descriptorType, b.descriptorCount, (uint32_t)b.stageFlags });
+    }
+    auto& layout = setLayouts[key];
+    if (!layout) {
+        VkDescriptorSetLayoutCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        info.bindingCount = (uint32_t)bindings.size();
+        info.pBindings = bindings.data();
+        VKDO(vkCreateDescriptorSetLayout(layoutDevice, &info, nullptr, &layout));
+    }
+    return layout;
+}
+
+VkPipelineLayout Layouts::PipelineLayout(const ShaderInfo* const* shaders, uint32_t count) {
+    requests++;
+    //[set] -> bindings in binding order, the reflected ones are sorted already
+    std::vector<std::vector<VkDescriptorSetLayoutBinding>> sets;
+    VkPushConstantRange range = {};
+    for (uint32_t s = 0; s < count; s++) {
+        const auto& shader = *shaders[s];
+        for (auto& b : shader.bindings) {
+            if (!b.count) {
+                std::cerr << "set " << b.set << " binding " << b.binding << " is a runtime array, which needs a layout of its own!" << std::endl;
+                abort();
+            }
+            if (sets.size() <= b.set) sets.resize(b.set + 1);
+            auto& bindings = sets[b.set];
+            auto it = bindings.begin();
+            while (it != bindings.end() && it->binding < b.binding) ++it;
+            if (it != bindings.end() && it->binding == b.binding) {
+                if (it->descriptorType != b.type || it->descriptorCount != b.count) {
+                    std::cerr << "set " << b.set << " binding " << b.binding << " differs between shader stages!" << std::endl;
+                    abort();
+                }
+                it->stageFlags |= shader.stage;
+                continue;
+            }
+            VkDescriptorSetLayoutBinding binding = {};
+            binding.binding = b.binding;
+            binding.descriptorType = b.type;
+            binding.descriptorCount = b.count;
+            binding.stageFlags = shader.stage;
+            bindings.insert(it, binding);
+        }
+        //blocks start at offset 0, so one range covers every stage's block
+        if (shader.pushConstantSize) {
+            range.stageFlags |= shader.stage;
+            range.size = std::max(range.size, shader.pushConstantSize);
+        }
+    }
+
+    std::vector<VkDescriptorSetLayout> handles;
+    std::vector<uint64_t> key;
+    for (auto& s : sets) {
+        handles.push_back(SetLayout(s));
+        key.push_back((uint64_t)handles.back());
+    }
+    key.push_back(range.stageFlags);
+    key.push_back(range.size);
+
+    auto& layout = pipelineLayouts[key];
+    if (!layout) {
+        VkPipelineLayoutCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        info.setLayoutCount = (uint32_t)handles.size();
+        info.pSetLayouts = handles.data();
+        info.pushConstantRangeCount = range.size ? 1 : 0;
+        info.pPushConstantRanges = &range;
+        VKDO(vkCreatePipelineLayout(layoutDevice, &info, nullptr, &layout));
+        layoutSets[layout] = handles;
+    }
+    return layout;
+}
+
+VkDescriptorSetLayout Layouts::SetLayoutOf(VkPipelineLayout layout, uint32_t set) {
+    return layoutSets.at(layout).at(set);
+}
+
+void Layouts::Report() {
+    std::cout << "layouts: " << requests << " pipeline layouts requested, " << pipelineLayouts.size()
+        << " created with " << setLayouts.size() << " set layouts" << std::endl;
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+#include "spirv.hpp"
+
+/* Descriptor set and pipeline layouts built from the reflected interface of shaders, so they
+ * always match the GLSL. Equal layouts are only created once and live until Exit.
+ * Only used from the main thread.
+ */
+class Layouts {
+public:
+    static void Init(VkDevice device);
+    static void Exit();
+
+    /* the same bindings always give the same layout */
+    static VkDescriptorSetLayout SetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);
+    /* Merges the bindings and push constants of the shaders of one pipeline. Every set up to the
+     * highest one used gets a layout, empty or not. Aborts if the stages disagree about a binding,
+     * or on runtime arrays, which need the flags Bindless sets.
+     */
+    static VkPipelineLayout PipelineLayout(const ShaderInfo* const* shaders, uint32_t count);
+    /* set of a layout made by PipelineLayout, for allocating descriptor sets */
+    static VkDescriptorSetLayout SetLayoutOf(VkPipelineLayout layout, uint32_t set);
+
+    static void Report();
+};
@@ -0,0 +1,137 @@
+#include "lz4.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const size_t MIN_MATCH = 4;
+//the spec keeps the last 5 bytes as literals, and no match may start in the last 12
+static const size_t LAST_LITERALS = 5;
+static const size_t MF_LIMIT = 12;
+static const size_t MAX_OFFSET = 65535;
+static const uint32_t HASH_LOG = 16;
+
+static uint32_t Read32(const char* p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static uint32_t Hash(uint32_t v) {
+    return (v * 2654435761u) >> (32 - HASH_LOG);
+}
+
+//lengths of 15 and above continue in extra bytes of 255
+static bool WriteLength(size_t len, char*& op, const char* end) {
+    for (; len >= 255; len -= 255) {
+        if (op >= end) return false;
+        *op++ = (char)255;
+    }
+    if (op >= end) return false;
+    *op++ = (char)len;
+    return true;
+}
+
+static bool WriteSequence(const char* lit, size_t litLen, size_t offset, size_t matchLen, char*& op, const char* end) {
+    if (op >= end) return false;
+    char* token = op++;
+    *token = (char)((std::min<size_t>(litLen, 15) << 4));
+    if (litLen >= 15 && !WriteLength(litLen - 15, op, end)) return false;
+    if ((size_t)(end - op) < litLen) return false;
+    if (litLen) memcpy(op, lit, litLen);
+    op += litLen;
+    if (!matchLen) return true; //the last sequence has literals only
+
+    if (end - op < 2) return false;
+    *op++ = (char)(offset & 0xff);
+    *op++ = (char)(offset >> 8);
+    const size_t ml = matchLen - MIN_MATCH;
+    *token |= (char)std::min<size_t>(ml, 15);
+    return ml < 15 || WriteLength(ml - 15, op, end);
+}
+
+size_t Lz4::CompressBound(size_t size) {
+    return size + size / 255 + 16;
+}
+
+size_t Lz4::Compress(const char* src, size_t size, char* dst, size_t capacity) {
+    char* op = dst;
+    const char* end = dst + capacity;
+    size_t anchor = 0;
+
+    if (size > MF_LIMIT) {
+        //positions are stored plus one, so 0 marks an empty slot
+        std::vector<uint32_t> table(1u << HASH_LOG, 0);
+        size_t ip = 0;
+        while (ip + MF_LIMIT < size) {
+            const uint32_t seq = Read32(src + ip);
+            const uint32_t h = Hash(seq);
+            const size_t ref = table[h];
+            table[h] = (uint32_t)(ip + 1);
+            if (!ref || ip - (ref - 1) > MAX_OFFSET || Read32(src + ref - 1) != seq) {
+                //skip faster through data that does not compress
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            const size_t match = ref - 1;
+            size_t len = MIN_MATCH;
+            while (ip + len < size - LAST_LITERALS && src[match + len] == src[ip + len]) len++;
+
+            if (!WriteSequence(src + anchor, ip - anchor, ip - match, len, op, end)) return 0;
+            ip += len;
+            anchor = ip;
+            if (ip + MF_LIMIT < size) {
+                table[Hash(Read32(src + ip - 2))] = (uint32_t)(ip - 1);
+            }
+        }
+    }
+    if (!WriteSequence(src + anchor, size - anchor, 0, 0, op, end)) return 0;
+    return op - dst;
+}
+
+static bool ReadLength(size_t& len, const char*& ip, const char* end) {
+    uint8_t b;
+    do {
+        if (ip >= end) return false;
+        b = (uint8_t)*ip++;
+        len += b;
+    } while (b == 255);
+    return true;
+}
+
+bool Lz4::Decompress(const char* src, size_t srcSize, char* dst, size_t dstSize) {
+    const char* ip = src;
+    const char* ipEnd = src + srcSize;
+    char* op = dst;
+    char* opEnd = dst + dstSize;
+
+    while (ip < ipEnd) {
+        const uint8_t token = (uint8_t)*ip++;
+        size_t litLen = token >> 4;
+        if (litLen == 15 && !ReadLength(litLen, ip, ipEnd)) return false;
+        if ((size_t)(ipEnd - ip) < litLen || (size_t)(opEnd - op) < litLen) return false;
+        if (litLen) memcpy(op, ip, litLen);
+        ip += litLen;
+        op += litLen;
+        if (ip == ipEnd) break; //the last sequence ends after its literals
+
+        if (ipEnd - ip < 2) return false;
+        const size_t offset = (uint8_t)ip[0] | ((size_t)(uint8_t)ip[1] << 8);
+        ip += 2;
+        size_t len = token & 15;
+        if (len == 15 && !ReadLength(len, ip, ipEnd)) return false;
+        len += MIN_MATCH;
+        if (!offset || offset > (size_t)(op - dst) || (size_t)(opEnd - op) < len) return false;
+
+        const char* match = op - offset;
+        if (offset >= len) {
+            memcpy(op, match, len);
+            op += len;
+        }
+        else {
+            //overlapping copies repeat the last offset bytes
+            for (size_t a = 0; a < len; a++) *op++ = match[a];
+        }
+    }
+    return op == opEnd;
+}
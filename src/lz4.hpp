@@ -0,0 +1,12 @@
+#pragma once
+#include <cstddef>
+
+/* The LZ4 block format, without the frame format around it. */
+class Lz4 {
+public:
+    static size_t CompressBound(size_t size);
+    /* returns the compressed size, or 0 if it would not fit in capacity */
+    static size_t Compress(const char* src, size_t size, char* dst, size_t capacity);
+    /* returns false unless src decodes to exactly dstSize bytes; never reads or writes out of bounds */
+    static bool Decompress(const char* src, size_t srcSize, char* dst, size_t dstSize);
+};
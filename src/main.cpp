@@ -1,7 +1,17 @@
 #include <iostream>
 #include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <random>
 
 #include "vulkanapi.hpp"
+#include "framestats.hpp"
+#include "gpuscene.hpp"
+#include "imagediff.hpp"
+#include "jobsystem.hpp"
+#include "profiler.hpp"
+#include "transforms.hpp"
 
 void error_callback(int code, const char* description)
 {
@@ -25,28 +35,304 @@ void initWindow() {
     glfwSetErrorCallback(error_callback);
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 }
 
-int main() {
-    initWindow();
+Mesh* createTriangle() {
+    std::vector<Vertex> vertices = {
+        { { 0.0f, -0.5f }, { 1.0f, 0.0f, 0.0f } },
+        { { 0.5f, 0.5f }, { 0.0f, 1.0f, 0.0f } },
+        { { -0.5f, 0.5f }, { 1.0f, 1.0f, 0.0f } }
+    };
+    return Mesh::Create(vertices, { 0, 1, 2 });
+}
+
+//many small triangles on a grid covering the screen, to exercise streaming of large meshes
+Mesh* createGrid(uint32_t triangles) {
+    const auto side = (uint32_t)std::ceil(std::sqrt((double)triangles));
+    const float cell = 2.0f / side;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    vertices.reserve(triangles * 3);
+    indices.reserve(triangles * 3);
+    for (uint32_t a = 0; a < triangles; a++) {
+        const float x = -1 + (a % side) * cell;
+        const float y = -1 + (a / side) * cell;
+        const float c = (float)a / triangles;
+        const auto first = (uint32_t)vertices.size();
+        vertices.push_back({ { x + cell * 0.5f, y }, { c, 1 - c, 0.5f } });
+        vertices.push_back({ { x + cell, y + cell }, { c, 1 - c, 0.5f } });
+        vertices.push_back({ { x, y + cell }, { c, 1 - c, 0.5f } });
+        indices.push_back(first);
+        indices.push_back(first + 1);
+        indices.push_back(first + 2);
+    }
+    return Mesh::Create(std::move(vertices), std::move(indices));
+}
+
+//small copies of the triangle scattered past the edges of the screen, so culling has work to do
+std::vector<GpuInstance> createInstances(uint32_t count) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-1.5f, 1.5f);
+    std::uniform_real_distribution<float> scale(0.02f, 0.1f);
+    std::vector<GpuInstance> instances(count);
+    for (auto& i : instances) {
+        i.position[0] = pos(rng);
+        i.position[1] = pos(rng);
+        i.scale = scale(rng);
+        i.mesh = 0;
+    }
+    return instances;
+}
+
+//a root per 64 objects with 8 children that hold the rest, the roots spin so every frame recomputes the scene
+void createTransforms(uint32_t count) {
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> pos(-1.5f, 1.5f);
+    uint32_t root = Transforms::NONE, child = Transforms::NONE;
+    for (uint32_t a = 0; a < count; a++) {
+        const uint32_t parent = (a % 64 == 0) ? Transforms::NONE : (a % 8 == 1) ? root : child;
+        const auto position = (parent == Transforms::NONE) ? glm::vec3(0) : glm::vec3(pos(rng), pos(rng), 0);
+        const auto t = Transforms::Add(parent, position, glm::quat(), glm::vec3(0.5f), glm::vec3(0), glm::vec3(0.1f));
+        if (parent == Transforms::NONE) root = t;
+        else if (parent == root) child = t;
+    }
+}
+
+void spinTransforms(uint32_t frame) {
+    for (uint32_t a = 0; a < Transforms::Count(); a += 64) {
+        Transforms::SetLocal(a, glm::vec3(0), glm::angleAxis(frame * 0.01f, glm::vec3(0, 0, 1)), glm::vec3(1));
+    }
+}
+
+//every mesh goes while frames keep going, those still uploading once the uploader is done with them
+void removeMeshes() {
+    while (Vulkan::meshes.Size()) {
+        Vulkan::RemoveMesh(Vulkan::meshes.IdAt(0));
+    }
+    std::cout << "meshes removed" << std::endl;
+}
+
+//the last frame against the golden image at path, or written there with update
+bool checkGolden(const std::string& path, bool update, uint32_t tolerance, uint64_t maxFailed) {
+    std::vector<uint8_t> pixels;
+    uint32_t width, height;
+    Vulkan::ReadLastFrame(pixels, width, height);
+    if (update) {
+        if (!ImageDiff::SavePpm(path, pixels.data(), width, height)) {
+            std::cerr << "cannot write golden image " << path << "!" << std::endl;
+            return false;
+        }
+        std::cout << "golden image " << path << " written" << std::endl;
+        return true;
+    }
+
+    std::vector<uint8_t> golden;
+    uint32_t goldenWidth, goldenHeight;
+    if (!ImageDiff::LoadPpm(path, golden, goldenWidth, goldenHeight)) {
+        std::cerr << "cannot load golden image " << path << ", make it with --update-golden" << std::endl;
+        return false;
+    }
+    if (goldenWidth != width || goldenHeight != height) {
+        std::cerr << "golden image " << path << " is " << goldenWidth << "x" << goldenHeight
+            << ", the frame is " << width << "x" << height << std::endl;
+        return false;
+    }
+    const auto diff = ImageDiff::Compare(pixels.data(), golden.data(), (size_t)width * height, tolerance);
+    const bool passed = diff.failed <= maxFailed;
+    std::cout << "golden " << path << ": " << (passed ? "passed" : "FAILED") << ", " << diff.failed << " of "
+        << diff.pixels << " pixels differ by more than " << tolerance << ", max " << diff.maxDelta
+        << ", mean " << diff.meanDelta << std::endl;
+    //kept next to the golden image to look at
+    if (!passed) {
+        ImageDiff::SavePpm(path + ".actual.ppm", pixels.data(), width, height);
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    uint32_t frames = 1000;
+    uint32_t warmup = 30;
+    uint32_t draws = 1;
+    uint32_t benchRecordDraws = 0;
+    uint32_t threads = 0;
+    uint32_t streamTriangles = 0;
+    uint32_t instances = 0;
+    uint32_t transforms = 0;
+    uint32_t removeAfter = UINT32_MAX;
+    std::string tracePath;
+    std::string goldenPath;
+    std::string timingsPath;
+    std::vector<std::string> texturePaths;
+    bool updateGolden = false;
+    uint32_t tolerance = 2;
+    uint64_t maxFailed = 0;
+    for (int a = 1; a < argc; a++) {
+        const std::string arg = argv[a];
+        if (arg == "--headless") Vulkan::headless = true;
+        else if (arg == "--frames" && a + 1 < argc) frames = std::stoul(argv[++a]);
+        else if (arg == "--warmup" && a + 1 < argc) warmup = std::stoul(argv[++a]);
+        else if (arg == "--draws" && a + 1 < argc) draws = std::stoul(argv[++a]);
+        else if (arg == "--bench-record" && a + 1 < argc) benchRecordDraws = std::stoul(argv[++a]);
+        else if (arg == "--threads" && a + 1 < argc) threads = std::stoul(argv[++a]);
+        else if (arg == "--stream-mesh" && a + 1 < argc) streamTriangles = std::stoul(argv[++a]);
+        else if (arg == "--instances" && a + 1 < argc) instances = std::stoul(argv[++a]);
+        else if (arg == "--transforms" && a + 1 < argc) transforms = std::stoul(argv[++a]);
+        else if (arg == "--remove-meshes" && a + 1 < argc) removeAfter = std::stoul(argv[++a]);
+        else if (arg == "--trace" && a + 1 < argc) tracePath = argv[++a];
+        else if (arg == "--golden" && a + 1 < argc) goldenPath = argv[++a];
+        else if (arg == "--update-golden") updateGolden = true;
+        else if (arg == "--tolerance" && a + 1 < argc) tolerance = std::stoul(argv[++a]);
+        else if (arg == "--max-failed-pixels" && a + 1 < argc) maxFailed = std::stoull(argv[++a]);
+        else if (arg == "--timings" && a + 1 < argc) timingsPath = argv[++a];
+        else if (arg == "--texture" && a + 1 < argc) texturePaths.push_back(argv[++a]);
+        else if (arg == "--texture-budget" && a + 1 < argc) Vulkan::textureBudget = std::stoull(argv[++a]) << 20;
+        else if (arg == "--pacing" && a + 1 < argc) {
+            const std::string mode = argv[++a];
+            //one frame at a time with input sampled as late as possible, or as many frames as the gpu queues
+            if (mode == "low-latency") Vulkan::pacing = { 1, true, Vulkan::pacing.maxFps, Vulkan::pacing.presentMode };
+            else if (mode == "throughput") Vulkan::pacing = { 3, false, Vulkan::pacing.maxFps, Vulkan::pacing.presentMode };
+            else a = argc; //unknown, print usage
+        }
+        else if (arg == "--binary-sync") Vulkan::timelineSync = false;
+        else if (arg == "--no-async-compute") Vulkan::asyncCompute = false;
+        else if (arg == "--post-passes" && a + 1 < argc) Vulkan::postPasses = std::stoul(argv[++a]);
+        else if (arg == "--merge-subpasses") Vulkan::mergeSubpasses = true;
+        else if (arg == "--verbose") Vulkan::verbose = true;
+        else if (arg == "--device" && a + 1 < argc) Vulkan::deviceChoice = argv[++a];
+        else if (arg == "--list-devices") Vulkan::listDevices = true;
+        else if (arg == "--device-group") Vulkan::deviceGroup = true;
+        else if (arg == "--frames-in-flight" && a + 1 < argc) Vulkan::pacing.framesInFlight = std::stoul(argv[++a]);
+        else if (arg == "--fps" && a + 1 < argc) Vulkan::pacing.maxFps = std::stod(argv[++a]);
+        else if (arg == "--present-mode" && a + 1 < argc) {
+            const std::string mode = argv[++a];
+            if (mode == "fifo") Vulkan::pacing.presentMode = VK_PRESENT_MODE_FIFO_KHR;
+            else if (mode == "mailbox") Vulkan::pacing.presentMode = VK_PRESENT_MODE_MAILBOX_KHR;
+            else if (mode == "immediate") Vulkan::pacing.presentMode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+            else a = argc;
+        }
+        else a = argc;
+        if (a >= argc) {
+            std::cerr << "usage: hellovulkan [--headless] [--frames n] [--warmup n] [--draws n] [--threads n] [--stream-mesh triangles] [--instances n] [--transforms n] [--remove-meshes frames] [--bench-record draws] [--trace file]"
+                " [--golden file.ppm] [--update-golden] [--tolerance n] [--max-failed-pixels n] [--timings file.csv] [--texture file.ktx2|file.dds] [--texture-budget MB]"
+                " [--pacing low-latency|throughput] [--frames-in-flight n] [--fps n] [--present-mode fifo|mailbox|immediate] [--binary-sync] [--no-async-compute]"
+                " [--post-passes n] [--merge-subpasses] [--verbose]"
+                " [--device index|name] [--list-devices] [--device-group]" << std::endl;
+            return 1;
+        }
+    }
+
+    //golden images are compared offscreen, where the size and the readback are fixed
+    if (!goldenPath.empty()) {
+        Vulkan::headless = true;
+        Vulkan::readback = true;
+    }
+    if (!Vulkan::headless)
+        initWindow();
+    Vulkan::gpuDriven = instances > 0;
+    JobSystem::Init(threads);
     Vulkan::Init();
     Vulkan::CreateSurface();
     Vulkan::InitDevice();
     Vulkan::CreateSwapchain();
-    Vulkan::CreateRenderPass();
+    Vulkan::CreateFrameGraph();
     Vulkan::CreateGraphicsPipeline();
-    Vulkan::CreateFramebuffers();
     Vulkan::CreateCommandPool();
     Vulkan::CreateCommandBuffers();
     Vulkan::CreateSemaphores();
 
-    while (!glfwWindowShouldClose(Vulkan::window)) {
-        glfwPollEvents();
-        Vulkan::DrawFrame();
+    //the streamed grid is tinted red and opaque, its pipeline is compiled when it first shows up
+    Vulkan::materials = {
+        Material{ { 1, 1, 1, 1 }, BLEND_ALPHA, false },
+        Material{ { 1, 0.4f, 0.4f, 1 }, BLEND_OPAQUE, true }
+    };
+    Vulkan::CreateMaterials();
+    const auto triangle = Vulkan::meshes.Add(createTriangle());
+    //level changes are recorded into the frame, which only runs on one device of a group
+    if (Vulkan::deviceGroup && !texturePaths.empty()) {
+        std::cout << "textures are not streamed with a device group, skipping them" << std::endl;
+        texturePaths.clear();
+    }
+    for (auto& path : texturePaths) {
+        //streamed in over the next frames, coarsest levels first
+        if (auto t = Texture::Load(path)) Vulkan::textures.push_back(t);
+    }
+    Vulkan::drawItems.assign(draws, DrawItem{ triangle, 3, 1, 0, 0, 0, 0 });
+    if (streamTriangles) {
+        //drawn once it has arrived, the frames in between keep going
+        const auto grid = Vulkan::meshes.Add(createGrid(streamTriangles));
+        Vulkan::drawItems.push_back(DrawItem{ grid, streamTriangles * 3, 1, 0, 0, 0, 1 });
+    }
+    if (Vulkan::gpuDriven) {
+        //every instance is a triangle
+        GpuScene::SetInstances(Vulkan::meshes, { triangle }, createInstances(instances));
+    }
+    if (transforms) {
+        Transforms::Init(Vulkan::pacing.framesInFlight, transforms);
+        createTransforms(transforms);
+    }
+
+    if (benchRecordDraws) {
+        //draws of meshes still uploading are skipped, which would make the numbers meaningless
+        while (!(*Vulkan::meshes.Get(triangle))->ready) {
+            Vulkan::DrawFrame();
+        }
+        for (uint32_t n = 1; n <= benchRecordDraws; n *= 10) {
+            Vulkan::BenchRecord(n, 1, 200);
+        }
+        //scaling curve over thread counts for the largest scene
+        for (uint32_t t = 1; ; t = std::min(t * 2, JobSystem::ThreadCount())) {
+            Vulkan::BenchRecord(benchRecordDraws, t, 200);
+            if (t == JobSystem::ThreadCount()) break;
+        }
+    }
+
+    if (!tracePath.empty()) {
+        Profiler::EnableTrace();
+    }
+    if (Vulkan::headless) {
+        for (uint32_t a = 0; a < warmup; a++) {
+            Vulkan::DrawFrame();
+        }
+        //the timed frames then all draw the complete scene, the last of them is compared
+        if (!goldenPath.empty()) {
+            Vulkan::DrawSettledFrame();
+        }
+        FrameStats::Reset();
+        for (uint32_t a = 0; a < frames; a++) {
+            if (a == removeAfter) removeMeshes();
+            spinTransforms(a);
+            Vulkan::DrawFrame();
+        }
+    }
+    else {
+        FrameStats::Reset();
+        //DrawFrame polls events itself, when the pacing mode wants input sampled
+        for (uint32_t a = 0; !glfwWindowShouldClose(Vulkan::window); a++) {
+            if (a == removeAfter) removeMeshes();
+            spinTransforms(a);
+            Vulkan::DrawFrame();
+        }
+    }
+    FrameStats::Report();
+    bool passed = true;
+    if (!goldenPath.empty()) {
+        passed = checkGolden(goldenPath, updateGolden, tolerance, maxFailed);
+    }
+    if (!timingsPath.empty() && !FrameStats::WriteCsv(timingsPath, goldenPath.empty() ? "run" : goldenPath)) {
+        std::cerr << "cannot write timings to " << timingsPath << "!" << std::endl;
     }
 
     Vulkan::Exit();
-    glfwDestroyWindow(Vulkan::window);
-    glfwTerminate();
+    //the results outlive Vulkan::Exit
+    Profiler::Report();
+    if (!tracePath.empty()) {
+        Profiler::WriteTrace(tracePath);
+    }
+    JobSystem::Exit();
+    if (!Vulkan::headless) {
+        glfwDestroyWindow(Vulkan::window);
+        glfwTerminate();
+    }
+    return passed ? 0 : 1;
 }
\ No newline at end of file
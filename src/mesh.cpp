@@ -0,0 +1,79 @@
+#include "mesh.hpp"
+#include "allocator.hpp"
+#include "handles.hpp"
+#include "uploader.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+VkPipelineVertexInputStateCreateInfo VertexLayout::CreateInfo() const {
+    VkPipelineVertexInputStateCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    info.vertexBindingDescriptionCount = (uint32_t)bindings.size();
+    info.pVertexBindingDescriptions = bindings.data();
+    info.vertexAttributeDescriptionCount = (uint32_t)attributes.size();
+    info.pVertexAttributeDescriptions = attributes.data();
+    return info;
+}
+
+VertexLayout Vertex::Layout() {
+    VertexLayout layout;
+    layout.bindings.push_back({ 0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX });
+    layout.attributes.push_back({ 0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof(Vertex, pos) });
+    layout.attributes.push_back({ 1, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(Vertex, color) });
+    return layout;
+}
+
+static Allocation* CreateDeviceBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer* buffer) {
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    return Allocator::CreateBuffer(info, MEMORY_USAGE_GPU_ONLY, buffer);
+}
+
+Mesh* Mesh::Create(std::vector<Vertex> vertices, std::vector<uint32_t> indices) {
+    auto mesh = new Mesh();
+    mesh->ready = false;
+    mesh->indexCount = (uint32_t)indices.size();
+    mesh->radius = 0;
+    for (auto& v : vertices) {
+        mesh->radius = std::max(mesh->radius, std::sqrt(v.pos[0] * v.pos[0] + v.pos[1] * v.pos[1]));
+    }
+    mesh->vertices.swap(vertices);
+    mesh->indices.swap(indices);
+
+    const VkDeviceSize vsize = mesh->vertices.size() * sizeof(Vertex);
+    const VkDeviceSize isize = mesh->indices.size() * sizeof(uint32_t);
+    mesh->bytes = vsize + isize;
+    mesh->vertexAlloc = CreateDeviceBuffer(vsize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &mesh->vertexBuffer);
+    mesh->indexAlloc = CreateDeviceBuffer(isize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &mesh->indexBuffer);
+
+    Uploader::Upload(mesh->vertexBuffer, 0, mesh->vertices.data(), vsize,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    //uploads finish in order, so the index buffer's ticket covers both
+    mesh->ticket = Uploader::Upload(mesh->indexBuffer, 0, mesh->indices.data(), isize,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+    return mesh;
+}
+
+void Mesh::Destroy(Mesh* mesh) {
+    DeletionQueue::RetireBuffer(mesh->vertexBuffer, mesh->vertexAlloc);
+    DeletionQueue::RetireBuffer(mesh->indexBuffer, mesh->indexAlloc);
+    delete mesh;
+}
+
+bool Mesh::Update() {
+    if (ready || !Uploader::IsDone(ticket)) return false;
+    ready = true;
+    std::vector<Vertex>().swap(vertices);
+    std::vector<uint32_t>().swap(indices);
+    return true;
+}
+
+void Mesh::Bind(VkCommandBuffer cmd) const {
+    const VkDeviceSize offset = 0;
+    vkCmdBindVertexBuffers(cmd, 0, 1, &vertexBuffer, &offset);
+    vkCmdBindIndexBuffer(cmd, indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+}
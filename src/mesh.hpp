@@ -0,0 +1,50 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <vector>
+
+struct Allocation;
+
+struct VertexLayout {
+    std::vector<VkVertexInputBindingDescription> bindings;
+    std::vector<VkVertexInputAttributeDescription> attributes;
+
+    /* points into this layout, which must outlive the pipeline creation */
+    VkPipelineVertexInputStateCreateInfo CreateInfo() const;
+};
+
+struct Vertex {
+    float pos[2];
+    float color[3];
+
+    static VertexLayout Layout();
+};
+
+/* Device local vertex and index buffers. The contents arrive through the Uploader over the
+ * following frames; the cpu copies are kept until then and the mesh must not be drawn before.
+ */
+class Mesh {
+public:
+    static Mesh* Create(std::vector<Vertex> vertices, std::vector<uint32_t> indices);
+    /* the upload must be done (or the Uploader gone), the buffers go once the frames submitted
+     * so far and the one being recorded, which waits for the upload, have finished */
+    static void Destroy(Mesh* mesh);
+
+    /* call once per frame after Uploader::Flush, returns true on the frame the mesh becomes ready */
+    bool Update();
+    void Bind(VkCommandBuffer cmd) const;
+
+    bool ready;
+    uint32_t indexCount;
+    /* distance of the furthest vertex from the origin */
+    float radius;
+    VkDeviceSize bytes;
+
+private:
+    Allocation* vertexAlloc;
+    Allocation* indexAlloc;
+    VkBuffer vertexBuffer;
+    VkBuffer indexBuffer;
+    uint64_t ticket;
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+};
@@ -0,0 +1,28 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "assetpack.hpp"
+#include "jobsystem.hpp"
+
+//offline tool: hvpack [--store] out.pack files...
+int main(int argc, char** argv) {
+    bool compress = true;
+    std::string out;
+    std::vector<std::string> files;
+    for (int a = 1; a < argc; a++) {
+        const std::string arg = argv[a];
+        if (arg == "--store") compress = false;
+        else if (out.empty()) out = arg;
+        else files.push_back(arg);
+    }
+    if (out.empty() || files.empty()) {
+        std::cerr << "usage: hvpack [--store] out.pack files..." << std::endl;
+        return 1;
+    }
+
+    JobSystem::Init(0);
+    const bool ok = AssetPack::Write(out, files, compress);
+    JobSystem::Exit();
+    return ok ? 0 : 1;
+}
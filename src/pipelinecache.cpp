@@ -0,0 +1,194 @@
+#include "pipelinecache.hpp"
+#include "filereader.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#ifdef PLATFORM_WIN
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+static const uint32_t FILE_MAGIC = 0x43505648; //"HVPC"
+static const uint32_t FILE_VERSION = 2;
+
+//prepended to the driver's blob, so stale files are rejected before they reach the driver
+struct CacheFileHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    //zero on devices before 1.1, which cannot report it
+    uint8_t driverUUID[VK_UUID_SIZE];
+    uint64_t dataSize;
+    uint64_t checksum;
+};
+
+static uint64_t Fnv1a(const char* data, size_t size) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t a = 0; a < size; a++) {
+        h ^= (uint8_t)data[a];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+//the driver uuid changes with driver builds that keep the version number
+static CacheFileHeader MakeHeader(VkPhysicalDevice physDevice) {
+    VkPhysicalDeviceIDProperties idProps = {};
+    idProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+    VkPhysicalDeviceProperties2 props2 = {};
+    props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    vkGetPhysicalDeviceProperties(physDevice, &props2.properties);
+    if (props2.properties.apiVersion >= VK_API_VERSION_1_1) {
+        props2.pNext = &idProps;
+        vkGetPhysicalDeviceProperties2(physDevice, &props2);
+    }
+    const auto& props = props2.properties;
+
+    CacheFileHeader hd = {};
+    hd.magic = FILE_MAGIC;
+    hd.version = FILE_VERSION;
+    hd.vendorID = props.vendorID;
+    hd.deviceID = props.deviceID;
+    hd.driverVersion = props.driverVersion;
+    memcpy(hd.pipelineCacheUUID, props.pipelineCacheUUID, VK_UUID_SIZE);
+    memcpy(hd.driverUUID, idProps.driverUUID, VK_UUID_SIZE);
+    return hd;
+}
+
+static const char* Validate(ByteSpan file, const CacheFileHeader& expected) {
+    if (file.size < sizeof(CacheFileHeader)) return "file too small";
+    CacheFileHeader hd;
+    memcpy(&hd, file.data, sizeof(hd));
+    if (hd.magic != FILE_MAGIC || hd.version != FILE_VERSION) return "bad magic or version";
+    if (hd.vendorID != expected.vendorID || hd.deviceID != expected.deviceID) return "different device";
+    if (hd.driverVersion != expected.driverVersion) return "different driver version";
+    if (memcmp(hd.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE)) return "different cache uuid";
+    if (memcmp(hd.driverUUID, expected.driverUUID, VK_UUID_SIZE)) return "different driver uuid";
+    if (hd.dataSize != file.size - sizeof(CacheFileHeader)) return "size mismatch";
+    const char* data = file.data + sizeof(CacheFileHeader);
+    if (hd.checksum != Fnv1a(data, hd.dataSize)) return "checksum mismatch";
+
+    //the driver's own header must agree as well
+    VkPipelineCacheHeaderVersionOne vkhd;
+    if (hd.dataSize < sizeof(vkhd)) return "driver header too small";
+    memcpy(&vkhd, data, sizeof(vkhd));
+    if (vkhd.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return "bad driver header version";
+    if (vkhd.vendorID != expected.vendorID || vkhd.deviceID != expected.deviceID
+            || memcmp(vkhd.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE)) {
+        return "driver header mismatch";
+    }
+    return nullptr;
+}
+
+struct CacheStats {
+    uint32_t count;
+    double ms;
+};
+static CacheStats hits, misses, unknown;
+static bool warm;
+//pipelines are also compiled on background threads
+static std::mutex statsMutex;
+
+bool PipelineCache::verbose = false;
+
+VkPipelineCache PipelineCache::Load(VkPhysicalDevice physDevice, VkDevice device, const std::string& path) {
+    auto file = MappedFile::Open(path);
+    const char* err = !file ? "no file" : Validate(file->Span(), MakeHeader(physDevice));
+    warm = !err;
+
+    VkPipelineCacheCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (warm) {
+        info.initialDataSize = file->Size() - sizeof(CacheFileHeader);
+        info.pInitialData = file->Span().data + sizeof(CacheFileHeader);
+        std::cout << "pipeline cache: loaded " << info.initialDataSize << " bytes" << std::endl;
+    }
+    else {
+        std::cout << "pipeline cache: starting empty (" << err << ")" << std::endl;
+    }
+
+    VkPipelineCache cache;
+    if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+        //the driver may still refuse data that passed our checks
+        std::cout << "pipeline cache: driver rejected data, starting empty" << std::endl;
+        info.initialDataSize = 0;
+        info.pInitialData = nullptr;
+        warm = false;
+        if (vkCreatePipelineCache(device, &info, nullptr, &cache) != VK_SUCCESS) {
+            std::cerr << "cannot create pipeline cache!" << std::endl;
+            abort();
+        }
+    }
+    MappedFile::Close(file);
+    return cache;
+}
+
+void PipelineCache::Save(VkPhysicalDevice physDevice, VkDevice device, VkPipelineCache cache, const std::string& path) {
+    size_t size = 0;
+    if (vkGetPipelineCacheData(device, cache, &size, nullptr) != VK_SUCCESS || !size) return;
+    std::vector<char> data(size);
+    if (vkGetPipelineCacheData(device, cache, &size, data.data()) != VK_SUCCESS) return;
+
+    auto hd = MakeHeader(physDevice);
+    hd.dataSize = size;
+    hd.checksum = Fnv1a(data.data(), size);
+
+    const auto tmpPath = path + ".tmp";
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        std::cout << "pipeline cache: cannot open " << tmpPath << std::endl;
+        return;
+    }
+    bool ok = fwrite(&hd, sizeof(hd), 1, f) == 1
+        && fwrite(data.data(), 1, size, f) == size
+        && fflush(f) == 0;
+#ifndef PLATFORM_WIN
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = (fclose(f) == 0) && ok;
+
+    //replace the old file in one step, readers see either the old or the new cache
+#ifdef PLATFORM_WIN
+    ok = ok && MoveFileExA(tmpPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    ok = ok && rename(tmpPath.c_str(), path.c_str()) == 0;
+#endif
+    if (!ok) {
+        std::cout << "pipeline cache: failed to write " << path << std::endl;
+        remove(tmpPath.c_str());
+        return;
+    }
+    std::cout << "pipeline cache: saved " << size << " bytes" << std::endl;
+}
+
+int PipelineCache::CacheHit(const VkPipelineCreationFeedbackEXT& feedback) {
+    if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) return -1;
+    return (feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) ? 1 : 0;
+}
+
+void PipelineCache::AddCreation(const char* name, double ms, int hit) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    auto& s = (hit == 1) ? hits : (hit == 0) ? misses : unknown;
+    s.count++;
+    s.ms += ms;
+    if (!verbose) return;
+    std::cout << "pipeline " << name << " created in " << ms << "ms ("
+        << ((hit == 1) ? "cache hit" : (hit == 0) ? "cache miss" : warm ? "warm cache" : "cold cache")
+        << ")" << std::endl;
+}
+
+void PipelineCache::Report() {
+    std::cout << "pipeline cache (" << (warm ? "warm" : "cold") << "): "
+        << hits.count << " hits " << hits.ms << "ms, "
+        << misses.count << " misses " << misses.ms << "ms";
+    if (unknown.count) {
+        std::cout << ", " << unknown.count << " unreported " << unknown.ms << "ms";
+    }
+    std::cout << std::endl;
+}
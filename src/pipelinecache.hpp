@@ -0,0 +1,20 @@
+#pragma once
+#include <string>
+#include <vulkan/vulkan.h>
+
+class PipelineCache {
+public:
+    /* creates a cache seeded from path, if the file was written by this device and driver */
+    static VkPipelineCache Load(VkPhysicalDevice physDevice, VkDevice device, const std::string& path);
+    /* writes to a temporary file first, so a crash never leaves a truncated cache behind */
+    static void Save(VkPhysicalDevice physDevice, VkDevice device, VkPipelineCache cache, const std::string& path);
+
+    /* 1 for a cache hit, 0 for a miss and -1 if the driver did not say */
+    static int CacheHit(const VkPipelineCreationFeedbackEXT& feedback);
+    /* hit: 1 = cache hit, 0 = miss, -1 = unknown (no creation feedback), safe from any thread */
+    static void AddCreation(const char* name, double ms, int hit);
+    static void Report();
+
+    /* AddCreation prints each pipeline, Report only prints the totals otherwise */
+    static bool verbose;
+};
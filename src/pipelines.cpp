@@ -0,0 +1,344 @@
+#include "pipelines.hpp"
+#include "jobsystem.hpp"
+#include "mesh.hpp"
+#include "pipelinecache.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+static_assert(sizeof(PipelineKey) == 32, "PipelineKey must not have padding");
+
+//lookups only lock the shard their key hashes to
+static const uint32_t SHARD_COUNT = 16;
+
+struct KeyHash {
+    size_t operator()(const PipelineKey& key) const {
+        auto data = (const uint8_t*)&key;
+        uint64_t h = 14695981039346656037ull;
+        for (size_t a = 0; a < sizeof(PipelineKey); a++) {
+            h ^= data[a];
+            h *= 1099511628211ull;
+        }
+        return (size_t)(h ^ (h >> 32));
+    }
+};
+
+struct KeyEqual {
+    bool operator()(const PipelineKey& a, const PipelineKey& b) const {
+        return !memcmp(&a, &b, sizeof(PipelineKey));
+    }
+};
+
+struct Entry {
+    VkPipeline pipeline;
+    //a compile has been started, by Get or on a background thread
+    bool compiling;
+};
+
+struct Shard {
+    std::mutex mutex;
+    //notified when a pipeline of this shard is done
+    std::condition_variable compiled;
+    std::unordered_map<PipelineKey, Entry, KeyHash, KeyEqual> map;
+};
+
+static VkDevice pipelineDevice;
+static VkPipelineCache pipelineCache;
+static bool creationFeedbackSupported;
+static VkShaderModule (*loadShader)(const std::string&, ShaderInfo&);
+static Shard shards[SHARD_COUNT];
+//only touched on the main thread and while it waits for recording threads
+static std::vector<std::string> shaderNames;
+static std::vector<VkShaderModule> shaderModules;
+static std::vector<ShaderInfo> shaderInfos;
+//background compiles not finished yet
+static std::mutex pendingMutex;
+static std::condition_variable pendingDone;
+static uint32_t pending;
+static std::atomic<uint32_t> syncCompiles, asyncCompiles, fallbacks;
+
+static Shard& ShardOf(const PipelineKey& key) {
+    return shards[KeyHash()(key) % SHARD_COUNT];
+}
+
+static std::string Name(const PipelineKey& key) {
+    static const char* blends[] = { "opaque", "alpha", "additive" };
+    return shaderNames[key.vertShader] + "+" + shaderNames[key.fragShader] + " " + blends[key.blend]
+        + ((key.cullMode == VK_CULL_MODE_NONE) ? " double sided" : "")
+        + (key.features ? " features " + std::to_string(key.features) : "");
+}
+
+//what Compile needs of a shader, copied so background compiles do not read the shader lists
+struct Stage {
+    VkShaderModule module;
+    std::vector<SpecConstant> specConstants;
+};
+
+static Stage StageOf(uint32_t shader) {
+    return Stage{ shaderModules[shader], shaderInfos[shader].specConstants };
+}
+
+//a 32 bit value per feature bit the shader declares, other constants keep their defaults
+struct Specialization {
+    std::vector<VkSpecializationMapEntry> entries;
+    std::vector<uint32_t> values;
+    VkSpecializationInfo info;
+
+    const VkSpecializationInfo* Build(const Stage& stage, uint32_t features) {
+        for (auto& c : stage.specConstants) {
+            if (c.id >= 32 || c.size != 4) continue;
+            entries.push_back(VkSpecializationMapEntry{ c.id, (uint32_t)(values.size() * 4), 4 });
+            values.push_back((features >> c.id) & 1);
+        }
+        info.mapEntryCount = (uint32_t)entries.size();
+        info.pMapEntries = entries.data();
+        info.dataSize = values.size() * 4;
+        info.pData = values.data();
+        return entries.empty() ? nullptr : &info;
+    }
+};
+
+//a mismatch would only show up as garbage on screen, or not at all on some drivers
+static void CheckVertexInput(const PipelineKey& key) {
+    const auto& inputs = shaderInfos[key.vertShader].inputs;
+    const auto layout = Vertex::Layout();
+    for (auto& i : inputs) {
+        bool found = false;
+        if (key.vertexInput == VERTEX_INPUT_MESH) {
+            for (auto& a : layout.attributes) {
+                found = found || (a.location == i.location && a.format == i.format);
+            }
+        }
+        if (!found) {
+            std::cerr << shaderNames[key.vertShader] << " reads location " << i.location
+                << " which the vertex input does not provide as format " << (int)i.format << "!" << std::endl;
+            abort();
+        }
+    }
+}
+
+static VkPipeline Compile(const PipelineKey& key, const Stage& vert, const Stage& frag, const std::string& name) {
+    VkPipelineShaderStageCreateInfo stages[2] = {};
+    Specialization specs[2];
+
+    auto& infov = stages[0];
+    infov.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    infov.stage = VK_SHADER_STAGE_VERTEX_BIT;
+    infov.module = vert.module;
+    infov.pName = "main";
+    infov.pSpecializationInfo = specs[0].Build(vert, key.features);
+
+    auto& infof = stages[1];
+    infof.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    infof.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    infof.module = frag.module;
+    infof.pName = "main";
+    infof.pSpecializationInfo = specs[1].Build(frag, key.features);
+
+    const auto vertexLayout = Vertex::Layout();
+    VkPipelineVertexInputStateCreateInfo inputInfo = {};
+    inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    if (key.vertexInput == VERTEX_INPUT_MESH) {
+        inputInfo = vertexLayout.CreateInfo();
+    }
+
+    VkPipelineInputAssemblyStateCreateInfo assemInfo = {};
+    assemInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    assemInfo.topology = (VkPrimitiveTopology)key.topology;
+    assemInfo.primitiveRestartEnable = VK_FALSE;
+
+    //set while recording, so the pipeline outlives swapchain resizes
+    VkPipelineViewportStateCreateInfo viewportInfo = {};
+    viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    viewportInfo.viewportCount = 1;
+    viewportInfo.scissorCount = 1;
+
+    VkPipelineRasterizationStateCreateInfo rastInfo = {};
+    rastInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    rastInfo.polygonMode = VK_POLYGON_MODE_FILL;
+    rastInfo.lineWidth = 1;
+    rastInfo.cullMode = key.cullMode;
+    rastInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
+
+    VkPipelineMultisampleStateCreateInfo msaaInfo = {};
+    msaaInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    msaaInfo.sampleShadingEnable = VK_FALSE;
+    msaaInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    msaaInfo.minSampleShading = 1;
+
+    VkPipelineColorBlendAttachmentState blendState = {};
+    blendState.colorWriteMask =
+        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    blendState.blendEnable = (key.blend != BLEND_OPAQUE) ? VK_TRUE : VK_FALSE;
+    blendState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+    blendState.dstColorBlendFactor = (key.blend == BLEND_ADDITIVE) ? VK_BLEND_FACTOR_ONE : VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+    blendState.colorBlendOp = VK_BLEND_OP_ADD;
+    blendState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    blendState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    blendState.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    VkPipelineColorBlendStateCreateInfo blendInfo = {};
+    blendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    blendInfo.logicOpEnable = VK_FALSE;
+    blendInfo.attachmentCount = 1;
+    blendInfo.pAttachments = &blendState;
+
+    const VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+    VkPipelineDynamicStateCreateInfo dynamicInfo = {};
+    dynamicInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    dynamicInfo.dynamicStateCount = 2;
+    dynamicInfo.pDynamicStates = dynamicStates;
+
+    VkGraphicsPipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineInfo.stageCount = 2;
+    pipelineInfo.pStages = stages;
+    pipelineInfo.pVertexInputState = &inputInfo;
+    pipelineInfo.pInputAssemblyState = &assemInfo;
+    pipelineInfo.pViewportState = &viewportInfo;
+    pipelineInfo.pRasterizationState = &rastInfo;
+    pipelineInfo.pMultisampleState = &msaaInfo;
+    pipelineInfo.pColorBlendState = &blendInfo;
+    pipelineInfo.pDynamicState = &dynamicInfo;
+    pipelineInfo.layout = key.layout;
+    pipelineInfo.renderPass = key.renderPass;
+    pipelineInfo.subpass = key.subpass;
+
+    VkPipelineCreationFeedbackEXT feedback = {};
+    VkPipelineCreationFeedbackEXT stageFeedback[2] = {};
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+    feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+    feedbackInfo.pPipelineCreationFeedback = &feedback;
+    feedbackInfo.pipelineStageCreationFeedbackCount = 2;
+    feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedback;
+    if (creationFeedbackSupported) {
+        pipelineInfo.pNext = &feedbackInfo;
+    }
+
+    //the cache is synchronized by the driver, so background threads share it
+    const auto t = std::chrono::steady_clock::now();
+    VkPipeline pipe;
+    VKDO(vkCreateGraphicsPipelines(pipelineDevice, pipelineCache, 1, &pipelineInfo, nullptr, &pipe));
+    const auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t).count();
+    PipelineCache::AddCreation(name.c_str(), ms, PipelineCache::CacheHit(feedback));
+    return pipe;
+}
+
+void Pipelines::Init(VkDevice device, VkPipelineCache cache, bool creationFeedback,
+        VkShaderModule (*load)(const std::string&, ShaderInfo&)) {
+    pipelineDevice = device;
+    pipelineCache = cache;
+    creationFeedbackSupported = creationFeedback;
+    loadShader = load;
+    pending = 0;
+    syncCompiles = asyncCompiles = fallbacks = 0;
+}
+
+void Pipelines::Exit() {
+    WaitIdle();
+    for (auto& s : shards) {
+        for (auto& e : s.map) {
+            vkDestroyPipeline(pipelineDevice, e.second.pipeline, nullptr);
+        }
+        s.map.clear();
+    }
+    for (auto m : shaderModules) {
+        vkDestroyShaderModule(pipelineDevice, m, nullptr);
+    }
+    shaderNames.clear();
+    shaderModules.clear();
+    shaderInfos.clear();
+}
+
+uint32_t Pipelines::Shader(const std::string& name) {
+    for (uint32_t a = 0; a < shaderNames.size(); a++) {
+        if (shaderNames[a] == name) return a;
+    }
+    ShaderInfo info;
+    shaderModules.push_back(loadShader(name, info));
+    shaderNames.push_back(name);
+    shaderInfos.push_back(info);
+    if (shaderNames.size() > UINT16_MAX) {
+        std::cerr << "too many shaders for PipelineKey!" << std::endl;
+        abort();
+    }
+    return (uint32_t)shaderNames.size() - 1;
+}
+
+VkShaderModule Pipelines::Module(uint32_t shader) {
+    return shaderModules[shader];
+}
+
+const ShaderInfo& Pipelines::Info(uint32_t shader) {
+    return shaderInfos[shader];
+}
+
+VkPipeline Pipelines::Get(const PipelineKey& key) {
+    auto& shard = ShardOf(key);
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    auto& entry = shard.map[key];
+    if (!entry.compiling) {
+        entry.compiling = true;
+        lock.unlock();
+        CheckVertexInput(key);
+        const auto pipe = Compile(key, StageOf(key.vertShader), StageOf(key.fragShader), Name(key));
+        syncCompiles++;
+        lock.lock();
+        //the map may have rehashed while unlocked
+        shard.map[key].pipeline = pipe;
+        shard.compiled.notify_all();
+        return pipe;
+    }
+    shard.compiled.wait(lock, [&]() { return shard.map[key].pipeline != VK_NULL_HANDLE; });
+    return shard.map[key].pipeline;
+}
+
+VkPipeline Pipelines::Find(const PipelineKey& key, VkPipeline fallback) {
+    auto& shard = ShardOf(key);
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto& entry = shard.map[key];
+        if (entry.pipeline) return entry.pipeline;
+        fallbacks++;
+        if (entry.compiling) return fallback;
+        entry.compiling = true;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending++;
+    }
+    CheckVertexInput(key);
+    const auto vert = StageOf(key.vertShader);
+    const auto frag = StageOf(key.fragShader);
+    const auto name = Name(key);
+    JobSystem::Submit([key, vert, frag, name]() {
+        const auto pipe = Compile(key, vert, frag, name);
+        asyncCompiles++;
+        auto& shard = ShardOf(key);
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            shard.map[key].pipeline = pipe;
+            shard.compiled.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        if (!--pending) pendingDone.notify_all();
+    });
+    return fallback;
+}
+
+void Pipelines::WaitIdle() {
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    pendingDone.wait(lock, []() { return pending == 0; });
+}
+
+void Pipelines::Report() {
+    std::cout << "pipelines: " << syncCompiles << " compiled on demand, " << asyncCompiles
+        << " in the background, fallback drawn " << fallbacks << " times" << std::endl;
+}
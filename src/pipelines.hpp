@@ -0,0 +1,101 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <string>
+#include "spirv.hpp"
+
+enum BlendMode : uint8_t {
+    BLEND_OPAQUE,
+    BLEND_ALPHA,
+    BLEND_ADDITIVE
+};
+
+enum VertexInput : uint8_t {
+    VERTEX_INPUT_MESH,
+    /* for shaders that make their own vertices */
+    VERTEX_INPUT_NONE
+};
+
+/* Feature bits of a family of shaders. Bit n sets the specialization constant with constant_id n
+ * to 1, so the shader can branch on it and the driver compiles only the path taken. Feature is an
+ * enum of bit indices, Count the number of them.
+ */
+template <typename Feature, uint32_t Count>
+class FeatureSet {
+public:
+    static_assert(Count <= 32, "features are specialization constant ids 0 to 31");
+
+    constexpr FeatureSet() : bits(0) {}
+    constexpr explicit FeatureSet(uint32_t bits) : bits(bits) {}
+
+    constexpr FeatureSet With(Feature f) const {
+        return FeatureSet(bits | (1u << f));
+    }
+    constexpr FeatureSet Without(Feature f) const {
+        return FeatureSet(bits & ~(1u << f));
+    }
+    constexpr FeatureSet With(Feature f, bool on) const {
+        return on ? With(f) : Without(f);
+    }
+    constexpr bool Has(Feature f) const {
+        return (bits >> f) & 1;
+    }
+    /* for PipelineKey::features */
+    constexpr uint32_t Bits() const {
+        return bits;
+    }
+
+private:
+    uint32_t bits;
+};
+
+/* Everything a graphics pipeline is built from. Compared and hashed as raw bytes, so start from
+ * PipelineKey key = {} and keep the struct free of padding. Viewport and scissor are dynamic.
+ */
+struct PipelineKey {
+    VkPipelineLayout layout;
+    VkRenderPass renderPass;
+    /* from Pipelines::Shader */
+    uint16_t vertShader;
+    uint16_t fragShader;
+    uint32_t subpass;
+    /* a FeatureSet, given to the specialization constants 0 to 31 of both stages */
+    uint32_t features;
+    VertexInput vertexInput;
+    BlendMode blend;
+    /* VkCullModeFlagBits, counter-clockwise faces are the back */
+    uint8_t cullMode;
+    /* VkPrimitiveTopology */
+    uint8_t topology;
+};
+
+/* Creates graphics pipelines on demand and keeps one per PipelineKey. Lookups may come from any
+ * thread. Find never blocks: a missing pipeline is compiled on a background thread while the caller
+ * draws with a fallback, so a new state combination does not stall the frame it first appears in.
+ */
+class Pipelines {
+public:
+    /* creationFeedback: VK_EXT_pipeline_creation_feedback is enabled, loadShader: by file name, also reflects it */
+    static void Init(VkDevice device, VkPipelineCache cache, bool creationFeedback,
+        VkShaderModule (*loadShader)(const std::string&, ShaderInfo&));
+    /* waits for the compiles in progress, then destroys every pipeline and shader */
+    static void Exit();
+
+    /* Loads a shader on first use and returns its id for PipelineKey. Loading may read the asset
+     * pack, so only call this from the main thread.
+     */
+    static uint32_t Shader(const std::string& name);
+    static VkShaderModule Module(uint32_t shader);
+    static const ShaderInfo& Info(uint32_t shader);
+
+    /* The pipeline for key, compiled on this thread if needed. Both here and in Find, the vertex
+     * shader's inputs are checked against the vertex input of the key before compiling.
+     */
+    static VkPipeline Get(const PipelineKey& key);
+    /* the pipeline for key if it is ready, otherwise fallback while it compiles in the background */
+    static VkPipeline Find(const PipelineKey& key, VkPipeline fallback);
+    /* blocks until the background compiles started by Find so far are done */
+    static void WaitIdle();
+
+    static void Report();
+};
@@ -0,0 +1,320 @@
+#include "profiler.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+//per frame in flight
+static const uint32_t MAX_GPU_SCOPES = 32;
+
+static const uint32_t STAT_COUNT = 5;
+static const VkQueryPipelineStatisticFlags STAT_FLAGS =
+    VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+    VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+//results come back in the order of the flag bits
+static const char* STAT_NAMES[STAT_COUNT] = {
+    "primitives", "vertex invocations", "clipped primitives", "fragment invocations", "compute invocations"
+};
+
+struct GpuScope {
+    const char* name;
+    uint32_t query;
+    //UINT32_MAX without statistics
+    uint32_t statQuery;
+};
+
+struct ScopeEvent {
+    const char* name;
+    bool gpu;
+    uint32_t thread;
+    //ns since the profiler started
+    int64_t start;
+    int64_t duration;
+    bool hasStats;
+    uint64_t stats[STAT_COUNT];
+};
+
+struct ScopeTotal {
+    const char* name;
+    bool gpu;
+    uint64_t count;
+    double ms;
+    uint64_t stats[STAT_COUNT];
+};
+
+static VkDevice profDevice;
+static VkQueryPool timestampPool;
+static VkQueryPool statPool;
+static uint64_t timestampMask;
+static double nsPerTick;
+static bool statistics;
+//a gpu timestamp and the cpu time it was written at, in ns since origin
+static uint64_t calibrationTicks;
+static int64_t calibrationNs;
+static Clock::time_point origin = Clock::now();
+
+static std::vector<std::vector<GpuScope>> frameScopes;
+static uint32_t recordingFrame;
+static uint32_t statsUsed;
+//indices into the recording frame's scopes
+static std::vector<uint32_t> openScopes;
+static uint32_t openStatScope;
+
+static std::mutex eventMutex;
+static bool tracing;
+static std::vector<ScopeEvent> events;
+static std::vector<ScopeTotal> totals;
+static std::atomic<uint32_t> nextThread(0);
+
+static int64_t NsSinceOrigin(Clock::time_point t) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(t - origin).count();
+}
+
+static void AddEvent(const ScopeEvent& e) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    if (tracing) events.push_back(e);
+    auto it = std::find_if(totals.begin(), totals.end(), [&](const ScopeTotal& t) {
+        return t.gpu == e.gpu && !strcmp(t.name, e.name);
+    });
+    if (it == totals.end()) {
+        totals.push_back(ScopeTotal{ e.name, e.gpu, 0, 0, {} });
+        it = totals.end() - 1;
+    }
+    it->count++;
+    it->ms += e.duration * 1e-6;
+    if (e.hasStats) {
+        for (uint32_t a = 0; a < STAT_COUNT; a++) it->stats[a] += e.stats[a];
+    }
+}
+
+//a timestamp written as soon as the queue runs it, against the cpu time halfway through the submit
+static void Calibrate(VkQueue queue, uint32_t queueFamily) {
+    VkCommandPoolCreateInfo pinfo = {};
+    pinfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    pinfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    pinfo.queueFamilyIndex = queueFamily;
+    VkCommandPool pool;
+    VKDO(vkCreateCommandPool(profDevice, &pinfo, nullptr, &pool));
+
+    VkCommandBufferAllocateInfo ainfo = {};
+    ainfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    ainfo.commandPool = pool;
+    ainfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    ainfo.commandBufferCount = 1;
+    VkCommandBuffer cmd;
+    VKDO(vkAllocateCommandBuffers(profDevice, &ainfo, &cmd));
+
+    VkCommandBufferBeginInfo binfo = {};
+    binfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    binfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VKDO(vkBeginCommandBuffer(cmd, &binfo));
+    vkCmdResetQueryPool(cmd, timestampPool, 0, 1);
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, 0);
+    VKDO(vkEndCommandBuffer(cmd));
+
+    VkSubmitInfo sinfo = {};
+    sinfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    sinfo.commandBufferCount = 1;
+    sinfo.pCommandBuffers = &cmd;
+    const auto before = Clock::now();
+    VKDO(vkQueueSubmit(queue, 1, &sinfo, VK_NULL_HANDLE));
+    VKDO(vkQueueWaitIdle(queue));
+    const auto after = Clock::now();
+
+    VKDO(vkGetQueryPoolResults(profDevice, timestampPool, 0, 1, sizeof(uint64_t), &calibrationTicks,
+        sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT));
+    calibrationTicks &= timestampMask;
+    calibrationNs = (NsSinceOrigin(before) + NsSinceOrigin(after)) / 2;
+    vkDestroyCommandPool(profDevice, pool, nullptr);
+}
+
+void Profiler::Init(VkDevice device, VkQueue queue, uint32_t queueFamily, uint32_t timestampBits,
+        float timestampPeriod, uint32_t frames, bool stats) {
+    profDevice = device;
+    frameScopes.assign(frames, std::vector<GpuScope>());
+    if (!timestampBits) return;
+    timestampMask = (timestampBits >= 64) ? ~0ull : ((1ull << timestampBits) - 1);
+    nsPerTick = timestampPeriod;
+    statistics = stats;
+
+    VkQueryPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = frames * MAX_GPU_SCOPES * 2;
+    VKDO(vkCreateQueryPool(device, &info, nullptr, &timestampPool));
+    if (statistics) {
+        info.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        info.queryCount = frames * MAX_GPU_SCOPES;
+        info.pipelineStatistics = STAT_FLAGS;
+        VKDO(vkCreateQueryPool(device, &info, nullptr, &statPool));
+    }
+    Calibrate(queue, queueFamily);
+}
+
+void Profiler::Exit() {
+    if (timestampPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(profDevice, timestampPool, nullptr);
+        timestampPool = VK_NULL_HANDLE;
+    }
+    if (statPool != VK_NULL_HANDLE) {
+        vkDestroyQueryPool(profDevice, statPool, nullptr);
+        statPool = VK_NULL_HANDLE;
+    }
+}
+
+void Profiler::EnableTrace() {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    tracing = true;
+}
+
+double Profiler::Collect(uint32_t frame) {
+    auto& scopes = frameScopes[frame];
+    if (timestampPool == VK_NULL_HANDLE || scopes.empty()) return -1;
+
+    //without the wait bit this fails instead of blocking if anything is missing
+    const uint32_t base = frame * MAX_GPU_SCOPES * 2;
+    const uint32_t count = (uint32_t)scopes.size() * 2;
+    uint64_t ticks[MAX_GPU_SCOPES * 2];
+    if (vkGetQueryPoolResults(profDevice, timestampPool, base, count, sizeof(ticks), ticks,
+            sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+        scopes.clear();
+        return -1;
+    }
+
+    int64_t first = INT64_MAX, last = INT64_MIN;
+    for (auto& s : scopes) {
+        ScopeEvent e = {};
+        e.name = s.name;
+        e.gpu = true;
+        const uint64_t begin = ticks[s.query - base] & timestampMask;
+        const uint64_t end = ticks[s.query - base + 1] & timestampMask;
+        //the difference is taken before converting, so it survives the counter wrapping
+        e.start = calibrationNs + (int64_t)(((int64_t)(begin - calibrationTicks)) * nsPerTick);
+        e.duration = (int64_t)(((end - begin) & timestampMask) * nsPerTick);
+        if (s.statQuery != UINT32_MAX) {
+            e.hasStats = vkGetQueryPoolResults(profDevice, statPool, s.statQuery, 1, sizeof(e.stats), e.stats,
+                sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS;
+        }
+        first = std::min(first, e.start);
+        last = std::max(last, e.start + e.duration);
+        AddEvent(e);
+    }
+    scopes.clear();
+    return (last - first) * 1e-6;
+}
+
+void Profiler::BeginFrame(VkCommandBuffer cmd, uint32_t frame) {
+    recordingFrame = frame;
+    frameScopes[frame].clear();
+    openScopes.clear();
+    openStatScope = UINT32_MAX;
+    statsUsed = 0;
+    if (timestampPool == VK_NULL_HANDLE) return;
+    vkCmdResetQueryPool(cmd, timestampPool, frame * MAX_GPU_SCOPES * 2, MAX_GPU_SCOPES * 2);
+    if (statistics) {
+        vkCmdResetQueryPool(cmd, statPool, frame * MAX_GPU_SCOPES, MAX_GPU_SCOPES);
+    }
+}
+
+void Profiler::BeginScope(VkCommandBuffer cmd, const char* name, bool stats) {
+    auto& scopes = frameScopes[recordingFrame];
+    //still pushed when out of queries, so EndScope pairs up
+    if (timestampPool == VK_NULL_HANDLE || scopes.size() == MAX_GPU_SCOPES) {
+        openScopes.push_back(UINT32_MAX);
+        return;
+    }
+    GpuScope s;
+    s.name = name;
+    s.query = (recordingFrame * MAX_GPU_SCOPES + (uint32_t)scopes.size()) * 2;
+    s.statQuery = UINT32_MAX;
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestampPool, s.query);
+    if (stats && statistics && openStatScope == UINT32_MAX) {
+        s.statQuery = recordingFrame * MAX_GPU_SCOPES + statsUsed++;
+        vkCmdBeginQuery(cmd, statPool, s.statQuery, 0);
+        openStatScope = (uint32_t)scopes.size();
+    }
+    openScopes.push_back((uint32_t)scopes.size());
+    scopes.push_back(s);
+}
+
+void Profiler::EndScope(VkCommandBuffer cmd) {
+    const uint32_t index = openScopes.back();
+    openScopes.pop_back();
+    if (index == UINT32_MAX) return;
+    auto& s = frameScopes[recordingFrame][index];
+    if (index == openStatScope) {
+        vkCmdEndQuery(cmd, statPool, s.statQuery);
+        openStatScope = UINT32_MAX;
+    }
+    vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestampPool, s.query + 1);
+}
+
+VkQueryPipelineStatisticFlags Profiler::StatisticsFlags() {
+    return (openStatScope != UINT32_MAX) ? STAT_FLAGS : 0;
+}
+
+void Profiler::AddCpuScope(const char* name, Clock::time_point start, Clock::time_point end) {
+    static thread_local uint32_t thread = nextThread++;
+    ScopeEvent e = {};
+    e.name = name;
+    e.thread = thread;
+    e.start = NsSinceOrigin(start);
+    e.duration = NsSinceOrigin(end) - e.start;
+    AddEvent(e);
+}
+
+bool Profiler::WriteTrace(const std::string& path) {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) {
+        std::cerr << "cannot write " << path << "!" << std::endl;
+        return false;
+    }
+    //complete events in us, the cpu threads and the gpu queue as two processes
+    fprintf(f, "{\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"cpu\"}},\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"gpu\"}}");
+    for (auto& e : events) {
+        fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+            e.name, e.gpu ? 1 : 0, e.thread, e.start * 1e-3, e.duration * 1e-3);
+        if (e.hasStats) {
+            fprintf(f, ",\"args\":{");
+            for (uint32_t a = 0; a < STAT_COUNT; a++) {
+                fprintf(f, "%s\"%s\":%llu", a ? "," : "", STAT_NAMES[a], (unsigned long long)e.stats[a]);
+            }
+            fprintf(f, "}");
+        }
+        fprintf(f, "}");
+    }
+    fprintf(f, "\n]}\n");
+    const bool ok = !ferror(f);
+    fclose(f);
+    std::cout << "wrote " << events.size() << " trace events to " << path << std::endl;
+    return ok;
+}
+
+void Profiler::Report() {
+    std::lock_guard<std::mutex> lock(eventMutex);
+    std::cout << "profile scopes:" << std::endl;
+    for (auto& t : totals) {
+        std::cout << "  " << (t.gpu ? "gpu " : "cpu ") << t.name << ": mean " << t.ms / t.count
+            << "ms over " << t.count << std::endl;
+        bool hasStats = false;
+        for (auto s : t.stats) hasStats |= s > 0;
+        if (!hasStats) continue;
+        std::cout << "   ";
+        for (uint32_t a = 0; a < STAT_COUNT; a++) {
+            std::cout << " " << STAT_NAMES[a] << " " << t.stats[a] / t.count;
+        }
+        std::cout << std::endl;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <chrono>
+#include <string>
+
+/* Named gpu scopes measured with timestamp and pipeline statistics queries, and cpu scopes on the
+ * same timeline. Each frame in flight has its own queries, read back after that frame's fence has
+ * been waited for, so collecting never stalls. Every scope is summed for Report, and kept for a
+ * Chrome trace (chrome://tracing or ui.perfetto.dev) once EnableTrace has been called.
+ */
+class Profiler {
+public:
+    /* Without timestampBits gpu scopes do nothing. statistics needs the pipelineStatisticsQuery and
+     * inheritedQueries features enabled on the device. queue is used once to line up the gpu clock.
+     */
+    static void Init(VkDevice device, VkQueue queue, uint32_t queueFamily, uint32_t timestampBits,
+        float timestampPeriod, uint32_t frames, bool statistics);
+    /* only destroys the queries, the results stay available for Report and WriteTrace */
+    static void Exit();
+
+    static void EnableTrace();
+    static bool WriteTrace(const std::string& path);
+    static void Report();
+
+    /* Reads what the frame's previous submission measured; its fence must have been waited for.
+     * Returns the gpu time of the whole frame in ms, or a negative value if nothing was measured.
+     */
+    static double Collect(uint32_t frame);
+
+    /* call first when recording the frame, outside any render pass */
+    static void BeginFrame(VkCommandBuffer cmd, uint32_t frame);
+    /* Scopes go in the frame's primary command buffer and may nest, but statistics scopes may not
+     * overlap each other. Buffers executed inside a statistics scope inherit StatisticsFlags().
+     */
+    static void BeginScope(VkCommandBuffer cmd, const char* name, bool statistics = false);
+    static void EndScope(VkCommandBuffer cmd);
+    static VkQueryPipelineStatisticFlags StatisticsFlags();
+
+    /* safe from any thread, name must outlive the profiler */
+    static void AddCpuScope(const char* name, std::chrono::steady_clock::time_point start,
+        std::chrono::steady_clock::time_point end);
+};
+
+/* measures the enclosing block as a cpu scope */
+class ProfileScope {
+public:
+    ProfileScope(const char* name) : name(name), start(std::chrono::steady_clock::now()) {}
+    ~ProfileScope() {
+        Profiler::AddCpuScope(name, start, std::chrono::steady_clock::now());
+    }
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
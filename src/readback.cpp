@@ -0,0 +1,71 @@
+#include "readback.hpp"
+#include "allocator.hpp"
+#include "handles.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+
+static VkDevice rbDevice;
+static VkBuffer rbBuffer;
+static Allocation* rbAlloc;
+static VkExtent2D rbExtent;
+//rounded up to the atom size, so each slot can be invalidated on its own
+static VkDeviceSize slotSize;
+static VkDeviceSize atom;
+
+void Readback::Init(VkDevice device, VkDeviceSize atomSize, uint32_t slots, VkExtent2D extent) {
+    rbDevice = device;
+    rbExtent = extent;
+    atom = atomSize ? atomSize : 1;
+    slotSize = ((VkDeviceSize)extent.width * extent.height * 4 + atom - 1) / atom * atom;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = slotSize * slots;
+    info.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    rbAlloc = Allocator::CreateBuffer(info, MEMORY_USAGE_READBACK, &rbBuffer);
+    if (!rbAlloc->mapped) {
+        std::cerr << "readback memory is not host visible!" << std::endl;
+        abort();
+    }
+}
+
+void Readback::Exit() {
+    DeletionQueue::RetireBuffer(rbBuffer, rbAlloc);
+    rbBuffer = VK_NULL_HANDLE;
+    rbAlloc = nullptr;
+}
+
+void Readback::Record(VkCommandBuffer cmd, uint32_t slot, VkImage image) {
+    VkBufferImageCopy region = {};
+    region.bufferOffset = slotSize * slot;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = { rbExtent.width, rbExtent.height, 1 };
+    vkCmdCopyImageToBuffer(cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, rbBuffer, 1, &region);
+
+    //waiting for the frame does not make its writes visible to the host by itself
+    VkBufferMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = rbBuffer;
+    barrier.offset = region.bufferOffset;
+    barrier.size = slotSize;
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0,
+        0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+const uint8_t* Readback::Map(uint32_t slot) {
+    //cached memory is often not coherent, a no-op where it is. Allocations start on a multiple of
+    //their power of two size, so the range rounded out to atoms stays inside the allocation
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = rbAlloc->memory;
+    range.offset = (rbAlloc->offset + slotSize * slot) / atom * atom;
+    range.size = (rbAlloc->offset + slotSize * (slot + 1) + atom - 1) / atom * atom - range.offset;
+    VKDO(vkInvalidateMappedMemoryRanges(rbDevice, 1, &range));
+    return (const uint8_t*)rbAlloc->mapped + slotSize * slot;
+}
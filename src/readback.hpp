@@ -0,0 +1,20 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+
+/* Copies rendered images into host memory without stalling the frame. One persistently mapped
+ * buffer holds a slot per frame in flight, created once in Init, so reading back every frame
+ * allocates nothing. A slot's copy is recorded into the frame's command buffer and read on the
+ * cpu once FrameSync says the frame has finished.
+ */
+class Readback {
+public:
+    /* slots of extent with 4 byte pixels, atomSize is the device's nonCoherentAtomSize */
+    static void Init(VkDevice device, VkDeviceSize atomSize, uint32_t slots, VkExtent2D extent);
+    static void Exit();
+
+    /* copies image, in TRANSFER_SRC_OPTIMAL, into slot and makes it visible to the host */
+    static void Record(VkCommandBuffer cmd, uint32_t slot, VkImage image);
+    /* the tightly packed pixels of slot, only valid once the frame that recorded it has finished */
+    static const uint8_t* Map(uint32_t slot);
+};
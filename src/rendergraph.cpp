@@ -0,0 +1,962 @@
+#include "rendergraph.hpp"
+#include "allocator.hpp"
+#include "profiler.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <set>
+
+static const uint32_t NONE = UINT32_MAX;
+
+static const VkAccessFlags WRITE_ACCESS = VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+    | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+struct UsageInfo {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    VkImageUsageFlags imageUsage;
+};
+
+static UsageInfo Info(GraphUsage usage, PassType type) {
+    const VkPipelineStageFlags shaders = (type != PASS_GRAPHICS) ? VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT
+        : (VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    switch (usage) {
+    case GRAPH_COLOR_ATTACHMENT:
+        return { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT };
+    case GRAPH_DEPTH_ATTACHMENT:
+        return { VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+            VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT };
+    case GRAPH_INPUT_ATTACHMENT:
+        return { VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_INPUT_ATTACHMENT_READ_BIT,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT };
+    case GRAPH_SAMPLED:
+        return { shaders, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT };
+    case GRAPH_STORAGE_READ:
+        return { shaders, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT };
+    case GRAPH_STORAGE_WRITE:
+        return { shaders, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL,
+            VK_IMAGE_USAGE_STORAGE_BIT };
+    case GRAPH_INDIRECT:
+        return { VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED, 0 };
+    case GRAPH_TRANSFER_SRC:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT };
+    default:
+        return { VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT };
+    }
+}
+
+static bool IsAttachment(GraphUsage usage) {
+    return usage == GRAPH_COLOR_ATTACHMENT || usage == GRAPH_DEPTH_ATTACHMENT || usage == GRAPH_INPUT_ATTACHMENT;
+}
+
+static bool IsDepth(VkFormat format) {
+    return format == VK_FORMAT_D16_UNORM || format == VK_FORMAT_X8_D24_UNORM_PACK32 || format == VK_FORMAT_D32_SFLOAT
+        || format == VK_FORMAT_D16_UNORM_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT
+        || format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+}
+
+//everything one pass does to one resource
+struct Access {
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    VkImageLayout layout;
+    bool write;
+    bool attachment;
+};
+
+//where a resource stands between passes
+struct State {
+    VkImageLayout layout;
+    //the last write (or layout transition), and where it has been made visible
+    bool pending;
+    VkPipelineStageFlags writeStage;
+    VkAccessFlags writeAccess;
+    VkPipelineStageFlags visibleStages;
+    VkAccessFlags visibleAccess;
+    //reads since the last write, a write has to wait for them
+    VkPipelineStageFlags readStages;
+    //last used on the async queue, or used on the graphics queue at all this frame
+    bool async;
+    bool graphicsUsed;
+};
+
+struct Dependency {
+    VkPipelineStageFlags srcStage;
+    VkAccessFlags srcAccess;
+    VkPipelineStageFlags dstStage;
+    VkAccessFlags dstAccess;
+};
+
+//whether a is ordered after what s has seen, with the dependency it takes if not
+static bool Hazard(const State& s, const Access& a, bool layoutChange, Dependency& dep) {
+    const bool raw = s.pending && ((a.stage & ~s.visibleStages) || (a.access & ~s.visibleAccess));
+    const bool war = a.write && s.readStages;
+    if (!layoutChange && !raw && !war) return false;
+    dep.srcStage = s.writeStage | s.readStages;
+    if (!dep.srcStage) dep.srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+    dep.srcAccess = s.pending ? s.writeAccess : 0;
+    dep.dstStage = a.stage;
+    dep.dstAccess = a.access;
+    return true;
+}
+
+//s after a, synchronized with a dependency or not
+static void Advance(State& s, const Access& a, bool synced, bool layoutChange) {
+    if (a.write) {
+        s.pending = true;
+        s.writeStage = a.stage;
+        s.writeAccess = a.access & WRITE_ACCESS;
+        s.visibleStages = 0;
+        s.visibleAccess = 0;
+        s.readStages = 0;
+    }
+    else if (layoutChange) {
+        //the transition is a write of its own, visible only where the dependency pointed
+        s.pending = true;
+        s.writeStage = a.stage;
+        s.writeAccess = 0;
+        s.visibleStages = a.stage;
+        s.visibleAccess = a.access;
+        s.readStages = a.stage;
+    }
+    else {
+        if (synced) {
+            s.visibleStages |= a.stage;
+            s.visibleAccess |= a.access;
+        }
+        s.readStages |= a.stage;
+    }
+    if (a.layout != VK_IMAGE_LAYOUT_UNDEFINED) s.layout = a.layout;
+}
+
+static VkDevice graphDevice;
+static std::map<std::vector<uint32_t>, VkRenderPass> renderPasses;
+//the profiler keeps scope names for as long as it runs
+static std::set<std::string> scopeNames;
+
+void RenderGraph::Init(VkDevice device) {
+    graphDevice = device;
+}
+
+void RenderGraph::Exit() {
+    for (auto& p : renderPasses) {
+        vkDestroyRenderPass(graphDevice, p.second, nullptr);
+    }
+    renderPasses.clear();
+}
+
+//equal descriptions give the same handle, the key is the create info flattened into words
+static VkRenderPass GetRenderPass(const std::vector<VkAttachmentDescription>& attachments,
+        const std::vector<VkSubpassDescription>& subpasses, const std::vector<VkSubpassDependency>& dependencies) {
+    std::vector<uint32_t> key;
+    key.push_back((uint32_t)attachments.size());
+    for (auto& a : attachments) {
+        const uint32_t words[] = { (uint32_t)a.format, (uint32_t)a.samples, (uint32_t)a.loadOp, (uint32_t)a.storeOp,
+            (uint32_t)a.initialLayout, (uint32_t)a.finalLayout };
+        key.insert(key.end(), words, words + 6);
+    }
+    const auto addRefs = [&](const VkAttachmentReference* refs, uint32_t count) {
+        key.push_back(count);
+        for (uint32_t a = 0; a < count; a++) {
+            key.push_back(refs[a].attachment);
+            key.push_back((uint32_t)refs[a].layout);
+        }
+    };
+    for (auto& s : subpasses) {
+        addRefs(s.pColorAttachments, s.colorAttachmentCount);
+        addRefs(s.pInputAttachments, s.inputAttachmentCount);
+        addRefs(s.pDepthStencilAttachment, s.pDepthStencilAttachment ? 1 : 0);
+        key.push_back(s.preserveAttachmentCount);
+        key.insert(key.end(), s.pPreserveAttachments, s.pPreserveAttachments + s.preserveAttachmentCount);
+    }
+    for (auto& d : dependencies) {
+        const uint32_t words[] = { d.srcSubpass, d.dstSubpass, d.srcStageMask, d.dstStageMask, d.srcAccessMask,
+            d.dstAccessMask, d.dependencyFlags };
+        key.insert(key.end(), words, words + 7);
+    }
+
+    auto it = renderPasses.find(key);
+    if (it != renderPasses.end()) return it->second;
+    if (!graphDevice) return VK_NULL_HANDLE;
+
+    VkRenderPassCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    info.attachmentCount = (uint32_t)attachments.size();
+    info.pAttachments = attachments.data();
+    info.subpassCount = (uint32_t)subpasses.size();
+    info.pSubpasses = subpasses.data();
+    info.dependencyCount = (uint32_t)dependencies.size();
+    info.pDependencies = dependencies.data();
+    VkRenderPass pass;
+    VKDO(vkCreateRenderPass(graphDevice, &info, nullptr, &pass));
+    renderPasses[key] = pass;
+    return pass;
+}
+
+RenderGraph* RenderGraph::Create() {
+    auto graph = new RenderGraph();
+    graph->after = {};
+    graph->stats = {};
+    graph->compiled = false;
+    graph->asyncCompute = false;
+    graph->asyncWaitStage = 0;
+    return graph;
+}
+
+void RenderGraph::Destroy(RenderGraph* graph) {
+    for (auto& g : graph->groups) {
+        for (auto& f : g.framebuffers) {
+            vkDestroyFramebuffer(graphDevice, f.second, nullptr);
+        }
+    }
+    for (auto& r : graph->resources) {
+        if (r.imported || !r.handle) continue;
+        vkDestroyImageView(graphDevice, r.view, nullptr);
+        vkDestroyImage(graphDevice, r.handle, nullptr);
+    }
+    for (auto a : graph->slots) {
+        Allocator::Free(a);
+    }
+    delete graph;
+}
+
+uint32_t RenderGraph::ImportImage(const std::string& name, VkFormat format, VkExtent2D extent,
+        VkImageLayout initialLayout, VkPipelineStageFlags initialStage, VkImageLayout finalLayout) {
+    Resource r = {};
+    r.name = name;
+    r.image = true;
+    r.imported = true;
+    r.format = format;
+    r.extent = extent;
+    r.initialLayout = initialLayout;
+    r.initialStage = initialStage;
+    r.finalLayout = finalLayout;
+    r.slot = r.aliasOf = NONE;
+    resources.push_back(r);
+    return (uint32_t)resources.size() - 1;
+}
+
+uint32_t RenderGraph::ImportBuffer(const std::string& name) {
+    Resource r = {};
+    r.name = name;
+    r.imported = true;
+    r.slot = r.aliasOf = NONE;
+    resources.push_back(r);
+    return (uint32_t)resources.size() - 1;
+}
+
+uint32_t RenderGraph::CreateImage(const std::string& name, VkFormat format, VkExtent2D extent) {
+    Resource r = {};
+    r.name = name;
+    r.image = true;
+    r.format = format;
+    r.extent = extent;
+    r.initialLayout = r.finalLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    r.slot = r.aliasOf = NONE;
+    resources.push_back(r);
+    return (uint32_t)resources.size() - 1;
+}
+
+uint32_t RenderGraph::AddPass(const std::string& name, PassType type, std::function<void(const PassContext&)> record) {
+    Pass p = {};
+    p.name = name;
+    p.type = type;
+    p.record = record;
+    p.contents = VK_SUBPASS_CONTENTS_INLINE;
+    passes.push_back(p);
+    return (uint32_t)passes.size() - 1;
+}
+
+void RenderGraph::Read(uint32_t pass, uint32_t resource, GraphUsage usage) {
+    passes[pass].uses.push_back(Use{ resource, usage, false });
+}
+
+void RenderGraph::Write(uint32_t pass, uint32_t resource, GraphUsage usage) {
+    if (usage == GRAPH_INPUT_ATTACHMENT || usage == GRAPH_SAMPLED || usage == GRAPH_STORAGE_READ
+            || usage == GRAPH_INDIRECT || usage == GRAPH_TRANSFER_SRC) {
+        std::cerr << "render graph: pass " << passes[pass].name << " writes " << resources[resource].name
+            << " with a read only usage!" << std::endl;
+        abort();
+    }
+    passes[pass].uses.push_back(Use{ resource, usage, true });
+}
+
+void RenderGraph::Clear(uint32_t pass, uint32_t resource, VkClearValue value) {
+    passes[pass].clears.push_back(std::make_pair(resource, value));
+}
+
+void RenderGraph::Cull() {
+    std::vector<bool> needed(resources.size(), false);
+    for (size_t a = 0; a < resources.size(); a++) {
+        needed[a] = resources[a].imported;
+    }
+    for (auto p = passes.rbegin(); p != passes.rend(); p++) {
+        p->culled = true;
+        for (auto& u : p->uses) {
+            if (u.write && needed[u.resource]) p->culled = false;
+        }
+        if (p->culled) continue;
+        for (auto& u : p->uses) {
+            const bool cleared = std::any_of(p->clears.begin(), p->clears.end(),
+                [&](const std::pair<uint32_t, VkClearValue>& c) { return c.first == u.resource; });
+            //a write that is not a clear may keep part of what was there
+            if (!u.write || !cleared) needed[u.resource] = true;
+        }
+    }
+}
+
+void RenderGraph::Merge(bool mergeSubpasses) {
+    groups.clear();
+    for (uint32_t p = 0; p < passes.size(); p++) {
+        auto& pass = passes[p];
+        if (pass.culled) continue;
+
+        VkExtent2D extent = {};
+        for (auto& u : pass.uses) {
+            if (IsAttachment(u.usage)) extent = resources[u.resource].extent;
+        }
+        if (pass.type == PASS_GRAPHICS && !extent.width) {
+            std::cerr << "render graph: graphics pass " << pass.name << " has no attachments!" << std::endl;
+            abort();
+        }
+
+        bool merge = mergeSubpasses && pass.type == PASS_GRAPHICS && !groups.empty();
+        if (merge) {
+            auto& g = groups.back();
+            merge = passes[g.passes[0]].type == PASS_GRAPHICS && g.extent.width == extent.width
+                && g.extent.height == extent.height;
+            //the group may only hand over attachments, anything else needs the render pass to end first
+            for (auto& u : pass.uses) {
+                for (auto q : g.passes) {
+                    for (auto& v : passes[q].uses) {
+                        if (v.resource != u.resource) continue;
+                        if (!IsAttachment(u.usage) || !IsAttachment(v.usage)) merge = false;
+                    }
+                }
+            }
+        }
+        if (merge) {
+            pass.group = (uint32_t)groups.size() - 1;
+            pass.subpass = (uint32_t)groups.back().passes.size();
+            groups.back().passes.push_back(p);
+            groups.back().name += "+" + pass.name;
+            stats.mergedPasses++;
+            continue;
+        }
+        Group g = {};
+        g.passes.push_back(p);
+        g.name = pass.name;
+        g.extent = extent;
+        pass.group = (uint32_t)groups.size();
+        pass.subpass = 0;
+        groups.push_back(g);
+    }
+}
+
+void RenderGraph::Allocate() {
+    std::vector<uint32_t> transient;
+    for (uint32_t r = 0; r < resources.size(); r++) {
+        auto& res = resources[r];
+        res.firstPass = NONE;
+        res.lastPass = 0;
+        res.usage = 0;
+        for (auto& g : groups) {
+            for (auto p : g.passes) {
+                for (auto& u : passes[p].uses) {
+                    if (u.resource != r) continue;
+                    res.firstPass = std::min(res.firstPass, passes[p].group);
+                    res.lastPass = std::max(res.lastPass, passes[p].group);
+                    res.usage |= Info(u.usage, passes[p].type).imageUsage;
+                }
+            }
+        }
+        if (!res.imported && res.image && res.firstPass != NONE) transient.push_back(r);
+    }
+
+    std::vector<VkMemoryRequirements> reqs(resources.size());
+    for (auto r : transient) {
+        auto& res = resources[r];
+        stats.transientImages++;
+        if (!graphDevice) {
+            //planned only, as if every texel took 4 bytes
+            reqs[r] = { (VkDeviceSize)res.extent.width * res.extent.height * 4, 256, UINT32_MAX };
+            stats.unaliasedBytes += reqs[r].size;
+            continue;
+        }
+        VkImageCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = res.format;
+        info.extent = { res.extent.width, res.extent.height, 1 };
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = res.usage;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VKDO(vkCreateImage(graphDevice, &info, nullptr, &res.handle));
+        vkGetImageMemoryRequirements(graphDevice, res.handle, &reqs[r]);
+        stats.unaliasedBytes += reqs[r].size;
+    }
+
+    //largest first, each into the first slot whose images are all done before it starts or start after it ends
+    std::sort(transient.begin(), transient.end(), [&](uint32_t a, uint32_t b) {
+        return reqs[a].size > reqs[b].size;
+    });
+    std::vector<VkMemoryRequirements> slotReqs;
+    std::vector<std::vector<uint32_t>> slotImages;
+    for (auto r : transient) {
+        auto& res = resources[r];
+        uint32_t slot = NONE;
+        for (uint32_t s = 0; s < slotImages.size() && slot == NONE; s++) {
+            if (!(slotReqs[s].memoryTypeBits & reqs[r].memoryTypeBits)) continue;
+            bool overlaps = false;
+            for (auto o : slotImages[s]) {
+                const auto& other = resources[o];
+                if (res.firstPass <= other.lastPass && other.firstPass <= res.lastPass) overlaps = true;
+            }
+            if (!overlaps) slot = s;
+        }
+        if (slot == NONE) {
+            slot = (uint32_t)slotImages.size();
+            slotReqs.push_back(reqs[r]);
+            slotImages.push_back(std::vector<uint32_t>());
+        }
+        auto& req = slotReqs[slot];
+        req.size = std::max(req.size, reqs[r].size);
+        req.alignment = std::max(req.alignment, reqs[r].alignment);
+        req.memoryTypeBits &= reqs[r].memoryTypeBits;
+        slotImages[slot].push_back(r);
+        res.slot = slot;
+    }
+
+    for (uint32_t s = 0; s < slotImages.size(); s++) {
+        stats.transientBytes += slotReqs[s].size;
+        stats.memorySlots++;
+        auto& images = slotImages[s];
+        std::sort(images.begin(), images.end(), [&](uint32_t a, uint32_t b) {
+            return resources[a].firstPass < resources[b].firstPass;
+        });
+        for (size_t a = 0; a < images.size(); a++) {
+            resources[images[a]].aliasOf = a ? images[a - 1] : NONE;
+        }
+        if (!graphDevice) continue;
+
+        auto alloc = Allocator::Alloc(slotReqs[s], MEMORY_USAGE_GPU_ONLY, false);
+        slots.push_back(alloc);
+        for (auto r : images) {
+            auto& res = resources[r];
+            VKDO(vkBindImageMemory(graphDevice, res.handle, alloc->memory, alloc->offset));
+
+            VkImageViewCreateInfo info = {};
+            info.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            info.image = res.handle;
+            info.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            info.format = res.format;
+            info.subresourceRange.aspectMask = IsDepth(res.format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+            info.subresourceRange.levelCount = 1;
+            info.subresourceRange.layerCount = 1;
+            VKDO(vkCreateImageView(graphDevice, &info, nullptr, &res.view));
+        }
+    }
+}
+
+static void AddTo(std::vector<VkSubpassDependency>& deps, uint32_t src, uint32_t dst, const Dependency& d) {
+    for (auto& e : deps) {
+        if (e.srcSubpass != src || e.dstSubpass != dst) continue;
+        e.srcStageMask |= d.srcStage;
+        e.srcAccessMask |= d.srcAccess;
+        e.dstStageMask |= d.dstStage;
+        e.dstAccessMask |= d.dstAccess;
+        return;
+    }
+    VkSubpassDependency e = {};
+    e.srcSubpass = src;
+    e.dstSubpass = dst;
+    e.srcStageMask = d.srcStage;
+    e.srcAccessMask = d.srcAccess;
+    e.dstStageMask = d.dstStage;
+    e.dstAccessMask = d.dstAccess;
+    //between subpasses only the same pixel is ever read back
+    if (src != VK_SUBPASS_EXTERNAL && dst != VK_SUBPASS_EXTERNAL) e.dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT;
+    deps.push_back(e);
+}
+
+void RenderGraph::Plan() {
+    std::vector<State> states(resources.size());
+    for (size_t a = 0; a < resources.size(); a++) {
+        auto& s = states[a];
+        s = {};
+        s.layout = resources[a].initialLayout;
+        s.readStages = resources[a].initialStage;
+    }
+    //per group, what each pass does to each resource, its uses folded in the order they first appear
+    std::vector<std::vector<std::vector<std::pair<uint32_t, Access>>>> accesses(groups.size());
+    for (size_t g = 0; g < groups.size(); g++) {
+        for (auto p : groups[g].passes) {
+            const auto& pass = passes[p];
+            std::vector<std::pair<uint32_t, Access>> folded;
+            for (auto& u : pass.uses) {
+                auto info = Info(u.usage, pass.type);
+                if (!resources[u.resource].image) info.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                auto it = std::find_if(folded.begin(), folded.end(), [&](const std::pair<uint32_t, Access>& f) {
+                    return f.first == u.resource;
+                });
+                if (it == folded.end()) {
+                    folded.push_back(std::make_pair(u.resource, Access{ info.stage, info.access, info.layout, u.write,
+                        IsAttachment(u.usage) }));
+                    continue;
+                }
+                auto& a = it->second;
+                if (a.layout != info.layout || a.attachment != IsAttachment(u.usage)) {
+                    std::cerr << "render graph: pass " << pass.name << " needs " << resources[u.resource].name
+                        << " in two layouts!" << std::endl;
+                    abort();
+                }
+                a.stage |= info.stage;
+                a.access |= info.access;
+                a.write = a.write || u.write;
+            }
+            accesses[g].push_back(folded);
+        }
+    }
+    //the frame before may still use the memory of a slot, so the first image in it waits for every use of the slot
+    std::vector<VkPipelineStageFlags> slotStages;
+    std::vector<VkAccessFlags> slotWrites;
+    for (auto& group : accesses) {
+        for (auto& pass : group) {
+            for (auto& a : pass) {
+                const auto slot = resources[a.first].slot;
+                if (slot == NONE) continue;
+                if (slot >= slotStages.size()) {
+                    slotStages.resize(slot + 1, 0);
+                    slotWrites.resize(slot + 1, 0);
+                }
+                slotStages[slot] |= a.second.stage;
+                if (a.second.write) slotWrites[slot] |= a.second.access & WRITE_ACCESS;
+            }
+        }
+    }
+    for (size_t a = 0; a < resources.size(); a++) {
+        const auto& res = resources[a];
+        if (res.slot == NONE || res.aliasOf != NONE) continue;
+        auto& s = states[a];
+        s.pending = true;
+        s.writeStage = slotStages[res.slot];
+        s.writeAccess = slotWrites[res.slot];
+        s.readStages = slotStages[res.slot];
+    }
+    //the first access to r after group g, if any
+    const auto nextAccess = [&](uint32_t r, size_t g, Access& out) {
+        for (size_t h = g + 1; h < groups.size(); h++) {
+            for (auto& pass : accesses[h]) {
+                for (auto& a : pass) {
+                    if (a.first != r) continue;
+                    out = a.second;
+                    return true;
+                }
+            }
+        }
+        return false;
+    };
+    const auto addBarrier = [&](Barrier& b, uint32_t r, const Dependency& d, VkImageLayout oldLayout, VkImageLayout newLayout) {
+        b.srcStage |= d.srcStage;
+        b.dstStage |= d.dstStage;
+        if (!resources[r].image) {
+            b.memory = true;
+            b.srcAccess |= d.srcAccess;
+            b.dstAccess |= d.dstAccess;
+            return;
+        }
+        VkImageMemoryBarrier ib = {};
+        ib.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        ib.srcAccessMask = d.srcAccess;
+        ib.dstAccessMask = d.dstAccess;
+        ib.oldLayout = oldLayout;
+        ib.newLayout = newLayout;
+        ib.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        ib.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        ib.subresourceRange.aspectMask = IsDepth(resources[r].format) ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+        ib.subresourceRange.levelCount = 1;
+        ib.subresourceRange.layerCount = 1;
+        b.images.push_back(r);
+        b.imageBarriers.push_back(ib);
+    };
+    const auto countBarrier = [&](const Barrier& b) {
+        if (!b.memory && b.images.empty()) return;
+        stats.barrierCalls++;
+        stats.barriers += (b.memory ? 1 : 0) + (uint32_t)b.images.size();
+    };
+
+    //what the async queue last touched is complete once the graphics queue's semaphore wait is over
+    const auto crossQueues = [&](uint32_t r, const Access& a, bool async) {
+        auto& s = states[r];
+        if (async) {
+            if (resources[r].image || s.graphicsUsed) {
+                std::cerr << "render graph: " << resources[r].name << " cannot be used on the async queue!" << std::endl;
+                abort();
+            }
+            s.async = true;
+            return;
+        }
+        s.graphicsUsed = true;
+        if (!s.async) return;
+        asyncWaitStage |= a.stage;
+        const auto layout = s.layout;
+        s = {};
+        s.layout = layout;
+        s.graphicsUsed = true;
+    };
+
+    for (size_t g = 0; g < groups.size(); g++) {
+        auto& group = groups[g];
+        const bool graphics = passes[group.passes[0]].type == PASS_GRAPHICS;
+        group.async = asyncCompute && passes[group.passes[0]].type == PASS_ASYNC_COMPUTE;
+
+        //an aliased image takes over the memory, and the hazards, of the one before it
+        for (auto& pass : accesses[g]) {
+            for (auto& a : pass) {
+                const auto& res = resources[a.first];
+                if (res.aliasOf != NONE && res.firstPass == g) {
+                    states[a.first] = states[res.aliasOf];
+                    states[a.first].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+                }
+            }
+        }
+
+        //whatever is not an attachment is synchronized before the render pass begins
+        for (auto& pass : accesses[g]) {
+            for (auto& a : pass) {
+                if (a.second.attachment) continue;
+                crossQueues(a.first, a.second, group.async);
+                auto& s = states[a.first];
+                const bool layoutChange = resources[a.first].image && s.layout != a.second.layout;
+                Dependency d;
+                const bool need = Hazard(s, a.second, layoutChange, d);
+                if (need) addBarrier(group.before, a.first, d, s.layout, a.second.layout);
+                Advance(s, a.second, need, layoutChange);
+            }
+        }
+        countBarrier(group.before);
+        if (!graphics) continue;
+
+        //attachments in the order they first appear
+        for (auto& pass : accesses[g]) {
+            for (auto& a : pass) {
+                if (a.second.attachment && std::find(group.attachments.begin(), group.attachments.end(), a.first)
+                        == group.attachments.end()) {
+                    group.attachments.push_back(a.first);
+                }
+            }
+        }
+        const auto count = (uint32_t)group.attachments.size();
+        std::vector<VkAttachmentDescription> descs(count);
+        std::vector<uint32_t> lastSubpass(count, VK_SUBPASS_EXTERNAL);
+        std::vector<VkSubpassDependency> deps;
+        group.clears.assign(count, VkClearValue{});
+        for (uint32_t i = 0; i < count; i++) {
+            const auto r = group.attachments[i];
+            auto& desc = descs[i];
+            desc.format = resources[r].format;
+            desc.samples = VK_SAMPLE_COUNT_1_BIT;
+            desc.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            desc.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+
+            bool cleared = false;
+            for (auto& c : passes[group.passes[0]].clears) {
+                if (c.first == r) {
+                    cleared = true;
+                    group.clears[i] = c.second;
+                }
+            }
+            for (size_t sp = 1; sp < group.passes.size() && !cleared; sp++) {
+                for (auto& c : passes[group.passes[sp]].clears) {
+                    if (c.first != r) continue;
+                    //a clear in a later subpass only counts if the attachment is not used before it
+                    bool usedBefore = false;
+                    for (size_t e = 0; e < sp; e++) {
+                        for (auto& a : accesses[g][e]) usedBefore = usedBefore || a.first == r;
+                    }
+                    if (usedBefore) continue;
+                    cleared = true;
+                    group.clears[i] = c.second;
+                }
+            }
+            const bool hasContents = states[r].layout != VK_IMAGE_LAYOUT_UNDEFINED;
+            desc.loadOp = cleared ? VK_ATTACHMENT_LOAD_OP_CLEAR
+                : hasContents ? VK_ATTACHMENT_LOAD_OP_LOAD : VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            //what is not loaded need not be transitioned from anything
+            desc.initialLayout = (desc.loadOp == VK_ATTACHMENT_LOAD_OP_LOAD) ? states[r].layout : VK_IMAGE_LAYOUT_UNDEFINED;
+        }
+
+        //attachment refs, and the dependencies between the subpasses using the same attachment
+        std::vector<std::vector<VkAttachmentReference>> colorRefs(group.passes.size());
+        std::vector<std::vector<VkAttachmentReference>> inputRefs(group.passes.size());
+        std::vector<VkAttachmentReference> depthRefs(group.passes.size(), VkAttachmentReference{ VK_ATTACHMENT_UNUSED,
+            VK_IMAGE_LAYOUT_UNDEFINED });
+        for (uint32_t sp = 0; sp < group.passes.size(); sp++) {
+            for (auto& a : accesses[g][sp]) {
+                if (!a.second.attachment) continue;
+                const auto i = (uint32_t)(std::find(group.attachments.begin(), group.attachments.end(), a.first)
+                    - group.attachments.begin());
+                crossQueues(a.first, a.second, false);
+                auto& s = states[a.first];
+                //the render pass transitions it, that only has to wait if anything came before
+                const bool layoutChange = s.layout != a.second.layout && (s.pending || s.readStages);
+                Dependency d;
+                const bool need = Hazard(s, a.second, layoutChange, d);
+                if (need) AddTo(deps, lastSubpass[i], sp, d);
+                Advance(s, a.second, need, layoutChange);
+                lastSubpass[i] = sp;
+
+                const VkAttachmentReference ref = { i, a.second.layout };
+                if (a.second.layout == VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL) colorRefs[sp].push_back(ref);
+                else if (a.second.layout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) depthRefs[sp] = ref;
+                else inputRefs[sp].push_back(ref);
+            }
+        }
+
+        //where each attachment goes after the render pass
+        for (uint32_t i = 0; i < count; i++) {
+            const auto r = group.attachments[i];
+            auto& desc = descs[i];
+            auto& s = states[r];
+            Access next;
+            const bool later = nextAccess(r, g, next);
+            desc.storeOp = (later || resources[r].imported) ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            desc.finalLayout = s.layout;
+            if (!later) {
+                if (resources[r].imported) {
+                    desc.finalLayout = resources[r].finalLayout;
+                    s.layout = desc.finalLayout;
+                }
+                continue;
+            }
+            if (next.attachment) continue; //the next render pass waits for it
+            //hand it over in the layout the next pass wants, that pass then needs no barrier of its own
+            const bool layoutChange = resources[r].image && s.layout != next.layout;
+            Dependency d;
+            const bool need = Hazard(s, next, layoutChange, d);
+            if (need) AddTo(deps, lastSubpass[i], VK_SUBPASS_EXTERNAL, d);
+            if (!need) continue;
+            //only the dependency is applied here, the next pass still makes its own read or write
+            if (layoutChange) {
+                desc.finalLayout = next.layout;
+                s.layout = next.layout;
+                s.pending = true;
+                s.writeStage = next.stage;
+                s.writeAccess = 0;
+                s.visibleStages = next.stage;
+                s.visibleAccess = next.access;
+                s.readStages = 0;
+            }
+            else {
+                s.visibleStages |= next.stage;
+                s.visibleAccess |= next.access;
+                if (next.write) s.readStages = 0;
+            }
+        }
+
+        std::vector<std::vector<uint32_t>> preserves(group.passes.size());
+        for (uint32_t i = 0; i < count; i++) {
+            uint32_t first = NONE, last = 0;
+            for (uint32_t sp = 0; sp < group.passes.size(); sp++) {
+                for (auto& a : accesses[g][sp]) {
+                    if (a.first != group.attachments[i]) continue;
+                    first = std::min(first, sp);
+                    last = std::max(last, sp);
+                }
+            }
+            for (uint32_t sp = first + 1; sp < last; sp++) {
+                bool used = false;
+                for (auto& a : accesses[g][sp]) used = used || a.first == group.attachments[i];
+                if (!used) preserves[sp].push_back(i);
+            }
+        }
+
+        std::vector<VkSubpassDescription> subpasses(group.passes.size());
+        for (uint32_t sp = 0; sp < group.passes.size(); sp++) {
+            auto& desc = subpasses[sp];
+            desc = {};
+            desc.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+            desc.colorAttachmentCount = (uint32_t)colorRefs[sp].size();
+            desc.pColorAttachments = colorRefs[sp].data();
+            desc.inputAttachmentCount = (uint32_t)inputRefs[sp].size();
+            desc.pInputAttachments = inputRefs[sp].data();
+            desc.pDepthStencilAttachment = (depthRefs[sp].attachment == VK_ATTACHMENT_UNUSED) ? nullptr : &depthRefs[sp];
+            desc.preserveAttachmentCount = (uint32_t)preserves[sp].size();
+            desc.pPreserveAttachments = preserves[sp].data();
+        }
+        group.renderPass = GetRenderPass(descs, subpasses, deps);
+        stats.renderPasses++;
+        stats.dependencies += (uint32_t)deps.size();
+    }
+
+    //imported images not left in their final layout by a render pass
+    for (uint32_t r = 0; r < resources.size(); r++) {
+        const auto& res = resources[r];
+        auto& s = states[r];
+        if (!res.imported || !res.image || s.layout == res.finalLayout) continue;
+        Dependency d;
+        d.srcStage = s.writeStage | s.readStages;
+        if (!d.srcStage) d.srcStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        d.srcAccess = s.pending ? s.writeAccess : 0;
+        d.dstStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+        d.dstAccess = 0;
+        addBarrier(after, r, d, s.layout, res.finalLayout);
+    }
+    countBarrier(after);
+}
+
+void RenderGraph::Compile(bool mergeSubpasses, bool async) {
+    if (compiled) {
+        std::cerr << "render graph: compiled twice!" << std::endl;
+        abort();
+    }
+    compiled = true;
+    asyncCompute = async;
+    stats.passes = (uint32_t)passes.size();
+    Cull();
+    for (auto& p : passes) {
+        if (p.culled) stats.culledPasses++;
+    }
+    Merge(mergeSubpasses);
+    for (auto& g : groups) {
+        g.scopeName = scopeNames.insert(g.name).first->c_str();
+    }
+    Allocate();
+    Plan();
+}
+
+VkRenderPass RenderGraph::RenderPass(uint32_t pass, uint32_t* subpass) const {
+    const auto& p = passes[pass];
+    if (p.culled || p.type != PASS_GRAPHICS) return VK_NULL_HANDLE;
+    if (subpass) *subpass = p.subpass;
+    return groups[p.group].renderPass;
+}
+
+std::vector<uint32_t> RenderGraph::Order() const {
+    std::vector<uint32_t> order;
+    for (auto& g : groups) {
+        order.insert(order.end(), g.passes.begin(), g.passes.end());
+    }
+    return order;
+}
+
+VkImageView RenderGraph::View(uint32_t resource) const {
+    return resources[resource].view;
+}
+
+void RenderGraph::SetImage(uint32_t resource, VkImage image, VkImageView view) {
+    resources[resource].handle = image;
+    resources[resource].view = view;
+}
+
+void RenderGraph::SetContents(uint32_t pass, VkSubpassContents contents) {
+    passes[pass].contents = contents;
+}
+
+void RenderGraph::RecordBarrier(VkCommandBuffer cmd, Barrier& barrier) {
+    if (!barrier.memory && barrier.images.empty()) return;
+    for (size_t a = 0; a < barrier.images.size(); a++) {
+        barrier.imageBarriers[a].image = resources[barrier.images[a]].handle;
+    }
+    VkMemoryBarrier mb = {};
+    mb.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    mb.srcAccessMask = barrier.srcAccess;
+    mb.dstAccessMask = barrier.dstAccess;
+    vkCmdPipelineBarrier(cmd, barrier.srcStage, barrier.dstStage, 0, barrier.memory ? 1 : 0, &mb, 0, nullptr,
+        (uint32_t)barrier.imageBarriers.size(), barrier.imageBarriers.data());
+}
+
+void RenderGraph::Execute(VkCommandBuffer cmd, VkCommandBuffer asyncCmd) {
+    for (auto& g : groups) {
+        //the profiler's queries belong to the graphics queue
+        if (g.async) {
+            RecordBarrier(asyncCmd, g.before);
+            const PassContext ctx = { asyncCmd, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, {} };
+            for (auto p : g.passes) {
+                passes[p].record(ctx);
+            }
+            continue;
+        }
+        Profiler::BeginScope(cmd, g.scopeName, true);
+        RecordBarrier(cmd, g.before);
+
+        if (passes[g.passes[0]].type != PASS_GRAPHICS) {
+            const PassContext ctx = { cmd, VK_NULL_HANDLE, 0, VK_NULL_HANDLE, {} };
+            for (auto p : g.passes) {
+                passes[p].record(ctx);
+            }
+            Profiler::EndScope(cmd);
+            continue;
+        }
+
+        std::vector<VkImageView> views;
+        for (auto r : g.attachments) {
+            views.push_back(resources[r].view);
+        }
+        auto& framebuffer = g.framebuffers[views];
+        if (!framebuffer) {
+            VkFramebufferCreateInfo info = {};
+            info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            info.renderPass = g.renderPass;
+            info.attachmentCount = (uint32_t)views.size();
+            info.pAttachments = views.data();
+            info.width = g.extent.width;
+            info.height = g.extent.height;
+            info.layers = 1;
+            VKDO(vkCreateFramebuffer(graphDevice, &info, nullptr, &framebuffer));
+        }
+
+        VkRenderPassBeginInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        info.renderPass = g.renderPass;
+        info.framebuffer = framebuffer;
+        info.renderArea.extent = g.extent;
+        info.clearValueCount = (uint32_t)g.clears.size();
+        info.pClearValues = g.clears.data();
+        vkCmdBeginRenderPass(cmd, &info, passes[g.passes[0]].contents);
+        for (uint32_t sp = 0; sp < g.passes.size(); sp++) {
+            auto& pass = passes[g.passes[sp]];
+            if (sp) vkCmdNextSubpass(cmd, pass.contents);
+            const PassContext ctx = { cmd, g.renderPass, sp, framebuffer, g.extent };
+            pass.record(ctx);
+        }
+        vkCmdEndRenderPass(cmd);
+        Profiler::EndScope(cmd);
+    }
+    RecordBarrier(cmd, after);
+}
+
+bool RenderGraph::HasAsyncWork() const {
+    for (auto& g : groups) {
+        if (g.async) return true;
+    }
+    return false;
+}
+
+VkPipelineStageFlags RenderGraph::AsyncWaitStage() const {
+    return asyncWaitStage;
+}
+
+const GraphStats& RenderGraph::Stats() const {
+    return stats;
+}
+
+void RenderGraph::Report() const {
+    std::cout << "render graph: " << stats.passes - stats.culledPasses << " of " << stats.passes << " passes in "
+        << groups.size() << " groups, " << stats.renderPasses << " render passes (" << stats.mergedPasses
+        << " merged as subpasses), per frame " << stats.barriers << " barriers in " << stats.barrierCalls
+        << " calls and " << stats.dependencies << " subpass dependencies, transient memory " << stats.transientBytes / 1024 << "KB ("
+        << stats.unaliasedBytes / 1024 << "KB without aliasing) for " << stats.transientImages << " images in "
+        << stats.memorySlots << " slots" << (HasAsyncWork() ? ", async compute" : "") << std::endl;
+}
@@ -0,0 +1,204 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+struct Allocation;
+
+/* how a pass touches a resource, which decides the stages, access and image layout */
+enum GraphUsage {
+    GRAPH_COLOR_ATTACHMENT,
+    GRAPH_DEPTH_ATTACHMENT,
+    /* read in a subpass of the render pass that wrote it */
+    GRAPH_INPUT_ATTACHMENT,
+    GRAPH_SAMPLED,
+    GRAPH_STORAGE_READ,
+    GRAPH_STORAGE_WRITE,
+    GRAPH_INDIRECT,
+    GRAPH_TRANSFER_SRC,
+    GRAPH_TRANSFER_DST
+};
+
+enum PassType {
+    PASS_COMPUTE,
+    PASS_GRAPHICS,
+    /* Compute on the async queue when the graph is compiled with one, otherwise PASS_COMPUTE.
+     * Only buffers, which must not have been used on the graphics queue earlier in the frame.
+     */
+    PASS_ASYNC_COMPUTE
+};
+
+/* what a pass records with, renderPass and framebuffer are null for compute passes */
+struct PassContext {
+    VkCommandBuffer cmd;
+    VkRenderPass renderPass;
+    uint32_t subpass;
+    VkFramebuffer framebuffer;
+    VkExtent2D extent;
+};
+
+struct GraphStats {
+    uint32_t passes;
+    uint32_t culledPasses;
+    uint32_t renderPasses;
+    /* graphics passes that became a subpass of the pass before them */
+    uint32_t mergedPasses;
+    /* recorded per frame: vkCmdPipelineBarrier calls, the memory and image barriers in them,
+     * and the dependencies inside render passes */
+    uint32_t barrierCalls;
+    uint32_t barriers;
+    uint32_t dependencies;
+    /* memory bound to transient images, and what it would take without aliasing */
+    VkDeviceSize transientBytes;
+    VkDeviceSize unaliasedBytes;
+    /* and the allocations the transient images were placed in */
+    uint32_t transientImages;
+    uint32_t memorySlots;
+};
+
+/* A frame described as passes that declare what they read and write. Compile culls the passes
+ * nothing depends on, places the barriers and layout transitions between the rest, and lets
+ * transient images whose lifetimes do not overlap share memory. Passes run in the order they
+ * were added, so a resource must be written by an earlier pass before it is read.
+ *
+ * Build the graph once, Compile it, then per frame set the imported handles and Execute.
+ * Rebuild it when the sizes change.
+ */
+class RenderGraph {
+public:
+    /* the render passes made by graphs are kept here, so an unchanged pass keeps its handle
+     * (and the pipelines built for it) when a graph is rebuilt. Without a device graphs are
+     * only planned, which makes no vulkan objects and cannot Execute; for tests */
+    static void Init(VkDevice device);
+    static void Exit();
+
+    static RenderGraph* Create();
+    /* the graph must not be in use by the device */
+    static void Destroy(RenderGraph* graph);
+
+    /* An image that outlives the graph, in initialLayout when the frame starts, accessed up to
+     * initialStage before it (such as where the acquire semaphore is waited), and left in finalLayout.
+     */
+    uint32_t ImportImage(const std::string& name, VkFormat format, VkExtent2D extent,
+        VkImageLayout initialLayout, VkPipelineStageFlags initialStage, VkImageLayout finalLayout);
+    /* Buffers are synchronized with memory barriers, so the graph does not need their handles.
+     * Imported resources count as outputs, the passes writing them are never culled.
+     */
+    uint32_t ImportBuffer(const std::string& name);
+    /* an image that only lives within the frame, created and aliased by Compile */
+    uint32_t CreateImage(const std::string& name, VkFormat format, VkExtent2D extent);
+
+    uint32_t AddPass(const std::string& name, PassType type, std::function<void(const PassContext&)> record);
+    void Read(uint32_t pass, uint32_t resource, GraphUsage usage);
+    void Write(uint32_t pass, uint32_t resource, GraphUsage usage);
+    /* clear an attachment written by pass instead of loading it */
+    void Clear(uint32_t pass, uint32_t resource, VkClearValue value);
+
+    /* mergeSubpasses: put consecutive graphics passes of the same size that only read each other
+     * as attachments into one render pass, which keeps the data on chip on tiled gpus.
+     * asyncCompute: record PASS_ASYNC_COMPUTE passes for the async queue, whose buffers are shared
+     * concurrently; the graphics side then waits for them with a semaphore instead of barriers.
+     */
+    void Compile(bool mergeSubpasses, bool asyncCompute);
+
+    /* the render pass a graphics pass runs in after Compile, for its pipelines */
+    VkRenderPass RenderPass(uint32_t pass, uint32_t* subpass = nullptr) const;
+
+    /* the passes Execute records after Compile, in order, without the culled ones */
+    std::vector<uint32_t> Order() const;
+
+    /* the view of an image the graph created, after Compile, for the descriptors of passes reading it */
+    VkImageView View(uint32_t resource) const;
+
+    /* per frame, before Execute */
+    void SetImage(uint32_t resource, VkImage image, VkImageView view);
+    /* how the record function of pass fills its subpass this frame, inline by default */
+    void SetContents(uint32_t pass, VkSubpassContents contents);
+    /* asyncCmd records the async passes, it may be null if HasAsyncWork is false */
+    void Execute(VkCommandBuffer cmd, VkCommandBuffer asyncCmd = VK_NULL_HANDLE);
+    bool HasAsyncWork() const;
+    /* the graphics queue stages that wait for the async queue's semaphore */
+    VkPipelineStageFlags AsyncWaitStage() const;
+
+    const GraphStats& Stats() const;
+    void Report() const;
+
+private:
+    struct Use {
+        uint32_t resource;
+        GraphUsage usage;
+        bool write;
+    };
+    struct Pass {
+        std::string name;
+        PassType type;
+        std::function<void(const PassContext&)> record;
+        std::vector<Use> uses;
+        std::vector<std::pair<uint32_t, VkClearValue>> clears;
+        VkSubpassContents contents;
+        bool culled;
+        //index into groups, and subpass within it
+        uint32_t group;
+        uint32_t subpass;
+    };
+    struct Resource {
+        std::string name;
+        bool image;
+        bool imported;
+        VkFormat format;
+        VkExtent2D extent;
+        VkImageLayout initialLayout;
+        VkPipelineStageFlags initialStage;
+        VkImageLayout finalLayout;
+        VkImageUsageFlags usage;
+        VkImage handle;
+        VkImageView view;
+        //transient images: the memory slot, and the resource that used it last
+        uint32_t slot;
+        uint32_t aliasOf;
+        uint32_t firstPass;
+        uint32_t lastPass;
+    };
+    struct Barrier {
+        VkPipelineStageFlags srcStage;
+        VkPipelineStageFlags dstStage;
+        VkAccessFlags srcAccess;
+        VkAccessFlags dstAccess;
+        //buffers are covered by one memory barrier
+        std::vector<uint32_t> images;
+        std::vector<VkImageMemoryBarrier> imageBarriers;
+        bool memory;
+    };
+    //passes recorded together, one render pass with a subpass each for graphics
+    struct Group {
+        std::vector<uint32_t> passes;
+        std::string name;
+        const char* scopeName;
+        bool async;
+        Barrier before;
+        VkRenderPass renderPass;
+        std::vector<uint32_t> attachments;
+        std::vector<VkClearValue> clears;
+        VkExtent2D extent;
+        std::map<std::vector<VkImageView>, VkFramebuffer> framebuffers;
+    };
+
+    void Cull();
+    void Merge(bool mergeSubpasses);
+    void Allocate();
+    void Plan();
+    void RecordBarrier(VkCommandBuffer cmd, Barrier& barrier);
+
+    std::vector<Pass> passes;
+    std::vector<Resource> resources;
+    std::vector<Group> groups;
+    Barrier after;
+    std::vector<Allocation*> slots;
+    GraphStats stats;
+    bool compiled;
+    bool asyncCompute;
+    VkPipelineStageFlags asyncWaitStage;
+};
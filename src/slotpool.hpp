@@ -0,0 +1,117 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+/* names an object in a SlotPool: its slot in the low 20 bits, the generation of the slot above */
+typedef uint32_t SlotId;
+
+/* Objects stored densely in one array, so going through all of them touches nothing else, and
+ * found through ids that stay valid while other objects come and go. Removing an object moves
+ * the last one into its place and bumps the generation of its slot, so ids of removed objects
+ * find nothing instead of whatever uses the slot next (until the generation wraps, after 4096
+ * reuses of one slot).
+ */
+template<class T>
+class SlotPool {
+public:
+    static const uint32_t INDEX_BITS = 20;
+    static const uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+    static const uint32_t GENERATION_MASK = UINT32_MAX >> INDEX_BITS;
+    /* never returned by Add */
+    static const SlotId NONE = UINT32_MAX;
+
+    SlotId Add(T value) {
+        uint32_t slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else {
+            //the last index is kept free so that NONE is never a live id
+            if (slots.size() >= INDEX_MASK) abort();
+            slot = (uint32_t)slots.size();
+            slots.push_back(Slot{ FREE, 0 });
+        }
+        slots[slot].dense = (uint32_t)items.size();
+        items.push_back(std::move(value));
+        slotOf.push_back(slot);
+        return MakeId(slot);
+    }
+
+    /* null if id was removed */
+    T* Get(SlotId id) {
+        const auto dense = Find(id);
+        return (dense == FREE) ? nullptr : &items[dense];
+    }
+    const T* Get(SlotId id) const {
+        const auto dense = Find(id);
+        return (dense == FREE) ? nullptr : &items[dense];
+    }
+
+    /* false if id was already removed */
+    bool Remove(SlotId id) {
+        const auto dense = Find(id);
+        if (dense == FREE) return false;
+        const auto last = (uint32_t)items.size() - 1;
+        if (dense != last) {
+            items[dense] = std::move(items[last]);
+            slotOf[dense] = slotOf[last];
+            slots[slotOf[dense]].dense = dense;
+        }
+        items.pop_back();
+        slotOf.pop_back();
+        Free(id & INDEX_MASK);
+        return true;
+    }
+
+    void Clear() {
+        for (auto slot : slotOf) {
+            Free(slot);
+        }
+        items.clear();
+        slotOf.clear();
+    }
+
+    uint32_t Size() const { return (uint32_t)items.size(); }
+    /* the id of the object at position i of the array, which changes as objects are removed */
+    SlotId IdAt(uint32_t i) const { return MakeId(slotOf[i]); }
+
+    /* every object, in no particular order */
+    T* begin() { return items.data(); }
+    T* end() { return items.data() + items.size(); }
+    const T* begin() const { return items.data(); }
+    const T* end() const { return items.data() + items.size(); }
+
+private:
+    static const uint32_t FREE = UINT32_MAX;
+
+    struct Slot {
+        /* position in items, FREE when the slot is not used */
+        uint32_t dense;
+        uint32_t generation;
+    };
+
+    SlotId MakeId(uint32_t slot) const {
+        return slot | (slots[slot].generation << INDEX_BITS);
+    }
+
+    uint32_t Find(SlotId id) const {
+        const auto slot = id & INDEX_MASK;
+        if (slot >= slots.size() || slots[slot].generation != (id >> INDEX_BITS)) return FREE;
+        return slots[slot].dense;
+    }
+
+    void Free(uint32_t slot) {
+        slots[slot].dense = FREE;
+        slots[slot].generation = (slots[slot].generation + 1) & GENERATION_MASK;
+        freeSlots.push_back(slot);
+    }
+
+    std::vector<T> items;
+    /* the slot of each item */
+    std::vector<uint32_t> slotOf;
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+};
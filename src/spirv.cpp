@@ -0,0 +1,336 @@
+#include "spirv.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+static const uint32_t SPIRV_MAGIC = 0x07230203;
+static const uint32_t HEADER_WORDS = 5;
+
+enum Op {
+    OP_ENTRY_POINT = 15,
+    OP_TYPE_BOOL = 20,
+    OP_TYPE_INT = 21,
+    OP_TYPE_FLOAT = 22,
+    OP_TYPE_VECTOR = 23,
+    OP_TYPE_MATRIX = 24,
+    OP_TYPE_IMAGE = 25,
+    OP_TYPE_SAMPLER = 26,
+    OP_TYPE_SAMPLED_IMAGE = 27,
+    OP_TYPE_ARRAY = 28,
+    OP_TYPE_RUNTIME_ARRAY = 29,
+    OP_TYPE_STRUCT = 30,
+    OP_TYPE_POINTER = 32,
+    OP_CONSTANT = 43,
+    OP_SPEC_CONSTANT_TRUE = 48,
+    OP_SPEC_CONSTANT_FALSE = 49,
+    OP_SPEC_CONSTANT = 50,
+    OP_VARIABLE = 59,
+    OP_DECORATE = 71,
+    OP_MEMBER_DECORATE = 72
+};
+
+enum Decoration {
+    DECORATION_SPEC_ID = 1,
+    DECORATION_BLOCK = 2,
+    DECORATION_BUFFER_BLOCK = 3,
+    DECORATION_ARRAY_STRIDE = 6,
+    DECORATION_MATRIX_STRIDE = 7,
+    DECORATION_BUILT_IN = 11,
+    DECORATION_LOCATION = 30,
+    DECORATION_BINDING = 33,
+    DECORATION_DESCRIPTOR_SET = 34,
+    DECORATION_OFFSET = 35
+};
+
+enum StorageClass {
+    STORAGE_UNIFORM_CONSTANT = 0,
+    STORAGE_INPUT = 1,
+    STORAGE_UNIFORM = 2,
+    STORAGE_PUSH_CONSTANT = 9,
+    STORAGE_STORAGE_BUFFER = 12
+};
+
+static const uint32_t DIM_BUFFER = 5;
+static const uint32_t DIM_SUBPASS_DATA = 6;
+static const uint32_t NONE = UINT32_MAX;
+
+struct Member {
+    uint32_t offset;
+    uint32_t matrixStride;
+    bool builtIn;
+};
+
+//everything known about one result id
+struct Id {
+    uint32_t op;
+    //the operands after the result id, for types
+    std::vector<uint32_t> operands;
+    //of constants and variables
+    uint32_t type;
+    uint32_t storage;
+    uint32_t value;
+    uint32_t set, binding, location, specId, arrayStride;
+    bool builtIn, block, bufferBlock;
+    std::vector<Member> members;
+};
+
+static uint32_t TypeSize(const std::vector<Id>& ids, uint32_t type, uint32_t matrixStride = 0) {
+    const auto& t = ids[type];
+    switch (t.op) {
+    case OP_TYPE_BOOL:
+        return 4;
+    case OP_TYPE_INT:
+    case OP_TYPE_FLOAT:
+        return t.operands[0] / 8;
+    case OP_TYPE_VECTOR:
+        return t.operands[1] * TypeSize(ids, t.operands[0]);
+    case OP_TYPE_MATRIX:
+        return t.operands[1] * (matrixStride ? matrixStride : TypeSize(ids, t.operands[0]));
+    case OP_TYPE_ARRAY: {
+        const auto length = ids[t.operands[1]].value;
+        return length * (t.arrayStride ? t.arrayStride : TypeSize(ids, t.operands[0]));
+    }
+    case OP_TYPE_STRUCT: {
+        uint32_t size = 0;
+        for (size_t a = 0; a < t.operands.size(); a++) {
+            const auto& m = t.members[a];
+            size = std::max(size, m.offset + TypeSize(ids, t.operands[a], m.matrixStride));
+        }
+        return size;
+    }
+    default:
+        return 0;
+    }
+}
+
+static VkFormat InputFormat(const std::vector<Id>& ids, uint32_t type) {
+    uint32_t count = 1;
+    if (ids[type].op == OP_TYPE_VECTOR) {
+        count = ids[type].operands[1];
+        type = ids[type].operands[0];
+    }
+    const auto& t = ids[type];
+    if (count < 1 || count > 4 || t.operands.empty()) return VK_FORMAT_UNDEFINED;
+    const bool isFloat = (t.op == OP_TYPE_FLOAT);
+    const bool isSigned = (t.op == OP_TYPE_INT) && t.operands[1];
+    if (t.operands[0] == 32) {
+        static const VkFormat floats[] = { VK_FORMAT_R32_SFLOAT, VK_FORMAT_R32G32_SFLOAT, VK_FORMAT_R32G32B32_SFLOAT, VK_FORMAT_R32G32B32A32_SFLOAT };
+        static const VkFormat sints[] = { VK_FORMAT_R32_SINT, VK_FORMAT_R32G32_SINT, VK_FORMAT_R32G32B32_SINT, VK_FORMAT_R32G32B32A32_SINT };
+        static const VkFormat uints[] = { VK_FORMAT_R32_UINT, VK_FORMAT_R32G32_UINT, VK_FORMAT_R32G32B32_UINT, VK_FORMAT_R32G32B32A32_UINT };
+        return (isFloat ? floats : isSigned ? sints : uints)[count - 1];
+    }
+    if (t.operands[0] == 64 && isFloat) {
+        static const VkFormat doubles[] = { VK_FORMAT_R64_SFLOAT, VK_FORMAT_R64G64_SFLOAT, VK_FORMAT_R64G64B64_SFLOAT, VK_FORMAT_R64G64B64A64_SFLOAT };
+        return doubles[count - 1];
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+//NONE if the type is not something a descriptor binds
+static uint32_t DescriptorType(const Id& t, uint32_t storage) {
+    switch (t.op) {
+    case OP_TYPE_STRUCT:
+        if (storage == STORAGE_STORAGE_BUFFER || t.bufferBlock) return VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        return (storage == STORAGE_UNIFORM) ? (uint32_t)VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : NONE;
+    case OP_TYPE_IMAGE: {
+        const auto dim = t.operands[1];
+        const auto sampled = t.operands[5];
+        if (dim == DIM_SUBPASS_DATA) return VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        if (dim == DIM_BUFFER) return (sampled == 2) ? VK_DESCRIPTOR_TYPE_STORAGE_TEXEL_BUFFER : VK_DESCRIPTOR_TYPE_UNIFORM_TEXEL_BUFFER;
+        return (sampled == 2) ? VK_DESCRIPTOR_TYPE_STORAGE_IMAGE : VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    }
+    case OP_TYPE_SAMPLER:
+        return VK_DESCRIPTOR_TYPE_SAMPLER;
+    case OP_TYPE_SAMPLED_IMAGE:
+        return VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    default:
+        return NONE;
+    }
+}
+
+//operands a type needs, and which of them are ids
+static bool TypeOperandsValid(uint32_t op, const std::vector<uint32_t>& operands, uint32_t bound) {
+    size_t needed = 0;
+    std::vector<size_t> idOperands;
+    switch (op) {
+    case OP_TYPE_INT: needed = 2; break;
+    case OP_TYPE_FLOAT: needed = 1; break;
+    case OP_TYPE_VECTOR:
+    case OP_TYPE_MATRIX: needed = 2; idOperands = { 0 }; break;
+    case OP_TYPE_IMAGE: needed = 7; idOperands = { 0 }; break;
+    case OP_TYPE_SAMPLED_IMAGE:
+    case OP_TYPE_RUNTIME_ARRAY: needed = 1; idOperands = { 0 }; break;
+    case OP_TYPE_ARRAY: needed = 2; idOperands = { 0, 1 }; break;
+    case OP_TYPE_POINTER: needed = 2; idOperands = { 1 }; break;
+    case OP_TYPE_STRUCT:
+        for (size_t a = 0; a < operands.size(); a++) idOperands.push_back(a);
+        break;
+    }
+    if (operands.size() < needed) return false;
+    for (auto a : idOperands) {
+        if (operands[a] >= bound) return false;
+    }
+    return true;
+}
+
+static bool Fail(const char* reason) {
+    std::cerr << "cannot reflect shader: " << reason << "!" << std::endl;
+    return false;
+}
+
+bool Spirv::Reflect(const void* code, size_t size, ShaderInfo& info) {
+    info = ShaderInfo();
+    if (size % 4 || size < HEADER_WORDS * 4) return Fail("not a whole number of words");
+    const auto words = (const uint32_t*)code;
+    const size_t count = size / 4;
+    if (words[0] != SPIRV_MAGIC) return Fail("bad magic number");
+    const uint32_t bound = words[3];
+
+    Id blank = {};
+    blank.type = blank.storage = blank.set = blank.binding = blank.location = blank.specId = NONE;
+    std::vector<Id> ids(bound, blank);
+    auto valid = [&](uint32_t id) { return id < bound; };
+    bool entryFound = false;
+    uint32_t executionModel = 0;
+
+    for (size_t w = HEADER_WORDS; w < count; ) {
+        const uint32_t op = words[w] & 0xffff;
+        const uint32_t length = words[w] >> 16;
+        if (!length || w + length > count) return Fail("truncated instruction");
+        const uint32_t* args = words + w + 1;
+        const uint32_t argCount = length - 1;
+        w += length;
+
+        switch (op) {
+        case OP_ENTRY_POINT:
+            if (entryFound || argCount < 3) break;
+            entryFound = true;
+            executionModel = args[0];
+            info.entryPoint = std::string((const char*)(args + 2), strnlen((const char*)(args + 2), (argCount - 2) * 4));
+            break;
+        case OP_DECORATE: {
+            if (argCount < 2 || !valid(args[0])) return Fail("bad decoration");
+            auto& id = ids[args[0]];
+            const uint32_t literal = (argCount > 2) ? args[2] : 0;
+            switch (args[1]) {
+            case DECORATION_SPEC_ID: id.specId = literal; break;
+            case DECORATION_BLOCK: id.block = true; break;
+            case DECORATION_BUFFER_BLOCK: id.bufferBlock = true; break;
+            case DECORATION_ARRAY_STRIDE: id.arrayStride = literal; break;
+            case DECORATION_BUILT_IN: id.builtIn = true; break;
+            case DECORATION_LOCATION: id.location = literal; break;
+            case DECORATION_BINDING: id.binding = literal; break;
+            case DECORATION_DESCRIPTOR_SET: id.set = literal; break;
+            }
+            break;
+        }
+        case OP_MEMBER_DECORATE: {
+            if (argCount < 3 || !valid(args[0])) return Fail("bad member decoration");
+            auto& members = ids[args[0]].members;
+            if (members.size() <= args[1]) members.resize(args[1] + 1, Member());
+            const uint32_t literal = (argCount > 3) ? args[3] : 0;
+            switch (args[2]) {
+            case DECORATION_OFFSET: members[args[1]].offset = literal; break;
+            case DECORATION_MATRIX_STRIDE: members[args[1]].matrixStride = literal; break;
+            case DECORATION_BUILT_IN: members[args[1]].builtIn = true; break;
+            }
+            break;
+        }
+        case OP_TYPE_BOOL:
+        case OP_TYPE_INT:
+        case OP_TYPE_FLOAT:
+        case OP_TYPE_VECTOR:
+        case OP_TYPE_MATRIX:
+        case OP_TYPE_IMAGE:
+        case OP_TYPE_SAMPLER:
+        case OP_TYPE_SAMPLED_IMAGE:
+        case OP_TYPE_ARRAY:
+        case OP_TYPE_RUNTIME_ARRAY:
+        case OP_TYPE_STRUCT:
+        case OP_TYPE_POINTER: {
+            if (argCount < 1 || !valid(args[0])) return Fail("bad type");
+            auto& id = ids[args[0]];
+            id.op = op;
+            id.operands.assign(args + 1, args + argCount);
+            if (!TypeOperandsValid(op, id.operands, bound)) return Fail("bad type operands");
+            if (op == OP_TYPE_STRUCT && id.members.size() < id.operands.size()) {
+                id.members.resize(id.operands.size(), Member());
+            }
+            break;
+        }
+        case OP_CONSTANT:
+        case OP_SPEC_CONSTANT:
+        case OP_SPEC_CONSTANT_TRUE:
+        case OP_SPEC_CONSTANT_FALSE: {
+            if (argCount < 2 || !valid(args[1])) return Fail("bad constant");
+            auto& id = ids[args[1]];
+            id.op = op;
+            id.type = args[0];
+            id.value = (argCount > 2) ? args[2] : (op == OP_SPEC_CONSTANT_TRUE) ? 1 : 0;
+            break;
+        }
+        case OP_VARIABLE: {
+            if (argCount < 3 || !valid(args[1])) return Fail("bad variable");
+            auto& id = ids[args[1]];
+            id.op = op;
+            id.type = args[0];
+            id.storage = args[2];
+            break;
+        }
+        }
+    }
+    if (!entryFound) return Fail("no entry point");
+    static const VkShaderStageFlagBits stages[] = {
+        VK_SHADER_STAGE_VERTEX_BIT, VK_SHADER_STAGE_TESSELLATION_CONTROL_BIT, VK_SHADER_STAGE_TESSELLATION_EVALUATION_BIT,
+        VK_SHADER_STAGE_GEOMETRY_BIT, VK_SHADER_STAGE_FRAGMENT_BIT, VK_SHADER_STAGE_COMPUTE_BIT
+    };
+    if (executionModel >= 6) return Fail("unsupported execution model");
+    info.stage = stages[executionModel];
+
+    //types are declared before use, so every id referenced below is known
+    for (uint32_t a = 0; a < bound; a++) {
+        const auto& v = ids[a];
+        if (v.op == OP_SPEC_CONSTANT || v.op == OP_SPEC_CONSTANT_TRUE || v.op == OP_SPEC_CONSTANT_FALSE) {
+            if (v.specId == NONE || !valid(v.type)) continue;
+            const auto& t = ids[v.type];
+            const uint32_t bytes = (t.op == OP_TYPE_BOOL || t.operands.empty()) ? 4 : t.operands[0] / 8;
+            info.specConstants.push_back(SpecConstant{ v.specId, bytes, v.value });
+            continue;
+        }
+        if (v.op != OP_VARIABLE || !valid(v.type) || ids[v.type].op != OP_TYPE_POINTER) continue;
+        uint32_t type = ids[v.type].operands[1];
+
+        if (v.storage == STORAGE_PUSH_CONSTANT) {
+            info.pushConstantSize = std::max(info.pushConstantSize, TypeSize(ids, type));
+        }
+        else if (v.storage == STORAGE_INPUT && info.stage == VK_SHADER_STAGE_VERTEX_BIT) {
+            const auto& t = ids[type];
+            const bool builtInBlock = !t.members.empty() && t.members[0].builtIn;
+            if (v.builtIn || builtInBlock || v.location == NONE) continue;
+            info.inputs.push_back(ShaderInput{ v.location, InputFormat(ids, type) });
+        }
+        else if (v.storage == STORAGE_UNIFORM_CONSTANT || v.storage == STORAGE_UNIFORM || v.storage == STORAGE_STORAGE_BUFFER) {
+            if (v.binding == NONE) continue;
+            uint32_t arraySize = 1;
+            while (ids[type].op == OP_TYPE_ARRAY || ids[type].op == OP_TYPE_RUNTIME_ARRAY) {
+                if (ids[type].op == OP_TYPE_RUNTIME_ARRAY) arraySize = 0;
+                else arraySize *= ids[ids[type].operands[1]].value;
+                type = ids[type].operands[0];
+            }
+            const auto descriptorType = DescriptorType(ids[type], v.storage);
+            if (descriptorType == NONE) return Fail("unknown descriptor type");
+            info.bindings.push_back(ShaderBinding{ (v.set == NONE) ? 0 : v.set, v.binding, (VkDescriptorType)descriptorType, arraySize });
+        }
+    }
+
+    std::sort(info.bindings.begin(), info.bindings.end(), [](const ShaderBinding& a, const ShaderBinding& b) {
+        return (a.set != b.set) ? a.set < b.set : a.binding < b.binding;
+    });
+    std::sort(info.inputs.begin(), info.inputs.end(), [](const ShaderInput& a, const ShaderInput& b) {
+        return a.location < b.location;
+    });
+    std::sort(info.specConstants.begin(), info.specConstants.end(), [](const SpecConstant& a, const SpecConstant& b) {
+        return a.id < b.id;
+    });
+    return true;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct ShaderBinding {
+    uint32_t set;
+    uint32_t binding;
+    VkDescriptorType type;
+    /* array size, 0 for a runtime array */
+    uint32_t count;
+};
+
+struct ShaderInput {
+    uint32_t location;
+    VkFormat format;
+};
+
+struct SpecConstant {
+    uint32_t id;
+    /* 4 or 8 bytes, bools take 4 */
+    uint32_t size;
+    /* the low 32 bits of the default */
+    uint32_t defaultValue;
+};
+
+/* what a shader expects from the pipeline around it */
+struct ShaderInfo {
+    VkShaderStageFlagBits stage;
+    std::string entryPoint;
+    /* sorted by set, then binding */
+    std::vector<ShaderBinding> bindings;
+    /* bytes of the push constant block, 0 without one */
+    uint32_t pushConstantSize;
+    /* vertex shaders only, sorted by location, built-ins left out */
+    std::vector<ShaderInput> inputs;
+    /* sorted by id */
+    std::vector<SpecConstant> specConstants;
+};
+
+/* Reads the interface of a SPIR-V module straight from its words, without a device.
+ * Only the first entry point is looked at.
+ */
+class Spirv {
+public:
+    /* false with a message if code is not a module this understands */
+    static bool Reflect(const void* code, size_t size, ShaderInfo& info);
+};
@@ -0,0 +1,954 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "allocator.hpp"
+#include "assetpack.hpp"
+#include "devicepicker.hpp"
+#include "filereader.hpp"
+#include "framesync.hpp"
+#include "handles.hpp"
+#include "imagediff.hpp"
+#include "jobsystem.hpp"
+#include "lz4.hpp"
+#include "rendergraph.hpp"
+#include "slotpool.hpp"
+#include "spirv.hpp"
+#include "texturefile.hpp"
+#include "transforms.hpp"
+
+static uint32_t checkCount;
+static uint32_t failCount;
+
+#define CHECK(cond) { checkCount++; if (!(cond)) {\
+    std::cerr << __FILE__ << ":" << __LINE__ << ": " << #cond << " failed" << std::endl;\
+    failCount++;\
+}}
+
+static bool WriteFile(const std::string& path, const std::vector<char>& data) {
+    std::ofstream out(path, std::ios::binary);
+    out.write(data.data(), data.size());
+    return out.good();
+}
+
+//text with repeats, so LZ4 has something to find, and some noise so it cannot find everything
+static std::vector<char> Compressible(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    const char* words[] = { "vertex ", "fragment ", "swapchain ", "queue ", "barrier ", "\n" };
+    std::vector<char> data;
+    while (data.size() < size) {
+        const char* w = words[rng() % 6];
+        data.insert(data.end(), w, w + strlen(w));
+        if (rng() % 8 == 0) data.push_back((char)rng());
+    }
+    data.resize(size);
+    return data;
+}
+
+static std::vector<char> Noise(size_t size, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::vector<char> data(size);
+    for (auto& c : data) c = (char)rng();
+    return data;
+}
+
+static void TestLz4() {
+    std::vector<std::vector<char>> inputs;
+    inputs.push_back(std::vector<char>());
+    inputs.push_back(std::vector<char>(1, 'x'));
+    inputs.push_back(std::vector<char>(100000, 'a'));
+    inputs.push_back(Compressible(300000, 1));
+    inputs.push_back(Noise(70000, 2));
+    for (size_t n = 1; n < 40; n++) inputs.push_back(Compressible(n, (uint32_t)n));
+
+    for (auto& in : inputs) {
+        std::vector<char> packed(Lz4::CompressBound(in.size()));
+        const auto size = Lz4::Compress(in.data(), in.size(), packed.data(), packed.size());
+        CHECK(size > 0 || in.empty());
+        std::vector<char> out(in.size());
+        CHECK(Lz4::Decompress(packed.data(), size, out.data(), out.size()));
+        CHECK(out == in);
+    }
+
+    //repeats shrink a lot, noise stays within the bound
+    const auto& runs = inputs[2];
+    std::vector<char> packed(Lz4::CompressBound(runs.size()));
+    CHECK(Lz4::Compress(runs.data(), runs.size(), packed.data(), packed.size()) < runs.size() / 100);
+    CHECK(Lz4::Compress(runs.data(), runs.size(), packed.data(), 8) == 0);
+
+    //corrupt input must be rejected without reading or writing out of bounds
+    const auto& text = inputs[3];
+    packed.resize(Lz4::CompressBound(text.size()));
+    const auto size = Lz4::Compress(text.data(), text.size(), packed.data(), packed.size());
+    packed.resize(size);
+    std::vector<char> out(text.size());
+    CHECK(!Lz4::Decompress(packed.data(), size - 1, out.data(), out.size()));
+    CHECK(!Lz4::Decompress(packed.data(), size, out.data(), out.size() - 1));
+    CHECK(!Lz4::Decompress(packed.data(), size / 2, out.data(), out.size()));
+    std::mt19937 rng(3);
+    uint32_t rejected = 0;
+    for (int a = 0; a < 200; a++) {
+        auto bad = packed;
+        for (int b = 0; b < 4; b++) bad[rng() % bad.size()] = (char)rng();
+        //a flipped literal still decodes, to the wrong bytes, anything else has to fail
+        if (!Lz4::Decompress(bad.data(), bad.size(), out.data(), out.size())) rejected++;
+    }
+    CHECK(rejected > 0);
+    //offsets pointing before the start of the output
+    const char backRef[] = { 0x10, 'a', 0x10, 0x00, 0x00 };
+    std::vector<char> small(32);
+    CHECK(!Lz4::Decompress(backRef, sizeof(backRef), small.data(), small.size()));
+}
+
+static void TestAssetPack() {
+    const std::vector<std::string> files = { "hvtest_text.bin", "hvtest_noise.bin", "hvtest_small.bin" };
+    std::vector<std::vector<char>> contents;
+    //several LZ4 blocks, one entry that does not shrink and is stored, and one much smaller than a block
+    contents.push_back(Compressible(700000, 4));
+    contents.push_back(Noise(50000, 5));
+    contents.push_back(Compressible(1000, 6));
+    for (size_t a = 0; a < files.size(); a++) CHECK(WriteFile(files[a], contents[a]));
+
+    const std::string path = "hvtest.pack";
+    for (int compress = 0; compress < 2; compress++) {
+        CHECK(AssetPack::Write(path, files, compress != 0));
+        auto pack = AssetPack::Open(path);
+        CHECK(pack);
+        if (!pack) continue;
+
+        CHECK(pack->EntryCount() == files.size());
+        CHECK(pack->Find("missing.bin") == UINT32_MAX);
+        for (size_t a = 0; a < files.size(); a++) {
+            const auto entry = pack->Find(files[a]);
+            CHECK(entry != UINT32_MAX);
+            if (entry == UINT32_MAX) continue;
+            CHECK(pack->Name(entry) == files[a]);
+            CHECK(pack->Size(entry) == contents[a].size());
+            CHECK(pack->IsCompressed(entry) == (compress && a != 1));
+            std::vector<char> out(pack->Size(entry));
+            CHECK(pack->Read(entry, out.data()));
+            CHECK(out == contents[a]);
+        }
+
+        std::vector<char> storage;
+        std::vector<ByteSpan> spans;
+        CHECK(pack->LoadAll(storage, spans));
+        CHECK(spans.size() == files.size());
+        for (size_t a = 0; a < spans.size(); a++) {
+            const auto& c = contents[pack->Find(pack->Name((uint32_t)a))];
+            CHECK(spans[a].size == c.size() && memcmp(spans[a].data, c.data(), c.size()) == 0);
+        }
+        AssetPack::Close(pack);
+    }
+
+    //a truncated pack does not open
+    auto data = FileReader::ReadBytes(path);
+    data.resize(data.size() / 2);
+    CHECK(WriteFile(path, data));
+    CHECK(!AssetPack::Open(path));
+    CHECK(!AssetPack::Open("hvtest_missing.pack"));
+
+    std::remove(path.c_str());
+    for (auto& f : files) std::remove(f.c_str());
+}
+
+//assembles a module by hand, so reflection is checked without glslc
+struct SpirvBuilder {
+    std::vector<uint32_t> words = { 0x07230203, 0x00010000, 0, 0, 0 };
+
+    void Op(uint32_t op, std::vector<uint32_t> args) {
+        words.push_back(op | (uint32_t)(args.size() + 1) << 16);
+        words.insert(words.end(), args.begin(), args.end());
+    }
+};
+
+static void TestSpirvModule() {
+    //a vertex shader with two inputs, a storage buffer array at set 1 binding 3, a push constant
+    //block of a vec2 and a uint, and a uint spec constant 7 with id 5
+    SpirvBuilder m;
+    const uint32_t main = 1, f32 = 2, vec2 = 3, vec3 = 4, inVec2 = 5, inVec3 = 6, pos = 7, color = 8,
+        u32 = 9, uints = 10, ssbo = 11, ssboPtr = 12, buffer = 13, block = 14, blockPtr = 15,
+        constants = 16, spec = 17, four = 18, bufferArray = 19, bound = 20;
+    m.Op(15, { 0, main, 0x6e69616d, 0, pos, color });
+    m.Op(71, { pos, 30, 0 });
+    m.Op(71, { color, 30, 1 });
+    m.Op(71, { ssbo, 2 });
+    m.Op(72, { ssbo, 0, 35, 0 });
+    m.Op(71, { buffer, 34, 1 });
+    m.Op(71, { buffer, 33, 3 });
+    m.Op(71, { block, 2 });
+    m.Op(72, { block, 0, 35, 0 });
+    m.Op(72, { block, 1, 35, 8 });
+    m.Op(71, { spec, 1, 5 });
+    m.Op(22, { f32, 32 });
+    m.Op(23, { vec2, f32, 2 });
+    m.Op(23, { vec3, f32, 3 });
+    m.Op(32, { inVec2, 1, vec2 });
+    m.Op(32, { inVec3, 1, vec3 });
+    m.Op(21, { u32, 32, 0 });
+    m.Op(43, { u32, four, 4 });
+    m.Op(29, { uints, u32 });
+    m.Op(30, { ssbo, uints });
+    m.Op(28, { bufferArray, ssbo, four });
+    m.Op(32, { ssboPtr, 12, bufferArray });
+    m.Op(30, { block, vec2, u32 });
+    m.Op(32, { blockPtr, 9, block });
+    m.Op(50, { u32, spec, 7 });
+    m.Op(59, { inVec2, pos, 1 });
+    m.Op(59, { inVec3, color, 1 });
+    m.Op(59, { ssboPtr, buffer, 12 });
+    m.Op(59, { blockPtr, constants, 9 });
+    m.words[3] = bound;
+
+    ShaderInfo info;
+    CHECK(Spirv::Reflect(m.words.data(), m.words.size() * 4, info));
+    CHECK(info.stage == VK_SHADER_STAGE_VERTEX_BIT);
+    CHECK(info.entryPoint == "main");
+    CHECK(info.inputs.size() == 2);
+    if (info.inputs.size() == 2) {
+        CHECK(info.inputs[0].location == 0 && info.inputs[0].format == VK_FORMAT_R32G32_SFLOAT);
+        CHECK(info.inputs[1].location == 1 && info.inputs[1].format == VK_FORMAT_R32G32B32_SFLOAT);
+    }
+    CHECK(info.bindings.size() == 1);
+    if (info.bindings.size() == 1) {
+        const auto& b = info.bindings[0];
+        CHECK(b.set == 1 && b.binding == 3 && b.type == VK_DESCRIPTOR_TYPE_STORAGE_BUFFER && b.count == 4);
+    }
+    CHECK(info.pushConstantSize == 12);
+    CHECK(info.specConstants.size() == 1);
+    if (info.specConstants.size() == 1) {
+        const auto& s = info.specConstants[0];
+        CHECK(s.id == 5 && s.size == 4 && s.defaultValue == 7);
+    }
+
+    //broken modules fail instead of reading past the end
+    CHECK(!Spirv::Reflect(m.words.data(), m.words.size() * 4 - 4, info));
+    CHECK(!Spirv::Reflect(m.words.data(), 6, info));
+    auto bad = m.words;
+    bad[0] = 0;
+    CHECK(!Spirv::Reflect(bad.data(), bad.size() * 4, info));
+    bad = m.words;
+    bad[3] = pos;
+    CHECK(!Spirv::Reflect(bad.data(), bad.size() * 4, info));
+}
+
+static bool ReflectFile(const std::string& path, ShaderInfo& info) {
+    auto file = MappedFile::Open(path);
+    if (!file) return false;
+    const auto span = file->Span();
+    const bool ok = Spirv::Reflect(span.data, span.size, info);
+    MappedFile::Close(file);
+    CHECK(ok);
+    return ok;
+}
+
+static bool HasBinding(const ShaderInfo& info, uint32_t set, uint32_t binding, VkDescriptorType type, uint32_t count) {
+    for (auto& b : info.bindings) {
+        if (b.set == set && b.binding == binding) return b.type == type && b.count == count;
+    }
+    return false;
+}
+
+//the shaders the renderer loads, where glslc has built them next to the executable
+static void TestSpirvShaders() {
+    ShaderInfo info;
+    uint32_t found = 0;
+    for (auto path : { "tri_v.spv", "inst_v.spv" }) {
+        if (!ReflectFile(path, info)) continue;
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_VERTEX_BIT);
+        CHECK(info.entryPoint == "main");
+        CHECK(info.inputs.size() == 2);
+        if (info.inputs.size() == 2) {
+            CHECK(info.inputs[0].location == 0 && info.inputs[0].format == VK_FORMAT_R32G32_SFLOAT);
+            CHECK(info.inputs[1].location == 1 && info.inputs[1].format == VK_FORMAT_R32G32B32_SFLOAT);
+        }
+        CHECK(info.pushConstantSize == 0);
+        if (std::string(path) == "tri_v.spv") {
+            CHECK(info.bindings.empty());
+        }
+        else {
+            CHECK(info.bindings.size() == 2);
+            CHECK(HasBinding(info, 0, 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1));
+            CHECK(HasBinding(info, 0, 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1));
+        }
+    }
+    if (ReflectFile("tri_f.spv", info)) {
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_FRAGMENT_BIT);
+        CHECK(info.bindings.empty() && info.inputs.empty() && info.pushConstantSize == 0);
+    }
+    if (ReflectFile("tri_b_f.spv", info)) {
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_FRAGMENT_BIT);
+        CHECK(info.bindings.size() == 1);
+        CHECK(HasBinding(info, 0, 2, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 0));
+        CHECK(info.pushConstantSize == 16);
+        CHECK(info.specConstants.size() == 1);
+        if (info.specConstants.size() == 1) {
+            CHECK(info.specConstants[0].id == 0 && info.specConstants[0].defaultValue == 1);
+        }
+    }
+    if (ReflectFile("cull_c.spv", info)) {
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_COMPUTE_BIT);
+        CHECK(info.bindings.size() == 4);
+        for (uint32_t b = 0; b < 4; b++) CHECK(HasBinding(info, 0, b, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1));
+        CHECK(info.pushConstantSize == 68);
+    }
+    //the render graph's copies, which make their own vertices
+    if (ReflectFile("copy_v.spv", info)) {
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_VERTEX_BIT);
+        CHECK(info.bindings.empty() && info.inputs.empty() && info.pushConstantSize == 0);
+    }
+    if (ReflectFile("copy_f.spv", info)) {
+        found++;
+        CHECK(info.stage == VK_SHADER_STAGE_FRAGMENT_BIT);
+        CHECK(info.bindings.size() == 1);
+        CHECK(HasBinding(info, 0, 0, VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT, 1));
+    }
+    if (found < 7) std::cout << "  " << 7 - found << " of 7 shaders not built, skipped" << std::endl;
+}
+
+static void TestImageDiff() {
+    std::mt19937 rng(7);
+    //tails of every length after the 4 pixel steps
+    for (size_t pixels : { 0, 1, 2, 3, 4, 5, 6, 7, 9, 15, 17, 31, 33, 1023, 4099 }) {
+        std::vector<uint8_t> a(pixels * 4), b(pixels * 4);
+        for (size_t p = 0; p < a.size(); p++) {
+            a[p] = (uint8_t)rng();
+            //mostly small deltas, some large ones, in either direction
+            const int delta = (rng() % 4 == 0) ? (int)(rng() % 256) - 128 : (int)(rng() % 7) - 3;
+            b[p] = (uint8_t)std::min(255, std::max(0, a[p] + delta));
+        }
+        for (uint32_t tolerance : { 0u, 2u, 40u }) {
+            const auto simd = ImageDiff::Compare(a.data(), b.data(), pixels, tolerance);
+            const auto scalar = ImageDiff::CompareScalar(a.data(), b.data(), pixels, tolerance);
+            CHECK(simd.pixels == pixels && scalar.pixels == pixels);
+            CHECK(simd.failed == scalar.failed);
+            CHECK(simd.maxDelta == scalar.maxDelta);
+            CHECK(std::fabs(simd.meanDelta - scalar.meanDelta) < 1e-9);
+        }
+        const auto same = ImageDiff::Compare(a.data(), a.data(), pixels, 0);
+        CHECK(same.failed == 0 && same.maxDelta == 0);
+    }
+
+    //only the last pixel differs, in the tail
+    std::vector<uint8_t> a(7 * 4, 100), b(7 * 4, 100);
+    b[6 * 4 + 1] = 200;
+    const auto tail = ImageDiff::Compare(a.data(), b.data(), 7, 2);
+    CHECK(tail.failed == 1 && tail.maxDelta > 2);
+    //alpha is ignored
+    b = a;
+    b[3] = 0;
+    CHECK(ImageDiff::Compare(a.data(), b.data(), 7, 0).failed == 0);
+}
+
+static void TestSlotPool() {
+    SlotPool<int> pool;
+    const auto a = pool.Add(1), b = pool.Add(2), c = pool.Add(3);
+    CHECK(pool.Size() == 3);
+    CHECK(a != b && b != c && a != SlotPool<int>::NONE);
+    CHECK(pool.Get(a) && *pool.Get(a) == 1);
+    CHECK(pool.Get(b) && *pool.Get(b) == 2);
+
+    //the last object moves into the hole, its id still finds it
+    CHECK(pool.Remove(a));
+    CHECK(pool.Size() == 2);
+    CHECK(!pool.Get(a));
+    CHECK(!pool.Remove(a));
+    CHECK(pool.Get(c) && *pool.Get(c) == 3);
+    CHECK(pool.IdAt(0) == c && pool.IdAt(1) == b);
+
+    //the slot is reused under a new generation, the stale id still finds nothing
+    const auto d = pool.Add(4);
+    CHECK((d & SlotPool<int>::INDEX_MASK) == (a & SlotPool<int>::INDEX_MASK));
+    CHECK(d != a);
+    CHECK(!pool.Get(a));
+    CHECK(pool.Get(d) && *pool.Get(d) == 4);
+    CHECK(!pool.Get(SlotPool<int>::NONE));
+
+    int sum = 0;
+    for (auto v : pool) sum += v;
+    CHECK(sum == 2 + 3 + 4);
+
+    pool.Clear();
+    CHECK(pool.Size() == 0);
+    CHECK(!pool.Get(b) && !pool.Get(c) && !pool.Get(d));
+
+    //against a plain map, with many reuses of the same slots
+    SlotPool<uint32_t> p;
+    std::vector<std::pair<SlotId, uint32_t>> live, dead;
+    std::mt19937 rng(8);
+    for (uint32_t n = 0; n < 20000; n++) {
+        if (live.empty() || rng() % 3) {
+            live.push_back(std::make_pair(p.Add(n), n));
+        }
+        else {
+            const auto i = rng() % live.size();
+            CHECK(p.Remove(live[i].first));
+            dead.push_back(live[i]);
+            live[i] = live.back();
+            live.pop_back();
+        }
+        if (live.size() > 64) {
+            for (auto& l : live) {
+                CHECK(p.Remove(l.first));
+                dead.push_back(l);
+            }
+            live.clear();
+        }
+    }
+    CHECK(p.Size() == live.size());
+    for (auto& l : live) CHECK(p.Get(l.first) && *p.Get(l.first) == l.second);
+    uint32_t stale = 0;
+    for (auto& d : dead) stale += p.Get(d.first) ? 1 : 0;
+    CHECK(stale == 0);
+    for (uint32_t i = 0; i < p.Size(); i++) CHECK(p.Get(p.IdAt(i)) == p.begin() + i);
+}
+
+static void TestBuddy() {
+    const VkDeviceSize SIZE = 4096, MIN_NODE = 256;
+    BuddyNodes nodes;
+    nodes.Init(SIZE, MIN_NODE);
+    CHECK(nodes.freeLists.size() == 5);
+    CHECK(nodes.LargestFree() == SIZE);
+
+    //the first small node splits every level down to it
+    VkDeviceSize offset = 1;
+    CHECK(nodes.AllocNode(4, &offset) && offset == 0);
+    CHECK(nodes.reserved == MIN_NODE);
+    for (uint32_t l = 1; l <= 4; l++) CHECK(nodes.freeLists[l].size() == 1 && *nodes.freeLists[l].begin() == SIZE >> l);
+    CHECK(nodes.LargestFree() == SIZE / 2);
+    CHECK(nodes.AllocNode(4, &offset) && offset == 256);
+    CHECK(nodes.AllocNode(1, &offset) && offset == 2048);
+    CHECK(!nodes.AllocNode(1, &offset));
+    CHECK(nodes.AllocNode(2, &offset) && offset == 1024);
+    CHECK(nodes.LargestFree() == 512);
+
+    //freeing merges with free buddies only
+    nodes.FreeNode(0, 4);
+    CHECK(nodes.freeLists[4].size() == 1 && nodes.LargestFree() == 512);
+    nodes.FreeNode(256, 4);
+    CHECK(nodes.freeLists[4].empty() && nodes.freeLists[2].size() == 1 && nodes.LargestFree() == 1024);
+    nodes.FreeNode(1024, 2);
+    nodes.FreeNode(2048, 1);
+    CHECK(nodes.reserved == 0);
+    CHECK(nodes.freeLists[0].size() == 1 && nodes.LargestFree() == SIZE);
+    for (uint32_t l = 1; l <= 4; l++) CHECK(nodes.freeLists[l].empty());
+
+    //random sizes until full: aligned, inside the block, never overlapping, and all merged back at the end
+    std::mt19937 rng(9);
+    BuddyNodes big;
+    big.Init(1 << 20, MIN_NODE);
+    for (int round = 0; round < 20; round++) {
+        std::vector<std::pair<VkDeviceSize, uint32_t>> allocs;
+        std::vector<bool> used((1 << 20) / MIN_NODE);
+        VkDeviceSize reserved = 0;
+        uint32_t misses = 0;
+        while (misses < 20) {
+            const uint32_t level = 2 + rng() % 10;
+            const VkDeviceSize nodeSize = big.size >> level;
+            if (!big.AllocNode(level, &offset)) {
+                misses++;
+                continue;
+            }
+            CHECK(offset % nodeSize == 0 && offset + nodeSize <= big.size);
+            bool overlap = false;
+            for (auto n = offset / MIN_NODE; n < (offset + nodeSize) / MIN_NODE; n++) {
+                if (used[n]) overlap = true;
+                used[n] = true;
+            }
+            CHECK(!overlap);
+            reserved += nodeSize;
+            allocs.push_back(std::make_pair(offset, level));
+            //free some along the way, so splits and merges interleave
+            if (rng() % 3 == 0) {
+                const auto i = rng() % allocs.size();
+                big.FreeNode(allocs[i].first, allocs[i].second);
+                const auto s = big.size >> allocs[i].second;
+                for (auto n = allocs[i].first / MIN_NODE; n < (allocs[i].first + s) / MIN_NODE; n++) used[n] = false;
+                reserved -= s;
+                allocs[i] = allocs.back();
+                allocs.pop_back();
+            }
+        }
+        CHECK(big.reserved == reserved);
+        std::shuffle(allocs.begin(), allocs.end(), rng);
+        for (auto& a : allocs) big.FreeNode(a.first, a.second);
+        CHECK(big.reserved == 0 && big.LargestFree() == big.size);
+    }
+}
+
+static DeviceInfo MakeDevice(const char* name, VkPhysicalDeviceType type, VkDeviceSize localMemory) {
+    DeviceInfo d = {};
+    d.name = name;
+    d.type = type;
+    d.apiVersion = VK_API_VERSION_1_2;
+    d.localMemory = localMemory;
+    VkQueueFamilyProperties family = {};
+    family.queueFlags = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT | VK_QUEUE_TRANSFER_BIT;
+    family.queueCount = 1;
+    d.queueFamilies.push_back(family);
+    d.present.push_back(true);
+    d.extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    d.groupSize = 1;
+    return d;
+}
+
+static void TestDevicePicker() {
+    const VkDeviceSize GB = 1ull << 30;
+    std::string reason;
+    std::vector<DeviceInfo> devices = {
+        MakeDevice("Integrated Graphics", VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU, 60 * GB),
+        MakeDevice("llvmpipe", VK_PHYSICAL_DEVICE_TYPE_CPU, 60 * GB),
+        MakeDevice("Discrete Small", VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU, 4 * GB),
+        MakeDevice("Discrete Large", VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU, 16 * GB),
+    };
+    //the type outweighs any amount of memory, memory breaks the tie between the discrete ones
+    CHECK(DevicePicker::Score(devices[2], false, reason) > DevicePicker::Score(devices[0], false, reason));
+    CHECK(DevicePicker::Score(devices[0], false, reason) > DevicePicker::Score(devices[1], false, reason));
+    CHECK(DevicePicker::Pick(devices, false, "") == 3);
+    CHECK(DevicePicker::Pick(devices, true, "") == 3);
+    devices[2].localMemory = devices[3].localMemory;
+    CHECK(DevicePicker::Pick(devices, false, "") == 2);
+    devices[2].localMemory = 4 * GB;
+
+    //a graphics family that cannot present, or no swapchain, only does headless
+    auto noPresent = devices[3];
+    noPresent.present[0] = false;
+    CHECK(DevicePicker::Score(noPresent, false, reason) < 0 && !reason.empty());
+    CHECK(DevicePicker::Score(noPresent, true, reason) >= 0);
+    auto noSwapchain = devices[3];
+    noSwapchain.extensions.clear();
+    CHECK(DevicePicker::Score(noSwapchain, false, reason) < 0 && !reason.empty());
+    CHECK(DevicePicker::Score(noSwapchain, true, reason) >= 0);
+    //presenting from a family without graphics does not count
+    auto presentElsewhere = devices[3];
+    presentElsewhere.present[0] = false;
+    VkQueueFamilyProperties computeOnly = {};
+    computeOnly.queueFlags = VK_QUEUE_COMPUTE_BIT;
+    computeOnly.queueCount = 1;
+    presentElsewhere.queueFamilies.push_back(computeOnly);
+    presentElsewhere.present.push_back(true);
+    CHECK(DevicePicker::Score(presentElsewhere, false, reason) < 0);
+    auto noGraphics = devices[3];
+    noGraphics.queueFamilies[0].queueFlags = VK_QUEUE_COMPUTE_BIT;
+    CHECK(DevicePicker::Score(noGraphics, true, reason) < 0);
+
+    devices[3] = noPresent;
+    CHECK(DevicePicker::Pick(devices, false, "") == 2);
+    CHECK(DevicePicker::Pick(devices, true, "") == 3);
+    devices[3] = noSwapchain;
+    CHECK(DevicePicker::Pick(devices, false, "") == 2);
+    CHECK(DevicePicker::Pick(devices, true, "") == 3);
+
+    //a choice wins over the scores, by index or by part of the name in any case
+    CHECK(DevicePicker::Pick(devices, false, "0") == 0);
+    CHECK(DevicePicker::Pick(devices, false, "1") == 1);
+    CHECK(DevicePicker::Pick(devices, false, "LLVM") == 1);
+    CHECK(DevicePicker::Pick(devices, false, "integrated") == 0);
+    //of several matches the best one
+    CHECK(DevicePicker::Pick(devices, true, "discrete") == 3);
+    CHECK(DevicePicker::Pick(devices, false, "discrete") == 2);
+    //a chosen device that cannot be used, or none at all, is -1
+    CHECK(DevicePicker::Pick(devices, false, "3") == -1);
+    CHECK(DevicePicker::Pick(devices, false, "large") == -1);
+    CHECK(DevicePicker::Pick(devices, true, "large") == 3);
+    CHECK(DevicePicker::Pick(devices, false, "4") == -1);
+    CHECK(DevicePicker::Pick(devices, false, "radeon") == -1);
+    CHECK(DevicePicker::Pick(std::vector<DeviceInfo>(), true, "") == -1);
+}
+
+//the same random hierarchy, added out of depth order, moved all at once and then a few objects at a time
+static void BuildTransforms(uint32_t count, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> pos(-10, 10);
+    Transforms::Clear();
+    for (uint32_t a = 0; a < count; a++) {
+        const uint32_t parent = (a == 0 || rng() % 10 == 0) ? Transforms::NONE : rng() % a;
+        const glm::vec3 axes[] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1) };
+        Transforms::Add(parent, glm::vec3(pos(rng), pos(rng), pos(rng)), glm::angleAxis(pos(rng), axes[rng() % 3]), glm::vec3(1 + pos(rng) * 0.05f),
+            glm::vec3(pos(rng)), glm::vec3(0.5f));
+    }
+}
+
+static std::vector<GpuTransform> UpdateTransforms(uint32_t kernel, uint32_t count) {
+    std::vector<GpuTransform> out(count);
+    BuildTransforms(count, 99);
+    Transforms::UpdateInto(kernel, out.data());
+    std::mt19937 rng(7);
+    for (uint32_t it = 0; it < 3; it++) {
+        for (uint32_t a = 0; a < count / 30; a++) {
+            Transforms::SetLocal(rng() % count, glm::vec3(it, 1, 2), glm::angleAxis(it * 0.3f, glm::vec3(0, 1, 0)),
+                glm::vec3(2));
+        }
+        Transforms::UpdateInto(kernel, out.data());
+    }
+    return out;
+}
+
+//the simd kernels give the same bits as the scalar one, dense and sparse
+static void TestTransforms() {
+    const uint32_t count = 1001;
+    const auto scalar = UpdateTransforms(0, count);
+    CHECK(Transforms::KernelCount() >= 1);
+    CHECK(!strcmp(Transforms::KernelName(0), "scalar"));
+    for (uint32_t k = 1; k < Transforms::KernelCount(); k++) {
+        std::cout << "  " << Transforms::KernelName(k) << std::endl;
+        const auto out = UpdateTransforms(k, count);
+        CHECK(!memcmp(out.data(), scalar.data(), count * sizeof(GpuTransform)));
+    }
+    Transforms::Clear();
+}
+
+static void NoRecord(const PassContext&) {}
+
+//graphs are planned without a device, see RenderGraph::Init
+static void TestRenderGraph() {
+    RenderGraph::Init(VK_NULL_HANDLE);
+    const VkExtent2D full = { 640, 480 }, half = { 320, 240 };
+    const auto importBackbuffer = [&](RenderGraph* g) {
+        return g->ImportImage("backbuffer", VK_FORMAT_B8G8R8A8_UNORM, full, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    };
+
+    //passes whose results nothing reads are culled, the rest keep the order they were added in
+    auto g = RenderGraph::Create();
+    auto back = importBackbuffer(g);
+    auto unused = g->CreateImage("unused", VK_FORMAT_R8G8B8A8_UNORM, full);
+    auto args = g->ImportBuffer("args");
+    const auto cull = g->AddPass("cull", PASS_COMPUTE, NoRecord);
+    g->Write(cull, args, GRAPH_STORAGE_WRITE);
+    const auto dead = g->AddPass("dead", PASS_GRAPHICS, NoRecord);
+    g->Write(dead, unused, GRAPH_COLOR_ATTACHMENT);
+    const auto draw = g->AddPass("draw", PASS_GRAPHICS, NoRecord);
+    g->Read(draw, args, GRAPH_INDIRECT);
+    g->Write(draw, back, GRAPH_COLOR_ATTACHMENT);
+    g->Compile(false, false);
+    CHECK(g->Order() == std::vector<uint32_t>({ cull, draw }));
+    CHECK(g->Stats().passes == 3 && g->Stats().culledPasses == 1);
+    CHECK(g->Stats().renderPasses == 1 && g->Stats().transientImages == 0);
+    //the indirect read waits for the compute write, the backbuffer is transitioned by the render pass
+    CHECK(g->Stats().barrierCalls == 1 && g->Stats().barriers == 1);
+    RenderGraph::Destroy(g);
+
+    //a chain of images, each only alive from the pass writing it to the one reading it
+    g = RenderGraph::Create();
+    back = importBackbuffer(g);
+    uint32_t images[3], chain[4];
+    for (uint32_t a = 0; a < 3; a++) {
+        images[a] = g->CreateImage("image" + std::to_string(a), VK_FORMAT_R8G8B8A8_UNORM, full);
+    }
+    for (uint32_t a = 0; a < 4; a++) {
+        chain[a] = g->AddPass("pass" + std::to_string(a), PASS_GRAPHICS, NoRecord);
+        if (a) g->Read(chain[a], images[a - 1], GRAPH_SAMPLED);
+        g->Write(chain[a], a < 3 ? images[a] : back, GRAPH_COLOR_ATTACHMENT);
+    }
+    g->Compile(true, false);
+    CHECK(g->Order() == std::vector<uint32_t>({ chain[0], chain[1], chain[2], chain[3] }));
+    //sampled reads end the render pass, so nothing merges
+    CHECK(g->Stats().renderPasses == 4 && g->Stats().mergedPasses == 0);
+    //the first and the last image never live at the same time
+    CHECK(g->Stats().transientImages == 3 && g->Stats().memorySlots == 2);
+    CHECK(g->Stats().transientBytes * 3 == g->Stats().unaliasedBytes * 2);
+    //each render pass hands its image over in the layout the reader wants, which leaves no barriers;
+    //a dependency into every pass for the image it writes, and out of the first three for the reader
+    CHECK(g->Stats().barrierCalls == 0 && g->Stats().dependencies == 7);
+    RenderGraph::Destroy(g);
+
+    //an image only read as an input attachment lets the reader become a subpass, unless the sizes differ
+    for (uint32_t merge = 0; merge < 2; merge++) {
+        g = RenderGraph::Create();
+        back = importBackbuffer(g);
+        const auto gbuffer = g->CreateImage("gbuffer", VK_FORMAT_R8G8B8A8_UNORM, full);
+        const auto small = g->CreateImage("small", VK_FORMAT_R8G8B8A8_UNORM, half);
+        const auto geometry = g->AddPass("geometry", PASS_GRAPHICS, NoRecord);
+        g->Write(geometry, gbuffer, GRAPH_COLOR_ATTACHMENT);
+        const auto light = g->AddPass("light", PASS_GRAPHICS, NoRecord);
+        g->Read(light, gbuffer, GRAPH_INPUT_ATTACHMENT);
+        g->Write(light, back, GRAPH_COLOR_ATTACHMENT);
+        const auto overlay = g->AddPass("overlay", PASS_GRAPHICS, NoRecord);
+        g->Write(overlay, small, GRAPH_COLOR_ATTACHMENT);
+        const auto compose = g->AddPass("compose", PASS_GRAPHICS, NoRecord);
+        g->Read(compose, small, GRAPH_SAMPLED);
+        g->Write(compose, back, GRAPH_COLOR_ATTACHMENT);
+        g->Compile(merge != 0, false);
+        uint32_t subpass = UINT32_MAX;
+        g->RenderPass(light, &subpass);
+        CHECK(subpass == merge);
+        g->RenderPass(overlay, &subpass);
+        CHECK(subpass == 0);
+        g->RenderPass(compose, &subpass);
+        CHECK(subpass == 0);
+        CHECK(g->Stats().mergedPasses == merge && g->Stats().renderPasses == 4 - merge);
+        CHECK(g->Order() == std::vector<uint32_t>({ geometry, light, overlay, compose }));
+        RenderGraph::Destroy(g);
+    }
+    RenderGraph::Exit();
+}
+
+//a texture container of one format and size, levels stored coarsest first
+struct TextureCase {
+    const char* name;
+    bool dds;
+    /* the vkFormat of a ktx2 file, or a dds fourCC, or with dx10 a dxgi format */
+    uint32_t code;
+    bool dx10;
+    VkFormat format;
+    TexelBlock block;
+    uint32_t width;
+    uint32_t height;
+    /* 0 for only the full size level */
+    uint32_t levels;
+};
+
+static const TextureCase TEXTURE_CASES[] = {
+    { "ktx2 bc1", false, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, false, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, { 4, 4, 8 }, 64, 32, 7 },
+    { "ktx2 bc4", false, VK_FORMAT_BC4_SNORM_BLOCK, false, VK_FORMAT_BC4_SNORM_BLOCK, { 4, 4, 8 }, 17, 9, 5 },
+    { "ktx2 bc6h", false, VK_FORMAT_BC6H_SFLOAT_BLOCK, false, VK_FORMAT_BC6H_SFLOAT_BLOCK, { 4, 4, 16 }, 8, 8, 4 },
+    { "ktx2 bc7", false, VK_FORMAT_BC7_SRGB_BLOCK, false, VK_FORMAT_BC7_SRGB_BLOCK, { 4, 4, 16 }, 50, 30, 3 },
+    { "ktx2 astc 4x4", false, VK_FORMAT_ASTC_4x4_SRGB_BLOCK, false, VK_FORMAT_ASTC_4x4_SRGB_BLOCK, { 4, 4, 16 }, 16, 16, 5 },
+    { "ktx2 astc 6x6", false, VK_FORMAT_ASTC_6x6_UNORM_BLOCK, false, VK_FORMAT_ASTC_6x6_UNORM_BLOCK, { 6, 6, 16 }, 50, 25, 0 },
+    { "ktx2 astc 12x10", false, VK_FORMAT_ASTC_12x10_UNORM_BLOCK, false, VK_FORMAT_ASTC_12x10_UNORM_BLOCK, { 12, 10, 16 }, 30, 30, 2 },
+    { "ktx2 rgba8", false, VK_FORMAT_R8G8B8A8_UNORM, false, VK_FORMAT_R8G8B8A8_UNORM, { 1, 1, 4 }, 5, 3, 0 },
+    { "dds dxt1", true, 0x31545844, false, VK_FORMAT_BC1_RGBA_UNORM_BLOCK, { 4, 4, 8 }, 64, 64, 7 },
+    { "dds dxt3", true, 0x33545844, false, VK_FORMAT_BC2_UNORM_BLOCK, { 4, 4, 16 }, 32, 16, 0 },
+    { "dds dxt5", true, 0x35545844, false, VK_FORMAT_BC3_UNORM_BLOCK, { 4, 4, 16 }, 12, 20, 5 },
+    { "dds ati1", true, 0x31495441, false, VK_FORMAT_BC4_UNORM_BLOCK, { 4, 4, 8 }, 16, 8, 2 },
+    { "dds bc5s", true, 0x53354342, false, VK_FORMAT_BC5_SNORM_BLOCK, { 4, 4, 16 }, 8, 8, 4 },
+    { "dds dx10 bc1 srgb", true, 72, true, VK_FORMAT_BC1_RGBA_SRGB_BLOCK, { 4, 4, 8 }, 20, 12, 5 },
+    { "dds dx10 bc6h", true, 95, true, VK_FORMAT_BC6H_UFLOAT_BLOCK, { 4, 4, 16 }, 16, 16, 0 },
+    { "dds dx10 bc7", true, 98, true, VK_FORMAT_BC7_UNORM_BLOCK, { 4, 4, 16 }, 24, 40, 6 },
+};
+
+static VkExtent2D CaseLevel(const TextureCase& c, uint32_t level) {
+    return { std::max(c.width >> level, 1u), std::max(c.height >> level, 1u) };
+}
+
+static VkDeviceSize CaseLevelBytes(const TextureCase& c, uint32_t level) {
+    const auto e = CaseLevel(c, level);
+    return (VkDeviceSize)((e.width + c.block.width - 1) / c.block.width) * ((e.height + c.block.height - 1) / c.block.height)
+        * c.block.bytes;
+}
+
+//the file, and where each level starts in it
+static std::vector<char> TextureCaseFile(const TextureCase& c, std::vector<size_t>& offsets) {
+    std::vector<char> f;
+    const auto put = [&](uint64_t v, size_t bytes) { f.insert(f.end(), (const char*)&v, (const char*)&v + bytes); };
+    const uint32_t stored = std::max(c.levels, 1u);
+    offsets.assign(stored, 0);
+    if (!c.dds) {
+        const uint8_t identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+        f.insert(f.end(), identifier, identifier + 12);
+        const uint32_t words[] = { c.code, 1, c.width, c.height, 0, 0, 1, c.levels, 0, 0, 0, 0, 0 };
+        for (auto w : words) put(w, 4);
+        put(0, 8);
+        put(0, 8);
+        //coarsest first in the file, the index is finest first
+        size_t offset = f.size() + stored * 24;
+        for (uint32_t a = stored; a-- > 0;) {
+            offsets[a] = offset;
+            offset += (size_t)CaseLevelBytes(c, a);
+        }
+        for (uint32_t a = 0; a < stored; a++) {
+            put(offsets[a], 8);
+            put(CaseLevelBytes(c, a), 8);
+            put(CaseLevelBytes(c, a), 8);
+        }
+        for (uint32_t a = stored; a-- > 0;) {
+            for (VkDeviceSize b = 0; b < CaseLevelBytes(c, a); b++) f.push_back((char)(a * 16 + b));
+        }
+        return f;
+    }
+    put(0x20534444, 4); //"DDS "
+    const uint32_t flags = 0x1007 | (c.levels ? 0x20000 : 0);
+    const uint32_t words[] = { 124, flags, c.height, c.width, 0, 0, c.levels };
+    for (auto w : words) put(w, 4);
+    for (uint32_t a = 0; a < 11; a++) put(0, 4);
+    const uint32_t format[] = { 32, 0x4, c.dx10 ? 0x30315844 : c.code, 0, 0, 0, 0, 0 };
+    for (auto w : format) put(w, 4);
+    for (uint32_t a = 0; a < 5; a++) put(0, 4);
+    if (c.dx10) {
+        const uint32_t dx10[] = { c.code, 3, 0, 1, 0 };
+        for (auto w : dx10) put(w, 4);
+    }
+    for (uint32_t a = 0; a < stored; a++) {
+        offsets[a] = f.size();
+        for (VkDeviceSize b = 0; b < CaseLevelBytes(c, a); b++) f.push_back((char)(a * 16 + b));
+    }
+    return f;
+}
+
+//parses a copy the exact size of bytes, so nothing past it could be read unnoticed by a checker
+static bool ParseCopy(const char* bytes, size_t size, TextureFile& tex) {
+    std::vector<char> copy(bytes, bytes + size);
+    const bool ok = TextureFile::Parse(ByteSpan{ copy.data(), copy.size() }, tex);
+    for (auto& l : tex.levels) {
+        if (l.data < copy.data() || l.data + l.size > copy.data() + copy.size()) return false;
+    }
+    return ok;
+}
+
+//one field of a valid file overwritten
+struct TextureDamage {
+    const char* name;
+    bool dds;
+    size_t offset;
+    uint64_t value;
+    size_t bytes;
+};
+
+static const TextureDamage TEXTURE_DAMAGE[] = {
+    { "ktx2 identifier", false, 0, 0, 1 },
+    { "ktx2 zero width", false, 20, 0, 4 },
+    { "ktx2 huge width", false, 20, 1u << 20, 4 },
+    { "ktx2 3d", false, 28, 4, 4 },
+    { "ktx2 cube", false, 36, 6, 4 },
+    { "ktx2 more levels than the chain", false, 40, 40, 4 },
+    { "ktx2 supercompressed", false, 44, 1, 4 },
+    { "ktx2 level past the end", false, 80, UINT64_MAX - 8, 8 },
+    { "ktx2 level longer than the file", false, 88, UINT64_MAX, 8 },
+    { "dds magic", true, 0, 0, 4 },
+    { "dds header size", true, 4, 100, 4 },
+    { "dds zero height", true, 12, 0, 4 },
+    { "dds huge width", true, 16, 1u << 20, 4 },
+    { "dds more levels than the chain", true, 28, 40, 4 },
+    { "dds cube", true, 112, 0x200, 4 },
+    { "dds dx10 array", true, 140, 6, 4 },
+    { "dds dx10 3d", true, 132, 4, 4 },
+};
+
+//header fields, level offsets and format blocks of ktx2 and dds files, and files cut short or damaged
+static void TestTextureFile() {
+    for (auto& c : TEXTURE_CASES) {
+        std::vector<size_t> offsets;
+        const auto file = TextureCaseFile(c, offsets);
+        TextureFile tex;
+        const bool ok = ParseCopy(file.data(), file.size(), tex);
+        CHECK(ok);
+        if (!ok) {
+            std::cerr << "  " << c.name << std::endl;
+            continue;
+        }
+        CHECK(tex.format == c.format);
+        CHECK(tex.extent.width == c.width && tex.extent.height == c.height);
+        CHECK(tex.levelCount == c.levels);
+        TexelBlock block = {};
+        CHECK(TextureFile::BlockOf(c.format, block));
+        CHECK(block.width == c.block.width && block.height == c.block.height && block.bytes == c.block.bytes);
+        CHECK(tex.levels.size() == offsets.size());
+        TextureFile inPlace;
+        CHECK(TextureFile::Parse(ByteSpan{ file.data(), file.size() }, inPlace));
+        for (uint32_t a = 0; a < inPlace.levels.size() && a < offsets.size(); a++) {
+            CHECK(inPlace.levels[a].data == file.data() + offsets[a]);
+            CHECK(inPlace.levels[a].size == CaseLevelBytes(c, a));
+            CHECK(inPlace.levels[a].size == TextureFile::LevelBytes(CaseLevel(c, a), block));
+        }
+        //every shorter file is rejected, whether it ends in a header or in the levels
+        bool anyShort = false;
+        for (size_t size = 0; size < file.size(); size++) {
+            TextureFile cut;
+            anyShort = anyShort || ParseCopy(file.data(), size, cut);
+        }
+        CHECK(!anyShort);
+    }
+    for (auto& d : TEXTURE_DAMAGE) {
+        //a dds with a dx10 header and mips, or a ktx2 with levels
+        const auto& c = d.dds ? TEXTURE_CASES[15] : TEXTURE_CASES[0];
+        std::vector<size_t> offsets;
+        auto file = TextureCaseFile(c, offsets);
+        memcpy(file.data() + d.offset, &d.value, d.bytes);
+        TextureFile tex;
+        const bool ok = ParseCopy(file.data(), file.size(), tex);
+        CHECK(!ok);
+        if (ok) std::cerr << "  " << d.name << std::endl;
+    }
+}
+
+struct Test {
+    const char* name;
+    void (*fn)();
+};
+
+//what is retired while a frame is recorded waits for that frame, which may wait for an upload into it
+static void TestDeletionQueue() {
+    const auto frame = FrameSync::NextValue();
+    CHECK(DeletionQueue::RetireValue() == frame);
+    uint32_t runs = 0;
+    DeletionQueue::Defer([&]() { runs++; });
+    DeletionQueue::Collect(frame - 1);
+    CHECK(runs == 0);
+    DeletionQueue::Collect(frame);
+    CHECK(runs == 1);
+    DeletionQueue::Collect(frame);
+    CHECK(runs == 1);
+}
+
+//a batch runs in the order things were retired, and what it retires itself comes after it
+static void TestDeletionOrder() {
+    const auto frame = FrameSync::NextValue();
+    std::vector<int> order;
+    DeletionQueue::Defer([&]() {
+        order.push_back(1);
+        DeletionQueue::Defer([&]() { order.push_back(3); });
+    });
+    DeletionQueue::Defer([&]() { order.push_back(2); });
+    DeletionQueue::Collect(frame - 1);
+    CHECK(order.empty());
+    DeletionQueue::Collect(frame);
+    CHECK(order == std::vector<int>({ 1, 2, 3 }));
+    DeletionQueue::Exit();
+    CHECK(order.size() == 3);
+}
+
+static const Test TESTS[] = {
+    { "lz4", TestLz4 },
+    { "assetpack", TestAssetPack },
+    { "spirv", TestSpirvModule },
+    { "shaders", TestSpirvShaders },
+    { "imagediff", TestImageDiff },
+    { "slotpool", TestSlotPool },
+    { "buddy", TestBuddy },
+    { "devicepicker", TestDevicePicker },
+    { "deletionqueue", TestDeletionQueue },
+    { "deletionorder", TestDeletionOrder },
+    { "transforms", TestTransforms },
+    { "rendergraph", TestRenderGraph },
+    { "texturefile", TestTextureFile },
+};
+
+//unit tests of the parts of the renderer that need no device: hvtest [name...]
+//Shaders are looked up in the working directory, the others write their files there too
+int main(int argc, char** argv) {
+    std::vector<std::string> names(argv + 1, argv + argc);
+    for (auto& n : names) {
+        const bool known = std::any_of(std::begin(TESTS), std::end(TESTS), [&](const Test& t) { return n == t.name; });
+        if (!known) {
+            std::cerr << "usage: hvtest [name...], names are:";
+            for (auto& t : TESTS) std::cerr << " " << t.name;
+            std::cerr << std::endl;
+            return 1;
+        }
+    }
+
+    JobSystem::Init(0);
+    for (auto& t : TESTS) {
+        if (!names.empty() && std::find(names.begin(), names.end(), t.name) == names.end()) continue;
+        const auto failed = failCount;
+        std::cout << t.name << std::endl;
+        t.fn();
+        if (failCount != failed) std::cout << "  " << failCount - failed << " failed" << std::endl;
+    }
+    JobSystem::Exit();
+
+    std::cout << checkCount << " checks, " << failCount << " failed" << std::endl;
+    return failCount ? 1 : 0;
+}
@@ -0,0 +1,407 @@
+#include "texture.hpp"
+#include "allocator.hpp"
+#include "bindless.hpp"
+#include "handles.hpp"
+#include "texturefile.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+
+//levels this size and smaller are loaded right away and never dropped
+static const uint32_t TAIL_SIZE = 128;
+//the file is read ahead of the uploads in pieces this size
+static const size_t READ_CHUNK = 1 << 20;
+//images being built at once may hold this much memory, so a budget increase is not taken in one frame
+static const VkDeviceSize MAX_PENDING_BYTES = 64ull << 20;
+//where textures are sampled, which the copies into them are made visible to
+static const VkPipelineStageFlags TEXTURE_STAGES = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+static VkPhysicalDevice texPhysDevice;
+static VkDevice texDevice;
+static VkDeviceSize budgetBytes;
+static bool bindlessTable;
+static VkSampler sampler;
+static uint32_t samplerIndex = UINT32_MAX;
+static std::vector<Texture*> textures;
+//device memory of every texture image, including those still being built
+static VkDeviceSize residentBytes;
+static VkDeviceSize pendingBytes;
+
+static uint32_t levelsStreamed;
+static uint32_t levelsDropped;
+static uint32_t mipsGenerated;
+
+void Texture::Init(VkPhysicalDevice physDevice, VkDevice device, VkDeviceSize budget, bool bindless) {
+    texPhysDevice = physDevice;
+    texDevice = device;
+    budgetBytes = budget;
+    bindlessTable = bindless;
+
+    VkSamplerCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    info.magFilter = VK_FILTER_LINEAR;
+    info.minFilter = VK_FILTER_LINEAR;
+    info.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    info.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    info.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    info.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    info.maxLod = VK_LOD_CLAMP_NONE;
+    VKDO(vkCreateSampler(device, &info, nullptr, &sampler));
+    if (bindless) {
+        samplerIndex = Bindless::AddSampler(sampler);
+    }
+}
+
+void Texture::Exit() {
+    while (!textures.empty()) {
+        Destroy(textures.back());
+    }
+    if (samplerIndex != UINT32_MAX) {
+        Bindless::RemoveSampler(samplerIndex);
+        samplerIndex = UINT32_MAX;
+    }
+    vkDestroySampler(texDevice, sampler, nullptr);
+}
+
+Texture* Texture::Load(const std::string& path) {
+    auto file = MappedFile::Open(path);
+    if (!file) {
+        std::cerr << "cannot open texture " << path << "!" << std::endl;
+        return nullptr;
+    }
+    TextureFile tex = {};
+    if (!TextureFile::Parse(file->Span(), tex)) {
+        std::cerr << path << " is not a texture that can be loaded!" << std::endl;
+        MappedFile::Close(file);
+        return nullptr;
+    }
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties(texPhysDevice, tex.format, &props);
+    TexelBlock block;
+    if (!TextureFile::BlockOf(tex.format, block) || !(props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)) {
+        std::cerr << "the device cannot sample " << path << " (format " << (int)tex.format << ")!" << std::endl;
+        MappedFile::Close(file);
+        return nullptr;
+    }
+    for (uint32_t a = 0; a < tex.levels.size(); a++) {
+        const VkExtent2D ext = { std::max(tex.extent.width >> a, 1u), std::max(tex.extent.height >> a, 1u) };
+        if (tex.levels[a].size != TextureFile::LevelBytes(ext, block)) {
+            std::cerr << "level " << a << " of " << path << " has the wrong size!" << std::endl;
+            MappedFile::Close(file);
+            return nullptr;
+        }
+    }
+
+    auto t = new Texture();
+    t->name = path;
+    t->file = file;
+    t->block = block;
+    t->levelData = tex.levels;
+    t->index = UINT32_MAX;
+    t->ready = false;
+    t->format = tex.format;
+    t->extent = tex.extent;
+    t->current = {};
+    t->next = {};
+    t->read = nullptr;
+    t->ticket = 0;
+    t->recordPending = false;
+    //a full chain down to 1x1, blitted from the first level where the format allows it
+    uint32_t fullChain = 1;
+    while ((std::max(tex.extent.width, tex.extent.height) >> fullChain) > 0) fullChain++;
+    const VkFormatFeatureFlags blit = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT
+        | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    t->generateMips = !tex.levelCount && block.width == 1 && (props.optimalTilingFeatures & blit) == blit;
+    t->levels = t->generateMips ? fullChain : (uint32_t)tex.levels.size();
+    if (!tex.levelCount && !t->generateMips) {
+        std::cout << path << " has no mips and they cannot be generated for its format" << std::endl;
+    }
+    //generated mips need the whole chain at once, the others start with their small levels
+    t->tailLevel = 0;
+    while (!t->generateMips && t->tailLevel + 1 < t->levels
+        && std::max(t->LevelExtent(t->tailLevel).width, t->LevelExtent(t->tailLevel).height) > TAIL_SIZE) {
+        t->tailLevel++;
+    }
+    t->firstLevel = t->tailLevel;
+    textures.push_back(t);
+    t->Start(t->tailLevel);
+    return t;
+}
+
+void Texture::Destroy(Texture* texture) {
+    textures.erase(std::find(textures.begin(), textures.end(), texture));
+    if (texture->read) {
+        FileReader::Finish(texture->read);
+    }
+    if (texture->index != UINT32_MAX) {
+        Bindless::RemoveTexture(texture->index);
+    }
+    texture->DestroyImage(texture->current);
+    texture->DestroyImage(texture->next);
+    MappedFile::Close(texture->file);
+    delete texture;
+}
+
+void Texture::DestroyImage(Image& image) {
+    if (!image.image) return;
+    residentBytes -= image.alloc->size;
+    DeletionQueue::Retire(HANDLE_IMAGE_VIEW, image.view);
+    DeletionQueue::RetireImage(image.image, image.alloc);
+    image = {};
+}
+
+VkExtent2D Texture::LevelExtent(uint32_t level) const {
+    return { std::max(extent.width >> level, 1u), std::max(extent.height >> level, 1u) };
+}
+
+//next's levels from the file are [next.first, FileLevelsEnd()), the others are copied from the current image
+uint32_t Texture::FileLevelsEnd() const {
+    const uint32_t copied = current.image ? std::max(next.first, current.first) : (uint32_t)levelData.size();
+    return std::min(copied, (uint32_t)levelData.size());
+}
+
+//builds next with the levels from first, and starts reading those the current image lacks
+void Texture::Start(uint32_t first) {
+    const auto ext = LevelExtent(first);
+    VkImageCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    info.imageType = VK_IMAGE_TYPE_2D;
+    info.format = format;
+    info.extent = { ext.width, ext.height, 1 };
+    info.mipLevels = levels - first;
+    info.arrayLayers = 1;
+    info.samples = VK_SAMPLE_COUNT_1_BIT;
+    info.tiling = VK_IMAGE_TILING_OPTIMAL;
+    //the source of the copies when the levels change again, and of the blits
+    info.usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    next.alloc = Allocator::CreateImage(info, MEMORY_USAGE_GPU_ONLY, &next.image);
+    next.first = first;
+
+    VkImageViewCreateInfo vinfo = {};
+    vinfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    vinfo.image = next.image;
+    vinfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    vinfo.format = format;
+    vinfo.components = {
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY,
+        VK_COMPONENT_SWIZZLE_IDENTITY
+    };
+    vinfo.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, levels - first, 0, 1 };
+    VKDO(vkCreateImageView(texDevice, &vinfo, nullptr, &next.view));
+    residentBytes += next.alloc->size;
+    pendingBytes += next.alloc->size;
+
+    //the copies into the staging ring on the frame's thread then never wait for the disk
+    ticket = 0;
+    read = nullptr;
+    const auto end = FileLevelsEnd();
+    if (end > first) {
+        const char* begin = levelData[first].data;
+        const char* last = levelData[first].data + levelData[first].size;
+        for (uint32_t l = first + 1; l < end; l++) {
+            begin = std::min(begin, levelData[l].data);
+            last = std::max(last, levelData[l].data + levelData[l].size);
+        }
+        read = FileReader::ReadAsync(ByteSpan{ begin, (size_t)(last - begin) }, READ_CHUNK, {});
+    }
+    if (current.image && first < current.first) {
+        levelsStreamed += current.first - first;
+    }
+    else if (current.image) {
+        levelsDropped += first - current.first;
+    }
+    recordPending = current.image || generateMips;
+}
+
+//coarsest first, so the uploads finish in the order the levels are useful
+void Texture::QueueUploads() {
+    for (uint32_t l = FileLevelsEnd(); l-- > next.first; ) {
+        const uint32_t level = l - next.first;
+        //the blits read the first level at the transfer stage
+        ticket = generateMips
+            ? Uploader::UploadImage(next.image, level, LevelExtent(l), block, levelData[l].data,
+                VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT)
+            : Uploader::UploadImage(next.image, level, LevelExtent(l), block, levelData[l].data,
+                VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, TEXTURE_STAGES, VK_ACCESS_SHADER_READ_BIT);
+    }
+}
+
+static VkImageMemoryBarrier LevelBarrier(VkImage image, uint32_t level, uint32_t count, VkImageLayout from, VkImageLayout to,
+        VkAccessFlags src, VkAccessFlags dst) {
+    VkImageMemoryBarrier b = {};
+    b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    b.srcAccessMask = src;
+    b.dstAccessMask = dst;
+    b.oldLayout = from;
+    b.newLayout = to;
+    b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.image = image;
+    b.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level, count, 0, 1 };
+    return b;
+}
+
+//the levels both images have go from current to next, current stays in use meanwhile
+void Texture::RecordCopies(VkCommandBuffer cmd) {
+    const uint32_t from = std::max(current.first, next.first);
+    const uint32_t count = levels - from;
+    const uint32_t src = from - current.first;
+    const uint32_t dst = from - next.first;
+
+    VkImageMemoryBarrier before[] = {
+        LevelBarrier(current.image, src, count, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0, VK_ACCESS_TRANSFER_READ_BIT),
+        LevelBarrier(next.image, dst, count, VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(cmd, TEXTURE_STAGES, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 2, before);
+
+    std::vector<VkImageCopy> regions(count);
+    for (uint32_t a = 0; a < count; a++) {
+        const auto ext = LevelExtent(from + a);
+        regions[a] = {};
+        regions[a].srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, src + a, 0, 1 };
+        regions[a].dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, dst + a, 0, 1 };
+        regions[a].extent = { ext.width, ext.height, 1 };
+    }
+    vkCmdCopyImage(cmd, current.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, next.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        count, regions.data());
+
+    VkImageMemoryBarrier after[] = {
+        LevelBarrier(current.image, src, count, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 0, 0),
+        LevelBarrier(next.image, dst, count, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+    };
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, TEXTURE_STAGES, 0, 0, nullptr, 0, nullptr, 2, after);
+}
+
+//each level is a linear downscale of the one before it, the first arrived in TRANSFER_SRC_OPTIMAL
+void Texture::RecordBlits(VkCommandBuffer cmd) {
+    auto b = LevelBarrier(next.image, 1, levels - 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &b);
+    for (uint32_t l = 1; l < levels; l++) {
+        const auto src = LevelExtent(l - 1);
+        const auto dst = LevelExtent(l);
+        VkImageBlit blit = {};
+        blit.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, l - 1, 0, 1 };
+        blit.srcOffsets[1] = { (int32_t)src.width, (int32_t)src.height, 1 };
+        blit.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, l, 0, 1 };
+        blit.dstOffsets[1] = { (int32_t)dst.width, (int32_t)dst.height, 1 };
+        vkCmdBlitImage(cmd, next.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, next.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1, &blit, VK_FILTER_LINEAR);
+        //the level is the source of the next blit
+        b = LevelBarrier(next.image, l, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT);
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &b);
+    }
+    b = LevelBarrier(next.image, 0, levels, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, TEXTURE_STAGES, 0, 0, nullptr, 0, nullptr, 1, &b);
+    mipsGenerated += levels - 1;
+}
+
+//next takes over, the old image goes once the frames that may sample it have finished
+void Texture::Swap() {
+    pendingBytes -= next.alloc->size;
+    const auto old = current;
+    current = next;
+    next = {};
+    if (index != UINT32_MAX) {
+        Bindless::RemoveTexture(index);
+    }
+    index = bindlessTable ? Bindless::AddTexture(current.view, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL) : UINT32_MAX;
+    firstLevel = current.first;
+    ready = true;
+    if (old.image) {
+        residentBytes -= old.alloc->size;
+        DeletionQueue::Retire(HANDLE_IMAGE_VIEW, old.view);
+        DeletionQueue::RetireImage(old.image, old.alloc);
+    }
+}
+
+void Texture::Update() {
+    for (auto t : textures) {
+        if (t->read && FileReader::IsDone(t->read)) {
+            FileReader::Finish(t->read);
+            t->read = nullptr;
+            t->QueueUploads();
+        }
+        if (t->next.image && !t->read && !t->recordPending && Uploader::IsDone(t->ticket)) {
+            t->Swap();
+        }
+    }
+
+    //over the budget the finest texture gives up a level, one at a time, once the images being built are done
+    if (residentBytes > budgetBytes) {
+        if (pendingBytes) return;
+        Texture* finest = nullptr;
+        for (auto t : textures) {
+            if (!t->next.image && t->current.first < t->tailLevel && (!finest || t->current.first < finest->current.first)) {
+                finest = t;
+            }
+        }
+        if (finest) {
+            finest->Start(finest->current.first + 1);
+        }
+        return;
+    }
+    //under it the coarsest gain one, while both their images fit next to each other
+    while (pendingBytes < MAX_PENDING_BYTES) {
+        Texture* coarsest = nullptr;
+        for (auto t : textures) {
+            if (t->ready && !t->next.image && t->current.first > 0 && (!coarsest || t->current.first > coarsest->current.first)) {
+                coarsest = t;
+            }
+        }
+        if (!coarsest) return;
+        VkDeviceSize bytes = 0;
+        for (uint32_t l = coarsest->current.first - 1; l < coarsest->levels; l++) {
+            bytes += TextureFile::LevelBytes(coarsest->LevelExtent(l), coarsest->block);
+        }
+        if (residentBytes + bytes > budgetBytes) return;
+        coarsest->Start(coarsest->current.first - 1);
+    }
+}
+
+void Texture::Record(VkCommandBuffer cmd) {
+    for (auto t : textures) {
+        if (!t->recordPending || t->read || !Uploader::IsDone(t->ticket)) continue;
+        if (t->current.image) {
+            t->RecordCopies(cmd);
+        }
+        else {
+            t->RecordBlits(cmd);
+        }
+        t->recordPending = false;
+    }
+}
+
+uint32_t Texture::Sampler() {
+    return samplerIndex;
+}
+
+void Texture::Report() {
+    //what the same levels would take as plain RGBA8
+    VkDeviceSize levelBytes = 0, rgbaBytes = 0;
+    uint32_t full = 0;
+    for (auto t : textures) {
+        if (!t->ready) continue;
+        for (uint32_t l = t->current.first; l < t->levels; l++) {
+            const auto ext = t->LevelExtent(l);
+            levelBytes += TextureFile::LevelBytes(ext, t->block);
+            rgbaBytes += (VkDeviceSize)ext.width * ext.height * 4;
+        }
+        full += t->current.first == 0;
+    }
+    std::cout << "textures: " << textures.size() << " loaded, " << full << " at full size, "
+        << (residentBytes >> 10) << "KB of " << (budgetBytes >> 10) << "KB budget, " << (levelBytes >> 10)
+        << "KB of levels (" << (rgbaBytes >> 10) << "KB as RGBA8), " << levelsStreamed << " levels streamed in, "
+        << levelsDropped << " dropped, " << mipsGenerated << " generated" << std::endl;
+}
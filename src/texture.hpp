@@ -0,0 +1,85 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <string>
+#include <vector>
+#include "filereader.hpp"
+#include "uploader.hpp"
+
+struct Allocation;
+
+/* A sampled image loaded from a KTX2 or DDS file, in the format stored there, so block compressed
+ * (BC, ASTC) data goes to the gpu as is. Levels are streamed in coarsest first: a texture starts
+ * with its small levels and gains finer ones while the textures fit the memory budget, or gives
+ * them up again when they do not. Each change builds an image with the new set of levels; levels
+ * it shares with the old image are copied on the gpu, the others come from the file through the
+ * Uploader, once FileReader::ReadAsync has faulted their pages in on the io threads. Files without
+ * mips get them generated with blits.
+ */
+class Texture {
+public:
+    /* budget: device memory for all textures, bindless: add them to the Bindless table */
+    static void Init(VkPhysicalDevice physDevice, VkDevice device, VkDeviceSize budget, bool bindless);
+    /* destroys the textures still loaded, the device must be idle */
+    static void Exit();
+
+    /* returns null if the file cannot be read or the device cannot sample its format.
+     * The file stays mapped, its levels are read as they are streamed in */
+    static Texture* Load(const std::string& path);
+    /* the texture must not be in use by the device */
+    static void Destroy(Texture* texture);
+
+    /* Call once per frame after Uploader::Flush. Swaps in the images that are complete, then starts
+     * loading finer levels or dropping fine ones to stay within the budget.
+     */
+    static void Update();
+    /* records the copies between old and new images and the mip generation, outside a render pass */
+    static void Record(VkCommandBuffer cmd);
+    /* a trilinear, repeating sampler in the Bindless table, for any texture */
+    static uint32_t Sampler();
+    static void Report();
+
+    /* index into the Bindless table, which changes whenever levels are added or dropped;
+     * UINT32_MAX before the first levels have arrived or without bindless */
+    uint32_t index;
+    bool ready;
+    VkFormat format;
+    VkExtent2D extent;
+    uint32_t levels;
+    /* the finest level the image in use has, 0 is full size */
+    uint32_t firstLevel;
+
+private:
+    struct Image {
+        VkImage image;
+        VkImageView view;
+        Allocation* alloc;
+        /* levels from first to the last of the texture */
+        uint32_t first;
+    };
+
+    VkExtent2D LevelExtent(uint32_t level) const;
+    uint32_t FileLevelsEnd() const;
+    void Start(uint32_t first);
+    void QueueUploads();
+    void RecordCopies(VkCommandBuffer cmd);
+    void RecordBlits(VkCommandBuffer cmd);
+    void Swap();
+    void DestroyImage(Image& image);
+
+    std::string name;
+    MappedFile* file;
+    TexelBlock block;
+    /* the data of each level in file, only level 0 when the mips are generated */
+    std::vector<ByteSpan> levelData;
+    bool generateMips;
+    /* the coarsest level that is always loaded */
+    uint32_t tailLevel;
+    Image current;
+    Image next;
+    /* next's levels being read from the file, their uploads are queued once it is done */
+    AsyncRead* read;
+    /* the upload of next's levels from the file, 0 if it has none */
+    uint64_t ticket;
+    /* next waits for its copies or mip generation to be recorded */
+    bool recordPending;
+};
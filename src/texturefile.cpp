@@ -0,0 +1,280 @@
+#include "texturefile.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+
+//larger than any device samples, which keeps level sizes far from overflowing
+static const uint32_t MAX_EXTENT = 1u << 16;
+
+struct FormatBlock {
+    VkFormat format;
+    TexelBlock block;
+};
+
+static const FormatBlock FORMATS[] = {
+    { VK_FORMAT_R8G8B8A8_UNORM, { 1, 1, 4 } },
+    { VK_FORMAT_R8G8B8A8_SRGB, { 1, 1, 4 } },
+    { VK_FORMAT_B8G8R8A8_UNORM, { 1, 1, 4 } },
+    { VK_FORMAT_B8G8R8A8_SRGB, { 1, 1, 4 } },
+    { VK_FORMAT_BC1_RGB_UNORM_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC1_RGB_SRGB_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC1_RGBA_UNORM_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC1_RGBA_SRGB_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC2_UNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC2_SRGB_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC3_UNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC3_SRGB_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC4_UNORM_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC4_SNORM_BLOCK, { 4, 4, 8 } },
+    { VK_FORMAT_BC5_UNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC5_SNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC6H_UFLOAT_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC6H_SFLOAT_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC7_UNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_BC7_SRGB_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_ASTC_4x4_UNORM_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_ASTC_4x4_SRGB_BLOCK, { 4, 4, 16 } },
+    { VK_FORMAT_ASTC_5x4_UNORM_BLOCK, { 5, 4, 16 } },
+    { VK_FORMAT_ASTC_5x4_SRGB_BLOCK, { 5, 4, 16 } },
+    { VK_FORMAT_ASTC_5x5_UNORM_BLOCK, { 5, 5, 16 } },
+    { VK_FORMAT_ASTC_5x5_SRGB_BLOCK, { 5, 5, 16 } },
+    { VK_FORMAT_ASTC_6x5_UNORM_BLOCK, { 6, 5, 16 } },
+    { VK_FORMAT_ASTC_6x5_SRGB_BLOCK, { 6, 5, 16 } },
+    { VK_FORMAT_ASTC_6x6_UNORM_BLOCK, { 6, 6, 16 } },
+    { VK_FORMAT_ASTC_6x6_SRGB_BLOCK, { 6, 6, 16 } },
+    { VK_FORMAT_ASTC_8x5_UNORM_BLOCK, { 8, 5, 16 } },
+    { VK_FORMAT_ASTC_8x5_SRGB_BLOCK, { 8, 5, 16 } },
+    { VK_FORMAT_ASTC_8x6_UNORM_BLOCK, { 8, 6, 16 } },
+    { VK_FORMAT_ASTC_8x6_SRGB_BLOCK, { 8, 6, 16 } },
+    { VK_FORMAT_ASTC_8x8_UNORM_BLOCK, { 8, 8, 16 } },
+    { VK_FORMAT_ASTC_8x8_SRGB_BLOCK, { 8, 8, 16 } },
+    { VK_FORMAT_ASTC_10x5_UNORM_BLOCK, { 10, 5, 16 } },
+    { VK_FORMAT_ASTC_10x5_SRGB_BLOCK, { 10, 5, 16 } },
+    { VK_FORMAT_ASTC_10x6_UNORM_BLOCK, { 10, 6, 16 } },
+    { VK_FORMAT_ASTC_10x6_SRGB_BLOCK, { 10, 6, 16 } },
+    { VK_FORMAT_ASTC_10x8_UNORM_BLOCK, { 10, 8, 16 } },
+    { VK_FORMAT_ASTC_10x8_SRGB_BLOCK, { 10, 8, 16 } },
+    { VK_FORMAT_ASTC_10x10_UNORM_BLOCK, { 10, 10, 16 } },
+    { VK_FORMAT_ASTC_10x10_SRGB_BLOCK, { 10, 10, 16 } },
+    { VK_FORMAT_ASTC_12x10_UNORM_BLOCK, { 12, 10, 16 } },
+    { VK_FORMAT_ASTC_12x10_SRGB_BLOCK, { 12, 10, 16 } },
+    { VK_FORMAT_ASTC_12x12_UNORM_BLOCK, { 12, 12, 16 } },
+    { VK_FORMAT_ASTC_12x12_SRGB_BLOCK, { 12, 12, 16 } }
+};
+
+bool TextureFile::BlockOf(VkFormat format, TexelBlock& block) {
+    for (auto& f : FORMATS) {
+        if (f.format == format) {
+            block = f.block;
+            return true;
+        }
+    }
+    return false;
+}
+
+VkDeviceSize TextureFile::LevelBytes(VkExtent2D extent, TexelBlock block) {
+    return (VkDeviceSize)((extent.width + block.width - 1) / block.width)
+        * ((extent.height + block.height - 1) / block.height) * block.bytes;
+}
+
+//the levels down to 1x1
+static uint32_t FullChain(uint32_t width, uint32_t height) {
+    uint32_t levels = 1;
+    while ((std::max(width, height) >> levels) > 0) levels++;
+    return levels;
+}
+
+static uint32_t FourCC(const char* c) {
+    return (uint32_t)c[0] | ((uint32_t)c[1] << 8) | ((uint32_t)c[2] << 16) | ((uint32_t)c[3] << 24);
+}
+
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+
+struct Ktx2Header {
+    uint8_t identifier[12];
+    uint32_t vkFormat;
+    uint32_t typeSize;
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    uint32_t pixelDepth;
+    uint32_t layerCount;
+    uint32_t faceCount;
+    /* 0 asks for the mips to be generated */
+    uint32_t levelCount;
+    uint32_t supercompressionScheme;
+    uint32_t dfdByteOffset;
+    uint32_t dfdByteLength;
+    uint32_t kvdByteOffset;
+    uint32_t kvdByteLength;
+    uint64_t sgdByteOffset;
+    uint64_t sgdByteLength;
+};
+
+struct Ktx2Level {
+    uint64_t byteOffset;
+    uint64_t byteLength;
+    uint64_t uncompressedByteLength;
+};
+
+//2D textures of one layer and face without supercompression, which is what the tools make for gpu formats
+static bool ParseKtx2(ByteSpan span, TextureFile& tex) {
+    Ktx2Header h;
+    if (span.size < sizeof(h)) return false;
+    memcpy(&h, span.data, sizeof(h));
+    if (memcmp(h.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER))) return false;
+    if (!h.pixelWidth || !h.pixelHeight || h.pixelDepth > 1 || h.layerCount > 1 || h.faceCount != 1
+        || h.supercompressionScheme) {
+        std::cerr << "only 2D ktx2 textures without supercompression are supported" << std::endl;
+        return false;
+    }
+    if (h.pixelWidth > MAX_EXTENT || h.pixelHeight > MAX_EXTENT || h.levelCount > FullChain(h.pixelWidth, h.pixelHeight)) {
+        return false;
+    }
+    tex.format = (VkFormat)h.vkFormat;
+    tex.extent = { h.pixelWidth, h.pixelHeight };
+    tex.levelCount = h.levelCount;
+    const uint32_t stored = std::max(h.levelCount, 1u);
+    if (span.size < sizeof(h) + stored * sizeof(Ktx2Level)) return false;
+    for (uint32_t a = 0; a < stored; a++) {
+        Ktx2Level level;
+        memcpy(&level, span.data + sizeof(h) + a * sizeof(level), sizeof(level));
+        if (level.byteOffset > span.size || level.byteLength > span.size - level.byteOffset) return false;
+        tex.levels.push_back(span.Sub((size_t)level.byteOffset, (size_t)level.byteLength));
+    }
+    return true;
+}
+
+struct DdsPixelFormat {
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t rMask;
+    uint32_t gMask;
+    uint32_t bMask;
+    uint32_t aMask;
+};
+
+struct DdsHeader {
+    uint32_t magic;
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t pitchOrLinearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];
+    DdsPixelFormat format;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+
+struct DdsHeaderDx10 {
+    uint32_t dxgiFormat;
+    uint32_t resourceDimension;
+    uint32_t miscFlag;
+    uint32_t arraySize;
+    uint32_t miscFlags2;
+};
+
+static const uint32_t DDSD_MIPMAPCOUNT = 0x20000;
+static const uint32_t DDPF_FOURCC = 0x4;
+static const uint32_t DDPF_RGB = 0x40;
+static const uint32_t DDSCAPS2_CUBEMAP = 0x200;
+static const uint32_t DDS_DIMENSION_TEXTURE2D = 3;
+
+static VkFormat DxgiFormat(uint32_t dxgi) {
+    switch (dxgi) {
+    case 28: return VK_FORMAT_R8G8B8A8_UNORM;
+    case 29: return VK_FORMAT_R8G8B8A8_SRGB;
+    case 71: return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+    case 72: return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    case 74: return VK_FORMAT_BC2_UNORM_BLOCK;
+    case 75: return VK_FORMAT_BC2_SRGB_BLOCK;
+    case 77: return VK_FORMAT_BC3_UNORM_BLOCK;
+    case 78: return VK_FORMAT_BC3_SRGB_BLOCK;
+    case 80: return VK_FORMAT_BC4_UNORM_BLOCK;
+    case 81: return VK_FORMAT_BC4_SNORM_BLOCK;
+    case 83: return VK_FORMAT_BC5_UNORM_BLOCK;
+    case 84: return VK_FORMAT_BC5_SNORM_BLOCK;
+    case 87: return VK_FORMAT_B8G8R8A8_UNORM;
+    case 91: return VK_FORMAT_B8G8R8A8_SRGB;
+    case 95: return VK_FORMAT_BC6H_UFLOAT_BLOCK;
+    case 96: return VK_FORMAT_BC6H_SFLOAT_BLOCK;
+    case 98: return VK_FORMAT_BC7_UNORM_BLOCK;
+    case 99: return VK_FORMAT_BC7_SRGB_BLOCK;
+    default: return VK_FORMAT_UNDEFINED;
+    }
+}
+
+static VkFormat DdsFormat(const DdsPixelFormat& pf) {
+    if (pf.flags & DDPF_FOURCC) {
+        const uint32_t c = pf.fourCC;
+        if (c == FourCC("DXT1")) return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        if (c == FourCC("DXT3")) return VK_FORMAT_BC2_UNORM_BLOCK;
+        if (c == FourCC("DXT5")) return VK_FORMAT_BC3_UNORM_BLOCK;
+        if (c == FourCC("ATI1") || c == FourCC("BC4U")) return VK_FORMAT_BC4_UNORM_BLOCK;
+        if (c == FourCC("BC4S")) return VK_FORMAT_BC4_SNORM_BLOCK;
+        if (c == FourCC("ATI2") || c == FourCC("BC5U")) return VK_FORMAT_BC5_UNORM_BLOCK;
+        if (c == FourCC("BC5S")) return VK_FORMAT_BC5_SNORM_BLOCK;
+        return VK_FORMAT_UNDEFINED;
+    }
+    //32 bit rgb, with or without alpha
+    if ((pf.flags & DDPF_RGB) && pf.rgbBitCount == 32) {
+        if (pf.rMask == 0xFF && pf.gMask == 0xFF00 && pf.bMask == 0xFF0000) return VK_FORMAT_R8G8B8A8_UNORM;
+        if (pf.rMask == 0xFF0000 && pf.gMask == 0xFF00 && pf.bMask == 0xFF) return VK_FORMAT_B8G8R8A8_UNORM;
+    }
+    return VK_FORMAT_UNDEFINED;
+}
+
+//2D textures without arrays or cube faces, the levels follow the header back to back
+static bool ParseDds(ByteSpan span, TextureFile& tex) {
+    DdsHeader h;
+    if (span.size < sizeof(h)) return false;
+    memcpy(&h, span.data, sizeof(h));
+    if (h.magic != FourCC("DDS ") || h.size != sizeof(h) - sizeof(h.magic)) return false;
+    size_t offset = sizeof(h);
+    if ((h.format.flags & DDPF_FOURCC) && h.format.fourCC == FourCC("DX10")) {
+        DdsHeaderDx10 dx10;
+        if (span.size < offset + sizeof(dx10)) return false;
+        memcpy(&dx10, span.data + offset, sizeof(dx10));
+        offset += sizeof(dx10);
+        if (dx10.resourceDimension != DDS_DIMENSION_TEXTURE2D || dx10.arraySize > 1) {
+            std::cerr << "only 2D dds textures without arrays are supported" << std::endl;
+            return false;
+        }
+        tex.format = DxgiFormat(dx10.dxgiFormat);
+    }
+    else {
+        tex.format = DdsFormat(h.format);
+    }
+    if ((h.caps2 & DDSCAPS2_CUBEMAP) || !h.width || !h.height) {
+        std::cerr << "only 2D dds textures without cube faces are supported" << std::endl;
+        return false;
+    }
+    tex.extent = { h.width, h.height };
+    tex.levelCount = ((h.flags & DDSD_MIPMAPCOUNT) && h.mipMapCount > 1) ? h.mipMapCount : 0;
+    if (h.width > MAX_EXTENT || h.height > MAX_EXTENT || tex.levelCount > FullChain(h.width, h.height)) return false;
+
+    TexelBlock block;
+    if (!TextureFile::BlockOf(tex.format, block)) return true; //reported by Load
+    for (uint32_t a = 0; a < std::max(tex.levelCount, 1u); a++) {
+        const VkExtent2D ext = { std::max(h.width >> a, 1u), std::max(h.height >> a, 1u) };
+        const auto bytes = TextureFile::LevelBytes(ext, block);
+        if (bytes > span.size - offset) return false;
+        tex.levels.push_back(span.Sub(offset, (size_t)bytes));
+        offset += (size_t)bytes;
+    }
+    return true;
+}
+
+bool TextureFile::Parse(ByteSpan span, TextureFile& tex) {
+    tex = {};
+    if (ParseKtx2(span, tex)) return true;
+    tex = {};
+    return ParseDds(span, tex);
+}
@@ -0,0 +1,24 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <vector>
+#include "filereader.hpp"
+#include "uploader.hpp"
+
+/* What a KTX2 or DDS container says about a 2D texture, with its levels pointing into the file.
+ * Only reads the file and checks it stays within it, so it needs no device.
+ */
+struct TextureFile {
+    VkFormat format;
+    VkExtent2D extent;
+    /* 0 when the file has only the full size level and wants the mips generated */
+    uint32_t levelCount;
+    std::vector<ByteSpan> levels;
+
+    /* false if span is neither container or is cut short. A file in a format BlockOf does not
+     * know parses without levels, it is up to the caller to reject it */
+    static bool Parse(ByteSpan span, TextureFile& tex);
+    /* the block of the formats textures can have */
+    static bool BlockOf(VkFormat format, TexelBlock& block);
+    static VkDeviceSize LevelBytes(VkExtent2D extent, TexelBlock block);
+};
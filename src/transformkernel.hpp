@@ -0,0 +1,222 @@
+#pragma once
+#include <cstdint>
+#include <cmath>
+#include "transforms.hpp"
+
+//Shared by transforms.cpp and transformsavx2.cpp, which is compiled for avx2.
+//Everything here has internal linkage, so no function built for avx2 can stand in for the others.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRANSFORMS_SSE2
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+enum TransformColumn {
+    COL_TX, COL_TY, COL_TZ,
+    COL_QX, COL_QY, COL_QZ, COL_QW,
+    COL_SX, COL_SY, COL_SZ,
+    /* local bounds as center and half extent */
+    COL_CX, COL_CY, COL_CZ,
+    COL_EX, COL_EY, COL_EZ,
+    LOCAL_COLUMNS
+};
+/* the world matrix, 3 rows of 4 */
+static const uint32_t WORLD_COLUMNS = 12;
+
+/* recompute the world matrix, then write it this many more frames */
+static const uint8_t DIRTY_FRESH = 0x80;
+static const uint8_t DIRTY_WRITES = 0x7F;
+
+/* the scene in slot order, parents always in an earlier level than their children */
+struct TransformColumns {
+    const float* local[LOCAL_COLUMNS];
+    float* world[WORLD_COLUMNS];
+    /* slot of the parent, unused for roots */
+    const int32_t* parent;
+    uint8_t* dirty;
+    /* where each slot goes in the output */
+    const uint32_t* handle;
+};
+
+/* updates the slots [begin, end) of one level and writes them to out */
+typedef void (*TransformKernel)(const TransformColumns& cols, uint32_t begin, uint32_t end, bool roots, GpuTransform* out);
+
+/* null when the build has no avx2 kernel */
+TransformKernel Avx2TransformKernel();
+
+namespace {
+
+struct ScalarLanes {
+    static const uint32_t WIDTH = 1;
+    float v;
+
+    static ScalarLanes Load(const float* p) { return { *p }; }
+    static ScalarLanes Gather(const float* base, const int32_t* index) { return { base[*index] }; }
+    static ScalarLanes Splat(float f) { return { f }; }
+    void Store(float* p) const { *p = v; }
+    ScalarLanes operator+(ScalarLanes o) const { return { v + o.v }; }
+    ScalarLanes operator-(ScalarLanes o) const { return { v - o.v }; }
+    ScalarLanes operator*(ScalarLanes o) const { return { v * o.v }; }
+    ScalarLanes Abs() const { return { std::fabs(v) }; }
+
+    static void Scatter(GpuTransform* out, const uint32_t* handle, const ScalarLanes (&f)[20]) {
+        float* dst = (float*)(out + *handle);
+        for (uint32_t a = 0; a < 20; a++) dst[a] = f[a].v;
+    }
+};
+
+#ifdef TRANSFORMS_SSE2
+//four lanes of four values, each lane's values go to its own transform
+inline void ScatterSse(GpuTransform* out, const uint32_t* handle, uint32_t offset, __m128 a, __m128 b, __m128 c, __m128 d) {
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps((float*)(out + handle[0]) + offset, a);
+    _mm_storeu_ps((float*)(out + handle[1]) + offset, b);
+    _mm_storeu_ps((float*)(out + handle[2]) + offset, c);
+    _mm_storeu_ps((float*)(out + handle[3]) + offset, d);
+}
+
+struct Sse2Lanes {
+    static const uint32_t WIDTH = 4;
+    __m128 v;
+
+    static Sse2Lanes Load(const float* p) { return { _mm_loadu_ps(p) }; }
+    static Sse2Lanes Gather(const float* base, const int32_t* index) {
+        return { _mm_setr_ps(base[index[0]], base[index[1]], base[index[2]], base[index[3]]) };
+    }
+    static Sse2Lanes Splat(float f) { return { _mm_set1_ps(f) }; }
+    void Store(float* p) const { _mm_storeu_ps(p, v); }
+    Sse2Lanes operator+(Sse2Lanes o) const { return { _mm_add_ps(v, o.v) }; }
+    Sse2Lanes operator-(Sse2Lanes o) const { return { _mm_sub_ps(v, o.v) }; }
+    Sse2Lanes operator*(Sse2Lanes o) const { return { _mm_mul_ps(v, o.v) }; }
+    Sse2Lanes Abs() const { return { _mm_andnot_ps(_mm_set1_ps(-0.0f), v) }; }
+
+    static void Scatter(GpuTransform* out, const uint32_t* handle, const Sse2Lanes (&f)[20]) {
+        for (uint32_t a = 0; a < 20; a += 4) {
+            ScatterSse(out, handle, a, f[a].v, f[a + 1].v, f[a + 2].v, f[a + 3].v);
+        }
+    }
+};
+#endif
+
+#ifdef __AVX2__
+struct Avx2Lanes {
+    static const uint32_t WIDTH = 8;
+    __m256 v;
+
+    static Avx2Lanes Load(const float* p) { return { _mm256_loadu_ps(p) }; }
+    static Avx2Lanes Gather(const float* base, const int32_t* index) {
+        return { _mm256_i32gather_ps(base, _mm256_loadu_si256((const __m256i*)index), 4) };
+    }
+    static Avx2Lanes Splat(float f) { return { _mm256_set1_ps(f) }; }
+    void Store(float* p) const { _mm256_storeu_ps(p, v); }
+    Avx2Lanes operator+(Avx2Lanes o) const { return { _mm256_add_ps(v, o.v) }; }
+    Avx2Lanes operator-(Avx2Lanes o) const { return { _mm256_sub_ps(v, o.v) }; }
+    Avx2Lanes operator*(Avx2Lanes o) const { return { _mm256_mul_ps(v, o.v) }; }
+    Avx2Lanes Abs() const { return { _mm256_andnot_ps(_mm256_set1_ps(-0.0f), v) }; }
+
+    static void Scatter(GpuTransform* out, const uint32_t* handle, const Avx2Lanes (&f)[20]) {
+        for (uint32_t a = 0; a < 20; a += 4) {
+            ScatterSse(out, handle, a, _mm256_castps256_ps128(f[a].v), _mm256_castps256_ps128(f[a + 1].v),
+                _mm256_castps256_ps128(f[a + 2].v), _mm256_castps256_ps128(f[a + 3].v));
+            ScatterSse(out, handle + 4, a, _mm256_extractf128_ps(f[a].v, 1), _mm256_extractf128_ps(f[a + 1].v, 1),
+                _mm256_extractf128_ps(f[a + 2].v, 1), _mm256_extractf128_ps(f[a + 3].v, 1));
+        }
+    }
+};
+#endif
+
+//Every width runs the same operations in the same order without fma, so all kernels give the same bits
+template<class V>
+inline void UpdateLanes(const TransformColumns& c, uint32_t i, bool roots, bool recompute, GpuTransform* out) {
+    V w[20];
+    if (recompute) {
+        const V tx = V::Load(c.local[COL_TX] + i), ty = V::Load(c.local[COL_TY] + i), tz = V::Load(c.local[COL_TZ] + i);
+        const V qx = V::Load(c.local[COL_QX] + i), qy = V::Load(c.local[COL_QY] + i);
+        const V qz = V::Load(c.local[COL_QZ] + i), qw = V::Load(c.local[COL_QW] + i);
+        const V sx = V::Load(c.local[COL_SX] + i), sy = V::Load(c.local[COL_SY] + i), sz = V::Load(c.local[COL_SZ] + i);
+
+        //rotation of a unit quaternion, times the scale of each axis
+        const V x2 = qx + qx, y2 = qy + qy, z2 = qz + qz;
+        const V xx = qx * x2, yy = qy * y2, zz = qz * z2;
+        const V xy = qx * y2, xz = qx * z2, yz = qy * z2;
+        const V wx = qw * x2, wy = qw * y2, wz = qw * z2;
+        const V one = V::Splat(1);
+        V l[12] = {
+            (one - (yy + zz)) * sx, (xy - wz) * sy, (xz + wy) * sz, tx,
+            (xy + wz) * sx, (one - (xx + zz)) * sy, (yz - wx) * sz, ty,
+            (xz - wy) * sx, (yz + wx) * sy, (one - (xx + yy)) * sz, tz
+        };
+        if (roots) {
+            for (uint32_t a = 0; a < 12; a++) w[a] = l[a];
+        }
+        else {
+            //parent * local, parents are in an earlier level and already done
+            V p[12];
+            for (uint32_t a = 0; a < 12; a++) p[a] = V::Gather(c.world[a], c.parent + i);
+            for (uint32_t r = 0; r < 3; r++) {
+                for (uint32_t j = 0; j < 4; j++) {
+                    w[r * 4 + j] = p[r * 4] * l[j] + p[r * 4 + 1] * l[4 + j] + p[r * 4 + 2] * l[8 + j];
+                }
+                w[r * 4 + 3] = w[r * 4 + 3] + p[r * 4 + 3];
+            }
+        }
+        for (uint32_t a = 0; a < 12; a++) w[a].Store(c.world[a] + i);
+    }
+    else {
+        for (uint32_t a = 0; a < 12; a++) w[a] = V::Load(c.world[a] + i);
+    }
+
+    //the box around the transformed local box
+    const V cx = V::Load(c.local[COL_CX] + i), cy = V::Load(c.local[COL_CY] + i), cz = V::Load(c.local[COL_CZ] + i);
+    const V ex = V::Load(c.local[COL_EX] + i), ey = V::Load(c.local[COL_EY] + i), ez = V::Load(c.local[COL_EZ] + i);
+    for (uint32_t r = 0; r < 3; r++) {
+        const V center = w[r * 4] * cx + w[r * 4 + 1] * cy + w[r * 4 + 2] * cz + w[r * 4 + 3];
+        const V extent = w[r * 4].Abs() * ex + w[r * 4 + 1].Abs() * ey + w[r * 4 + 2].Abs() * ez;
+        w[12 + r] = center - extent;
+        w[16 + r] = center + extent;
+    }
+    w[15] = V::Splat(0);
+    w[19] = V::Splat(0);
+    V::Scatter(out, c.handle + i, w);
+}
+
+//one slot with the scalar math, if it has anything pending
+inline void UpdateSlot(const TransformColumns& c, uint32_t i, bool roots, GpuTransform* out) {
+    uint8_t& d = c.dirty[i];
+    if (!d) return;
+    UpdateLanes<ScalarLanes>(c, i, roots, (d & DIRTY_FRESH) != 0, out);
+    d = (d & DIRTY_WRITES) ? (d & DIRTY_WRITES) - 1 : 0;
+}
+
+//Blocks without pending writes are skipped, blocks without fresh lanes skip the math. A block with
+//only a lane or two pending is done lane by lane, as sparse changes would pay for the whole block
+template<class V>
+void UpdateRange(const TransformColumns& c, uint32_t begin, uint32_t end, bool roots, GpuTransform* out) {
+    uint32_t i = begin;
+    for (; i + V::WIDTH <= end; i += V::WIDTH) {
+        uint8_t any = 0;
+        uint32_t pending = 0;
+        for (uint32_t a = 0; a < V::WIDTH; a++) {
+            any |= c.dirty[i + a];
+            pending += c.dirty[i + a] != 0;
+        }
+        if (!any) continue;
+        if (pending <= V::WIDTH / 4) {
+            for (uint32_t a = 0; a < V::WIDTH; a++) UpdateSlot(c, i + a, roots, out);
+            continue;
+        }
+        UpdateLanes<V>(c, i, roots, (any & DIRTY_FRESH) != 0, out);
+        for (uint32_t a = 0; a < V::WIDTH; a++) {
+            uint8_t& d = c.dirty[i + a];
+            d = (d & DIRTY_WRITES) ? (d & DIRTY_WRITES) - 1 : 0;
+        }
+    }
+    for (; i < end; i++) {
+        UpdateSlot(c, i, roots, out);
+    }
+}
+
+}
@@ -0,0 +1,335 @@
+#include "transforms.hpp"
+#include "transformkernel.hpp"
+#include "allocator.hpp"
+#include "handles.hpp"
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <cstdlib>
+#if defined(TRANSFORMS_SSE2) && defined(_MSC_VER)
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+struct Kernel {
+    const char* name;
+    TransformKernel fn;
+};
+
+//per slot, in depth order
+static std::vector<float> localCols[LOCAL_COLUMNS];
+static std::vector<float> worldCols[WORLD_COLUMNS];
+static std::vector<int32_t> parentSlots;
+static std::vector<uint8_t> dirtyFlags;
+static std::vector<uint32_t> slotObjects;
+//per object, in the order they were added
+static std::vector<uint32_t> objectSlots;
+static std::vector<uint32_t> objectParents;
+static std::vector<uint32_t> objectDepths;
+//the first slot of each depth, then the end
+static std::vector<uint32_t> levelStarts;
+
+static bool layoutChanged;
+//slots are in depth order as long as no object is added shallower than the last one
+static bool sorted = true;
+static bool changed;
+//frames that still get writes, so nothing is walked once every slot is current
+static uint32_t pendingFrames;
+static uint32_t writeFrames = 1;
+
+static VkBuffer tfBuffer;
+static Allocation* tfAlloc;
+static uint32_t tfCapacity;
+static VkDeviceSize slotBytes;
+static Kernel kernel = { "scalar", UpdateRange<ScalarLanes> };
+
+#ifdef TRANSFORMS_SSE2
+static bool CpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    //the os has to save the ymm registers as well
+    if (!(info[2] & (1 << 27)) || !(info[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+//every kernel this cpu can run, the fastest last
+static std::vector<Kernel> Kernels() {
+    std::vector<Kernel> kernels = { { "scalar", UpdateRange<ScalarLanes> } };
+#ifdef TRANSFORMS_SSE2
+    kernels.push_back({ "sse2", UpdateRange<Sse2Lanes> });
+    if (Avx2TransformKernel() && CpuHasAvx2()) {
+        kernels.push_back({ "avx2", Avx2TransformKernel() });
+    }
+#endif
+    return kernels;
+}
+
+template<class T>
+static void Permute(std::vector<T>& v, const std::vector<uint32_t>& order) {
+    std::vector<T> out(v.size());
+    for (size_t a = 0; a < order.size(); a++) {
+        out[a] = v[order[a]];
+    }
+    v.swap(out);
+}
+
+//sorts the slots by depth if needed, then finds the levels and the parents' slots
+static void Rebuild() {
+    const uint32_t count = (uint32_t)objectSlots.size();
+    uint32_t maxDepth = 0;
+    for (auto d : objectDepths) maxDepth = std::max(maxDepth, d);
+    levelStarts.assign(maxDepth + 2, 0);
+    for (auto d : objectDepths) levelStarts[d + 1]++;
+    for (uint32_t a = 1; a < levelStarts.size(); a++) levelStarts[a] += levelStarts[a - 1];
+
+    if (!sorted) {
+        //stable, so objects keep their order within a level
+        std::vector<uint32_t> order(count);
+        auto next = levelStarts;
+        for (uint32_t s = 0; s < count; s++) {
+            order[next[objectDepths[slotObjects[s]]]++] = s;
+        }
+        for (auto& col : localCols) Permute(col, order);
+        for (auto& col : worldCols) Permute(col, order);
+        Permute(dirtyFlags, order);
+        Permute(slotObjects, order);
+        for (uint32_t s = 0; s < count; s++) {
+            objectSlots[slotObjects[s]] = s;
+        }
+        sorted = true;
+    }
+    parentSlots.resize(count);
+    for (uint32_t s = 0; s < count; s++) {
+        const auto parent = objectParents[slotObjects[s]];
+        parentSlots[s] = (parent == Transforms::NONE) ? 0 : (int32_t)objectSlots[parent];
+    }
+    layoutChanged = false;
+}
+
+static TransformColumns Columns() {
+    TransformColumns c;
+    for (uint32_t a = 0; a < LOCAL_COLUMNS; a++) c.local[a] = localCols[a].data();
+    for (uint32_t a = 0; a < WORLD_COLUMNS; a++) c.world[a] = worldCols[a].data();
+    c.parent = parentSlots.data();
+    c.dirty = dirtyFlags.data();
+    c.handle = slotObjects.data();
+    return c;
+}
+
+static void Run(GpuTransform* out, TransformKernel fn) {
+    if (layoutChanged) Rebuild();
+    if (changed) {
+        //children of recomputed objects are recomputed too, level by level
+        for (uint32_t s = levelStarts[1]; s < slotObjects.size(); s++) {
+            if (dirtyFlags[parentSlots[s]] & DIRTY_FRESH) {
+                dirtyFlags[s] = DIRTY_FRESH | writeFrames;
+            }
+        }
+        pendingFrames = writeFrames;
+        changed = false;
+    }
+    if (!pendingFrames) return;
+    pendingFrames--;
+    const auto c = Columns();
+    for (uint32_t l = 0; l + 1 < levelStarts.size(); l++) {
+        fn(c, levelStarts[l], levelStarts[l + 1], l == 0, out);
+    }
+}
+
+static void SetColumns(uint32_t slot, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    localCols[COL_TX][slot] = position.x;
+    localCols[COL_TY][slot] = position.y;
+    localCols[COL_TZ][slot] = position.z;
+    localCols[COL_QX][slot] = rotation.x;
+    localCols[COL_QY][slot] = rotation.y;
+    localCols[COL_QZ][slot] = rotation.z;
+    localCols[COL_QW][slot] = rotation.w;
+    localCols[COL_SX][slot] = scale.x;
+    localCols[COL_SY][slot] = scale.y;
+    localCols[COL_SZ][slot] = scale.z;
+    dirtyFlags[slot] = DIRTY_FRESH | writeFrames;
+    changed = true;
+}
+
+void Transforms::Init(uint32_t frames, uint32_t capacity) {
+    writeFrames = frames;
+    tfCapacity = capacity;
+    //each frame's slot can be bound at its offset
+    slotBytes = ((VkDeviceSize)capacity * sizeof(GpuTransform) + 255) & ~(VkDeviceSize)255;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = slotBytes * frames;
+    info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    tfAlloc = Allocator::CreateBuffer(info, MEMORY_USAGE_UPLOAD, &tfBuffer);
+    if (!tfAlloc->mapped) {
+        std::cerr << "transform memory is not host visible!" << std::endl;
+        abort();
+    }
+    kernel = Kernels().back();
+    std::cout << "transforms updated with " << kernel.name << std::endl;
+}
+
+void Transforms::Exit() {
+    if (tfBuffer) {
+        DeletionQueue::RetireBuffer(tfBuffer, tfAlloc);
+        tfBuffer = VK_NULL_HANDLE;
+        tfAlloc = nullptr;
+    }
+    Clear();
+}
+
+uint32_t Transforms::Add(uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale,
+        const glm::vec3& boundsCenter, const glm::vec3& boundsExtent) {
+    const auto object = (uint32_t)objectSlots.size();
+    if (tfBuffer && object == tfCapacity) {
+        std::cerr << "more than " << tfCapacity << " transforms!" << std::endl;
+        abort();
+    }
+    const uint32_t depth = (parent == NONE) ? 0 : objectDepths[parent] + 1;
+    if (!slotObjects.empty() && depth < objectDepths[slotObjects.back()]) {
+        sorted = false;
+    }
+    const auto slot = (uint32_t)slotObjects.size();
+    for (auto& col : localCols) col.push_back(0);
+    for (auto& col : worldCols) col.push_back(0);
+    dirtyFlags.push_back(0);
+    slotObjects.push_back(object);
+    objectSlots.push_back(slot);
+    objectParents.push_back(parent);
+    objectDepths.push_back(depth);
+    localCols[COL_CX][slot] = boundsCenter.x;
+    localCols[COL_CY][slot] = boundsCenter.y;
+    localCols[COL_CZ][slot] = boundsCenter.z;
+    localCols[COL_EX][slot] = boundsExtent.x;
+    localCols[COL_EY][slot] = boundsExtent.y;
+    localCols[COL_EZ][slot] = boundsExtent.z;
+    SetColumns(slot, position, rotation, scale);
+    layoutChanged = true;
+    return object;
+}
+
+void Transforms::SetLocal(uint32_t object, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+    SetColumns(objectSlots[object], position, rotation, scale);
+}
+
+void Transforms::Clear() {
+    for (auto& col : localCols) col.clear();
+    for (auto& col : worldCols) col.clear();
+    parentSlots.clear();
+    dirtyFlags.clear();
+    slotObjects.clear();
+    objectSlots.clear();
+    objectParents.clear();
+    objectDepths.clear();
+    levelStarts.clear();
+    layoutChanged = false;
+    sorted = true;
+    changed = false;
+    pendingFrames = 0;
+}
+
+uint32_t Transforms::Count() {
+    return (uint32_t)objectSlots.size();
+}
+
+void Transforms::Update(uint64_t frame) {
+    const auto offset = slotBytes * (frame % writeFrames);
+    Run((GpuTransform*)(tfAlloc->mapped + offset), kernel.fn);
+}
+
+const char* Transforms::Isa() {
+    return kernel.name;
+}
+
+uint32_t Transforms::KernelCount() {
+    return (uint32_t)Kernels().size();
+}
+
+const char* Transforms::KernelName(uint32_t k) {
+    return Kernels()[k].name;
+}
+
+void Transforms::UpdateInto(uint32_t k, GpuTransform* out) {
+    Run(out, Kernels()[k].fn);
+}
+
+typedef std::chrono::steady_clock BenchClock;
+
+static double BenchMsSince(BenchClock::time_point t) {
+    return std::chrono::duration<double, std::milli>(BenchClock::now() - t).count();
+}
+
+void Transforms::Benchmark() {
+    const uint32_t SIZES[] = { 10000, 100000, 1000000 };
+    const auto kernels = Kernels();
+    std::cout << "transform benchmark: " << sizeof(GpuTransform) << " bytes per object, roots, children and leaves 1:7:56" << std::endl;
+
+    for (auto count : SIZES) {
+        //three levels, the children of each object next to each other as a scene loader adds them
+        Clear();
+        writeFrames = 1;
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> pos(-10, 10);
+        const uint32_t roots = std::max(count / 64, 1u);
+        const uint32_t children = std::max(count / 8, roots + 1);
+        std::vector<glm::vec3> positions(count);
+        std::vector<uint32_t> leaves;
+        for (uint32_t a = 0; a < count; a++) {
+            const uint32_t parent = (a < roots) ? NONE : (a < children) ? (uint64_t)(a - roots) * roots / (children - roots)
+                : roots + (uint64_t)(a - children) * (children - roots) / (count - children);
+            positions[a] = glm::vec3(pos(rng), pos(rng), pos(rng));
+            Add(parent, positions[a], glm::angleAxis(pos(rng), glm::vec3(0, 1, 0)), glm::vec3(1), glm::vec3(0), glm::vec3(0.5f));
+            if (a >= children && rng() % 10 == 0) leaves.push_back(a);
+        }
+        const uint32_t iterations = std::max(5u, 2000000 / count);
+        std::vector<GpuTransform> out(count), first(count);
+
+        std::cout << "  " << count << " objects, " << iterations << " updates" << std::endl;
+        for (auto& k : kernels) {
+            //moving every root changes every object
+            double allMs = 0;
+            for (uint32_t it = 0; it < iterations; it++) {
+                for (uint32_t r = 0; r < roots; r++) {
+                    SetLocal(r, positions[r], glm::angleAxis(it * 0.01f + r, glm::vec3(0, 0, 1)), glm::vec3(1));
+                }
+                const auto t = BenchClock::now();
+                Run(out.data(), k.fn);
+                allMs += BenchMsSince(t);
+            }
+            //a tenth of the leaves move, scattered over the scene
+            double someMs = 0;
+            for (uint32_t it = 0; it < iterations; it++) {
+                for (auto l : leaves) {
+                    SetLocal(l, positions[l], glm::angleAxis(it * 0.01f, glm::vec3(1, 0, 0)), glm::vec3(1));
+                }
+                const auto t = BenchClock::now();
+                Run(out.data(), k.fn);
+                someMs += BenchMsSince(t);
+            }
+            allMs /= iterations;
+            someMs /= iterations;
+            if (&k == &kernels[0]) {
+                first = out;
+            }
+            const bool same = !memcmp(first.data(), out.data(), count * sizeof(GpuTransform));
+            std::cout << "    " << k.name << ": all " << allMs << "ms (" << allMs * 1e6 / count << "ns/object), "
+                << "10% of leaves " << someMs << "ms (" << someMs * 1e6 / leaves.size() << "ns/moved object)"
+                << (same ? "" : ", differs from scalar!") << std::endl;
+        }
+    }
+    Clear();
+}
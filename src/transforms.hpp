@@ -0,0 +1,55 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+/* one object's world transform as the gpu reads it, 80 bytes */
+struct GpuTransform {
+    /* the affine world matrix, row major */
+    float rows[3][4];
+    /* world space box around the local bounds, w is 0 */
+    float boundsMin[4];
+    float boundsMax[4];
+};
+
+/* World matrices and bounds of a scene hierarchy, updated on the cpu every frame. Objects are
+ * stored as structure of arrays sorted by their depth in the hierarchy, so each level is updated
+ * with SSE2 or AVX2 (picked at runtime, with a scalar fallback) several objects at a time after
+ * the level of their parents. Only objects that changed, and their descendants, are recomputed;
+ * the results are written straight into a mapped buffer with a slot per frame in flight.
+ * No shader reads that buffer yet, it is there so the cost measured includes the writes to
+ * mapped memory a renderer would pay.
+ */
+class Transforms {
+public:
+    static const uint32_t NONE = UINT32_MAX;
+
+    /* a buffer of capacity transforms per frame, needs the Allocator */
+    static void Init(uint32_t frames, uint32_t capacity);
+    static void Exit();
+
+    /* parent is an object added before, or NONE. Returns the object's index in the buffer */
+    static uint32_t Add(uint32_t parent, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale,
+        const glm::vec3& boundsCenter, const glm::vec3& boundsExtent);
+    /* rotation must be normalized */
+    static void SetLocal(uint32_t object, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale);
+    static void Clear();
+    static uint32_t Count();
+
+    /* Call once per frame, after the frame's slot is no longer read. Recomputes what changed and
+     * writes it to every slot in turn, so each slot is current when its frame is drawn.
+     */
+    static void Update(uint64_t frame);
+    /* the instruction set of the kernel Update uses */
+    static const char* Isa();
+
+    /* the kernels this cpu can run, scalar first and the one Update uses last */
+    static uint32_t KernelCount();
+    static const char* KernelName(uint32_t kernel);
+    /* Update with the given kernel into out, a transform per object, instead of the buffer */
+    static void UpdateInto(uint32_t kernel, GpuTransform* out);
+
+    /* times updates of 10k to 1M objects with every kernel the cpu has, no device needed */
+    static void Benchmark();
+};
@@ -0,0 +1,13 @@
+#include "transformkernel.hpp"
+
+//built with avx2 enabled, Transforms only calls it when the cpu has it
+
+#ifdef __AVX2__
+TransformKernel Avx2TransformKernel() {
+    return UpdateRange<Avx2Lanes>;
+}
+#else
+TransformKernel Avx2TransformKernel() {
+    return nullptr;
+}
+#endif
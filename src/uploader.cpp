@@ -0,0 +1,464 @@
+#include "uploader.hpp"
+#include "allocator.hpp"
+#include "handles.hpp"
+#include "vkdo.hpp"
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+struct UploadRequest {
+    VkBuffer dst;
+    VkDeviceSize offset;
+    const char* data;
+    VkDeviceSize size;
+    /* bytes already copied into the staging ring */
+    VkDeviceSize copied;
+    VkPipelineStageFlags stage;
+    VkAccessFlags access;
+    bool concurrent;
+    uint64_t ticket;
+    /* image requests have no dst, size covers the whole level */
+    VkImage image;
+    uint32_t level;
+    VkExtent2D extent;
+    TexelBlock block;
+    VkImageLayout layout;
+};
+
+struct UploadBatch {
+    VkCommandBuffer transfer;
+    VkCommandBuffer acquire;
+    VkFence fence;
+    /* only signaled when the batch finishes a request, the graphics submit of frame waits on them.
+     * One per device of the group, signaled by that device */
+    VkSemaphore semaphores[VK_MAX_DEVICE_GROUP_SIZE];
+    bool signals;
+    uint64_t frame;
+    /* staging bytes to give back once the batch has executed, including any skipped at the ring's end */
+    VkDeviceSize ringBytes;
+};
+
+static VkDevice upDevice;
+static uint32_t transferFamily;
+static uint32_t graphicsFamily;
+static VkQueue transferQueue;
+static uint32_t deviceCount;
+//0, 1, 2... the device that signals each of a batch's semaphores
+static uint32_t deviceIndices[VK_MAX_DEVICE_GROUP_SIZE];
+static VkCommandPool transferPool;
+static VkCommandPool acquirePool;
+static VkBuffer ringBuffer;
+static Allocation* ringAlloc;
+static VkDeviceSize ringSize;
+static VkDeviceSize ringHead;
+static VkDeviceSize ringUsed;
+static VkDeviceSize frameBudget;
+//rows of texel blocks the transfer queue copies at a time, 0 when it only copies whole levels
+static uint32_t rowStep;
+static std::deque<UploadRequest> requests;
+static std::deque<UploadBatch> inFlight;
+static std::vector<UploadBatch> freeBatches;
+static uint64_t nextTicket = 1;
+static uint64_t doneTicket;
+
+static uint64_t uploadedBytes;
+static uint32_t batchCount;
+static uint32_t ringFullCount;
+
+//hands out up to want contiguous bytes at the head of the ring
+static bool RingAlloc(VkDeviceSize want, VkDeviceSize& size, VkDeviceSize& offset, VkDeviceSize& consumed) {
+    const auto free = ringSize - ringUsed;
+    const auto toEnd = ringSize - ringHead;
+    if (free > toEnd && toEnd < want && toEnd < free - toEnd) {
+        //the piece before the end is the smaller one, skip it and continue at the start
+        ringUsed += toEnd;
+        consumed += toEnd;
+        ringHead = 0;
+    }
+    size = std::min(want, std::min(ringSize - ringUsed, ringSize - ringHead));
+    if (!size) return false;
+    offset = ringHead;
+    ringHead = (ringHead + size) % ringSize;
+    ringUsed += size;
+    consumed += size;
+    return true;
+}
+
+static void BeginBatch(UploadBatch& batch, bool& recording) {
+    if (recording) return;
+    VkCommandBufferBeginInfo binfo = {};
+    binfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    binfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VKDO(vkBeginCommandBuffer(batch.transfer, &binfo));
+    recording = true;
+}
+
+static UploadBatch GetBatch() {
+    if (!freeBatches.empty()) {
+        auto b = freeBatches.back();
+        freeBatches.pop_back();
+        VKDO(vkResetFences(upDevice, 1, &b.fence));
+        b.signals = false;
+        b.ringBytes = 0;
+        return b;
+    }
+    UploadBatch b = {};
+    VkCommandBufferAllocateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    info.commandBufferCount = 1;
+    info.commandPool = transferPool;
+    VKDO(vkAllocateCommandBuffers(upDevice, &info, &b.transfer));
+    if (acquirePool != VK_NULL_HANDLE) {
+        info.commandPool = acquirePool;
+        VKDO(vkAllocateCommandBuffers(upDevice, &info, &b.acquire));
+    }
+
+    VkFenceCreateInfo finfo = {};
+    finfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    VKDO(vkCreateFence(upDevice, &finfo, nullptr, &b.fence));
+    VkSemaphoreCreateInfo sinfo = {};
+    sinfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    for (uint32_t a = 0; a < deviceCount; a++) {
+        VKDO(vkCreateSemaphore(upDevice, &sinfo, nullptr, &b.semaphores[a]));
+    }
+    return b;
+}
+
+static VkCommandPool CreatePool(uint32_t family) {
+    VkCommandPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    info.queueFamilyIndex = family;
+    info.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    VkCommandPool pool;
+    VKDO(vkCreateCommandPool(upDevice, &info, nullptr, &pool));
+    return pool;
+}
+
+static VkBufferMemoryBarrier OwnershipBarrier(const UploadRequest& r, VkAccessFlags src, VkAccessFlags dst) {
+    VkBufferMemoryBarrier b = {};
+    b.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    b.srcAccessMask = src;
+    b.dstAccessMask = dst;
+    b.srcQueueFamilyIndex = transferFamily;
+    b.dstQueueFamilyIndex = graphicsFamily;
+    b.buffer = r.dst;
+    b.offset = r.offset;
+    b.size = r.size;
+    return b;
+}
+
+static VkImageMemoryBarrier ImageBarrier(const UploadRequest& r, VkImageLayout from, VkImageLayout to, VkAccessFlags src, VkAccessFlags dst) {
+    VkImageMemoryBarrier b = {};
+    b.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    b.srcAccessMask = src;
+    b.dstAccessMask = dst;
+    b.oldLayout = from;
+    b.newLayout = to;
+    b.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    b.image = r.image;
+    b.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, r.level, 1, 0, 1 };
+    return b;
+}
+
+static VkDeviceSize RowBytes(VkExtent2D extent, TexelBlock block) {
+    return (VkDeviceSize)(extent.width + block.width - 1) / block.width * block.bytes;
+}
+
+//copies the next rows of texel blocks of an image request, in steps the transfer queue can copy
+static bool CopyImageRows(UploadBatch& batch, UploadRequest& r, VkDeviceSize& spent, bool& recording) {
+    const auto rowBytes = RowBytes(r.extent, r.block);
+    const auto rows = (uint32_t)(r.size / rowBytes);
+    const auto done = (uint32_t)(r.copied / rowBytes);
+    const uint32_t step = rowStep ? rowStep : rows;
+    auto fit = [&](VkDeviceSize bytes) {
+        const auto n = (uint32_t)std::min<VkDeviceSize>(bytes / rowBytes, rows - done);
+        return (done + n == rows) ? n : n - n % step;
+    };
+    //one step always goes into a batch that copies nothing else, however large it is
+    uint32_t want = fit(frameBudget - spent);
+    if (!want) {
+        if (spent) return false;
+        want = std::min(step, rows - done);
+    }
+
+    //the source offset has to be a multiple of both the block size and 4
+    VkDeviceSize align = r.block.bytes;
+    while (align % 4) align += r.block.bytes;
+    const auto pad = (align - ringHead % align) % align;
+    VkDeviceSize size = 0, offset;
+    if (ringSize - ringUsed >= pad) {
+        ringHead = (ringHead + pad) % ringSize;
+        ringUsed += pad;
+        batch.ringBytes += pad;
+        RingAlloc(want * rowBytes, size, offset, batch.ringBytes);
+    }
+    //the ring may have handed out part of a step, which goes back to it
+    const uint32_t got = fit(size);
+    const auto bytes = got * rowBytes;
+    if (bytes < size) {
+        ringHead = offset + bytes;
+        ringUsed -= size - bytes;
+        batch.ringBytes -= size - bytes;
+    }
+    if (!got) {
+        ringFullCount++;
+        return false;
+    }
+
+    BeginBatch(batch, recording);
+    if (!r.copied) {
+        const auto b = ImageBarrier(r, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+        vkCmdPipelineBarrier(batch.transfer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+            0, 0, nullptr, 0, nullptr, 1, &b);
+    }
+    memcpy(ringAlloc->mapped + offset, r.data + r.copied, bytes);
+    const uint32_t y = done * r.block.height;
+    VkBufferImageCopy region = {};
+    region.bufferOffset = offset;
+    region.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, r.level, 0, 1 };
+    region.imageOffset = { 0, (int32_t)y, 0 };
+    region.imageExtent = { r.extent.width, std::min(r.extent.height - y, got * r.block.height), 1 };
+    vkCmdCopyBufferToImage(batch.transfer, ringBuffer, r.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+    r.copied += bytes;
+    spent += bytes;
+    return true;
+}
+
+void Uploader::Init(VkDevice device, uint32_t tFamily, VkQueue tQueue, uint32_t gFamily, VkExtent3D imageGranularity,
+        VkDeviceSize size, VkDeviceSize budget, uint32_t devices) {
+    upDevice = device;
+    transferFamily = tFamily;
+    transferQueue = tQueue;
+    graphicsFamily = gFamily;
+    rowStep = imageGranularity.height;
+    ringSize = size;
+    frameBudget = budget;
+    deviceCount = devices;
+    for (uint32_t a = 0; a < deviceCount; a++) deviceIndices[a] = a;
+
+    transferPool = CreatePool(transferFamily);
+    //the graphics queue only needs its own command buffers to take ownership from another family
+    acquirePool = (transferFamily != graphicsFamily) ? CreatePool(graphicsFamily) : VK_NULL_HANDLE;
+
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = ringSize;
+    info.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    ringAlloc = Allocator::CreateBuffer(info, MEMORY_USAGE_UPLOAD, &ringBuffer);
+
+    std::cout << "uploader: " << (ringSize >> 20) << "MB staging ring on queue family " << transferFamily
+        << ((transferFamily != graphicsFamily) ? " (dedicated transfer)" : " (shared with graphics)") << std::endl;
+}
+
+void Uploader::Exit() {
+    vkQueueWaitIdle(transferQueue);
+    for (auto& b : inFlight) {
+        freeBatches.push_back(b);
+    }
+    inFlight.clear();
+    for (auto& b : freeBatches) {
+        vkDestroyFence(upDevice, b.fence, nullptr);
+        for (uint32_t a = 0; a < deviceCount; a++) {
+            vkDestroySemaphore(upDevice, b.semaphores[a], nullptr);
+        }
+    }
+    freeBatches.clear();
+    requests.clear();
+    vkDestroyCommandPool(upDevice, transferPool, nullptr);
+    if (acquirePool != VK_NULL_HANDLE) {
+        vkDestroyCommandPool(upDevice, acquirePool, nullptr);
+    }
+    DeletionQueue::RetireBuffer(ringBuffer, ringAlloc);
+}
+
+uint64_t Uploader::Upload(VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size,
+        VkPipelineStageFlags stage, VkAccessFlags access, bool concurrent) {
+    UploadRequest r = {};
+    r.dst = dst;
+    r.offset = offset;
+    r.data = (const char*)data;
+    r.size = size;
+    r.stage = stage;
+    r.access = access;
+    r.concurrent = concurrent;
+    r.ticket = nextTicket++;
+    requests.push_back(r);
+    return r.ticket;
+}
+
+uint64_t Uploader::UploadImage(VkImage dst, uint32_t level, VkExtent2D extent, TexelBlock block, const void* data,
+        VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access) {
+    const auto rowBytes = RowBytes(extent, block);
+    const uint32_t rows = (extent.height + block.height - 1) / block.height;
+    //a step of rows is copied from one piece of the ring, half of it is always free eventually
+    if ((rowStep ? std::min(rowStep, rows) : rows) * rowBytes > ringSize / 2) {
+        std::cerr << "a " << extent.width << "x" << extent.height << " image level does not fit the staging ring!" << std::endl;
+        abort();
+    }
+    UploadRequest r = {};
+    r.image = dst;
+    r.level = level;
+    r.extent = extent;
+    r.block = block;
+    r.data = (const char*)data;
+    r.size = rowBytes * rows;
+    r.layout = layout;
+    r.stage = stage;
+    r.access = access;
+    r.ticket = nextTicket++;
+    requests.push_back(r);
+    return r.ticket;
+}
+
+bool Uploader::IsDone(uint64_t ticket) {
+    return ticket <= doneTicket;
+}
+
+bool Uploader::IsIdle() {
+    return doneTicket + 1 == nextTicket;
+}
+
+UploadSubmit Uploader::Flush(uint64_t frame, uint64_t completedFrame) {
+    //a batch is free once its copies have run and the frame that waited on its semaphores has finished
+    while (!inFlight.empty()) {
+        auto& b = inFlight.front();
+        if ((b.signals && b.frame > completedFrame) || vkGetFenceStatus(upDevice, b.fence) != VK_SUCCESS) break;
+        ringUsed -= b.ringBytes;
+        freeBatches.push_back(b);
+        inFlight.pop_front();
+    }
+    //an empty ring starts over, so the largest piece it can hand out is all of it
+    if (!ringUsed) {
+        ringHead = 0;
+    }
+
+    UploadSubmit submit = {};
+    if (requests.empty()) return submit;
+
+    auto batch = GetBatch();
+    bool recording = false;
+    VkDeviceSize spent = 0;
+    std::vector<VkBufferMemoryBarrier> releases, acquires;
+    std::vector<VkImageMemoryBarrier> imageReleases, imageAcquires;
+    while (!requests.empty()) {
+        auto& r = requests.front();
+        if (r.copied < r.size && r.image != VK_NULL_HANDLE) {
+            if (spent >= frameBudget || !CopyImageRows(batch, r, spent, recording)) break;
+            if (r.copied < r.size) continue;
+        }
+        else if (r.copied < r.size) {
+            VkDeviceSize size, offset;
+            if (spent >= frameBudget) break;
+            if (!RingAlloc(std::min(r.size - r.copied, frameBudget - spent), size, offset, batch.ringBytes)) {
+                ringFullCount++;
+                break;
+            }
+            BeginBatch(batch, recording);
+            memcpy(ringAlloc->mapped + offset, r.data + r.copied, size);
+            VkBufferCopy region = {};
+            region.srcOffset = offset;
+            region.dstOffset = r.offset + r.copied;
+            region.size = size;
+            vkCmdCopyBuffer(batch.transfer, ringBuffer, r.dst, 1, &region);
+            r.copied += size;
+            spent += size;
+            //the ring may have handed out less than asked, try again for the rest
+            if (r.copied < r.size) continue;
+        }
+
+        //earlier chunks went out in earlier batches on the same queue, so one release covers them
+        //the semaphore alone makes the copy visible to a buffer shared by the families
+        if (r.image != VK_NULL_HANDLE) {
+            auto release = ImageBarrier(r, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, r.layout, VK_ACCESS_TRANSFER_WRITE_BIT, 0);
+            //within one family the transition is all there is, the semaphore makes it visible
+            if (acquirePool != VK_NULL_HANDLE) {
+                release.srcQueueFamilyIndex = transferFamily;
+                release.dstQueueFamilyIndex = graphicsFamily;
+                auto acquire = release;
+                acquire.srcAccessMask = 0;
+                acquire.dstAccessMask = r.access;
+                imageAcquires.push_back(acquire);
+            }
+            imageReleases.push_back(release);
+        }
+        else if (acquirePool != VK_NULL_HANDLE && r.size && !r.concurrent) {
+            releases.push_back(OwnershipBarrier(r, VK_ACCESS_TRANSFER_WRITE_BIT, 0));
+            acquires.push_back(OwnershipBarrier(r, 0, r.access));
+        }
+        submit.waitStage |= r.stage;
+        doneTicket = r.ticket;
+        requests.pop_front();
+    }
+
+    if (!recording) {
+        //nothing to copy, either the ring is full or the requests were empty. Padding skipped on
+        //the way is the newest part of the ring and goes back
+        ringHead = (ringHead + ringSize - batch.ringBytes % ringSize) % ringSize;
+        ringUsed -= batch.ringBytes;
+        freeBatches.push_back(batch);
+        return submit;
+    }
+
+    if (!releases.empty() || !imageReleases.empty()) {
+        vkCmdPipelineBarrier(batch.transfer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+            0, 0, nullptr, (uint32_t)releases.size(), releases.data(), (uint32_t)imageReleases.size(), imageReleases.data());
+    }
+    VKDO(vkEndCommandBuffer(batch.transfer));
+
+    batch.signals = submit.waitStage != 0;
+    batch.frame = frame;
+
+    VkSubmitInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    info.commandBufferCount = 1;
+    info.pCommandBuffers = &batch.transfer;
+    //on a device group every device copies into its own instance of the memory and signals for itself
+    const uint32_t allDevices = (1u << deviceCount) - 1;
+    VkDeviceGroupSubmitInfo groupInfo = {};
+    groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_SUBMIT_INFO;
+    groupInfo.commandBufferCount = 1;
+    groupInfo.pCommandBufferDeviceMasks = &allDevices;
+    groupInfo.pSignalSemaphoreDeviceIndices = deviceIndices;
+    if (deviceCount > 1) {
+        info.pNext = &groupInfo;
+    }
+    if (batch.signals) {
+        info.signalSemaphoreCount = deviceCount;
+        info.pSignalSemaphores = batch.semaphores;
+        groupInfo.signalSemaphoreCount = deviceCount;
+    }
+    VKDO(vkQueueSubmit(transferQueue, 1, &info, batch.fence));
+
+    if (!acquires.empty() || !imageAcquires.empty()) {
+        //the semaphore wait covers waitStage, so the acquire chains onto it by using the same stages
+        VkCommandBufferBeginInfo binfo = {};
+        binfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        binfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VKDO(vkBeginCommandBuffer(batch.acquire, &binfo));
+        vkCmdPipelineBarrier(batch.acquire, submit.waitStage, submit.waitStage,
+            0, 0, nullptr, (uint32_t)acquires.size(), acquires.data(), (uint32_t)imageAcquires.size(), imageAcquires.data());
+        VKDO(vkEndCommandBuffer(batch.acquire));
+        submit.acquire = batch.acquire;
+    }
+
+    inFlight.push_back(batch);
+    if (batch.signals) {
+        //into the batch in flight, which stays put until the frame has finished
+        submit.semaphore = inFlight.back().semaphores[0];
+        submit.semaphores = inFlight.back().semaphores;
+        submit.semaphoreCount = deviceCount;
+    }
+    uploadedBytes += spent;
+    batchCount++;
+    return submit;
+}
+
+void Uploader::PrintStats() {
+    std::cout << "uploader: " << (uploadedBytes >> 10) << "KB in " << batchCount << " batches, ring full "
+        << ringFullCount << " times" << std::endl;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <vulkan/vulkan.h>
+
+/* what the graphics submit of a frame has to include for the uploads Flush finished */
+struct UploadSubmit {
+    /* VK_NULL_HANDLE if nothing finished this frame */
+    VkSemaphore semaphore;
+    /* On a device group the copies run on every device, and device d signals semaphores[d], which
+     * device d has to wait on before it uses the uploads. Just semaphore otherwise.
+     */
+    const VkSemaphore* semaphores;
+    uint32_t semaphoreCount;
+    VkPipelineStageFlags waitStage;
+    /* acquires ownership on the graphics queue, VK_NULL_HANDLE when both queues share a family */
+    VkCommandBuffer acquire;
+};
+
+/* the texel block of a format, 1x1 for uncompressed ones */
+struct TexelBlock {
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytes;
+};
+
+/* Streams buffer and image data to the gpu through a persistently mapped staging ring.
+ * Copies run on the transfer queue, at most frameBudget bytes per Flush, so large uploads are
+ * spread over several frames instead of stalling one. Requests finish in the order they were made.
+ */
+class Uploader {
+public:
+    /* imageGranularity is minImageTransferGranularity of the transfer family, large images are
+     * split into rows in steps of its height. deviceCount is the size of the device group behind
+     * device, 1 without one */
+    static void Init(VkDevice device, uint32_t transferFamily, VkQueue transferQueue, uint32_t graphicsFamily,
+        VkExtent3D imageGranularity, VkDeviceSize ringSize, VkDeviceSize frameBudget, uint32_t deviceCount = 1);
+    static void Exit();
+
+    /* Queues a copy of size bytes from data to dst at offset, to be used at stage with access.
+     * data is read during later Flush calls and must stay valid until IsDone(ticket).
+     * concurrent: dst is VK_SHARING_MODE_CONCURRENT over the transfer family and every family
+     * that reads it, so its ownership is not moved to the graphics queue.
+     */
+    static uint64_t Upload(VkBuffer dst, VkDeviceSize offset, const void* data, VkDeviceSize size,
+        VkPipelineStageFlags stage, VkAccessFlags access, bool concurrent = false);
+    /* Queues a copy of mip level of dst, of size extent, from data holding its rows of texel blocks
+     * tightly packed. The level goes from UNDEFINED to layout, to be used at stage with access, and
+     * is not touched by anything else until IsDone(ticket).
+     */
+    static uint64_t UploadImage(VkImage dst, uint32_t level, VkExtent2D extent, TexelBlock block, const void* data,
+        VkImageLayout layout, VkPipelineStageFlags stage, VkAccessFlags access);
+    /* true once the upload is visible to command buffers submitted with the UploadSubmit that finished it */
+    static bool IsDone(uint64_t ticket);
+    /* true when every upload queued so far is done */
+    static bool IsIdle();
+
+    /* Call once per frame, before the frame's graphics submit. completedFrame is the latest frame whose
+     * graphics work is known to have finished; staging space and semaphores are reused after that.
+     */
+    static UploadSubmit Flush(uint64_t frame, uint64_t completedFrame);
+
+    static void PrintStats();
+};
@@ -0,0 +1,12 @@
+#pragma once
+#include <vulkan/vulkan.h>
+#include <cstdlib>
+#include <iostream>
+
+/* Aborts with the failing call and its error code unless cmd returns VK_SUCCESS. The result is
+ * local, so recording threads can use this too.
+ */
+#define VKDO(cmd) { const VkResult result = cmd; if (result != VK_SUCCESS) {\
+    std::cerr << #cmd << " failed with error code " << (int)result << std::endl;\
+    abort();\
+}}
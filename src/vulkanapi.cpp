@@ -4,52 +4,201 @@
 #include <set>
 #include <vector>
 #include <cstdint>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include "allocator.hpp"
+#include "assetpack.hpp"
+#include "asynccompute.hpp"
+#include "bindless.hpp"
+#include "devicepicker.hpp"
 #include "filereader.hpp"
+#include "framestats.hpp"
+#include "framesync.hpp"
+#include "gpuscene.hpp"
+#include "handles.hpp"
+#include "jobsystem.hpp"
+#include "layouts.hpp"
+#include "pipelinecache.hpp"
+#include "pipelines.hpp"
+#include "profiler.hpp"
+#include "readback.hpp"
+#include "rendergraph.hpp"
+#include "spirv.hpp"
+#include "transforms.hpp"
+#include "uploader.hpp"
+#include "vkdo.hpp"
 
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
-const uint32_t MAX_FRAMES_IN_FLIGHT = 2;
+//FramePacing::framesInFlight picks how many of these are used
+const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
 
-VkResult result;
+const char* PIPELINE_CACHE_PATH = "pipeline.cache";
+//assets are looked up here first, then as loose files
+const char* ASSET_PACK_PATH = "assets.pack";
+
+const VkDeviceSize STAGING_RING_SIZE = 32ull << 20;
+//caps the copies submitted per frame, so a large mesh is spread over several frames
+const VkDeviceSize UPLOAD_BUDGET_PER_FRAME = 8ull << 20;
+
+//a present that never completes, as for a hidden window, only costs this much per frame
+const uint64_t PRESENT_WAIT_TIMEOUT_NS = 100000000;
+
+//draws per secondary command buffer below which recording stays on the calling thread
+const uint32_t MIN_DRAWS_PER_JOB = 256;
 
-#define VKDO(cmd) if ((result = cmd) != VK_SUCCESS) {\
-    std::cerr << #cmd << " failed with error code " << (int)result << std::endl;\
-    abort();\
-}
 #define FNCOK std::cout << __func__ << "() ok" << std::endl;
 
+typedef std::chrono::steady_clock Clock;
+
+double MsSince(Clock::time_point t) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - t).count();
+}
+
 GLFWwindow* Vulkan::window;
+bool Vulkan::headless = false;
+std::vector<DrawItem> Vulkan::drawItems;
+SlotPool<Mesh*> Vulkan::meshes;
+std::vector<Texture*> Vulkan::textures;
+VkDeviceSize Vulkan::textureBudget = 256ull << 20;
+bool Vulkan::gpuDriven = false;
+bool Vulkan::timelineSync = true;
+bool Vulkan::asyncCompute = true;
+std::vector<Material> Vulkan::materials;
+FramePacing Vulkan::pacing = { 2, false, 0, VK_PRESENT_MODE_MAILBOX_KHR };
+bool Vulkan::readback = false;
+std::string Vulkan::deviceChoice;
+bool Vulkan::listDevices = false;
+bool Vulkan::deviceGroup = false;
+uint32_t Vulkan::postPasses = 0;
+bool Vulkan::mergeSubpasses = false;
+bool Vulkan::verbose = false;
 
 VkInstance instance;
 VkPhysicalDevice physDevice;
 VkDevice device;
+//physical devices behind device, frame n renders on device n % groupSize
+uint32_t groupSize = 1;
 uint32_t graphicsFamily;
+uint32_t transferFamily;
+uint32_t computeFamily;
 VkQueue graphicsQueue;
+VkQueue transferQueue;
+VkQueue computeQueue;
 VkQueue presentQueue;
 VkSurfaceKHR surface;
 VkSurfaceFormatKHR surfaceFormat;
 VkExtent2D extent;
-VkSwapchainKHR swapchain;
+UniqueSwapchain swapchain;
 std::vector<VkImage> swapchainImages;
-std::vector<VkImageView> swapchainImageViews;
-std::vector<VkFramebuffer> swapchainFramebuffers;
-std::vector<VkCommandBuffer> commandBuffers;
+std::vector<UniqueImageView> swapchainImageViews;
+//the frame as passes, rebuilt with the swapchain, the render pass of its main pass is kept across rebuilds
+RenderGraph* frameGraph;
+uint32_t targetResource;
+uint32_t mainPass;
 VkRenderPass renderPass;
-VkPipelineLayout pipelineLayout;
+//the main pass draws into a transient image, which reaches the target through these
+struct CopyPass {
+    uint32_t pass;
+    uint32_t source;
+    VkPipeline pipeline;
+    VkDescriptorSet set;
+};
+std::vector<CopyPass> copyPasses;
+VkPipelineLayout copyLayout;
+//made with the graph whose views its sets point at, retired with it
+UniqueDescriptorPool copyPool;
+//passes of the same size are merged into subpasses where that keeps attachments on chip
+bool tiledGpu;
+//what the pass callbacks of the frame being recorded work on
+struct FrameRecord {
+    uint32_t frame;
+    uint32_t drawCount;
+    uint32_t jobs;
+    uint32_t threads;
+    VkImage target;
+} recording;
 VkPipeline pipeline;
-VkCommandPool commandPool;
-VkSemaphore imgReadySemaphore[MAX_FRAMES_IN_FLIGHT];
-VkSemaphore rendFinSemaphore[MAX_FRAMES_IN_FLIGHT];
-VkFence rendFences[MAX_FRAMES_IN_FLIGHT];
-std::vector<VkFence> imagesInFlight;
+VkPipeline instancedPipeline;
+UniquePipeline cullPipeline;
+//VK_EXT_descriptor_indexing, without it meshes are drawn untinted with an empty layout
+bool bindlessSupported;
+//the state of the triangle pipeline, materials change blending and culling from there
+PipelineKey meshKey;
+//per material, drawn with the triangle pipeline until the background compile is done
+std::vector<PipelineKey> materialKeys;
+//the tints of Vulkan::materials as CreateMaterials uploaded them, in the bindless table at materialBufferIndex
+std::vector<float> tintData;
+VkBuffer materialBuffer;
+Allocation* materialAlloc;
+uint32_t materialBufferIndex;
+uint64_t materialTicket;
+bool materialsReady;
+UniqueCommandPool commandPools[MAX_FRAMES_IN_FLIGHT];
+VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
+struct WorkerPool {
+    UniqueCommandPool pool;
+    std::vector<VkCommandBuffer> buffers;
+    uint32_t used;
+};
+//[frame in flight][worker thread]
+std::vector<WorkerPool> workerPools[MAX_FRAMES_IN_FLIGHT];
+std::vector<VkCommandBuffer> secondaryBuffers;
+UniqueSemaphore imgReadySemaphore[MAX_FRAMES_IN_FLIGHT];
+UniqueSemaphore rendFinSemaphore[MAX_FRAMES_IN_FLIGHT];
+//the FrameSync value of the last frame that drew to each swapchain image
+std::vector<uint64_t> imageFrames;
+std::vector<Allocation*> offscreenAllocs;
+//taken out of Vulkan::meshes before their upload finished, destroyed once it has
+std::vector<Mesh*> removedMeshes;
+uint32_t timestampBits;
+float timestampPeriod;
+VkDeviceSize nonCoherentAtomSize;
+bool framesSubmitted[MAX_FRAMES_IN_FLIGHT];
+UniquePipelineCache pipelineCache;
+AssetPack* assetPack;
+bool creationFeedbackSupported;
+bool framebufferResized;
+//VK_KHR_present_wait, null without it
+PFN_vkWaitForPresentKHR waitForPresent;
+uint64_t nextPresentId = 1;
+//frames presented with an id whose latency has not been measured yet, oldest first
+struct PendingPresent {
+    uint64_t id;
+    std::chrono::steady_clock::time_point input;
+};
+std::deque<PendingPresent> pendingPresents;
+//when each frame in flight sampled input, for frames measured at their fence instead
+std::chrono::steady_clock::time_point frameInput[MAX_FRAMES_IN_FLIGHT];
+bool frameInputPending[MAX_FRAMES_IN_FLIGHT];
+std::chrono::steady_clock::time_point nextFrameStart;
 
 const std::vector<const char*> deviceExtensions = {
     VK_KHR_SWAPCHAIN_EXTENSION_NAME
 };
 
+VkShaderModule CreateShaderModule(const std::string& name, ShaderInfo& reflection);
+void RecordCullPass(const PassContext& ctx);
+void RecordMainPass(const PassContext& ctx);
+void RecordReadbackPass(const PassContext& ctx);
+void RecordCopyPass(const PassContext& ctx, uint32_t copy);
+
+void OnFramebufferResize(GLFWwindow*, int, int) {
+    framebufferResized = true;
+}
+
 void Vulkan::Init() {
-    window = glfwCreateWindow(WIDTH, HEIGHT, "Hello Vulkan", 0, 0);
+    pacing.framesInFlight = std::max(1u, std::min(pacing.framesInFlight, MAX_FRAMES_IN_FLIGHT));
+    //swapchain images are not made to be copied from
+    readback = readback && headless;
+    if (!headless) {
+        window = glfwCreateWindow(WIDTH, HEIGHT, "Hello Vulkan", 0, 0);
+        glfwSetFramebufferSizeCallback(window, OnFramebufferResize);
+    }
 
     VkApplicationInfo appinfo = {};
     appinfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
@@ -57,11 +206,15 @@ void Vulkan::Init() {
     appinfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appinfo.pEngineName = "No Engine";
     appinfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appinfo.apiVersion = VK_API_VERSION_1_0;
+    //1.1 for vkGetPhysicalDeviceFeatures2, 1.2 for timeline semaphores in core
+    appinfo.apiVersion = VK_API_VERSION_1_2;
 
     uint32_t glfwExtensionCount = 0;
-    const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-    if (!glfwExtensionCount) abort();
+    const char** glfwExtensions = nullptr;
+    if (!headless) {
+        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+        if (!glfwExtensionCount) abort();
+    }
 
     VkInstanceCreateInfo createinfo = {};
     createinfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -82,53 +235,316 @@ void Vulkan::InitDevice() {
     if (!count) exit(0);
     std::vector<VkPhysicalDevice> devices(count);
     VKDO(vkEnumeratePhysicalDevices(instance, &count, devices.data()));
-    
-    physDevice = devices[0];
+
+    //devices linked into a group, a device without links is a group of its own
+    VKDO(vkEnumeratePhysicalDeviceGroups(instance, &count, nullptr));
+    std::vector<VkPhysicalDeviceGroupProperties> groups(count);
+    for (auto& g : groups) {
+        g.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_GROUP_PROPERTIES;
+    }
+    VKDO(vkEnumeratePhysicalDeviceGroups(instance, &count, groups.data()));
+    auto groupOf = [&](VkPhysicalDevice d) -> const VkPhysicalDeviceGroupProperties* {
+        for (auto& g : groups) {
+            const auto end = g.physicalDevices + g.physicalDeviceCount;
+            if (std::find(g.physicalDevices, end, d) != end) return &g;
+        }
+        return nullptr;
+    };
+
+    std::vector<DeviceInfo> infos;
+    for (auto d : devices) {
+        infos.push_back(DevicePicker::Query(d, headless ? VK_NULL_HANDLE : surface));
+        if (auto g = groupOf(d)) infos.back().groupSize = g->physicalDeviceCount;
+    }
+    //the command line wins over the environment
+    std::string choice = deviceChoice;
+    if (choice.empty() && getenv("HV_DEVICE")) choice = getenv("HV_DEVICE");
+    const int picked = DevicePicker::Pick(infos, headless, choice);
+    DevicePicker::Print(infos, headless, picked);
+    if (listDevices) exit(0);
+    if (picked < 0) {
+        std::cerr << (choice.empty() ? "no usable device" : "no usable device matches \"" + choice + "\"") << std::endl;
+        exit(1);
+    }
+    physDevice = devices[picked];
+
+    //frames alternate between the devices of the group, each renders into its own instance of the
+    //offscreen targets. A swapchain, a readback into host memory and the other queues would each
+    //need to be split across the devices, so only the plain offscreen frame loop is supported
+    const auto group = groupOf(physDevice);
+    deviceGroup = deviceGroup && group && group->physicalDeviceCount > 1;
+    if (deviceGroup && (!headless || readback)) {
+        std::cout << "device groups need --headless and no readback, rendering on one device" << std::endl;
+        deviceGroup = false;
+    }
+    groupSize = deviceGroup ? group->physicalDeviceCount : 1;
+    if (deviceGroup) {
+        std::cout << "alternating frames across " << groupSize << " devices" << std::endl;
+        asyncCompute = false;
+    }
+
+    VkPhysicalDeviceProperties props;
+    vkGetPhysicalDeviceProperties(physDevice, &props);
+    std::cout << "using " << props.deviceName << std::endl;
+    //arm, qualcomm, imagination and apple
+    tiledGpu = props.vendorID == 0x13B5 || props.vendorID == 0x5143 || props.vendorID == 0x1010 || props.vendorID == 0x106B;
+    timestampPeriod = props.limits.timestampPeriod;
+    nonCoherentAtomSize = props.limits.nonCoherentAtomSize;
 
     vkGetPhysicalDeviceQueueFamilyProperties(physDevice, &count, nullptr);
     std::vector<VkQueueFamilyProperties> queueFamilies(count);
     vkGetPhysicalDeviceQueueFamilyProperties(physDevice, &count, queueFamilies.data());
     for (uint32_t a = 0; a < count; a++) {
-        VkBool32 pres;
-        VKDO(vkGetPhysicalDeviceSurfaceSupportKHR(physDevice, a, surface, &pres));
+        VkBool32 pres = VK_TRUE;
+        if (!headless) {
+            VKDO(vkGetPhysicalDeviceSurfaceSupportKHR(physDevice, a, surface, &pres));
+        }
         if (pres && (queueFamilies[a].queueFlags & VK_QUEUE_GRAPHICS_BIT) > 0) {
             graphicsFamily = a;
             break;
         }
     }
+    timestampBits = queueFamilies[graphicsFamily].timestampValidBits;
+
+    //a transfer-only family is usually backed by a dma engine that copies alongside rendering.
+    //In a group the ownership transfers would have to run on every device, so it is not used
+    transferFamily = graphicsFamily;
+    for (uint32_t a = 0; a < count && !deviceGroup; a++) {
+        const auto flags = queueFamilies[a].queueFlags;
+        if ((flags & VK_QUEUE_TRANSFER_BIT) && !(flags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            transferFamily = a;
+            break;
+        }
+    }
+
+    //a compute family without graphics can run the culling of one frame while the last one still draws
+    computeFamily = graphicsFamily;
+    for (uint32_t a = 0; a < count; a++) {
+        const auto flags = queueFamilies[a].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT)) {
+            computeFamily = a;
+            break;
+        }
+    }
 
-    VkDeviceQueueCreateInfo queueCreateInfo = {};
-    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueCreateInfo.queueFamilyIndex = graphicsFamily;
-    queueCreateInfo.queueCount = 1;
     float queuePriority = 1.0f;
-    queueCreateInfo.pQueuePriorities = &queuePriority;
+    VkDeviceQueueCreateInfo queueCreateInfos[3] = {};
+    for (auto& q : queueCreateInfos) {
+        q.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+        q.queueCount = 1;
+        q.pQueuePriorities = &queuePriority;
+    }
+    uint32_t queueCount = 0;
+    queueCreateInfos[queueCount++].queueFamilyIndex = graphicsFamily;
+    if (transferFamily != graphicsFamily) {
+        queueCreateInfos[queueCount++].queueFamilyIndex = transferFamily;
+    }
 
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(physDevice, &supportedFeatures);
     VkPhysicalDeviceFeatures deviceFeatures = {};
+    //the instanced shader finds its instances through gl_InstanceIndex, which includes firstInstance
+    if (gpuDriven && !supportedFeatures.drawIndirectFirstInstance) {
+        std::cout << "drawIndirectFirstInstance is not supported, gpu driven drawing is disabled" << std::endl;
+        gpuDriven = false;
+    }
+    deviceFeatures.drawIndirectFirstInstance = gpuDriven ? VK_TRUE : VK_FALSE;
+    //textures in these formats are only loaded when their feature is there, see Texture::Load
+    deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+    deviceFeatures.textureCompressionASTC_LDR = supportedFeatures.textureCompressionASTC_LDR;
+    //the culling is the only compute work, without it (or a family for it) everything stays on one queue
+    asyncCompute = asyncCompute && gpuDriven && computeFamily != graphicsFamily;
+    if (asyncCompute) {
+        queueCreateInfos[queueCount++].queueFamilyIndex = computeFamily;
+    }
+    else if (gpuDriven) {
+        std::cout << "no async compute, culling runs on the graphics queue" << std::endl;
+    }
+    //statistics scopes around the render pass also count the secondary buffers executed in it
+    const bool statisticsSupported = supportedFeatures.pipelineStatisticsQuery && supportedFeatures.inheritedQueries;
+    deviceFeatures.pipelineStatisticsQuery = statisticsSupported ? VK_TRUE : VK_FALSE;
+    deviceFeatures.inheritedQueries = statisticsSupported ? VK_TRUE : VK_FALSE;
+    //the bindless arrays are indexed with push constants, which are dynamically uniform
+    bindlessSupported = supportedFeatures.shaderSampledImageArrayDynamicIndexing
+        && supportedFeatures.shaderStorageBufferArrayDynamicIndexing;
+
+    vkEnumerateDeviceExtensionProperties(physDevice, nullptr, &count, nullptr);
+    std::vector<VkExtensionProperties> availableExtensions(count);
+    vkEnumerateDeviceExtensionProperties(physDevice, nullptr, &count, availableExtensions.data());
+    auto hasExtension = [&](const char* name) {
+        for (auto& e : availableExtensions) {
+            if (!strcmp(e.extensionName, name)) return true;
+        }
+        return false;
+    };
+
+    //offscreen targets do not need the swapchain extension
+    std::vector<const char*> extensions;
+    if (!headless) {
+        extensions = deviceExtensions;
+    }
+    creationFeedbackSupported = hasExtension(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+
+    //presentation times for the latency numbers, otherwise frames are measured to the end of their gpu work
+    VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {};
+    presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {};
+    presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+    presentWaitFeatures.pNext = &presentIdFeatures;
+    bool presentWaitSupported = !headless && props.apiVersion >= VK_API_VERSION_1_1
+        && hasExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) && hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    //one frame counter for cpu and gpu, otherwise FrameSync keeps a fence per frame
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures = {};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    bool timelineSupported = timelineSync && props.apiVersion >= VK_API_VERSION_1_1
+        && (props.apiVersion >= VK_API_VERSION_1_2 || hasExtension(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME));
+    //one table of resources for every draw, see Bindless
+    VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures = {};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+    bindlessSupported = bindlessSupported && props.apiVersion >= VK_API_VERSION_1_1
+        && (props.apiVersion >= VK_API_VERSION_1_2 || hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME));
+
+    //the same feature structs are chained into the query and, for what is supported, into vkCreateDevice
+    auto chainFeatures = [&]() -> void* {
+        void* chain = nullptr;
+        if (timelineSupported) {
+            timelineFeatures.pNext = chain;
+            chain = &timelineFeatures;
+        }
+        if (bindlessSupported) {
+            indexingFeatures.pNext = chain;
+            chain = &indexingFeatures;
+        }
+        if (presentWaitSupported) {
+            presentIdFeatures.pNext = chain;
+            presentWaitFeatures.pNext = &presentIdFeatures;
+            chain = &presentWaitFeatures;
+        }
+        return chain;
+    };
+    if (timelineSupported || presentWaitSupported || bindlessSupported) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = chainFeatures();
+        vkGetPhysicalDeviceFeatures2(physDevice, &features2);
+        presentWaitSupported = presentWaitSupported && presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+        timelineSupported = timelineSupported && timelineFeatures.timelineSemaphore;
+        bindlessSupported = bindlessSupported && indexingFeatures.runtimeDescriptorArray
+            && indexingFeatures.descriptorBindingPartiallyBound && indexingFeatures.descriptorBindingUpdateUnusedWhilePending
+            && indexingFeatures.descriptorBindingSampledImageUpdateAfterBind
+            && indexingFeatures.descriptorBindingStorageBufferUpdateAfterBind;
+    }
+    if (bindlessSupported) {
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing = VK_TRUE;
+        deviceFeatures.shaderStorageBufferArrayDynamicIndexing = VK_TRUE;
+    }
+    else {
+        std::cout << "descriptor indexing is not supported, materials are disabled" << std::endl;
+    }
+    if (presentWaitSupported) {
+        extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+    }
+    if (timelineSupported && props.apiVersion < VK_API_VERSION_1_2) {
+        extensions.push_back(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME);
+    }
+    if (bindlessSupported && props.apiVersion < VK_API_VERSION_1_2) {
+        extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    }
+    if (creationFeedbackSupported) {
+        extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+    }
+    //without it every mesh's indirect command is drawn, even when culling left it with no instances
+    const bool drawCountSupported = gpuDriven && hasExtension(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    if (drawCountSupported) {
+        extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    }
 
     VkDeviceCreateInfo createInfo = {};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    createInfo.pQueueCreateInfos = &queueCreateInfo;
-    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = queueCreateInfos;
+    createInfo.queueCreateInfoCount = queueCount;
     createInfo.pEnabledFeatures = &deviceFeatures;
-    createInfo.enabledExtensionCount = deviceExtensions.size();
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    createInfo.enabledExtensionCount = extensions.size();
+    createInfo.ppEnabledExtensionNames = extensions.data();
+    createInfo.pNext = chainFeatures();
+    VkDeviceGroupDeviceCreateInfo groupInfo = {};
+    groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_DEVICE_CREATE_INFO;
+    if (deviceGroup) {
+        groupInfo.physicalDeviceCount = group->physicalDeviceCount;
+        groupInfo.pPhysicalDevices = group->physicalDevices;
+        groupInfo.pNext = createInfo.pNext;
+        createInfo.pNext = &groupInfo;
+    }
 
     VKDO(vkCreateDevice(physDevice, &createInfo, nullptr, &device));
+    if (presentWaitSupported) {
+        waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+    }
+    std::cout << "latency measured to " << (waitForPresent ? "presentation" : "end of gpu work") << std::endl;
 
     vkGetDeviceQueue(device, graphicsFamily, 0, &graphicsQueue);
     presentQueue = graphicsQueue;
+    vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
+    if (asyncCompute) {
+        vkGetDeviceQueue(device, computeFamily, 0, &computeQueue);
+        AsyncCompute::Init(device, computeFamily, computeQueue, MAX_FRAMES_IN_FLIGHT);
+    }
+
+    Allocator::Init(physDevice, device);
+    FrameSync::Init(device, pacing.framesInFlight, timelineSupported);
+    DeletionQueue::Init(device);
+    Uploader::Init(device, transferFamily, transferQueue, graphicsFamily, queueFamilies[transferFamily].minImageTransferGranularity,
+        STAGING_RING_SIZE, UPLOAD_BUDGET_PER_FRAME, groupSize);
+    Profiler::Init(device, graphicsQueue, graphicsFamily, timestampBits, timestampPeriod, MAX_FRAMES_IN_FLIGHT, statisticsSupported);
+    PipelineCache::verbose = verbose;
+    pipelineCache.Reset(PipelineCache::Load(physDevice, device, PIPELINE_CACHE_PATH));
+    assetPack = AssetPack::Open(ASSET_PACK_PATH);
+    Pipelines::Init(device, pipelineCache, creationFeedbackSupported, CreateShaderModule);
+    Layouts::Init(device);
+    RenderGraph::Init(device);
+    if (bindlessSupported) {
+        VkPhysicalDeviceDescriptorIndexingProperties indexingProps = {};
+        indexingProps.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+        VkPhysicalDeviceProperties2 props2 = {};
+        props2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        props2.pNext = &indexingProps;
+        vkGetPhysicalDeviceProperties2(physDevice, &props2);
+        Bindless::Init(device, indexingProps);
+    }
+    Texture::Init(physDevice, device, textureBudget, bindlessSupported);
+    if (gpuDriven) {
+        PFN_vkCmdDrawIndexedIndirectCountKHR drawCount = nullptr;
+        if (drawCountSupported) {
+            drawCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
+        }
+        //the async queue culls, the graphics queue draws and the transfer queue uploads the instances
+        std::vector<uint32_t> families = { graphicsFamily };
+        if (asyncCompute) {
+            families.push_back(computeFamily);
+            if (transferFamily != graphicsFamily) families.push_back(transferFamily);
+        }
+        GpuScene::Init(device, MAX_FRAMES_IN_FLIGHT, drawCount,
+            Pipelines::Info(Pipelines::Shader("cull_c.spv")), Pipelines::Info(Pipelines::Shader("inst_v.spv")), families);
+    }
 
     FNCOK
 }
 
 void Vulkan::CreateSurface() {
+    if (headless) return;
+
     VKDO(glfwCreateWindowSurface(instance, window, nullptr, &surface));
 
     FNCOK
 }
 
 void Vulkan::CreateSwapchain() {
+    if (headless) {
+        CreateOffscreenTargets();
+        return;
+    }
+
     uint32_t surfaceFormatCount;
     vkGetPhysicalDeviceSurfaceFormatsKHR(physDevice, surface, &surfaceFormatCount, nullptr);
     std::vector<VkSurfaceFormatKHR> surfaceFormats(surfaceFormatCount);
@@ -152,17 +568,23 @@ void Vulkan::CreateSwapchain() {
 
     VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR;
     for (auto& p : presentModes) {
-        if (p == VK_PRESENT_MODE_MAILBOX_KHR) {
+        if (p == pacing.presentMode) {
             presentMode = p;
             break;
         }
     }
+    if (presentMode != pacing.presentMode) {
+        std::cout << "present mode " << pacing.presentMode << " is not supported, using fifo" << std::endl;
+    }
 
     extent = capabilities.currentExtent;
-    if (capabilities.currentExtent.width == INT32_MAX) {
-        extent.width = std::max(std::min(WIDTH, capabilities.maxImageExtent.width),
+    //the surface takes the size of the swapchain, which follows the window
+    if (capabilities.currentExtent.width == UINT32_MAX) {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        extent.width = std::max(std::min((uint32_t)width, capabilities.maxImageExtent.width),
             capabilities.minImageExtent.width);
-        extent.height = std::max(std::min(HEIGHT, capabilities.maxImageExtent.height),
+        extent.height = std::max(std::min((uint32_t)height, capabilities.maxImageExtent.height),
             capabilities.minImageExtent.height);
     }
 
@@ -191,9 +613,13 @@ void Vulkan::CreateSwapchain() {
     swapInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     swapInfo.presentMode = presentMode;
     swapInfo.clipped = VK_TRUE;
-    swapInfo.oldSwapchain = VK_NULL_HANDLE;
+    //lets the presentation engine hand over images still queued on the old one
+    swapInfo.oldSwapchain = swapchain;
 
-    VKDO(vkCreateSwapchainKHR(device, &swapInfo, nullptr, &swapchain));
+    //the old swapchain is retired, the frames still using it finish first
+    VkSwapchainKHR created;
+    VKDO(vkCreateSwapchainKHR(device, &swapInfo, nullptr, &created));
+    swapchain.Reset(created);
 
     uint32_t swapImgCnt;
     vkGetSwapchainImagesKHR(device, swapchain, &swapImgCnt, nullptr);
@@ -205,6 +631,40 @@ void Vulkan::CreateSwapchain() {
     CreateImageViews();
 }
 
+void Vulkan::CreateOffscreenTargets() {
+    surfaceFormat.format = VK_FORMAT_B8G8R8A8_UNORM;
+    surfaceFormat.colorSpace = VK_COLOR_SPACE_SRGB_NONLINEAR_KHR;
+    extent = { WIDTH, HEIGHT };
+
+    //one target per frame in flight, so frames are paced the same as with a swapchain
+    for (uint32_t a = 0; a < pacing.framesInFlight; a++) {
+        VkImageCreateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        info.imageType = VK_IMAGE_TYPE_2D;
+        info.format = surfaceFormat.format;
+        info.extent = { extent.width, extent.height, 1 };
+        info.mipLevels = 1;
+        info.arrayLayers = 1;
+        info.samples = VK_SAMPLE_COUNT_1_BIT;
+        info.tiling = VK_IMAGE_TILING_OPTIMAL;
+        info.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        VkImage image;
+        offscreenAllocs.push_back(Allocator::CreateImage(info, MEMORY_USAGE_GPU_ONLY, &image));
+        swapchainImages.push_back(image);
+    }
+    //the targets never change size, so neither does the readback buffer
+    if (readback) {
+        Readback::Init(device, nonCoherentAtomSize, pacing.framesInFlight, extent);
+    }
+
+    FNCOK
+
+    CreateImageViews();
+}
+
 void Vulkan::CreateImageViews() {
     for (const auto& image : swapchainImages) {
         VkImageViewCreateInfo info = {};
@@ -224,324 +684,848 @@ void Vulkan::CreateImageViews() {
         info.subresourceRange.baseArrayLayer = 0;
         info.subresourceRange.layerCount = 1;
         
-        VkImageView view;
-        VKDO(vkCreateImageView(device, &info, nullptr, &view));
-
-        swapchainImageViews.push_back(view);
+        swapchainImageViews.emplace_back();
+        VKDO(vkCreateImageView(device, &info, nullptr, swapchainImageViews.back().Put()));
     }
 
     FNCOK
 }
 
-VkShaderModule CreateShaderModule(const std::vector<char>& code) {
-    VkShaderModuleCreateInfo info;
+VkShaderModule CreateShaderModule(const std::string& name, ShaderInfo& reflection) {
+    //mappings and pack entries are page aligned, so stored code goes to the driver without a copy
+    std::vector<char> storage;
+    MappedFile* file = nullptr;
+    ByteSpan code;
+    const auto entry = assetPack ? assetPack->Find(name) : UINT32_MAX;
+    if (entry != UINT32_MAX) {
+        code = assetPack->Load(entry, storage);
+    }
+    else {
+        file = MappedFile::Open(name);
+        if (!file) abort();
+        code = file->Span();
+    }
+    if (!code.data) {
+        std::cerr << "cannot load shader " << name << "!" << std::endl;
+        abort();
+    }
+    if (!Spirv::Reflect(code.data, code.size, reflection)) {
+        std::cerr << "in " << name << std::endl;
+        abort();
+    }
+    VkShaderModuleCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    info.codeSize = code.size();
-    info.pCode = (const uint32_t*)code.data();
+    info.codeSize = code.size;
+    info.pCode = (const uint32_t*)code.data;
     VkShaderModule mod;
     VKDO(vkCreateShaderModule(device, &info, nullptr, &mod));
+    MappedFile::Close(file);
     return mod;
 }
 
-void Vulkan::CreateRenderPass() {
-    VkAttachmentDescription colorAtt = {};
-    colorAtt.format = surfaceFormat.format;
-    colorAtt.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAtt.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAtt.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAtt.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAtt.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAtt.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAtt.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-
-    VkAttachmentReference attRef = {};
-    attRef.attachment = 0;
-    attRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-
-    VkSubpassDescription subpass = {};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &attRef;
-
-    VkSubpassDependency dep = {};
-    dep.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dep.dstSubpass = 0;
-    dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dep.srcAccessMask = 0;
-    dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    VkRenderPassCreateInfo passInfo = {};
-    passInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    passInfo.attachmentCount = 1;
-    passInfo.pAttachments = &colorAtt;
-    passInfo.subpassCount = 1;
-    passInfo.pSubpasses = &subpass;
-    passInfo.dependencyCount = 1;
-    passInfo.pDependencies = &dep;
-
-    VKDO(vkCreateRenderPass(device, &passInfo, nullptr, &renderPass));
-
+void Vulkan::CreateFrameGraph() {
+    auto graph = RenderGraph::Create();
+    targetResource = graph->ImportImage("target", surfaceFormat.format, extent, VK_IMAGE_LAYOUT_UNDEFINED,
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+    uint32_t culledDraws = 0;
+    if (gpuDriven) {
+        culledDraws = graph->ImportBuffer("culled draws");
+        const auto cull = graph->AddPass("cull", PASS_ASYNC_COMPUTE, RecordCullPass);
+        graph->Write(cull, culledDraws, GRAPH_STORAGE_WRITE);
+    }
+    auto source = graph->CreateImage("scene", surfaceFormat.format, extent);
+    mainPass = graph->AddPass("main pass", PASS_GRAPHICS, RecordMainPass);
+    graph->Write(mainPass, source, GRAPH_COLOR_ATTACHMENT);
+    VkClearValue cv = {};
+    cv.color = {{ 0.f, 0.f, 1.f, 1.f }};
+    graph->Clear(mainPass, source, cv);
+    if (gpuDriven) {
+        graph->Read(mainPass, culledDraws, GRAPH_INDIRECT);
+        graph->Read(mainPass, culledDraws, GRAPH_STORAGE_READ);
+    }
+    //each copy gets an image of its own, the graph decides which of them share memory
+    copyPasses.clear();
+    for (uint32_t a = 0; a <= postPasses; a++) {
+        const bool last = a == postPasses;
+        const auto name = "post " + std::to_string(a);
+        const auto dest = last ? targetResource : graph->CreateImage(name, surfaceFormat.format, extent);
+        const auto copy = graph->AddPass(last ? "composite" : name, PASS_GRAPHICS, [a](const PassContext& ctx) {
+            RecordCopyPass(ctx, a);
+        });
+        graph->Read(copy, source, GRAPH_INPUT_ATTACHMENT);
+        graph->Write(copy, dest, GRAPH_COLOR_ATTACHMENT);
+        copyPasses.push_back(CopyPass{ copy, source, VK_NULL_HANDLE, VK_NULL_HANDLE });
+        source = dest;
+    }
+    if (readback) {
+        //imported, so the copy is kept although nothing in the graph reads it
+        const auto pixels = graph->ImportBuffer("readback");
+        const auto copy = graph->AddPass("readback", PASS_COMPUTE, RecordReadbackPass);
+        graph->Read(copy, targetResource, GRAPH_TRANSFER_SRC);
+        graph->Write(copy, pixels, GRAPH_TRANSFER_DST);
+    }
+    graph->Compile(tiledGpu || mergeSubpasses, asyncCompute);
+    graph->Report();
+
+    frameGraph = graph;
+    renderPass = graph->RenderPass(mainPass);
+
+    PipelineKey key = {};
+    key.vertShader = Pipelines::Shader("copy_v.spv");
+    key.fragShader = Pipelines::Shader("copy_f.spv");
+    const ShaderInfo* stages[] = { &Pipelines::Info(key.vertShader), &Pipelines::Info(key.fragShader) };
+    key.layout = Layouts::PipelineLayout(stages, 2);
+    key.vertexInput = VERTEX_INPUT_NONE;
+    key.blend = BLEND_OPAQUE;
+    key.cullMode = VK_CULL_MODE_NONE;
+    key.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    copyLayout = key.layout;
+
+    VkDescriptorPoolSize size = {};
+    size.type = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+    size.descriptorCount = (uint32_t)copyPasses.size();
+    VkDescriptorPoolCreateInfo pinfo = {};
+    pinfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    pinfo.maxSets = (uint32_t)copyPasses.size();
+    pinfo.poolSizeCount = 1;
+    pinfo.pPoolSizes = &size;
+    VKDO(vkCreateDescriptorPool(device, &pinfo, nullptr, copyPool.Put()));
+    const auto setLayout = Layouts::SetLayoutOf(copyLayout, 0);
+    for (auto& c : copyPasses) {
+        //the copies are the same pipeline in each render pass and subpass they end up in
+        key.renderPass = graph->RenderPass(c.pass, &key.subpass);
+        c.pipeline = Pipelines::Get(key);
+
+        VkDescriptorSetAllocateInfo ainfo = {};
+        ainfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        ainfo.descriptorPool = copyPool;
+        ainfo.descriptorSetCount = 1;
+        ainfo.pSetLayouts = &setLayout;
+        VKDO(vkAllocateDescriptorSets(device, &ainfo, &c.set));
+        VkDescriptorImageInfo image = {};
+        image.imageView = graph->View(c.source);
+        image.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        VkWriteDescriptorSet write = {};
+        write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        write.dstSet = c.set;
+        write.descriptorCount = 1;
+        write.descriptorType = VK_DESCRIPTOR_TYPE_INPUT_ATTACHMENT;
+        write.pImageInfo = &image;
+        vkUpdateDescriptorSets(device, 1, &write, 0, nullptr);
+    }
 
     FNCOK
 }
 
-void Vulkan::CreateGraphicsPipeline() {
-    auto vertCode = FileReader::ReadBytes("tri_v.spv");
-    auto fragCode = FileReader::ReadBytes("tri_f.spv");
+VkPipeline CreateComputePipeline(const char* name, const std::string& shader, VkPipelineLayout layout) {
+    auto mod = Pipelines::Module(Pipelines::Shader(shader));
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = mod;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = layout;
+
+    VkPipelineCreationFeedbackEXT feedback = {};
+    VkPipelineCreationFeedbackEXT stageFeedback = {};
+    VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+    feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+    feedbackInfo.pPipelineCreationFeedback = &feedback;
+    feedbackInfo.pipelineStageCreationFeedbackCount = 1;
+    feedbackInfo.pPipelineStageCreationFeedbacks = &stageFeedback;
+    if (creationFeedbackSupported) {
+        pipelineInfo.pNext = &feedbackInfo;
+    }
 
-    auto vert = CreateShaderModule(vertCode);
-    auto frag = CreateShaderModule(fragCode);
+    const auto t = Clock::now();
+    VkPipeline pipe;
+    VKDO(vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipe));
+    PipelineCache::AddCreation(name, MsSince(t), PipelineCache::CacheHit(feedback));
+    return pipe;
+}
 
-    VkPipelineShaderStageCreateInfo stages[2] = {};
+void Vulkan::CreateGraphicsPipeline() {
+    PipelineKey key = {};
+    key.renderPass = renderPass;
+    key.vertShader = Pipelines::Shader("tri_v.spv");
+    key.fragShader = Pipelines::Shader(bindlessSupported ? "tri_b_f.spv" : "tri_f.spv");
+    //the table's arrays are update-after-bind, which reflection cannot tell
+    if (bindlessSupported) {
+        key.layout = Bindless::PipelineLayout();
+    }
+    else {
+        const ShaderInfo* stages[] = { &Pipelines::Info(key.vertShader), &Pipelines::Info(key.fragShader) };
+        key.layout = Layouts::PipelineLayout(stages, 2);
+    }
+    key.vertexInput = VERTEX_INPUT_MESH;
+    key.blend = BLEND_ALPHA;
+    key.cullMode = VK_CULL_MODE_BACK_BIT;
+    key.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    //every feature on, so it can stand in for any material
+    key.features = MeshFeatures().With(MESH_TINT, bindlessSupported).Bits();
+    meshKey = key;
+    pipeline = Pipelines::Get(key);
+    if (gpuDriven) {
+        key.layout = GpuScene::PipelineLayout();
+        key.vertShader = Pipelines::Shader("inst_v.spv");
+        key.fragShader = Pipelines::Shader("tri_f.spv");
+        key.features = 0;
+        instancedPipeline = Pipelines::Get(key);
+        cullPipeline.Reset(CreateComputePipeline("cull", "cull_c.spv", GpuScene::PipelineLayout()));
+    }
 
-    auto& infov = stages[0];
-    infov.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    infov.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    infov.module = vert;
-    infov.pName = "main";
+    FNCOK
+}
 
-    auto& infof = stages[1];
-    infof.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    infof.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    infof.module = frag;
-    infof.pName = "main";
+void Vulkan::CreateMaterials() {
+    if (materials.empty()) {
+        materials.push_back(Material{ { 1, 1, 1, 1 }, BLEND_ALPHA, false });
+    }
+    materialKeys.clear();
+    for (auto& m : materials) {
+        auto key = meshKey;
+        key.blend = m.blend;
+        key.cullMode = m.doubleSided ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+        const bool white = m.tint[0] == 1 && m.tint[1] == 1 && m.tint[2] == 1 && m.tint[3] == 1;
+        key.features = MeshFeatures().With(MESH_TINT, bindlessSupported && !white).Bits();
+        materialKeys.push_back(key);
+    }
 
-    VkPipelineVertexInputStateCreateInfo inputInfo = {};
-    inputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    inputInfo.vertexBindingDescriptionCount = 0;
-    inputInfo.vertexAttributeDescriptionCount = 0;
+    if (!bindlessSupported) return;
+    if (materialBuffer) {
+        //called again: the uploader may still hold on to the old tints until the frame being recorded
+        DeletionQueue::Defer([old = std::move(tintData)]() {});
+        DeletionQueue::RetireBuffer(materialBuffer, materialAlloc);
+        Bindless::RemoveBuffer(materialBufferIndex);
+        materialBuffer = VK_NULL_HANDLE;
+        materialsReady = false;
+    }
+    tintData.clear();
+    for (auto& m : materials) {
+        tintData.insert(tintData.end(), m.tint, m.tint + 4);
+    }
+    const VkDeviceSize size = tintData.size() * sizeof(float);
+    VkBufferCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    info.size = size;
+    info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    materialAlloc = Allocator::CreateBuffer(info, MEMORY_USAGE_GPU_ONLY, &materialBuffer);
+    materialTicket = Uploader::Upload(materialBuffer, 0, tintData.data(), size,
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    materialBufferIndex = Bindless::AddBuffer(materialBuffer, 0, size);
 
-    VkPipelineInputAssemblyStateCreateInfo assemInfo = {};
-    assemInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    assemInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    assemInfo.primitiveRestartEnable = VK_FALSE;
+    FNCOK
+}
 
-    VkViewport viewport = {};
-    viewport.x = 0;
-    viewport.y = 0;
-    viewport.width = extent.width;
-    viewport.height = extent.height;
-    viewport.minDepth = 0;
-    viewport.maxDepth = 1;
+void Vulkan::CreateCommandPool() {
+    //one pool per frame in flight, reset as a whole once that frame's fence has signaled
+    VkCommandPoolCreateInfo info = {};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    info.queueFamilyIndex = graphicsFamily;
+    info.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    for (uint32_t a = 0; a < MAX_FRAMES_IN_FLIGHT; a++) {
+        VKDO(vkCreateCommandPool(device, &info, nullptr, commandPools[a].Put()));
 
-    VkRect2D scissor;
-    scissor.offset = { 0, 0 };
-    scissor.extent = extent;
+        //pools are externally synchronized, so every recording thread gets its own
+        workerPools[a].resize(JobSystem::ThreadCount());
+        for (auto& w : workerPools[a]) {
+            VKDO(vkCreateCommandPool(device, &info, nullptr, w.pool.Put()));
+            w.used = 0;
+        }
+    }
+
+    FNCOK
+}
 
-    VkPipelineViewportStateCreateInfo viewportInfo = {};
-    viewportInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportInfo.viewportCount = 1;
-    viewportInfo.pViewports = &viewport;
-    viewportInfo.scissorCount = 1;
-    viewportInfo.pScissors = &scissor;
-
-    VkPipelineRasterizationStateCreateInfo rastInfo = {};
-    rastInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rastInfo.polygonMode = VK_POLYGON_MODE_FILL;
-    rastInfo.lineWidth = 1;
-    rastInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-    rastInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-
-    VkPipelineMultisampleStateCreateInfo msaaInfo = {};
-    msaaInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    msaaInfo.sampleShadingEnable = VK_FALSE;
-    msaaInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    msaaInfo.minSampleShading = 1;
-
-    VkPipelineColorBlendAttachmentState blendState = {};
-    blendState.colorWriteMask = 
-        VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
-        VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    blendState.blendEnable = VK_TRUE;
-    blendState.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
-    blendState.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
-    blendState.colorBlendOp = VK_BLEND_OP_ADD;
-    blendState.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    blendState.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    blendState.alphaBlendOp = VK_BLEND_OP_ADD;
-
-    VkPipelineColorBlendStateCreateInfo blendInfo = {};
-    blendInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    blendInfo.logicOpEnable = VK_FALSE;
-    blendInfo.attachmentCount = 1;
-    blendInfo.pAttachments = &blendState;
-
-    //dynamic state here
-
-    VkPipelineLayoutCreateInfo layoutInfo = {};
-    layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    VKDO(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout));
-
-    VkGraphicsPipelineCreateInfo pipelineInfo = {};
-    pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 2;
-    pipelineInfo.pStages = stages;
-    pipelineInfo.pVertexInputState = &inputInfo;
-    pipelineInfo.pInputAssemblyState = &assemInfo;
-    pipelineInfo.pViewportState = &viewportInfo;
-    pipelineInfo.pRasterizationState = &rastInfo;
-    pipelineInfo.pMultisampleState = &msaaInfo;
-    pipelineInfo.pColorBlendState = &blendInfo;
-    pipelineInfo.layout = pipelineLayout;
-    pipelineInfo.renderPass = renderPass;
-    pipelineInfo.subpass = 0;
-    VKDO(vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline));
-
-    vkDestroyShaderModule(device, vert, nullptr);
-    vkDestroyShaderModule(device, frag, nullptr);
+void Vulkan::CreateCommandBuffers() {
+    for (uint32_t a = 0; a < MAX_FRAMES_IN_FLIGHT; a++) {
+        VkCommandBufferAllocateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        info.commandPool = commandPools[a];
+        info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        info.commandBufferCount = 1;
+        VKDO(vkAllocateCommandBuffers(device, &info, &commandBuffers[a]));
+    }
 
     FNCOK
 }
 
-void Vulkan::CreateFramebuffers() {
-    for (auto& v : swapchainImageViews) {
-        VkImageView atts[] = { v };
+void ResetFramePools(uint32_t frame) {
+    VKDO(vkResetCommandPool(device, commandPools[frame], 0));
+    for (auto& w : workerPools[frame]) {
+        VKDO(vkResetCommandPool(device, w.pool, 0));
+        w.used = 0;
+    }
+}
 
-        VkFramebufferCreateInfo info = {};
-        info.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        info.renderPass = renderPass;
-        info.attachmentCount = 1;
-        info.pAttachments = atts;
-        info.width = extent.width;
-        info.height = extent.height;
-        info.layers = 1;
+VkCommandBuffer GetSecondaryBuffer(uint32_t frame, uint32_t worker) {
+    auto& w = workerPools[frame][worker];
+    if (w.used == w.buffers.size()) {
+        VkCommandBufferAllocateInfo info = {};
+        info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        info.commandPool = w.pool;
+        info.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        info.commandBufferCount = 1;
+        VkCommandBuffer buf;
+        VKDO(vkAllocateCommandBuffers(device, &info, &buf));
+        w.buffers.push_back(buf);
+    }
+    return w.buffers[w.used++];
+}
 
-        VkFramebuffer fbo;
-        VKDO(vkCreateFramebuffer(device, &info, nullptr, &fbo));
+//dynamic state is not inherited, so every secondary buffer sets it again
+void SetViewport(VkCommandBuffer buf) {
+    VkViewport viewport = {};
+    viewport.width = (float)extent.width;
+    viewport.height = (float)extent.height;
+    viewport.maxDepth = 1;
+    VkRect2D scissor = {};
+    scissor.extent = extent;
+    vkCmdSetViewport(buf, 0, 1, &viewport);
+    vkCmdSetScissor(buf, 0, 1, &scissor);
+}
 
-        swapchainFramebuffers.push_back(fbo);
+void RecordDraws(VkCommandBuffer buf, uint32_t first, uint32_t count) {
+    //the tints are read by every draw, so nothing is drawn before they arrive
+    if (bindlessSupported && !materialsReady) return;
+    SetViewport(buf);
+    if (bindlessSupported) {
+        Bindless::Bind(buf, VK_PIPELINE_BIND_POINT_GRAPHICS);
     }
+    const Mesh* bound = nullptr;
+    VkPipeline boundPipeline = VK_NULL_HANDLE;
+    uint32_t material = UINT32_MAX;
+    for (uint32_t a = first; a < first + count; a++) {
+        auto& d = Vulkan::drawItems[a];
+        const auto slot = Vulkan::meshes.Get(d.mesh);
+        if (!slot || !(*slot)->ready) continue;
+        const auto mesh = *slot;
+        if (mesh != bound) {
+            mesh->Bind(buf);
+            bound = mesh;
+        }
+        if (d.material != material) {
+            material = d.material;
+            //all variants share the layout, so the bound table and push constants stay valid
+            const auto pipe = Pipelines::Find(materialKeys[material], pipeline);
+            if (pipe != boundPipeline) {
+                vkCmdBindPipeline(buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipe);
+                boundPipeline = pipe;
+            }
+            if (bindlessSupported) {
+                const DrawConstants constants = { 0, 0, materialBufferIndex, material };
+                vkCmdPushConstants(buf, Bindless::PipelineLayout(), VK_SHADER_STAGE_ALL, 0, sizeof(constants), &constants);
+            }
+        }
+        vkCmdDrawIndexed(buf, d.indexCount, d.instanceCount, d.firstIndex, d.vertexOffset, d.firstInstance);
+    }
+}
 
-    FNCOK
+void RecordCullPass(const PassContext& ctx) {
+    GpuScene::RecordCull(ctx.cmd, recording.frame, cullPipeline);
 }
 
-void Vulkan::CreateCommandPool() {
-    VkCommandPoolCreateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    info.queueFamilyIndex = graphicsFamily;
-    info.flags = 0;
-    VKDO(vkCreateCommandPool(device, &info, nullptr, &commandPool));
+void RecordMainPass(const PassContext& ctx) {
+    const auto frame = recording.frame;
+    const auto drawCount = recording.drawCount;
+    const auto jobs = recording.jobs;
+    if (jobs <= 1) {
+        RecordDraws(ctx.cmd, 0, drawCount);
+        if (Vulkan::gpuDriven) {
+            GpuScene::RecordDraws(ctx.cmd, frame, instancedPipeline);
+        }
+        return;
+    }
 
-    FNCOK
+    VkCommandBufferInheritanceInfo inherit = {};
+    inherit.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inherit.renderPass = ctx.renderPass;
+    inherit.subpass = ctx.subpass;
+    inherit.framebuffer = ctx.framebuffer;
+    inherit.pipelineStatistics = Profiler::StatisticsFlags();
+
+    VkCommandBufferBeginInfo sinfo = {};
+    sinfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    sinfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    sinfo.pInheritanceInfo = &inherit;
+
+    //each job records a contiguous slice, executed in slice order so draw order is kept
+    secondaryBuffers.resize(jobs);
+    JobSystem::ParallelFor(jobs, [&](uint32_t job, uint32_t worker) {
+        auto sec = GetSecondaryBuffer(frame, worker);
+        VKDO(vkBeginCommandBuffer(sec, &sinfo));
+        const uint32_t first = (uint32_t)((uint64_t)drawCount * job / jobs);
+        const uint32_t last = (uint32_t)((uint64_t)drawCount * (job + 1) / jobs);
+        RecordDraws(sec, first, last - first);
+        VKDO(vkEndCommandBuffer(sec));
+        secondaryBuffers[job] = sec;
+    }, recording.threads);
+    //the gpu driven draws are a handful of commands, they go last in a buffer of their own
+    if (Vulkan::gpuDriven) {
+        auto sec = GetSecondaryBuffer(frame, 0);
+        VKDO(vkBeginCommandBuffer(sec, &sinfo));
+        SetViewport(sec);
+        GpuScene::RecordDraws(sec, frame, instancedPipeline);
+        VKDO(vkEndCommandBuffer(sec));
+        secondaryBuffers.push_back(sec);
+    }
+    vkCmdExecuteCommands(ctx.cmd, (uint32_t)secondaryBuffers.size(), secondaryBuffers.data());
 }
 
-void Vulkan::CreateCommandBuffers() {
-    const auto n = (uint32_t)swapchainFramebuffers.size();
+void RecordReadbackPass(const PassContext& ctx) {
+    Readback::Record(ctx.cmd, recording.frame, recording.target);
+}
 
-    VkCommandBufferAllocateInfo info = {};
-    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    info.commandPool = commandPool;
-    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    info.commandBufferCount = n;
-    commandBuffers.resize(n);
-    VKDO(vkAllocateCommandBuffers(device, &info, commandBuffers.data()));
+void RecordCopyPass(const PassContext& ctx, uint32_t copy) {
+    const auto& c = copyPasses[copy];
+    SetViewport(ctx.cmd);
+    vkCmdBindPipeline(ctx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, c.pipeline);
+    vkCmdBindDescriptorSets(ctx.cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, copyLayout, 0, 1, &c.set, 0, nullptr);
+    vkCmdDraw(ctx.cmd, 3, 1, 0, 0);
+}
 
+//device is the index in the device group, ignored without one
+void RecordFrame(VkCommandBuffer buf, uint32_t frame, uint32_t id, uint32_t threads, uint32_t device) {
     VkCommandBufferBeginInfo binfo = {};
     binfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    binfo.flags = 0;
-    for (uint32_t a = 0; a < n; a++) {
-        auto& buf = commandBuffers[a];
-        VKDO(vkBeginCommandBuffer(buf, &binfo));
-        VkRenderPassBeginInfo pinfo = {};
-        pinfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-        pinfo.renderPass = renderPass;
-        pinfo.framebuffer = swapchainFramebuffers[a];
-        pinfo.renderArea.extent = extent;
-        VkClearValue cv = {};
-        cv.color = {{ 0.f, 0.f, 1.f, 1.f }};
-        pinfo.clearValueCount = 1;
-        pinfo.pClearValues = &cv;
-        vkCmdBeginRenderPass(buf, &pinfo, VK_SUBPASS_CONTENTS_INLINE);
-
-        vkCmdBindPipeline(buf, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
-        vkCmdDraw(buf, 3, 1, 0, 0);
-
-        vkCmdEndRenderPass(buf);
-        VKDO(vkEndCommandBuffer(buf));
+    binfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkDeviceGroupCommandBufferBeginInfo groupInfo = {};
+    groupInfo.sType = VK_STRUCTURE_TYPE_DEVICE_GROUP_COMMAND_BUFFER_BEGIN_INFO;
+    groupInfo.deviceMask = 1u << device;
+    if (Vulkan::deviceGroup) {
+        binfo.pNext = &groupInfo;
     }
+    VKDO(vkBeginCommandBuffer(buf, &binfo));
+    Profiler::BeginFrame(buf, frame);
+    Profiler::BeginScope(buf, "frame");
+
+    const auto drawCount = (uint32_t)Vulkan::drawItems.size();
+    const uint32_t jobs = std::min(threads, std::max(drawCount / MIN_DRAWS_PER_JOB, 1u));
+    recording = FrameRecord{ frame, drawCount, jobs, threads, swapchainImages[id] };
+
+    //level copies and mip generation go before anything could sample the textures
+    Texture::Record(buf);
+    frameGraph->SetImage(targetResource, swapchainImages[id], swapchainImageViews[id]);
+    frameGraph->SetContents(mainPass, (jobs <= 1) ? VK_SUBPASS_CONTENTS_INLINE : VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    frameGraph->Execute(buf, Vulkan::asyncCompute ? AsyncCompute::Begin(frame) : VK_NULL_HANDLE);
+
+    Profiler::EndScope(buf);
+    VKDO(vkEndCommandBuffer(buf));
 }
 
 void Vulkan::CreateSemaphores() {
     VkSemaphoreCreateInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-    VkFenceCreateInfo finfo = {};
-    finfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    finfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
     for (uint32_t a = 0; a < MAX_FRAMES_IN_FLIGHT; a++) {
-        VKDO(vkCreateSemaphore(device, &info, nullptr, &imgReadySemaphore[a]));
-        VKDO(vkCreateSemaphore(device, &info, nullptr, &rendFinSemaphore[a]));
-        VKDO(vkCreateFence(device, &finfo, nullptr, &rendFences[a]));
+        VKDO(vkCreateSemaphore(device, &info, nullptr, imgReadySemaphore[a].Put()));
+        VKDO(vkCreateSemaphore(device, &info, nullptr, rendFinSemaphore[a].Put()));
     }
-    imagesInFlight.resize(swapchainImages.size(), VK_NULL_HANDLE);
+    imageFrames.assign(swapchainImages.size(), 0);
 }
 
 uint32_t currentFrame = 0;
 
+bool Vulkan::RecreateSwapchain() {
+    int width, height;
+    glfwGetFramebufferSize(window, &width, &height);
+    if (!width || !height) return false; //minimized
+
+    //no wait for the device: the old objects go once the frames still using them have finished.
+    //The views are retired here and the swapchain when CreateSwapchain replaces it
+    const auto oldGraph = frameGraph;
+    swapchainImageViews.clear();
+    swapchainImages.clear();
+
+    CreateSwapchain();
+    //the render pass comes out the same, so the pipelines made for it stay valid
+    CreateFrameGraph();
+    DeletionQueue::Defer([oldGraph]() {
+        RenderGraph::Destroy(oldGraph);
+    });
+    //the new images have never been rendered to
+    imageFrames.assign(swapchainImages.size(), 0);
+    //present ids belong to the old swapchain
+    pendingPresents.clear();
+    framebufferResized = false;
+    std::cout << "swapchain recreated at " << extent.width << "x" << extent.height << std::endl;
+    return true;
+}
+
+void Vulkan::RemoveMesh(SlotId id) {
+    const auto slot = meshes.Get(id);
+    if (!slot) return;
+    const auto mesh = *slot;
+    meshes.Remove(id);
+    //the uploader still reads the vertices of a mesh on its way
+    if (mesh->ready) {
+        Mesh::Destroy(mesh);
+    }
+    else {
+        removedMeshes.push_back(mesh);
+    }
+}
+
+//the frame's previous submission has finished when this is called, so its queries are available
+void ReadTimestamps(uint32_t frame) {
+    if (!framesSubmitted[frame]) return;
+    const double gpuMs = Profiler::Collect(frame);
+    if (gpuMs >= 0) {
+        FrameStats::AddGpuTime(gpuMs);
+    }
+}
+
+//sleeps off the rest of the frame's slot, returns the ms slept
+double LimitFrameRate() {
+    if (Vulkan::pacing.maxFps <= 0) return 0;
+    const auto period = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1 / Vulkan::pacing.maxFps));
+    const auto now = Clock::now();
+    //slots follow each other exactly, unless the frame was late
+    const auto start = std::max(nextFrameStart, now);
+    nextFrameStart = start + period;
+    if (start == now) return 0;
+    std::this_thread::sleep_until(start);
+    Profiler::AddCpuScope("limiter", now, Clock::now());
+    return MsSince(now);
+}
+
+//polls the oldest presents, or with block waits until the newest is on screen
+void CheckPresents(bool block) {
+    if (!waitForPresent) return;
+    while (!pendingPresents.empty()) {
+        const uint64_t id = block ? pendingPresents.back().id : pendingPresents.front().id;
+        const auto result = waitForPresent(device, swapchain, id, block ? PRESENT_WAIT_TIMEOUT_NS : 0);
+        if (result == VK_TIMEOUT) return;
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            //out of date or lost, the swapchain is replaced on the next acquire
+            pendingPresents.clear();
+            return;
+        }
+        //ids complete in order, so every earlier frame is on screen too
+        while (!pendingPresents.empty() && pendingPresents.front().id <= id) {
+            FrameStats::AddLatency(MsSince(pendingPresents.front().input));
+            pendingPresents.pop_front();
+        }
+    }
+}
+
+//the moment a frame's latency is measured from
+Clock::time_point SampleInput() {
+    if (!Vulkan::headless) {
+        glfwPollEvents();
+    }
+    return Clock::now();
+}
+
 void Vulkan::DrawFrame() {
-    uint32_t id;
-    vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imgReadySemaphore[currentFrame], VK_NULL_HANDLE, &id);
-    
-    auto& fence = rendFences[currentFrame];
+    ProfileScope scope("DrawFrame");
+    const auto frameStart = Clock::now();
+    double waitMs = LimitFrameRate();
+
+    {
+        const auto t = Clock::now();
+        CheckPresents(pacing.lowLatency);
+        waitMs += MsSince(t);
+        Profiler::AddCpuScope("present wait", t, Clock::now());
+    }
+    Clock::time_point input;
+    if (!pacing.lowLatency) {
+        input = SampleInput();
+    }
 
-    if (imagesInFlight[id] != VK_NULL_HANDLE) {
-        vkWaitForFences(device, 1, &imagesInFlight[id], VK_TRUE, UINT64_MAX);
+    //the slot's previous frame has to finish before its semaphores are used again, the one the
+    //acquire signals included
+    const uint64_t frame = FrameSync::NextValue();
+    {
+        const auto t = Clock::now();
+        FrameSync::Wait((frame > pacing.framesInFlight) ? frame - pacing.framesInFlight : 0);
+        waitMs += MsSince(t);
+        Profiler::AddCpuScope("wait", t, Clock::now());
     }
-    imagesInFlight[id] = fence;
 
-    vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);
-    vkResetFences(device, 1, &fence);
+    uint32_t id = currentFrame;
+    if (!headless) {
+        if (framebufferResized && !RecreateSwapchain()) {
+            glfwWaitEvents(); //nothing to present to while minimized
+            return;
+        }
+        const auto t = Clock::now();
+        const auto result = vkAcquireNextImageKHR(device, swapchain, UINT64_MAX, imgReadySemaphore[currentFrame], VK_NULL_HANDLE, &id);
+        waitMs += MsSince(t);
+        Profiler::AddCpuScope("acquire", t, Clock::now());
+        //the semaphore is not signaled on failure, so the frame is skipped
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            framebufferResized = true;
+            return;
+        }
+        //a suboptimal image is still drawn and presented, the swapchain is replaced afterwards
+        if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            std::cerr << "vkAcquireNextImageKHR failed with error code " << (int)result << std::endl;
+            abort();
+        }
+    }
+
+    //the image can come back while the frame that last drew to it, from another slot, is still running
+    {
+        const auto t = Clock::now();
+        FrameSync::Wait(imageFrames[id]);
+        imageFrames[id] = frame;
+        waitMs += MsSince(t);
+        Profiler::AddCpuScope("image wait", t, Clock::now());
+    }
+
+    ReadTimestamps(currentFrame);
+    if (frameInputPending[currentFrame]) {
+        FrameStats::AddLatency(MsSince(frameInput[currentFrame]));
+        frameInputPending[currentFrame] = false;
+    }
+    //late, everything this frame waits for is behind it
+    if (pacing.lowLatency) {
+        input = SampleInput();
+    }
+
+    DeletionQueue::Collect(FrameSync::CompletedValue());
+    const auto upload = Uploader::Flush(frame, FrameSync::CompletedValue());
+    for (uint32_t a = 0; a < meshes.Size(); a++) {
+        const auto mesh = meshes.begin()[a];
+        if (mesh->Update() && verbose) {
+            std::cout << "mesh " << meshes.IdAt(a) << " uploaded (" << (mesh->bytes >> 10) << "KB) by frame "
+                << frame << std::endl;
+        }
+    }
+    //a copy recorded by this Flush is waited for by this frame, which the deletion queue waits for as well
+    for (size_t a = 0; a < removedMeshes.size();) {
+        if (removedMeshes[a]->Update()) {
+            Mesh::Destroy(removedMeshes[a]);
+            removedMeshes[a] = removedMeshes.back();
+            removedMeshes.pop_back();
+        }
+        else a++;
+    }
+    if (materialBuffer && !materialsReady) {
+        materialsReady = Uploader::IsDone(materialTicket);
+    }
+    Texture::Update();
+    if (Transforms::Count()) {
+        ProfileScope scope("transforms");
+        Transforms::Update(frame);
+    }
+
+    const auto recordStart = Clock::now();
+    auto buf = commandBuffers[currentFrame];
+    ResetFramePools(currentFrame);
+    const auto groupDevice = (uint32_t)(frame % groupSize);
+    RecordFrame(buf, currentFrame, id, JobSystem::ThreadCount(), groupDevice);
+    FrameStats::AddRecordTime(MsSince(recordStart));
+    Profiler::AddCpuScope("record", recordStart, Clock::now());
 
     VkSubmitInfo info = {};
     info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    VkSemaphore waitSema[] = { imgReadySemaphore[currentFrame] };
-    VkPipelineStageFlags flags[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    info.waitSemaphoreCount = 1;
+    //the swapchain image, the async compute or the upload, and the upload again on the other devices of a group
+    VkSemaphore waitSema[2 + VK_MAX_DEVICE_GROUP_SIZE];
+    VkPipelineStageFlags flags[2 + VK_MAX_DEVICE_GROUP_SIZE];
+    //on a device group, the device that runs each wait
+    uint32_t waitDevices[2 + VK_MAX_DEVICE_GROUP_SIZE];
+    std::fill(waitDevices, waitDevices + 2 + VK_MAX_DEVICE_GROUP_SIZE, groupDevice);
+    VkSemaphore sigSema[] = { rendFinSemaphore[currentFrame] };
+    if (!headless) {
+        waitSema[info.waitSemaphoreCount] = imgReadySemaphore[currentFrame];
+        flags[info.waitSemaphoreCount++] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        info.signalSemaphoreCount = 1;
+        info.pSignalSemaphores = sigSema;
+    }
+    //the compute submit takes the upload's semaphore, the graphics queue waits for both through its own
+    if (asyncCompute) {
+        const auto stage = frameGraph->AsyncWaitStage() | upload.waitStage;
+        waitSema[info.waitSemaphoreCount] = AsyncCompute::Submit(currentFrame, upload.semaphore);
+        flags[info.waitSemaphoreCount++] = stage ? stage : (VkPipelineStageFlags)VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+    else if (upload.semaphore != VK_NULL_HANDLE) {
+        //on a group device a waits for its own copies here, which orders its later frames after them too
+        for (uint32_t a = 0; a < upload.semaphoreCount; a++) {
+            waitSema[info.waitSemaphoreCount] = upload.semaphores[a];
+            waitDevices[info.waitSemaphoreCount] = a;
+            flags[info.waitSemaphoreCount++] = upload.waitStage;
+        }
+    }
     info.pWaitSemaphores = waitSema;
     info.pWaitDstStageMask = flags;
-    info.commandBufferCount = 1;
-    info.pCommandBuffers = &commandBuffers[id];
-    VkSemaphore sigSema[] = { rendFinSemaphore[currentFrame] };
-    info.signalSemaphoreCount = 1;
-    info.pSignalSemaphores = sigSema;
+    //the ownership acquire has to run before any draw reads the new buffers
+    VkCommandBuffer bufs[] = { upload.acquire, buf };
+    const bool acquire = upload.acquire != VK_NULL_HANDLE;
+    info.commandBufferCount = acquire ? 2 : 1;
+    info.pCommandBuffers = acquire ? bufs : &buf;
+
+    const auto submitStart = Clock::now();
+    FrameSync::Submit(graphicsQueue, info, deviceGroup ? (int32_t)groupDevice : -1, deviceGroup ? waitDevices : nullptr);
+    framesSubmitted[currentFrame] = true;
+    Profiler::AddCpuScope("submit", submitStart, Clock::now());
+
+    if (headless || !waitForPresent) {
+        frameInput[currentFrame] = input;
+        frameInputPending[currentFrame] = true;
+    }
+    if (!headless) {
+        VkPresentInfoKHR presInfo = {};
+        presInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presInfo.waitSemaphoreCount = 1;
+        presInfo.pWaitSemaphores = sigSema;
+        VkSwapchainKHR swapchains[] = { swapchain };
+        presInfo.swapchainCount = 1;
+        presInfo.pSwapchains = swapchains;
+        presInfo.pImageIndices = &id;
+        const uint64_t presentId = nextPresentId++;
+        VkPresentIdKHR presentIdInfo = {};
+        presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+        presentIdInfo.swapchainCount = 1;
+        presentIdInfo.pPresentIds = &presentId;
+        if (waitForPresent) {
+            presInfo.pNext = &presentIdInfo;
+            pendingPresents.push_back(PendingPresent{ presentId, input });
+        }
+        const auto presentStart = Clock::now();
+        const auto result = vkQueuePresentKHR(presentQueue, &presInfo);
+        Profiler::AddCpuScope("present", presentStart, Clock::now());
+        if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
+            framebufferResized = true;
+        }
+        else if (result != VK_SUCCESS) {
+            std::cerr << "vkQueuePresentKHR failed with error code " << (int)result << std::endl;
+            abort();
+        }
+    }
 
-    VKDO(vkQueueSubmit(graphicsQueue, 1, &info, fence));
+    currentFrame = (currentFrame + 1) % pacing.framesInFlight;
 
-    VkPresentInfoKHR presInfo = {};
-    presInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
-    presInfo.waitSemaphoreCount = 1;
-    presInfo.pWaitSemaphores = sigSema;
-    VkSwapchainKHR swapchains[] = { swapchain };
-    presInfo.swapchainCount = 1;
-    presInfo.pSwapchains = swapchains;
-    presInfo.pImageIndices = &id;
-    vkQueuePresentKHR(presentQueue, &presInfo);
+    FrameStats::AddCpuTime(MsSince(frameStart) - waitMs);
+}
 
-    currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+void Vulkan::DrawSettledFrame() {
+    while (!Uploader::IsIdle()) {
+        DrawFrame();
+    }
+    //marks the meshes ready and asks for the pipelines of everything drawn
+    DrawFrame();
+    Pipelines::WaitIdle();
+    DrawFrame();
+}
+
+void Vulkan::ReadLastFrame(std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height) {
+    FrameSync::Wait(FrameSync::NextValue() - 1);
+    const uint32_t slot = (currentFrame + pacing.framesInFlight - 1) % pacing.framesInFlight;
+    const auto bgra = Readback::Map(slot);
+    width = extent.width;
+    height = extent.height;
+    //the offscreen targets are B8G8R8A8
+    rgba.resize((size_t)width * height * 4);
+    for (size_t a = 0; a < rgba.size(); a += 4) {
+        rgba[a] = bgra[a + 2];
+        rgba[a + 1] = bgra[a + 1];
+        rgba[a + 2] = bgra[a];
+        rgba[a + 3] = bgra[a + 3];
+    }
+}
+
+void Vulkan::BenchRecord(uint32_t draws, uint32_t threads, uint32_t iterations) {
+    //records into frame 0's pools without submitting, so only the cpu side is measured
+    FrameSync::Wait(FrameSync::NextValue() - 1);
+    const auto items = drawItems;
+    drawItems.assign(draws, items.empty() ? DrawItem{ 0, 3, 1, 0, 0, 0, 0 } : items[0]);
+
+    std::vector<double> times(iterations);
+    for (uint32_t a = 0; a < iterations; a++) {
+        const auto t = Clock::now();
+        ResetFramePools(0);
+        RecordFrame(commandBuffers[0], 0, 0, threads, 0);
+        times[a] = MsSince(t);
+    }
+    std::sort(times.begin(), times.end());
+    const double median = times[times.size() / 2];
+    std::cout << "record " << draws << " draws on " << threads << " threads: median "
+        << median * 1000 << "us/frame, " << median * 1e6 / std::max(draws, 1u) << "ns/draw, min "
+        << times[0] * 1000 << "us" << std::endl;
+
+    drawItems = items;
+    //the benchmark left frame 0's buffer recorded but never submitted
+    framesSubmitted[0] = false;
 }
 
 void Vulkan::Exit() {
     vkDeviceWaitIdle(device);
-    for (uint32_t a = 0; a < MAX_FRAMES_IN_FLIGHT; a++) {
-        vkDestroyFence(device, rendFences[a], nullptr);
-        vkDestroySemaphore(device, rendFinSemaphore[a], nullptr);
-        vkDestroySemaphore(device, imgReadySemaphore[a], nullptr);
+    //background compiles still write to the cache
+    Pipelines::Exit();
+    PipelineCache::Report();
+    Pipelines::Report();
+    Layouts::Report();
+    Allocator::PrintStats();
+    Uploader::PrintStats();
+    Texture::Report();
+    Texture::Exit();
+    textures.clear();
+    PipelineCache::Save(physDevice, device, pipelineCache, PIPELINE_CACHE_PATH);
+    AssetPack::Close(assetPack);
+    FrameSync::Exit();
+    //with the device idle, what is queued goes now, while the modules it calls into are still there
+    DeletionQueue::Collect(DeletionQueue::RetireValue());
+    Profiler::Exit();
+    if (asyncCompute) {
+        AsyncCompute::Exit();
     }
-    vkDestroyCommandPool(device, commandPool, nullptr);
-    for (auto f : swapchainFramebuffers) {
-        vkDestroyFramebuffer(device, f, nullptr);
+    RenderGraph::Destroy(frameGraph);
+    if (gpuDriven) {
+        GpuScene::Exit();
     }
-    vkDestroyPipeline(device, pipeline, nullptr);
-    vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-    vkDestroyRenderPass(device, renderPass, nullptr);
-    for (auto v : swapchainImageViews) {
-        vkDestroyImageView(device, v, nullptr);
+    Layouts::Exit();
+    if (bindlessSupported) {
+        Bindless::Exit();
+        if (materialBuffer) {
+            DeletionQueue::RetireBuffer(materialBuffer, materialAlloc);
+        }
     }
-    vkDestroySwapchainKHR(device, swapchain, nullptr); //<- bad instruction here sometimes
+    RenderGraph::Exit();
+    if (headless) {
+        for (size_t a = 0; a < swapchainImages.size(); a++) {
+            DeletionQueue::RetireImage(swapchainImages[a], offscreenAllocs[a]);
+        }
+        if (readback) {
+            Readback::Exit();
+        }
+    }
+    Uploader::Exit();
+    Transforms::Exit();
+    for (auto m : meshes) {
+        Mesh::Destroy(m);
+    }
+    meshes.Clear();
+    for (auto m : removedMeshes) {
+        Mesh::Destroy(m);
+    }
+    removedMeshes.clear();
+
+    //everything owned here goes into the queue, which is emptied in one go with the device idle;
+    //the views are destroyed before the swapchain whose images they look at
+    pipelineCache.Reset();
+    cullPipeline.Reset();
+    copyPool.Reset();
+    swapchainImageViews.clear();
+    swapchain.Reset();
+    for (uint32_t a = 0; a < MAX_FRAMES_IN_FLIGHT; a++) {
+        rendFinSemaphore[a].Reset();
+        imgReadySemaphore[a].Reset();
+        commandPools[a].Reset();
+        workerPools[a].clear();
+    }
+    DeletionQueue::Report();
+    DeletionQueue::Exit();
+    Allocator::Exit();
     vkDestroyDevice(device, nullptr);
 
-    vkDestroySurfaceKHR(instance, surface, nullptr);
+    if (!headless) {
+        vkDestroySurfaceKHR(instance, surface, nullptr);
+    }
     vkDestroyInstance(instance, nullptr);
 }
\ No newline at end of file
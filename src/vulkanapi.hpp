@@ -1,23 +1,128 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <string>
+#include <vector>
+#include "mesh.hpp"
+#include "pipelines.hpp"
+#include "slotpool.hpp"
+#include "texture.hpp"
+
+struct DrawItem {
+    /* id in Vulkan::meshes, skipped until that mesh has finished uploading and once it is removed */
+    SlotId mesh;
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    /* index into Vulkan::materials */
+    uint32_t material;
+};
+
+/* specialization constants of the mesh shaders, the values are their constant_id */
+enum MeshFeature : uint32_t {
+    /* multiply by Material::tint, off for white materials so they skip reading it */
+    MESH_TINT,
+    MESH_FEATURE_COUNT
+};
+typedef FeatureSet<MeshFeature, MESH_FEATURE_COUNT> MeshFeatures;
+
+struct Material {
+    /* multiplied into the vertex colors, needs descriptor indexing */
+    float tint[4];
+    BlendMode blend;
+    bool doubleSided;
+};
+
+/* how DrawFrame trades latency against throughput */
+struct FramePacing {
+    /* frames the cpu may run ahead of the gpu, 1 to 3 */
+    uint32_t framesInFlight;
+    /* waits until the previous frame is on screen, then samples input right before recording */
+    bool lowLatency;
+    /* 0 for no limit */
+    double maxFps;
+    /* falls back to fifo, which every surface has */
+    VkPresentModeKHR presentMode;
+};
 
 class Vulkan {
 public:
     static GLFWwindow* window;
+    /* render into offscreen images instead of a window surface */
+    static bool headless;
+    /* recorded into a fresh command buffer every frame, so it can change between frames */
+    static std::vector<DrawItem> drawItems;
+    /* destroyed in Exit, or before with RemoveMesh */
+    static SlotPool<Mesh*> meshes;
+    /* loaded with Texture::Load after InitDevice, destroyed in Exit */
+    static std::vector<Texture*> textures;
+    /* device memory the textures may use, read in InitDevice */
+    static VkDeviceSize textureBudget;
+    /* read by CreateMaterials, which is called again after a change, the tints are ignored on
+     * devices without descriptor indexing */
+    static std::vector<Material> materials;
+    /* also cull and draw the GpuScene instances, cleared in InitDevice if the device cannot */
+    static bool gpuDriven;
+    /* sync frames with a timeline semaphore when the device has them, otherwise with fences */
+    static bool timelineSync;
+    /* cull on a compute-only queue family if there is one, cleared in InitDevice otherwise */
+    static bool asyncCompute;
+    /* read in Init and CreateSwapchain */
+    static FramePacing pacing;
+    /* copy every frame into host memory for ReadLastFrame, headless only */
+    static bool readback;
+    /* the device to use by index or part of its name, instead of the best scoring one.
+     * Read in InitDevice, HV_DEVICE is used when it is empty */
+    static std::string deviceChoice;
+    /* print the devices and their scores in InitDevice, then exit */
+    static bool listDevices;
+    /* alternate frames across the devices linked with the chosen one, headless without readback only.
+     * Cleared in InitDevice if the device is not in a group */
+    static bool deviceGroup;
+    /* fullscreen copies between the main pass and the last one into the target, read in CreateFrameGraph.
+     * Each reads the image before it as an input attachment, so their images can share memory */
+    static uint32_t postPasses;
+    /* merge the graphics passes of one size into subpasses on any gpu, not only on tiled ones */
+    static bool mergeSubpasses;
+    /* print every mesh upload and pipeline creation as it happens, not only the totals on exit */
+    static bool verbose;
 
     static void Init();
     static void CreateSurface();
     static void InitDevice();
     static void CreateSwapchain();
+    static void CreateOffscreenTargets();
     static void CreateImageViews();
-    static void CreateRenderPass();
+    /* Describes the frame as a render graph, which also makes the render pass the pipelines are
+     * built for. Call after CreateSwapchain.
+     */
+    static void CreateFrameGraph();
     static void CreateGraphicsPipeline();
-    static void CreateFramebuffers();
+    /* Call once before the first frame. Uploads the tints into a storage buffer in the bindless table,
+     * draws wait until it arrives. Pipelines for other states are compiled when first drawn.
+     */
+    static void CreateMaterials();
     static void CreateCommandPool();
     static void CreateCommandBuffers();
     static void CreateSemaphores();
+    /* Replaces the swapchain after a resize and rebuilds what depends on its images and extent.
+     * Returns false while the window is minimized.
+     */
+    static bool RecreateSwapchain();
+    /* Takes a mesh out of meshes and destroys it once no frame uses it and its upload is done,
+     * without waiting for the device. Draws of it are skipped from now on.
+     */
+    static void RemoveMesh(SlotId id);
 
     static void DrawFrame();
+    /* Draws frames until every upload and pipeline compile has arrived, then one more that shows
+     * all of them, so the image does not depend on how fast the machine streams or compiles.
+     */
+    static void DrawSettledFrame();
+    /* waits for the last frame drawn, then gives its pixels as RGBA8, needs readback */
+    static void ReadLastFrame(std::vector<uint8_t>& rgba, uint32_t& width, uint32_t& height);
+    static void BenchRecord(uint32_t draws, uint32_t threads, uint32_t iterations);
 
     static void Exit();
 };
\ No newline at end of file